@@ -66,6 +66,7 @@ process.gammaJet = cms.EDFilter('GammaJetFilter',
 
     json = cms.string(os.path.join(fullPath, "lumiSummary.json")),
     csv = cms.string(os.path.join(fullPath, "lumibyls.csv")),
+    cacheLumiFiles = cms.untracked.bool(True), # Cache the parsed CSV file next to it
     filterData = cms.untracked.bool(True),
 
     runOnNonCHS   = cms.untracked.bool(False),
@@ -82,9 +83,21 @@ process.gammaJet = cms.EDFilter('GammaJetFilter',
     correctJecFromRaw = cms.untracked.bool(True),
     #correctorLabel = cms.untracked.string("ak5PFchsL1FastL2L3"),
     correctorLabel = cms.untracked.string("ak5PFchsL1FastL2L3Residual"),
+    # Evaluate JEC payloads in batch, as long as they agree with FactorizedJetCorrector
+    useBatchJEC = cms.untracked.bool(True),
+    batchJECTolerance = cms.untracked.double(1e-5),
 
     # MET
-    redoTypeIMETCorrection = cms.untracked.bool(True)
+    redoTypeIMETCorrection = cms.untracked.bool(True),
+
+    # Jet collections of an event are processed by up to this number of threads
+    jetCollectionThreads = cms.untracked.uint32(1),
+
+    # Output layout. With wideTrees, one tree for the event and one tree per jet collection, with prefixed branches
+    wideTrees = cms.untracked.bool(False),
+    #compressionAlgorithm = cms.untracked.string("lz4"), # zlib, lzma or lz4 (ROOT 6). Applies to the whole output file
+    #compressionLevel = cms.untracked.int32(4),
+    basketOptimizationEvents = cms.untracked.uint32(1000) # Tune basket sizes after this number of events
     )
 
 process.p = cms.Path(process.gammaJet)
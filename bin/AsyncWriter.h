@@ -0,0 +1,136 @@
+#pragma once
+
+// Records written by a background thread, through a bounded queue.
+//
+// push() copies a record in the queue and returns, so the filling and the
+// compression of the output happen in parallel with the event loop. When the
+// queue is full, push() waits for the writer thread: this is a stall, counted
+// with its duration. The writer thread takes all the queued records at once
+// and calls the write function for each of them, in push order.
+//
+// With a capacity of 0, there is no thread and push() writes the record
+// directly.
+//
+// ROOT 5 I/O isn't thread-safe: the write function must not share any ROOT
+// object or file with the caller. The finalizer gives the skim writer thread
+// a file of its own, copied into the output file after close().
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+template<typename Record>
+class AsyncWriter {
+  public:
+    typedef std::function<void(const Record&)> Write;
+
+    struct Stats {
+      uint64_t records;
+      // Number of queued records, after each push
+      size_t maxDepth;
+      double meanDepth;
+      uint64_t stalls;
+      // In ms
+      double stallTime;
+    };
+
+    AsyncWriter(size_t capacity, Write write):
+      mCapacity(capacity), mWrite(write), mClosed(false), mDepthSum(0) {
+      mStats.records = 0;
+      mStats.maxDepth = 0;
+      mStats.meanDepth = 0;
+      mStats.stalls = 0;
+      mStats.stallTime = 0;
+
+      if (mCapacity > 0)
+        mThread = std::thread(&AsyncWriter::run, this);
+    }
+
+    ~AsyncWriter() {
+      close();
+    }
+
+    void push(const Record& record) {
+      mStats.records++;
+      if (mCapacity == 0) {
+        mWrite(record);
+        return;
+      }
+
+      std::unique_lock<std::mutex> lock(mMutex);
+      if (mQueue.size() >= mCapacity) {
+        clock::time_point start = clock::now();
+        mNotFull.wait(lock, [this] { return mQueue.size() < mCapacity; });
+        mStats.stalls++;
+        mStats.stallTime += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+      }
+
+      mQueue.push_back(record);
+      mStats.maxDepth = std::max(mStats.maxDepth, mQueue.size());
+      mDepthSum += mQueue.size();
+      lock.unlock();
+
+      mNotEmpty.notify_one();
+    }
+
+    // Write the queued records and stop the thread. Nothing can be pushed afterwards
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mClosed)
+          return;
+        mClosed = true;
+      }
+
+      mNotEmpty.notify_one();
+      if (mThread.joinable())
+        mThread.join();
+    }
+
+    const Stats& stats() {
+      mStats.meanDepth = (mStats.records > 0) ? (double) mDepthSum / mStats.records : 0;
+      return mStats;
+    }
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    void run() {
+      std::vector<Record> records;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mMutex);
+          mNotEmpty.wait(lock, [this] { return ! mQueue.empty() || mClosed; });
+          if (mQueue.empty())
+            return;
+
+          records.assign(mQueue.begin(), mQueue.end());
+          mQueue.clear();
+        }
+        mNotFull.notify_one();
+
+        for (const Record& record: records)
+          mWrite(record);
+      }
+    }
+
+    size_t mCapacity;
+    Write mWrite;
+
+    std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::deque<Record> mQueue;
+    bool mClosed;
+    std::thread mThread;
+
+    uint64_t mDepthSum;
+    Stats mStats;
+};
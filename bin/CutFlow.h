@@ -0,0 +1,149 @@
+#pragma once
+
+// Declarative event selection of the finalizer.
+//
+// A CutFlow is an ordered list of named cuts, evaluated on blocks of events
+// stored as one array per variable (the Block type). evaluate() applies the
+// cuts one after the other, each on the events kept by the previous ones, and
+// gives for each event the position of the first cut it fails. count() turns
+// this position into the usual cut-flow counters: passed(i) is the number of
+// counted events passing the first i + 1 cuts.
+//
+// Each cut has an estimated cost per event, replaced by the measured one once
+// it has been evaluated. tune() sorts the cuts by increasing
+// cost / rejection, the order minimizing the time spent in the selection for
+// independent cuts. The counters of a cut depend on the cuts before it, so
+// they are reset when tune() changes the order: they are then the cut flow of
+// the events counted after the last change.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+template<typename Block>
+class CutFlow {
+  public:
+    typedef std::function<bool(const Block&, size_t)> Predicate;
+
+    // cost: estimated time to evaluate the cut on one event, in ns
+    void add(const std::string& name, double cost, Predicate predicate) {
+      Cut cut;
+      cut.name = name;
+      cut.estimatedCost = cost;
+      cut.predicate = predicate;
+      cut.evaluated = 0;
+      cut.evaluatedPassed = 0;
+      cut.time = 0;
+      cut.passed = 0;
+
+      mCuts.push_back(cut);
+    }
+
+    size_t size() const {
+      return mCuts.size();
+    }
+
+    const std::string& name(size_t i) const {
+      return mCuts[i].name;
+    }
+
+    uint64_t passed(size_t i) const {
+      return mCuts[i].passed;
+    }
+
+    // Measured time per event in ns, or the estimation if the cut was never evaluated
+    double cost(size_t i) const {
+      const Cut& cut = mCuts[i];
+      return (cut.evaluated > 0) ? cut.time / cut.evaluated : cut.estimatedCost;
+    }
+
+    // Fraction of the events reaching the cut which it rejects, 1 if the cut was never evaluated
+    double rejection(size_t i) const {
+      const Cut& cut = mCuts[i];
+      return (cut.evaluated > 0) ? 1. - (double) cut.evaluatedPassed / cut.evaluated : 1.;
+    }
+
+    // Apply the cuts to the events 'selected' of the block, which keeps the events passing all of them.
+    // failedAt[k] is set to the position of the first cut failed by the event k, or to size() if it passes all of them
+    void evaluate(const Block& block, std::vector<uint32_t>& selected, std::vector<uint8_t>& failedAt) {
+      for (uint32_t k: selected)
+        failedAt[k] = mCuts.size();
+
+      for (size_t i = 0; i < mCuts.size() && ! selected.empty(); i++) {
+        Cut& cut = mCuts[i];
+
+        clock::time_point start = clock::now();
+        size_t kept = 0;
+        for (uint32_t k: selected) {
+          if (cut.predicate(block, k))
+            selected[kept++] = k;
+          else
+            failedAt[k] = i;
+        }
+        cut.time += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+        cut.evaluated += selected.size();
+        cut.evaluatedPassed += kept;
+        selected.resize(kept);
+      }
+    }
+
+    // Update the counters with an event which failed the cut failedAt. Returns true if it passed all the cuts
+    bool count(uint8_t failedAt) {
+      for (size_t i = 0; i < failedAt; i++)
+        mCuts[i].passed++;
+
+      return failedAt == mCuts.size();
+    }
+
+    // Order the cuts by increasing cost / rejection. Cuts rejecting nothing come last, in their current order.
+    // Returns true if the order changed, in which case the counters are reset
+    bool tune() {
+      std::vector<double> ranks(mCuts.size());
+      std::vector<size_t> order(mCuts.size());
+      for (size_t i = 0; i < mCuts.size(); i++) {
+        ranks[i] = (rejection(i) > 0) ? cost(i) / rejection(i) : HUGE_VAL;
+        order[i] = i;
+      }
+
+      std::stable_sort(order.begin(), order.end(), [&ranks](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+
+      bool changed = false;
+      std::vector<Cut> cuts;
+      for (size_t i: order) {
+        changed |= (i != cuts.size());
+        cuts.push_back(mCuts[i]);
+      }
+      mCuts.swap(cuts);
+
+      if (changed) {
+        for (Cut& cut: mCuts)
+          cut.passed = 0;
+      }
+
+      return changed;
+    }
+
+  private:
+    typedef std::chrono::high_resolution_clock clock;
+
+    struct Cut {
+      std::string name;
+      double estimatedCost;
+      Predicate predicate;
+
+      // Measurements, for tune()
+      uint64_t evaluated;
+      uint64_t evaluatedPassed;
+      double time;
+
+      uint64_t passed;
+    };
+
+    std::vector<Cut> mCuts;
+};
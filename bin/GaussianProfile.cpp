@@ -1,4 +1,5 @@
 #include "GaussianProfile.h"
+#include "TraceRecorder.h"
 
 #include <sstream>
 #include <TH1D.h>
@@ -30,6 +31,8 @@ void GaussianProfile::createGraph() {
   if (m_profiles.size() == 0 || (m_graph.get() && !m_dirty))
     return;
 
+  TraceSpan span("GaussianProfile graph", "output", m_name);
+
   std::stringstream ss;
   ss << m_name << "_graph";
 
@@ -0,0 +1,271 @@
+#pragma once
+
+// Manifest of an incremental finalization.
+//
+// Each input file is finalized alone into a partial output, and the partial
+// outputs are merged into the final one. The manifest records, for each input
+// file, what it looked like when it was finalized (size and modification
+// time), its number of events and its partial output. On the next run, only
+// the new files and the files whose size or modification time changed are
+// finalized again. Empty input files have no partial output: they are
+// recorded with 0 entries and an empty partial output name, and skipped by
+// the merge.
+//
+// The partial outputs also depend on the options of the finalizer, summed up
+// by a ConfigurationFingerprint. The manifest records the fingerprint of its
+// partial outputs, which is also part of their names: when it changes, all
+// the files are finalized again.
+//
+// The manifest also records which partial outputs are merged into the
+// output file. When files were only added, their partial outputs are merged
+// into the existing output; the output is only rebuilt from all the partial
+// outputs when a file changed or was removed.
+//
+// The manifest is a text file, with a '# configuration <fingerprint>' header
+// line, then one tab separated line per input file:
+//   <file> <size> <modification time> <entries> <partial output> <merged>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <TDatime.h>
+#include <TFile.h>
+
+// FNV-1a hash of data, continuing 'hash'
+inline uint64_t fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ULL) {
+  for (char c: data) {
+    hash ^= (unsigned char) c;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Hash of the options, and of the input files other than the events, changing the output of the finalizer
+class ConfigurationFingerprint {
+  public:
+    ConfigurationFingerprint():
+      mHash(fnv1a("")) {
+    }
+
+    template<typename T>
+    void add(const std::string& name, const T& value) {
+      std::ostringstream ss;
+      ss << std::setprecision(9) << name << '=' << value << '\n';
+      mHash = fnv1a(ss.str(), mHash);
+    }
+
+    // An input file of the finalizer, by its path, size and modification time
+    void addFile(const std::string& name, const std::string& path) {
+      std::ostringstream ss;
+      struct stat info;
+      if (stat(path.c_str(), &info) == 0)
+        ss << path << ' ' << info.st_size << ' ' << info.st_mtim.tv_sec << '.' << info.st_mtim.tv_nsec;
+      else
+        ss << path << " missing";
+      add(name, ss.str());
+    }
+
+    std::string hex() const {
+      char hex[17];
+      snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) mHash);
+      return hex;
+    }
+
+  private:
+    uint64_t mHash;
+};
+
+class IncrementalManifest {
+  public:
+    struct Entry {
+      std::string file;
+      uint64_t size;
+      // In ns since the epoch
+      int64_t modificationTime;
+      uint64_t entries;
+      std::string partial;
+      // The partial output is in the output file
+      bool merged;
+    };
+
+    // A missing manifest is an empty one. Returns false if the file can't be parsed
+    bool load(const std::string& path) {
+      mEntries.clear();
+      mConfiguration.clear();
+
+      std::ifstream f(path.c_str());
+      if (! f)
+        return true;
+
+      std::string line;
+      const std::string configurationHeader = "# configuration ";
+      while (std::getline(f, line)) {
+        if (line.compare(0, configurationHeader.size(), configurationHeader) == 0)
+          mConfiguration = line.substr(configurationHeader.size());
+        if (line.empty() || line[0] == '#')
+          continue;
+
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t'))
+          fields.push_back(field);
+        // The partial output of an empty input file, in manifests without merged column
+        if (line[line.size() - 1] == '\t')
+          fields.push_back("");
+
+        if (fields.size() != 5 && fields.size() != 6)
+          return false;
+
+        Entry entry;
+        entry.file = fields[0];
+        entry.partial = fields[4];
+        try {
+          entry.size = std::stoull(fields[1]);
+          entry.modificationTime = std::stoll(fields[2]);
+          entry.entries = std::stoull(fields[3]);
+          entry.merged = (fields.size() == 6) && std::stoi(fields[5]) != 0;
+        } catch (std::exception& e) {
+          return false;
+        }
+        mEntries[entry.file] = entry;
+      }
+
+      return true;
+    }
+
+    // Written to a temporary file first, so an interrupted job never leaves a truncated manifest
+    bool save(const std::string& path) const {
+      std::string temporary = path + ".tmp";
+      {
+        std::ofstream f(temporary.c_str());
+        if (! f)
+          return false;
+
+        f << "# configuration " << mConfiguration << std::endl;
+        f << "# file\tsize\tmodification time\tentries\tpartial output\tmerged" << std::endl;
+        for (const auto& it: mEntries) {
+          const Entry& entry = it.second;
+          f << entry.file << "\t" << entry.size << "\t" << entry.modificationTime << "\t" << entry.entries << "\t" << entry.partial << "\t" << entry.merged << std::endl;
+        }
+
+        if (! f.good())
+          return false;
+      }
+
+      return rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // Fill the size and modification time of an input file. Remote files (xrootd, dcap, ...) are opened
+    // to get them from the ROOT file header. Returns false if the file can't be accessed
+    static bool describe(const std::string& file, Entry& entry) {
+      entry.file = file;
+      entry.entries = 0;
+      entry.merged = false;
+
+      if (file.find("://") == std::string::npos) {
+        struct stat info;
+        if (stat(file.c_str(), &info) != 0)
+          return false;
+
+        entry.size = info.st_size;
+        entry.modificationTime = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+        return true;
+      }
+
+      TFile* f = TFile::Open(file.c_str());
+      if (! f)
+        return false;
+
+      entry.size = f->GetSize();
+      entry.modificationTime = (int64_t) f->GetModificationDate().Convert() * 1000000000;
+      f->Close();
+      delete f;
+
+      return true;
+    }
+
+    // Name of the partial output of an input file: its base name, a hash of its full path and the configuration
+    static std::string partialOutputName(const std::string& file, const std::string& configuration) {
+      std::string name = file.substr(file.find_last_of('/') + 1);
+      size_t extension = name.find_last_of('.');
+      if (extension != std::string::npos && extension > 0)
+        name.erase(extension);
+
+      char hash[17];
+      snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) fnv1a(file));
+      return name + "_" + hash + "_" + configuration + ".root";
+    }
+
+    const std::string& configuration() const {
+      return mConfiguration;
+    }
+
+    // Set the configuration fingerprint of the partial outputs. If it differs from the one of the manifest, no file is up
+    // to date anymore: they are all forgotten, and their entries returned
+    std::vector<Entry> configure(const std::string& configuration) {
+      std::vector<Entry> removed;
+      if (configuration != mConfiguration) {
+        for (const auto& it: mEntries)
+          removed.push_back(it.second);
+        mEntries.clear();
+        mConfiguration = configuration;
+      }
+
+      return removed;
+    }
+
+    // True if the file was finalized as it is now, with the current configuration, and its partial output, if any, still exists
+    bool upToDate(const Entry& current) const {
+      std::map<std::string, Entry>::const_iterator it = mEntries.find(current.file);
+      if (it == mEntries.end())
+        return false;
+
+      struct stat info;
+      return it->second.size == current.size && it->second.modificationTime == current.modificationTime && (it->second.partial.empty() || stat(it->second.partial.c_str(), &info) == 0);
+    }
+
+    void update(const Entry& entry) {
+      mEntries[entry.file] = entry;
+    }
+
+    // Record that all the partial outputs are in the output file
+    void setMerged() {
+      for (auto& it: mEntries)
+        it.second.merged = true;
+    }
+
+    // Forget the files which are not in 'files'. Returns their entries
+    std::vector<Entry> retain(const std::vector<std::string>& files) {
+      std::map<std::string, Entry> kept;
+      std::vector<Entry> removed;
+      for (const auto& it: mEntries) {
+        if (std::find(files.begin(), files.end(), it.first) != files.end())
+          kept.insert(it);
+        else
+          removed.push_back(it.second);
+      }
+
+      mEntries.swap(kept);
+      return removed;
+    }
+
+    const std::map<std::string, Entry>& entries() const {
+      return mEntries;
+    }
+
+  private:
+    std::string mConfiguration;
+    std::map<std::string, Entry> mEntries;
+};
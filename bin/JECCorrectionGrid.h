@@ -0,0 +1,315 @@
+#pragma once
+
+// Precomputed jet energy corrections for the --jec mode of the finalizer.
+//
+// The full correction is tabulated at startup on a (eta, log pt, rho, area)
+// grid using a JECBatchCorrector. Eta cells follow the union of the payload
+// bin edges: inside such a cell the correction doesn't depend on eta, so only
+// (log pt, rho, area) are interpolated, trilinearly. This only holds when all
+// the levels are binned in JetEta and depend on nothing but pt, rho and area;
+// check canTabulate() before building a grid.
+//
+// The interpolation is compared with the exact corrector in every grid cell.
+// Its error is not largest at a fixed place of the cell for a non-linear
+// correction, so each cell is sampled at its corners, the middles of its
+// edges and faces, its centre, and a few random points, at random eta in the
+// eta cell. The deviation of a cell is the largest one over these points: it
+// can still underestimate the true maximum, but not by missing a whole region
+// of the cell. Cells whose deviation is above the tolerance (see
+// setTolerance()), as well as jets outside of the grid, are corrected with the
+// exact corrector.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "JetMETCorrections/GammaJetFilter/interface/JECBatchCorrector.h"
+
+class JECCorrectionGrid {
+  public:
+    // randomPoints: number of random points checked in each cell, in addition to the corners, middles and centre
+    JECCorrectionGrid(const JECBatchCorrector& corrector, float ptMin = 10., float ptMax = 5000., size_t ptPoints = 64, float rhoMax = 50., size_t rhoPoints = 26, float areaMax = 2., size_t areaPoints = 11, size_t randomPoints = 2):
+      mCorrector(corrector),
+      mTolerance(HUGE_VAL),
+      mLogPt(std::log(ptMin), std::log(ptMax), ptPoints),
+      mRho(0., rhoMax, rhoPoints),
+      mArea(0., areaMax, areaPoints) {
+
+      mEtaEdges = corrector.binEdges();
+
+      const size_t cellSize = mLogPt.points * mRho.points * mArea.points;
+      mTable.reserve(etaCells() * cellSize);
+
+      JECJetBatch jets;
+      std::vector<float> corrections;
+      for (size_t c = 0; c < etaCells(); c++) {
+        float eta = (mEtaEdges[c] + mEtaEdges[c + 1]) / 2.;
+
+        jets.clear();
+        for (size_t i = 0; i < mLogPt.points; i++) {
+          for (size_t j = 0; j < mRho.points; j++) {
+            for (size_t k = 0; k < mArea.points; k++) {
+              jets.push_back(eta, std::exp(mLogPt.at(i)), mRho.at(j), mArea.at(k));
+            }
+          }
+        }
+
+        mCorrector.getCorrections(jets, corrections);
+        mTable.insert(mTable.end(), corrections.begin(), corrections.end());
+      }
+
+      computeDeviations(randomPoints);
+    }
+
+    // Returns false, with the reason, if the corrections of corrector can't be tabulated on this grid
+    static bool canTabulate(const JECBatchCorrector& corrector, std::string& reason) {
+      if (! corrector.binnedIn(JECBatchLevel::kJetEta)) {
+        reason = "JEC payloads must all be binned in JetEta only";
+        return false;
+      }
+
+      if (corrector.usesVariable(JECBatchLevel::kNPV)) {
+        reason = "JEC payloads must not depend on NPV";
+        return false;
+      }
+
+      return true;
+    }
+
+    // Cells where the interpolation differs from the exact correction factor
+    // by more than tolerance are evaluated with the exact corrector.
+    void setTolerance(double tolerance) {
+      mTolerance = tolerance;
+    }
+
+    size_t size() const {
+      return mTable.size();
+    }
+
+    void getCorrections(const JECJetBatch& jets, std::vector<float>& corrections) const {
+      corrections.resize(jets.size());
+
+      JECJetBatch outside;
+      std::vector<size_t> outsideIndexes;
+
+      for (size_t i = 0; i < jets.size(); i++) {
+        if (! interpolate(jets.eta[i], jets.pt[i], jets.rho[i], jets.area[i], corrections[i])) {
+          outside.push_back(jets.eta[i], jets.pt[i], jets.rho[i], jets.area[i], jets.npv[i]);
+          outsideIndexes.push_back(i);
+        }
+      }
+
+      if (outside.size() == 0)
+        return;
+
+      std::vector<float> exact;
+      mCorrector.getCorrections(outside, exact);
+      for (size_t i = 0; i < outsideIndexes.size(); i++)
+        corrections[outsideIndexes[i]] = exact[i];
+    }
+
+    // Maximal absolute difference between the interpolated and the exact
+    // correction factors, over the cells where the interpolation is used.
+    double maxDeviation() const {
+      double deviation = 0.;
+      for (float cellDeviation: mCellDeviations) {
+        if (cellDeviation <= mTolerance)
+          deviation = std::max(deviation, (double) cellDeviation);
+      }
+
+      return deviation;
+    }
+
+    // Fraction of the grid cells evaluated with the exact corrector
+    double exactFraction() const {
+      if (mCellDeviations.empty())
+        return 1.;
+
+      size_t exact = 0;
+      for (float cellDeviation: mCellDeviations) {
+        if (cellDeviation > mTolerance)
+          exact++;
+      }
+
+      return (double) exact / mCellDeviations.size();
+    }
+
+  private:
+    struct Axis {
+      Axis(float min_, float max_, size_t points_):
+        min(min_), max(max_), points(std::max<size_t>(points_, 2)), step((max_ - min_) / (points - 1)) {}
+
+      float at(float index) const {
+        return min + index * step;
+      }
+
+      // Lower grid point and fraction of the way to the next one. False if x is outside the axis
+      bool locate(float x, size_t& index, float& fraction) const {
+        if (x < min || x > max)
+          return false;
+
+        float t = (x - min) / step;
+        index = std::min<size_t>(t, points - 2);
+        fraction = t - index;
+        return true;
+      }
+
+      float min;
+      float max;
+      size_t points;
+      float step;
+    };
+
+    // Largest absolute difference between interpolated and exact correction over the points checked in each cell.
+    // Relative differences would be meaningless where L1 subtracts the whole jet.
+    void computeDeviations(size_t randomPoints) {
+      const size_t cellsI = mLogPt.points - 1, cellsJ = mRho.points - 1, cellsK = mArea.points - 1;
+      const size_t cellsPerEta = cellsI * cellsJ * cellsK;
+      mCellDeviations.assign(etaCells() * cellsPerEta, 0.);
+
+      // Points at half the grid step: the corners, middles of the edges and faces, and centres of the cells
+      const size_t pointsI = 2 * cellsI + 1, pointsJ = 2 * cellsJ + 1, pointsK = 2 * cellsK + 1;
+
+      // Fixed seed: the grid, and so the output of the finalizer, is reproducible
+      std::mt19937 generator(0);
+      std::uniform_real_distribution<float> uniform(0., 1.);
+
+      JECJetBatch jets;
+      std::vector<float> exact;
+      std::vector<float> deviations;
+      std::vector<size_t> randomCells;
+      std::vector<float> randomFractions;
+
+      for (size_t c = 0; c < etaCells(); c++) {
+        float eta = (mEtaEdges[c] + mEtaEdges[c + 1]) / 2.;
+        float* cellDeviations = &mCellDeviations[c * cellsPerEta];
+
+        jets.clear();
+        for (size_t i = 0; i < pointsI; i++) {
+          for (size_t j = 0; j < pointsJ; j++) {
+            for (size_t k = 0; k < pointsK; k++) {
+              jets.push_back(eta, std::exp(mLogPt.at(i / 2.)), mRho.at(j / 2.), mArea.at(k / 2.));
+            }
+          }
+        }
+
+        mCorrector.getCorrections(jets, exact);
+
+        deviations.resize(jets.size());
+        for (size_t i = 0, n = 0; i < pointsI; i++) {
+          for (size_t j = 0; j < pointsJ; j++) {
+            for (size_t k = 0; k < pointsK; k++, n++) {
+              // Interpolated in the cell of the point, or in the one below for the last grid point
+              size_t ci = std::min(i / 2, cellsI - 1), cj = std::min(j / 2, cellsJ - 1), ck = std::min(k / 2, cellsK - 1);
+              float value = interpolateInCell(c, ci, cj, ck, (i - 2 * ci) / 2., (j - 2 * cj) / 2., (k - 2 * ck) / 2.);
+              deviations[n] = std::fabs(value - exact[n]);
+            }
+          }
+        }
+
+        // The 27 points of each cell
+        for (size_t i = 0; i < cellsI; i++) {
+          for (size_t j = 0; j < cellsJ; j++) {
+            for (size_t k = 0; k < cellsK; k++) {
+              float deviation = 0.;
+              for (size_t di = 0; di < 3; di++) {
+                for (size_t dj = 0; dj < 3; dj++) {
+                  for (size_t dk = 0; dk < 3; dk++) {
+                    size_t n = ((2 * i + di) * pointsJ + 2 * j + dj) * pointsK + 2 * k + dk;
+                    deviation = std::max(deviation, deviations[n]);
+                  }
+                }
+              }
+              cellDeviations[(i * cellsJ + j) * cellsK + k] = deviation;
+            }
+          }
+        }
+
+        if (randomPoints == 0)
+          continue;
+
+        jets.clear();
+        randomCells.clear();
+        randomFractions.clear();
+        for (size_t cell = 0; cell < cellsPerEta; cell++) {
+          size_t i = cell / (cellsJ * cellsK), j = (cell / cellsK) % cellsJ, k = cell % cellsK;
+          for (size_t r = 0; r < randomPoints; r++) {
+            float fi = uniform(generator), fj = uniform(generator), fk = uniform(generator);
+            float randomEta = mEtaEdges[c] + uniform(generator) * (mEtaEdges[c + 1] - mEtaEdges[c]);
+            jets.push_back(std::min(randomEta, std::nextafter(mEtaEdges[c + 1], mEtaEdges[c])), std::exp(mLogPt.at(i + fi)), mRho.at(j + fj), mArea.at(k + fk));
+            randomCells.push_back(cell);
+            randomFractions.push_back(fi);
+            randomFractions.push_back(fj);
+            randomFractions.push_back(fk);
+          }
+        }
+
+        mCorrector.getCorrections(jets, exact);
+
+        for (size_t n = 0; n < jets.size(); n++) {
+          size_t cell = randomCells[n];
+          size_t i = cell / (cellsJ * cellsK), j = (cell / cellsK) % cellsJ, k = cell % cellsK;
+          float value = interpolateInCell(c, i, j, k, randomFractions[3 * n], randomFractions[3 * n + 1], randomFractions[3 * n + 2]);
+          cellDeviations[cell] = std::max(cellDeviations[cell], std::fabs(value - exact[n]));
+        }
+      }
+    }
+
+    size_t etaCells() const {
+      return (mEtaEdges.size() < 2) ? 0 : mEtaEdges.size() - 1;
+    }
+
+    bool interpolate(float eta, float pt, float rho, float area, float& correction) const {
+      size_t cell;
+      if (! interpolate(eta, pt, rho, area, correction, cell))
+        return false;
+
+      return mCellDeviations[cell] <= mTolerance;
+    }
+
+    bool interpolate(float eta, float pt, float rho, float area, float& correction, size_t& cell) const {
+      if (etaCells() == 0 || eta < mEtaEdges.front() || eta >= mEtaEdges.back() || pt <= 0)
+        return false;
+
+      size_t c = (std::upper_bound(mEtaEdges.begin(), mEtaEdges.end(), eta) - mEtaEdges.begin()) - 1;
+
+      size_t i, j, k;
+      float fi, fj, fk;
+      if (! mLogPt.locate(std::log(pt), i, fi) || ! mRho.locate(rho, j, fj) || ! mArea.locate(area, k, fk))
+        return false;
+
+      correction = interpolateInCell(c, i, j, k, fi, fj, fk);
+      cell = ((c * (mLogPt.points - 1) + i) * (mRho.points - 1) + j) * (mArea.points - 1) + k;
+      return true;
+    }
+
+    // Trilinear interpolation in the cell (i, j, k) of the eta cell c, at the fractions (fi, fj, fk) of the cell
+    float interpolateInCell(size_t c, size_t i, size_t j, size_t k, float fi, float fj, float fk) const {
+      const size_t strideJ = mArea.points;
+      const size_t strideI = mRho.points * strideJ;
+      const float* corners = &mTable[c * mLogPt.points * strideI + i * strideI + j * strideJ + k];
+
+      float value = 0.;
+      for (size_t corner = 0; corner < 8; corner++) {
+        size_t di = (corner >> 2) & 1, dj = (corner >> 1) & 1, dk = corner & 1;
+        float weight = (di ? fi : 1 - fi) * (dj ? fj : 1 - fj) * (dk ? fk : 1 - fk);
+        value += weight * corners[di * strideI + dj * strideJ + dk];
+      }
+
+      return value;
+    }
+
+    const JECBatchCorrector& mCorrector;
+    double mTolerance;
+
+    std::vector<float> mEtaEdges;
+    Axis mLogPt;
+    Axis mRho;
+    Axis mArea;
+
+    // Indexed as [eta cell][log pt][rho][area]
+    std::vector<float> mTable;
+    std::vector<float> mCellDeviations;
+};
@@ -6,6 +6,7 @@
 // Custom corrections
 #include "CondFormats/JetMETObjects/interface/JetCorrectorParameters.h"
 #include "CondFormats/JetMETObjects/interface/FactorizedJetCorrector.h"
+#include "JetMETCorrections/GammaJetFilter/interface/JECBatchCorrector.h"
 
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/dom/DOM.hpp>
@@ -44,7 +45,8 @@ class XMLSimpleStr {
 };
 
 
-FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xmlfile, const std::string& jetAlgo, const bool isMC) {
+// Fill payloads with the files described in xmlfile, in the order they must be applied
+bool getJECPayloadsFromXML(const std::string& xmlfile, const std::string& jetAlgo, const bool isMC, std::vector<std::string>& payloads) {
 
   try {
     XMLPlatformUtils::Initialize();
@@ -54,7 +56,7 @@ FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xml
     std::cout << "Error during initialization! :\n" << message << "\n";
     XMLString::release(&message);
 
-    return NULL;
+    return false;
   }
 
   const std::string mcDataText = (isMC) ? "MC" : "DATA";
@@ -85,7 +87,6 @@ FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xml
     XMLCh* prefixStr = XMLString::transcode("prefix");
     XMLCh* pathStr = XMLString::transcode("path");
 
-    std::vector<JetCorrectorParameters> correctors;
     XMLSimpleStr prefix(corrections->getAttribute(prefixStr));
     XMLSimpleStr path(corrections->getAttribute(pathStr));
 
@@ -116,7 +117,7 @@ FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xml
         //std::string filename = path.get() + prefix.get() + "_" + name.get() + "_" + jetAlgo + ".txt";
         if (!onlyOnData || (onlyOnData && !isMC)) {
           std::cout << "Using payload '" << filename << "'" << std::endl;
-          correctors.push_back(JetCorrectorParameters(filename));
+          payloads.push_back(filename);
         }
       }
     }
@@ -125,21 +126,61 @@ FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xml
     XMLString::release(&onlyOnDataStr);
     XMLString::release(&trueStr);
 
-    return new FactorizedJetCorrector(correctors);
+    return true;
 
   } catch (const XMLException& toCatch) {
     char* message = XMLString::transcode(toCatch.getMessage());
     std::cout << "Exception message is: \n" << message << "\n";
     XMLString::release(&message);
-    return NULL;
+    return false;
   } catch (const DOMException& toCatch) {
     char* message = XMLString::transcode(toCatch.msg);
     std::cout << "Exception message is: \n" << message << "\n";
     XMLString::release(&message);
-    return NULL;
+    return false;
   }
 
   XMLPlatformUtils::Terminate();
-  return NULL;
+  return false;
+}
+
+// Payloads are parsed once per process, see JECPayloadCache
+FactorizedJetCorrector* makeFactorizedJetCorrector(const std::vector<std::string>& payloads) {
+
+  std::vector<JetCorrectorParameters> correctors;
+  for (const std::string& payload: payloads) {
+    correctors.push_back(JECPayloadCache::get<JetCorrectorParameters>(payload));
+  }
+
+  return new FactorizedJetCorrector(correctors);
+}
+
+FactorizedJetCorrector* makeFactorizedJetCorrectorFromXML(const std::string& xmlfile, const std::string& jetAlgo, const bool isMC) {
+
+  std::vector<std::string> payloads;
+  if (! getJECPayloadsFromXML(xmlfile, jetAlgo, isMC, payloads))
+    return NULL;
+
+  return makeFactorizedJetCorrector(payloads);
+}
+
+// Batch version of makeFactorizedJetCorrector. Returns NULL if the payloads can't be read
+JECBatchCorrector* makeJECBatchCorrector(const std::vector<std::string>& payloads) {
+
+  try {
+    return new JECBatchCorrector(payloads);
+  } catch (const std::exception& e) {
+    std::cout << "Can't use batch JEC: " << e.what() << std::endl;
+    return NULL;
+  }
+}
+
+JECBatchCorrector* makeJECBatchCorrectorFromXML(const std::string& xmlfile, const std::string& jetAlgo, const bool isMC) {
+
+  std::vector<std::string> payloads;
+  if (! getJECPayloadsFromXML(xmlfile, jetAlgo, isMC, payloads))
+    return NULL;
+
+  return makeJECBatchCorrector(payloads);
 }
 
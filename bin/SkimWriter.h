@@ -0,0 +1,149 @@
+#pragma once
+
+// Flat tree of the events kept by the finalizer, with only the variables used
+// downstream: one entry per event, one branch per variable, no object.
+//
+// The variables of an event are given to Fill() as a SkimEvent, which can be
+// built elsewhere, e.g. queued for an AsyncWriter. Only the branches listed
+// when creating the writer are written; the others are never created. Each
+// branch is compressed with its own settings, so the skim can use a fast
+// compression while the histograms of the same file keep the default one.
+
+#include <TBranch.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct SkimEvent {
+  UInt_t run;
+  UInt_t lumi_block;
+  UInt_t event;
+
+  Float_t weight;
+  Float_t generator_weight;
+  Float_t pu_weight;
+
+  UInt_t nvertex;
+  Float_t rho;
+
+  Float_t photon_pt;
+  Float_t photon_eta;
+  Float_t photon_phi;
+
+  Float_t first_jet_pt;
+  Float_t first_jet_eta;
+  Float_t first_jet_phi;
+  Float_t first_jet_raw_pt;
+  Float_t second_jet_pt;
+
+  Float_t alpha;
+  Float_t resp_balancing;
+  Float_t resp_balancing_raw;
+  Float_t resp_mpf;
+  Float_t resp_mpf_raw;
+
+  Int_t pt_bin;
+  Int_t eta_bin;
+
+  // MC only
+  Float_t gen_photon_pt;
+  Float_t first_gen_jet_pt;
+  Float_t resp_balancing_gen;
+  Float_t resp_mpf_gen;
+};
+
+class SkimWriter {
+  public:
+    struct Variable {
+      std::string name;
+      std::string type;
+      size_t offset;
+      bool mcOnly;
+    };
+
+    // All the variables which can be written, in the order of the branches
+    static const std::vector<Variable>& variables() {
+      static const std::vector<Variable> variables = {
+        {"run", "i", offsetof(SkimEvent, run), false},
+        {"lumi_block", "i", offsetof(SkimEvent, lumi_block), false},
+        {"event", "i", offsetof(SkimEvent, event), false},
+        {"weight", "F", offsetof(SkimEvent, weight), false},
+        {"generator_weight", "F", offsetof(SkimEvent, generator_weight), false},
+        {"pu_weight", "F", offsetof(SkimEvent, pu_weight), false},
+        {"nvertex", "i", offsetof(SkimEvent, nvertex), false},
+        {"rho", "F", offsetof(SkimEvent, rho), false},
+        {"photon_pt", "F", offsetof(SkimEvent, photon_pt), false},
+        {"photon_eta", "F", offsetof(SkimEvent, photon_eta), false},
+        {"photon_phi", "F", offsetof(SkimEvent, photon_phi), false},
+        {"first_jet_pt", "F", offsetof(SkimEvent, first_jet_pt), false},
+        {"first_jet_eta", "F", offsetof(SkimEvent, first_jet_eta), false},
+        {"first_jet_phi", "F", offsetof(SkimEvent, first_jet_phi), false},
+        {"first_jet_raw_pt", "F", offsetof(SkimEvent, first_jet_raw_pt), false},
+        {"second_jet_pt", "F", offsetof(SkimEvent, second_jet_pt), false},
+        {"alpha", "F", offsetof(SkimEvent, alpha), false},
+        {"resp_balancing", "F", offsetof(SkimEvent, resp_balancing), false},
+        {"resp_balancing_raw", "F", offsetof(SkimEvent, resp_balancing_raw), false},
+        {"resp_mpf", "F", offsetof(SkimEvent, resp_mpf), false},
+        {"resp_mpf_raw", "F", offsetof(SkimEvent, resp_mpf_raw), false},
+        {"pt_bin", "I", offsetof(SkimEvent, pt_bin), false},
+        {"eta_bin", "I", offsetof(SkimEvent, eta_bin), false},
+        {"gen_photon_pt", "F", offsetof(SkimEvent, gen_photon_pt), true},
+        {"first_gen_jet_pt", "F", offsetof(SkimEvent, first_gen_jet_pt), true},
+        {"resp_balancing_gen", "F", offsetof(SkimEvent, resp_balancing_gen), true},
+        {"resp_mpf_gen", "F", offsetof(SkimEvent, resp_mpf_gen), true}
+      };
+
+      return variables;
+    }
+
+    // Returns the name of the first unknown variable of 'names', or an empty string
+    static std::string unknownVariable(const std::vector<std::string>& names) {
+      for (const std::string& name: names) {
+        if (! find(name))
+          return name;
+      }
+
+      return "";
+    }
+
+    // Create the branches of 'names' in tree, or of all the variables if names is empty. MC only variables are skipped for data.
+    // compressionSettings: see OutputTree::compressionSettings, or -1 for the settings of the file
+    SkimWriter(TTree* tree, const std::vector<std::string>& names, bool isMC, int compressionSettings):
+      mTree(tree) {
+      for (const Variable& variable: variables()) {
+        if (! names.empty() && std::find(names.begin(), names.end(), variable.name) == names.end())
+          continue;
+        if (variable.mcOnly && ! isMC)
+          continue;
+
+        TBranch* branch = mTree->Branch(variable.name.c_str(), reinterpret_cast<char*>(&mEvent) + variable.offset, (variable.name + "/" + variable.type).c_str());
+        if (compressionSettings >= 0)
+          branch->SetCompressionSettings(compressionSettings);
+      }
+    }
+
+    void Fill(const SkimEvent& event) {
+      mEvent = event;
+      mTree->Fill();
+    }
+
+    TTree* tree() const {
+      return mTree;
+    }
+
+  private:
+    static const Variable* find(const std::string& name) {
+      for (const Variable& variable: variables()) {
+        if (variable.name == name)
+          return &variable;
+      }
+
+      return NULL;
+    }
+
+    TTree* mTree;
+    SkimEvent mEvent;
+};
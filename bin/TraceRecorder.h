@@ -0,0 +1,191 @@
+#pragma once
+
+// Timeline of the finalizer, written as a Chrome trace-event JSON file
+// (chrome://tracing, https://ui.perfetto.dev).
+//
+// Spans are recorded with TraceSpan, which measures the time between its
+// construction and its destruction. Nothing is recorded until enable() is
+// called, and a disabled span only costs a test of a flag.
+//
+// Inside the event loop, only the spans of the sampled events are recorded:
+// setEvent() tells the recorder which entry is processed, and if it is sampled
+// (one entry out of 'sampling'). clearEvent() records again everything.
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TraceRecorder {
+  public:
+    static TraceRecorder& instance() {
+      static TraceRecorder recorder;
+      return recorder;
+    }
+
+    void enable(const std::string& fileName, uint64_t sampling) {
+      mFileName = fileName;
+      mSampling = std::max<uint64_t>(sampling, 1);
+      mEnabled = true;
+      mRecording = true;
+    }
+
+    bool recording() const {
+      return mRecording;
+    }
+
+    void setEvent(uint64_t entry) {
+      if (! mEnabled)
+        return;
+
+      mEntry = entry;
+      mInEvent = true;
+      mRecording = (entry % mSampling == 0);
+    }
+
+    void clearEvent() {
+      mInEvent = false;
+      mRecording = mEnabled.load();
+    }
+
+    // Microseconds since the creation of the recorder
+    double now() const {
+      return std::chrono::duration<double, std::micro>(clock::now() - mStart).count();
+    }
+
+    void record(const char* name, const char* category, const std::string& detail, double start, double end) {
+      Span span;
+      span.name = name;
+      span.category = category;
+      span.detail = detail;
+      span.start = start;
+      span.duration = end - start;
+      span.inEvent = mInEvent;
+      span.entry = mEntry;
+
+      std::lock_guard<std::mutex> lock(mMutex);
+      span.thread = threadIndex();
+      mSpans.push_back(span);
+    }
+
+    // Write the recorded spans, if enabled. Returns false if the file could not be written
+    bool write() {
+      if (! mEnabled)
+        return true;
+
+      std::lock_guard<std::mutex> lock(mMutex);
+      std::ofstream out(mFileName.c_str());
+      if (! out)
+        return false;
+
+      int pid = getpid();
+      out << std::fixed << std::setprecision(3);
+      out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+      out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"args\": {\"name\": \"gammaJetFinalizer\"}}";
+      for (const Span& span: mSpans) {
+        out << ",\n{\"name\": \"" << escape(span.name) << "\", \"cat\": \"" << span.category << "\", \"ph\": \"X\"";
+        out << ", \"ts\": " << span.start << ", \"dur\": " << span.duration << ", \"pid\": " << pid << ", \"tid\": " << span.thread;
+        out << ", \"args\": {";
+        if (span.inEvent)
+          out << "\"entry\": " << span.entry;
+        if (! span.detail.empty())
+          out << (span.inEvent ? ", " : "") << "\"detail\": \"" << escape(span.detail) << "\"";
+        out << "}}";
+      }
+      out << "\n]}\n";
+
+      return out.good();
+    }
+
+    const std::string& fileName() const {
+      return mFileName;
+    }
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Span {
+      std::string name;
+      const char* category;
+      std::string detail;
+      double start;
+      double duration;
+      bool inEvent;
+      uint64_t entry;
+      int thread;
+    };
+
+    TraceRecorder():
+      mEnabled(false), mRecording(false), mSampling(1), mInEvent(false), mEntry(0), mStart(clock::now()) {
+    }
+
+    // Small thread ids, in order of appearance. Called with the mutex locked
+    int threadIndex() {
+      std::thread::id id = std::this_thread::get_id();
+      std::map<std::thread::id, int>::const_iterator it = mThreads.find(id);
+      if (it == mThreads.end())
+        it = mThreads.insert(std::make_pair(id, (int) mThreads.size() + 1)).first;
+
+      return it->second;
+    }
+
+    static std::string escape(const std::string& text) {
+      std::string escaped;
+      for (char c: text) {
+        if (c == '"' || c == '\\')
+          escaped += '\\';
+        escaped += c;
+      }
+
+      return escaped;
+    }
+
+    std::atomic<bool> mEnabled;
+    std::atomic<bool> mRecording;
+    uint64_t mSampling;
+    std::atomic<bool> mInEvent;
+    std::atomic<uint64_t> mEntry;
+    clock::time_point mStart;
+
+    std::string mFileName;
+    std::mutex mMutex;
+    std::vector<Span> mSpans;
+    std::map<std::thread::id, int> mThreads;
+};
+
+// Records the time between its construction (or the call to start()) and its destruction
+class TraceSpan {
+  public:
+    TraceSpan(const char* name, const char* category, const std::string& detail = "", bool started = true):
+      mName(name), mCategory(category), mDetail(detail), mStart(-1) {
+      if (started)
+        start();
+    }
+
+    ~TraceSpan() {
+      TraceRecorder& recorder = TraceRecorder::instance();
+      if (mStart >= 0)
+        recorder.record(mName, mCategory, mDetail, mStart, recorder.now());
+    }
+
+    void start() {
+      TraceRecorder& recorder = TraceRecorder::instance();
+      if (recorder.recording())
+        mStart = recorder.now();
+    }
+
+  private:
+    const char* mName;
+    const char* mCategory;
+    std::string mDetail;
+    double mStart;
+};
@@ -11,13 +11,19 @@
 #include <TChain.h>
 #include <TFile.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
 // Header file for the classes stored in the TTree if any.
 
 // Fixed size dimensions of array or collections stored in the TTree if any.
+#define MAX_TRIGGER_WORDS 8 // Must match GammaJetFilter
 
 class AnalysisTree {
   public :
     TTree          *fChain;   //!pointer to the analyzed TTree or TChain
+    TString         fPrefix;  //!prefix of the branch names, for trees sharing a TTree
 
     // Declaration of leaf types
     UInt_t                      run;
@@ -28,6 +34,11 @@ class AnalysisTree {
     Int_t                       pu_nvertex;
     Float_t                     event_weight;
     Double_t                    generator_weight;
+    ULong64_t                   trigger_menu_id;
+    Int_t                       trigger_words;
+    ULong64_t                   trigger_bits[MAX_TRIGGER_WORDS];
+
+    // Trees written before trigger menus were introduced store the names and results for each event
     std::vector<std::string>*   trigger_names;
     std::vector<bool>*          trigger_results;
 
@@ -41,11 +52,28 @@ class AnalysisTree {
     virtual ~AnalysisTree();
     virtual Int_t    GetEntry(Long64_t entry);
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
+
+    // Read the trigger_menus tree
+    void LoadTriggerMenus(TTree *menus);
+
+    // Names of the photon paths of the current entry, and their results
+    const std::vector<std::string>& GetTriggerNames() const;
+    const std::vector<std::string>& GetTriggerNames(ULong64_t menuId) const;
+    bool GetTriggerResult(size_t index) const;
+
+    // True if the trees store trigger menus. If false, trigger_menu_id is always 0
+    bool HasTriggerMenus() const {
+      return ! legacyTriggers;
+    }
+
+  private:
+    bool legacyTriggers;
+    std::map<ULong64_t, std::vector<std::string>> triggerMenus;
 };
 
 
-AnalysisTree::AnalysisTree() : fChain(0), trigger_names(NULL), trigger_results(NULL)
+AnalysisTree::AnalysisTree() : fChain(0), trigger_menu_id(0), trigger_words(0), trigger_names(NULL), trigger_results(NULL), legacyTriggers(false)
 {
 }
 
@@ -67,26 +95,80 @@ Int_t AnalysisTree::GetEntry(Long64_t entry)
 }
 
 
-void AnalysisTree::Init(TTree *tree)
+void AnalysisTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (!tree)
     return;
 
   fChain = tree;
+  fPrefix = prefix;
   //fChain->SetMakeClass(1);
 
-  fChain->SetBranchAddress("run", &run, NULL);
-  fChain->SetBranchAddress("lumi_block", &lumi_block, NULL);
-  fChain->SetBranchAddress("event", &event, NULL);
-  fChain->SetBranchAddress("ntrue_interactions", &ntrue_interactions, &b_ntrue_interactions);
-  fChain->SetBranchAddress("nvertex", &nvertex, &b_nvertex);
-  fChain->SetBranchAddress("pu_nvertex", &pu_nvertex, &b_nvertex);
-  fChain->SetBranchAddress("event_weight", &event_weight, &b_event_weight);
-  fChain->SetBranchAddress("generator_weight", &generator_weight, NULL);
-  fChain->SetBranchAddress("trigger_names", &trigger_names, NULL);
-  fChain->SetBranchAddress("trigger_results", &trigger_results, NULL);
+  fChain->SetBranchAddress(fPrefix + "run", &run, NULL);
+  fChain->SetBranchAddress(fPrefix + "lumi_block", &lumi_block, NULL);
+  fChain->SetBranchAddress(fPrefix + "event", &event, NULL);
+  fChain->SetBranchAddress(fPrefix + "ntrue_interactions", &ntrue_interactions, &b_ntrue_interactions);
+  fChain->SetBranchAddress(fPrefix + "nvertex", &nvertex, &b_nvertex);
+  fChain->SetBranchAddress(fPrefix + "pu_nvertex", &pu_nvertex, &b_nvertex);
+  fChain->SetBranchAddress(fPrefix + "event_weight", &event_weight, &b_event_weight);
+  fChain->SetBranchAddress(fPrefix + "generator_weight", &generator_weight, NULL);
+
+  legacyTriggers = (fChain->GetBranch(fPrefix + "trigger_menu_id") == NULL);
+  if (legacyTriggers) {
+    fChain->SetBranchAddress(fPrefix + "trigger_names", &trigger_names, NULL);
+    fChain->SetBranchAddress(fPrefix + "trigger_results", &trigger_results, NULL);
+  } else {
+    fChain->SetBranchAddress(fPrefix + "trigger_menu_id", &trigger_menu_id, NULL);
+    fChain->SetBranchAddress(fPrefix + "trigger_words", &trigger_words, NULL);
+    fChain->SetBranchAddress(fPrefix + "trigger_bits", trigger_bits, NULL);
+  }
 
   //fChain->SetCacheSize(-1);
   //fChain->AddBranchToCache("*");
 }
+
+void AnalysisTree::LoadTriggerMenus(TTree *menus)
+{
+  if (!menus || legacyTriggers)
+    return;
+
+  ULong64_t menu_id;
+  std::vector<std::string>* names = NULL;
+
+  menus->SetBranchAddress(fPrefix + "menu_id", &menu_id, NULL);
+  menus->SetBranchAddress(fPrefix + "trigger_names", &names, NULL);
+
+  Long64_t entries = menus->GetEntries();
+  for (Long64_t i = 0; i < entries; i++) {
+    menus->GetEntry(i);
+    triggerMenus[menu_id] = *names;
+  }
+
+  menus->ResetBranchAddresses();
+  delete names;
+}
+
+const std::vector<std::string>& AnalysisTree::GetTriggerNames() const
+{
+  if (legacyTriggers)
+    return *trigger_names;
+
+  return GetTriggerNames(trigger_menu_id);
+}
+
+const std::vector<std::string>& AnalysisTree::GetTriggerNames(ULong64_t menuId) const
+{
+  static const std::vector<std::string> empty;
+  std::map<ULong64_t, std::vector<std::string>>::const_iterator it = triggerMenus.find(menuId);
+
+  return (it == triggerMenus.end()) ? empty : it->second;
+}
+
+bool AnalysisTree::GetTriggerResult(size_t index) const
+{
+  if (legacyTriggers)
+    return trigger_results->at(index);
+
+  return (trigger_bits[index / 64] >> (index % 64)) & 1;
+}
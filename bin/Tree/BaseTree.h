@@ -18,6 +18,7 @@
 class BaseTree {
   public :
     TTree          *fChain;   //!pointer to the analyzed TTree or TChain
+    TString         fPrefix;  //!prefix of the branch names, for trees sharing a TTree
 
     // Declaration of leaf types
     Int_t           is_present;
@@ -43,7 +44,7 @@ class BaseTree {
     BaseTree();
     virtual ~BaseTree();
     virtual Int_t    GetEntry(Long64_t entry);
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
     virtual void     InitCache();
 };
 
@@ -70,24 +71,25 @@ Int_t BaseTree::GetEntry(Long64_t entry)
   return fChain->GetEntry(entry);
 }
 
-void BaseTree::Init(TTree *tree)
+void BaseTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (! tree)
     return;
 
   fChain = tree;
+  fPrefix = prefix;
   fChain->SetMakeClass(1);
 
-  fChain->SetBranchAddress("is_present", &is_present, &b_is_present);
-  fChain->SetBranchAddress("et", &et, &b_et);
-  fChain->SetBranchAddress("pt", &pt, &b_pt);
-  fChain->SetBranchAddress("eta", &eta, &b_eta);
-  fChain->SetBranchAddress("phi", &phi, &b_phi);
-  fChain->SetBranchAddress("px", &px, &b_px);
-  fChain->SetBranchAddress("py", &py, &b_py);
-  fChain->SetBranchAddress("pz", &pz, &b_pz);
-  fChain->SetBranchAddress("e", &e, NULL);
+  fChain->SetBranchAddress(fPrefix + "is_present", &is_present, &b_is_present);
+  fChain->SetBranchAddress(fPrefix + "et", &et, &b_et);
+  fChain->SetBranchAddress(fPrefix + "pt", &pt, &b_pt);
+  fChain->SetBranchAddress(fPrefix + "eta", &eta, &b_eta);
+  fChain->SetBranchAddress(fPrefix + "phi", &phi, &b_phi);
+  fChain->SetBranchAddress(fPrefix + "px", &px, &b_px);
+  fChain->SetBranchAddress(fPrefix + "py", &py, &b_py);
+  fChain->SetBranchAddress(fPrefix + "pz", &pz, &b_pz);
+  fChain->SetBranchAddress(fPrefix + "e", &e, NULL);
   
   InitCache();
 }
@@ -15,29 +15,29 @@
 
 // Header file for the classes stored in the TTree if any.
 
-// Fixed size dimensions of array or collections stored in the TTree if any.
+// Arrays are sized by LeptonTree, see LeptonTree::LoadTree().
 
 class ElectronTree: public LeptonTree {
   public :
 
     // Declaration of leaf types
-    Float_t         isolation[30];   //[n]
+    std::vector<Float_t>  isolation;   //[n]
 
     // List of branches
     TBranch        *b_isolation;   //!
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
 };
 
-void ElectronTree::Init(TTree *tree)
+void ElectronTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (!tree)
     return;
 
-  LeptonTree::Init(tree);
+  LeptonTree::Init(tree, prefix);
 
-  fChain->SetBranchAddress("isolation", &isolation, &b_isolation);
+  SetArrayAddress("isolation", isolation, &b_isolation);
 
   LeptonTree::InitCache();
 }
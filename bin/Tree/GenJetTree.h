@@ -14,6 +14,8 @@
 #include <TClonesArray.h>
 #include <TLorentzVector.h>
 
+#include <vector>
+
 // Header file for the classes stored in the TTree if any.
 
 // Fixed size dimensions of array or collections stored in the TTree if any.
@@ -22,49 +24,68 @@ class GenJetTree: public BaseTree {
   public :
 
     // Declaration of leaf types
-    TClonesArray*    neutrinos;
-    TClonesArray*    neutrinos_pdg_id;
+    // Neutrinos from B / C partons decays, first jet only
+    std::vector<float>*  neutrinos_px;
+    std::vector<float>*  neutrinos_py;
+    std::vector<float>*  neutrinos_pz;
+    std::vector<float>*  neutrinos_e;
+    std::vector<int>*    neutrinos_pdg_id;
+    // Same, for files written before neutrinos were stored as vectors. TLorentzVector and TParameter<int>
+    TClonesArray*    legacy_neutrinos;
+    TClonesArray*    legacy_neutrinos_pdg_id;
     int              parton_pdg_id;
     TLorentzVector*  parton_p4;
     int              parton_flavour;
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
     GenJetTree();
 };
 
 GenJetTree::GenJetTree() {
 
-  neutrinos = NULL;
+  neutrinos_px = NULL;
+  neutrinos_py = NULL;
+  neutrinos_pz = NULL;
+  neutrinos_e = NULL;
   neutrinos_pdg_id = NULL;
+  legacy_neutrinos = NULL;
+  legacy_neutrinos_pdg_id = NULL;
   parton_p4 = NULL;
 
 }
 
-void GenJetTree::Init(TTree *tree)
+void GenJetTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (! tree)
     return;
 
-  BaseTree::Init(tree);
-
-  if (fChain->GetBranch("neutrinos")) {
-    neutrinos = new TClonesArray("TLorentzVector", 3);
-    fChain->SetBranchAddress("neutrinos", &neutrinos, NULL);
-  }
-
-  if (fChain->GetBranch("neutrinos_pdg_id")) {
-    neutrinos_pdg_id = new TClonesArray("TParameter<int>", 3);
-    fChain->SetBranchAddress("neutrinos_pdg_id", &neutrinos_pdg_id, NULL);
+  BaseTree::Init(tree, prefix);
+
+  if (fChain->GetBranch(fPrefix + "neutrinos")) {
+    // Legacy layout
+    legacy_neutrinos = new TClonesArray("TLorentzVector", 3);
+    fChain->SetBranchAddress(fPrefix + "neutrinos", &legacy_neutrinos, NULL);
+
+    if (fChain->GetBranch(fPrefix + "neutrinos_pdg_id")) {
+      legacy_neutrinos_pdg_id = new TClonesArray("TParameter<int>", 3);
+      fChain->SetBranchAddress(fPrefix + "neutrinos_pdg_id", &legacy_neutrinos_pdg_id, NULL);
+    }
+  } else if (fChain->GetBranch(fPrefix + "neutrinos_px")) {
+    fChain->SetBranchAddress(fPrefix + "neutrinos_px", &neutrinos_px, NULL);
+    fChain->SetBranchAddress(fPrefix + "neutrinos_py", &neutrinos_py, NULL);
+    fChain->SetBranchAddress(fPrefix + "neutrinos_pz", &neutrinos_pz, NULL);
+    fChain->SetBranchAddress(fPrefix + "neutrinos_e", &neutrinos_e, NULL);
+    fChain->SetBranchAddress(fPrefix + "neutrinos_pdg_id", &neutrinos_pdg_id, NULL);
   }
   
-  if (fChain->GetBranch("parton_p4")) {
+  if (fChain->GetBranch(fPrefix + "parton_p4")) {
     parton_p4 = new TLorentzVector();
-    fChain->SetBranchAddress("parton_p4", &parton_p4, NULL);
+    fChain->SetBranchAddress(fPrefix + "parton_p4", &parton_p4, NULL);
   }
 
-  fChain->SetBranchAddress("parton_pdg_id", &parton_pdg_id, NULL);
-  fChain->SetBranchAddress("parton_flavour", &parton_flavour, NULL);
+  fChain->SetBranchAddress(fPrefix + "parton_pdg_id", &parton_pdg_id, NULL);
+  fChain->SetBranchAddress(fPrefix + "parton_flavour", &parton_flavour, NULL);
   
   // Enable cache for better read performances
   BaseTree::InitCache();
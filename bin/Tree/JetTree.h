@@ -60,7 +60,7 @@ class JetTree: public BaseTree {
 */
     JetTree();
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
     void             DisableUnrelatedBranches();
 };
 
@@ -71,59 +71,59 @@ JetTree::JetTree():
 {
 }
 
-void JetTree::Init(TTree *tree)
+void JetTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (! tree)
     return;
 
-  BaseTree::Init(tree);
+  BaseTree::Init(tree, prefix);
 
-  fChain->SetBranchAddress("jet_area", &jet_area, &b_jet_area);
-  fChain->SetBranchAddress("btag_tc_high_eff", &btag_tc_high_eff, NULL);
-  fChain->SetBranchAddress("btag_tc_high_pur", &btag_tc_high_pur, NULL);
-  fChain->SetBranchAddress("btag_ssv_high_eff", &btag_tc_high_eff, NULL);
-  fChain->SetBranchAddress("btag_ssv_high_pur", &btag_tc_high_pur, NULL);
-  fChain->SetBranchAddress("btag_jet_probability", &btag_jet_probability, NULL);
-  fChain->SetBranchAddress("btag_jet_b_probability", &btag_jet_b_probability, NULL);
-  fChain->SetBranchAddress("btag_csv", &btag_csv, NULL);
-  fChain->SetBranchAddress("qg_tag_mlp", &qg_tag_mlp, NULL);
-  fChain->SetBranchAddress("qg_tag_likelihood", &qg_tag_likelihood, NULL);
-  fChain->SetBranchAddress("jet_CHEn", &jet_CHEn, NULL);
-  fChain->SetBranchAddress("jet_NHEn", &jet_NHEn, NULL);
-  fChain->SetBranchAddress("jet_PhEn", &jet_PhEn, NULL);
-  fChain->SetBranchAddress("jet_ElEn", &jet_ElEn, NULL);
-  fChain->SetBranchAddress("jet_MuEn", &jet_MuEn, NULL);
-  fChain->SetBranchAddress("jet_CEEn", &jet_CEEn, NULL);
-  fChain->SetBranchAddress("jet_NEEn", &jet_NEEn, NULL);
-  fChain->SetBranchAddress("jet_PhMult", &jet_PhMult, NULL);
-  fChain->SetBranchAddress("jet_NHMult", &jet_NHMult, NULL);
-  fChain->SetBranchAddress("jet_ElMult", &jet_ElMult, NULL);
-  fChain->SetBranchAddress("jet_CHMult", &jet_CHMult, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_area", &jet_area, &b_jet_area);
+  fChain->SetBranchAddress(fPrefix + "btag_tc_high_eff", &btag_tc_high_eff, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_tc_high_pur", &btag_tc_high_pur, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_ssv_high_eff", &btag_tc_high_eff, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_ssv_high_pur", &btag_tc_high_pur, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_jet_probability", &btag_jet_probability, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_jet_b_probability", &btag_jet_b_probability, NULL);
+  fChain->SetBranchAddress(fPrefix + "btag_csv", &btag_csv, NULL);
+  fChain->SetBranchAddress(fPrefix + "qg_tag_mlp", &qg_tag_mlp, NULL);
+  fChain->SetBranchAddress(fPrefix + "qg_tag_likelihood", &qg_tag_likelihood, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_CHEn", &jet_CHEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_NHEn", &jet_NHEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_PhEn", &jet_PhEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_ElEn", &jet_ElEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_MuEn", &jet_MuEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_CEEn", &jet_CEEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_NEEn", &jet_NEEn, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_PhMult", &jet_PhMult, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_NHMult", &jet_NHMult, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_ElMult", &jet_ElMult, NULL);
+  fChain->SetBranchAddress(fPrefix + "jet_CHMult", &jet_CHMult, NULL);
   InitCache();
 }
 
 void JetTree::DisableUnrelatedBranches()
 {
-  fChain->SetBranchStatus("jet_area", 0);
-  fChain->SetBranchStatus("btag_tc_high_eff", 0);
-  fChain->SetBranchStatus("btag_tc_high_pur", 0);
-  fChain->SetBranchStatus("btag_ssv_high_eff", 0);
-  fChain->SetBranchStatus("btag_ssv_high_pur", 0);
-  fChain->SetBranchStatus("btag_jet_probability", 0);
-  fChain->SetBranchStatus("btag_jet_b_probability", 0);
-  fChain->SetBranchStatus("btag_csv", 0);
-  fChain->SetBranchStatus("qg_tag_mlp", 0);
-  fChain->SetBranchStatus("qg_tag_likelihood", 0);
-  fChain->SetBranchStatus("jet_CHEn", 0);
-  fChain->SetBranchStatus("jet_NHEn", 0);
-  fChain->SetBranchStatus("jet_PhEn", 0);
-  fChain->SetBranchStatus("jet_ElEn", 0);
-  fChain->SetBranchStatus("jet_MuEn", 0);
-  fChain->SetBranchStatus("jet_CEEn", 0);
-  fChain->SetBranchStatus("jet_NEEn", 0);
-  fChain->SetBranchStatus("jet_PhMult", 0);
-  fChain->SetBranchStatus("jet_NHMult", 0);
-  fChain->SetBranchStatus("jet_ElMult", 0);
-  fChain->SetBranchStatus("jet_CHMult", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_area", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_tc_high_eff", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_tc_high_pur", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_ssv_high_eff", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_ssv_high_pur", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_jet_probability", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_jet_b_probability", 0);
+  fChain->SetBranchStatus(fPrefix + "btag_csv", 0);
+  fChain->SetBranchStatus(fPrefix + "qg_tag_mlp", 0);
+  fChain->SetBranchStatus(fPrefix + "qg_tag_likelihood", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_CHEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_NHEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_PhEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_ElEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_MuEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_CEEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_NEEn", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_PhMult", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_NHMult", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_ElMult", 0);
+  fChain->SetBranchStatus(fPrefix + "jet_CHMult", 0);
 }
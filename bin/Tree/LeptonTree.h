@@ -10,26 +10,33 @@
 #include <TROOT.h>
 #include <TChain.h>
 #include <TFile.h>
+#include <TLeaf.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
 
 // Header file for the classes stored in the TTree if any.
 
-// Fixed size dimensions of array or collections stored in the TTree if any.
+// Arrays are sized for the largest number of leptons stored in the current tree, as recorded
+// by its n leaf, and grown in LoadTree() when an entry holds more leptons.
 
 class LeptonTree {
   public :
     TTree          *fChain;   //!pointer to the analyzed TTree or TChain
+    TString         fPrefix;  //!prefix of the branch names, for trees sharing a TTree
     Int_t           fCurrent; //!current Tree number in a TChain
 
     // Declaration of leaf types
-    Int_t           n;
-    Int_t           id[30];   //[n]
-    Float_t         pt[30];   //[n]
-    Float_t         px[30];   //[n]
-    Float_t         py[30];   //[n]
-    Float_t         pz[30];   //[n]
-    Float_t         eta[30];   //[n]
-    Float_t         phi[30];   //[n]
-    Int_t           charge[30];   //[n]
+    Int_t                 n;
+    std::vector<Int_t>    id;   //[n]
+    std::vector<Float_t>  pt;   //[n]
+    std::vector<Float_t>  px;   //[n]
+    std::vector<Float_t>  py;   //[n]
+    std::vector<Float_t>  pz;   //[n]
+    std::vector<Float_t>  eta;   //[n]
+    std::vector<Float_t>  phi;   //[n]
+    std::vector<Int_t>    charge;   //[n]
 
     // List of branches
     TBranch        *b_n;   //!
@@ -45,12 +52,24 @@ class LeptonTree {
     LeptonTree();
     virtual ~LeptonTree();
     virtual Int_t    GetEntry(Long64_t entry);
+    virtual Long64_t LoadTree(Long64_t entry);
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
     virtual void     InitCache();
+
+  protected:
+    // Set the address of a [n] array branch
+    template<typename T>
+      void SetArrayAddress(const char* name, std::vector<T>& array, TBranch** branch);
+
+    // Resize all the arrays to hold size leptons, and set their addresses again
+    void Reserve(Int_t size);
+
+    Int_t           fMaxN;    //!size of the arrays
+    std::vector<std::function<void()>> fArrays; //!resize and set the address of each array
 };
 
-LeptonTree::LeptonTree() : fChain(0) 
+LeptonTree::LeptonTree() : fChain(0), fCurrent(-1), n(0), fMaxN(0)
 {
 }
 
@@ -68,27 +87,84 @@ Int_t LeptonTree::GetEntry(Long64_t entry)
   if (!fChain)
     return 0;
 
+  if (LoadTree(entry) < 0)
+    return 0;
+
   return fChain->GetEntry(entry);
 }
 
-void LeptonTree::Init(TTree *tree)
+Long64_t LeptonTree::LoadTree(Long64_t entry)
+{
+  // Set the environment to read one entry, and make sure the arrays can hold it.
+  // Must be called before reading the array branches without GetEntry()
+  if (!fChain)
+    return -5;
+
+  Long64_t localEntry = fChain->LoadTree(entry);
+  if (localEntry < 0)
+    return localEntry;
+
+  if (fChain->GetTreeNumber() != fCurrent) {
+    fCurrent = fChain->GetTreeNumber();
+    TLeaf* leaf = fChain->GetLeaf(fPrefix + "n");
+    if (leaf && leaf->GetMaximum() > fMaxN)
+      Reserve(leaf->GetMaximum());
+  }
+
+  b_n->GetEntry(localEntry);
+  if (n > fMaxN)
+    Reserve(n);
+
+  return localEntry;
+}
+
+void LeptonTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (!tree)
     return;
 
   fChain = tree;
+  fPrefix = prefix;
   fChain->SetMakeClass(1);
 
-  fChain->SetBranchAddress("n", &n, &b_n);
-  fChain->SetBranchAddress("id", &id, &b_id);
-  fChain->SetBranchAddress("pt", &pt, &b_pt);
-  fChain->SetBranchAddress("px", &px, &b_px);
-  fChain->SetBranchAddress("py", &py, &b_py);
-  fChain->SetBranchAddress("pz", &pz, &b_pz);
-  fChain->SetBranchAddress("eta", &eta, &b_eta);
-  fChain->SetBranchAddress("phi", &phi, &b_phi);
-  fChain->SetBranchAddress("charge", &charge, &b_charge);
+  fChain->SetBranchAddress(fPrefix + "n", &n, &b_n);
+
+  // Only the header of the current file is read here. At least one element, so that addresses are never NULL
+  TLeaf* leaf = fChain->GetLeaf(fPrefix + "n");
+  fMaxN = std::max(1, (leaf) ? leaf->GetMaximum() : 0);
+  fCurrent = fChain->GetTreeNumber();
+  fArrays.clear();
+
+  SetArrayAddress("id", id, &b_id);
+  SetArrayAddress("pt", pt, &b_pt);
+  SetArrayAddress("px", px, &b_px);
+  SetArrayAddress("py", py, &b_py);
+  SetArrayAddress("pz", pz, &b_pz);
+  SetArrayAddress("eta", eta, &b_eta);
+  SetArrayAddress("phi", phi, &b_phi);
+  SetArrayAddress("charge", charge, &b_charge);
+}
+
+template<typename T>
+void LeptonTree::SetArrayAddress(const char* name, std::vector<T>& array, TBranch** branch)
+{
+  // The chain keeps the address when it switches files. It's set again each time the array is resized
+  TString branchName = fPrefix + name;
+  std::function<void()> setAddress = [this, branchName, &array, branch] {
+    array.resize(fMaxN, 0);
+    fChain->SetBranchAddress(branchName, &array[0], branch);
+  };
+
+  setAddress();
+  fArrays.push_back(setAddress);
+}
+
+void LeptonTree::Reserve(Int_t size)
+{
+  fMaxN = size;
+  for (const std::function<void()>& setAddress: fArrays)
+    setAddress();
 }
 
 void LeptonTree::InitCache() {
@@ -18,6 +18,7 @@
 class MiscTree {
   public :
     TTree          *fChain;   //!pointer to the analyzed TTree or TChain
+    TString         fPrefix;  //!prefix of the branch names, for trees sharing a TTree
 
     // Declaration of leaf types
     Double_t        rho;
@@ -29,7 +30,7 @@ class MiscTree {
     virtual ~MiscTree();
     virtual Int_t    GetEntry(Long64_t entry);
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
 };
 
 
@@ -52,16 +53,17 @@ Int_t MiscTree::GetEntry(Long64_t entry)
   return fChain->GetEntry(entry);
 }
 
-void MiscTree::Init(TTree *tree)
+void MiscTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (!tree)
     return;
 
   fChain = tree;
+  fPrefix = prefix;
   fChain->SetMakeClass(1);
 
-  fChain->SetBranchAddress("rho", &rho, &b_rho);
+  fChain->SetBranchAddress(fPrefix + "rho", &rho, &b_rho);
 
   //fChain->SetCacheSize(-1);
   //fChain->AddBranchToCache("*");
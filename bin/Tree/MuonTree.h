@@ -13,28 +13,28 @@
 
 // Header file for the classes stored in the TTree if any.
 
-// Fixed size dimensions of array or collections stored in the TTree if any.
+// Arrays are sized by LeptonTree, see LeptonTree::LoadTree().
 
 class MuonTree: public LeptonTree {
   public :
 
     // Declaration of leaf types
-    Float_t         relative_isolation[30];   //[n]
-    Float_t         delta_beta_relative_isolation[30];   //[n]
+    std::vector<Float_t>  relative_isolation;   //[n]
+    std::vector<Float_t>  delta_beta_relative_isolation;   //[n]
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
 };
 
-void MuonTree::Init(TTree *tree)
+void MuonTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (!tree)
     return;
 
-  LeptonTree::Init(tree);
+  LeptonTree::Init(tree, prefix);
 
-  fChain->SetBranchAddress("relative_isolation", &relative_isolation, NULL);
-  fChain->SetBranchAddress("delta_beta_relative_isolation", &relative_isolation, NULL);
+  SetArrayAddress("relative_isolation", relative_isolation, NULL);
+  SetArrayAddress("delta_beta_relative_isolation", delta_beta_relative_isolation, NULL);
 
   LeptonTree::InitCache();
 }
@@ -32,30 +32,31 @@ class PhotonTree: public BaseTree {
 
     // List of branches
     TBranch        *b_jet_area;
+    TBranch        *b_has_pixel_seed;   //!
 
-    virtual void     Init(TTree *tree);
+    virtual void     Init(TTree *tree, const TString& prefix = "");
 };
 
-void PhotonTree::Init(TTree *tree)
+void PhotonTree::Init(TTree *tree, const TString& prefix/* = ""*/)
 {
   // Set branch addresses and branch pointers
   if (! tree)
     return;
 
-  BaseTree::Init(tree);
-
-  fChain->SetBranchAddress("has_pixel_seed", &has_pixel_seed, NULL);
-  fChain->SetBranchAddress("hadTowOverEm", &hadTowOverEm, NULL);
-  fChain->SetBranchAddress("sigmaIetaIeta", &sigmaIetaIeta, NULL);
-  fChain->SetBranchAddress("rho", &rho, NULL);
-  fChain->SetBranchAddress("hasMatchedPromptElectron", &hasMatchedPromptElectron, NULL);
-  fChain->SetBranchAddress("chargedHadronsIsolation", &chargedHadronsIsolation, NULL);
-  fChain->SetBranchAddress("neutralHadronsIsolation", &neutralHadronsIsolation, NULL);
-  fChain->SetBranchAddress("photonIsolation", &photonIsolation, NULL);
-  fChain->SetBranchAddress("footprintMExCorr", &footprintMExCorr, NULL);
-  fChain->SetBranchAddress("footprintMEyCorr", &footprintMEyCorr, NULL);
-  fChain->SetBranchAddress("originalEnergy", &originalEnergy, NULL);
-  fChain->SetBranchAddress("regressionEnergy", &regressionEnergy, NULL);
+  BaseTree::Init(tree, prefix);
+
+  fChain->SetBranchAddress(fPrefix + "has_pixel_seed", &has_pixel_seed, &b_has_pixel_seed);
+  fChain->SetBranchAddress(fPrefix + "hadTowOverEm", &hadTowOverEm, NULL);
+  fChain->SetBranchAddress(fPrefix + "sigmaIetaIeta", &sigmaIetaIeta, NULL);
+  fChain->SetBranchAddress(fPrefix + "rho", &rho, NULL);
+  fChain->SetBranchAddress(fPrefix + "hasMatchedPromptElectron", &hasMatchedPromptElectron, NULL);
+  fChain->SetBranchAddress(fPrefix + "chargedHadronsIsolation", &chargedHadronsIsolation, NULL);
+  fChain->SetBranchAddress(fPrefix + "neutralHadronsIsolation", &neutralHadronsIsolation, NULL);
+  fChain->SetBranchAddress(fPrefix + "photonIsolation", &photonIsolation, NULL);
+  fChain->SetBranchAddress(fPrefix + "footprintMExCorr", &footprintMExCorr, NULL);
+  fChain->SetBranchAddress(fPrefix + "footprintMEyCorr", &footprintMEyCorr, NULL);
+  fChain->SetBranchAddress(fPrefix + "originalEnergy", &originalEnergy, NULL);
+  fChain->SetBranchAddress(fPrefix + "regressionEnergy", &regressionEnergy, NULL);
 
   BaseTree::InitCache();
 }
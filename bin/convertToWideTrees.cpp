@@ -0,0 +1,286 @@
+// Convert ntuples produced by GammaJetFilter with one tree per object to the
+// wide layout (wideTrees = True): all the event trees are merged into
+// gammaJet/events, and the trees of each jet collection into
+// gammaJet/<collection>/events. Branches are prefixed by the name of their
+// original tree (photon_pt, first_jet_raw_pt, ...), except for the analysis
+// tree whose branches keep their names.
+
+#include <TBranchElement.h>
+#include <TBranchObject.h>
+#include <TClass.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TKey.h>
+#include <TLeaf.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "tclap/CmdLine.h"
+
+#include "JetMETCorrections/GammaJetFilter/interface/OutputTree.h"
+
+const std::vector<std::string> EVENT_TREES = {"analysis", "photon", "photon_gen", "electrons", "muons"};
+const std::vector<std::string> COLLECTION_TREES = {"first_jet", "second_jet", "first_jet_raw", "second_jet_raw", "first_jet_gen", "second_jet_gen", "met", "met_raw", "met_gen", "misc"};
+
+// Branch buffers shared between the input trees and the wide tree
+class BranchBuffers {
+  public:
+    char* allocate(size_t size) {
+      mBuffers.push_back(std::vector<char>(size, 0));
+      return &mBuffers.back()[0];
+    }
+
+    // Pointer to an object. The object is allocated, and owned, by the input branch
+    void** allocateObject() {
+      mObjects.push_back(NULL);
+      return &mObjects.back();
+    }
+
+  private:
+    std::deque<std::vector<char>> mBuffers;
+    std::deque<void*> mObjects;
+};
+
+// Class of the objects stored in a branch, or NULL for leaf branches
+const char* objectClassName(TBranch* branch) {
+  if (branch->InheritsFrom(TBranchElement::Class()))
+    return static_cast<TBranchElement*>(branch)->GetClassName();
+
+  if (branch->InheritsFrom(TBranchObject::Class()))
+    return static_cast<TBranchObject*>(branch)->GetClassName();
+
+  return NULL;
+}
+
+std::string prefixFor(const std::string& treeName) {
+  return (treeName == "analysis") ? "" : treeName + "_";
+}
+
+// Leaf list of a branch in the wide tree, from the one of the input branch ('pt[n]/F' -> 'electrons_pt[electrons_n]/F')
+std::string wideLeafList(TBranch* branch, TLeaf* leaf, const std::string& prefix) {
+  std::string title = branch->GetTitle();
+  size_t slash = title.rfind('/');
+  std::string type = (slash == std::string::npos) ? "F" : title.substr(slash + 1);
+
+  std::string leafList = prefix + branch->GetName();
+  if (leaf->GetLeafCount())
+    leafList += "[" + prefix + leaf->GetLeafCount()->GetName() + "]";
+  else if (leaf->GetLenStatic() > 1)
+    leafList += "[" + std::to_string((long long) leaf->GetLenStatic()) + "]";
+
+  return leafList + "/" + type;
+}
+
+bool addBranches(TTree* input, TTree* output, const std::string& prefix, BranchBuffers& buffers) {
+  TObjArray* branches = input->GetListOfBranches();
+
+  // Object branches: ROOT allocates the objects when reading the first entry, and the wide tree needs them to exist
+  std::vector<std::pair<TBranch*, void**>> objectBranches;
+  for (int i = 0; i < branches->GetEntriesFast(); i++) {
+    TBranch* branch = static_cast<TBranch*>(branches->At(i));
+    if (! objectClassName(branch))
+      continue;
+
+    void** object = buffers.allocateObject();
+    input->SetBranchAddress(branch->GetName(), object);
+    objectBranches.push_back(std::make_pair(branch, object));
+  }
+
+  if (! objectBranches.empty())
+    input->GetEntry(0);
+
+  for (size_t i = 0; i < objectBranches.size(); i++) {
+    TBranch* branch = objectBranches[i].first;
+    if (! *objectBranches[i].second) {
+      std::cerr << "Error: can't read object branch '" << branch->GetName() << "' of tree '" << input->GetName() << "'" << std::endl;
+      return false;
+    }
+
+    output->Branch((prefix + branch->GetName()).c_str(), objectClassName(branch), objectBranches[i].second, branch->GetBasketSize(), branch->GetSplitLevel());
+  }
+
+  // Leaf branches. Counts must exist in the wide tree before the arrays using them
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < branches->GetEntriesFast(); i++) {
+      TBranch* branch = static_cast<TBranch*>(branches->At(i));
+      if (objectClassName(branch))
+        continue;
+
+      TLeaf* leaf = static_cast<TLeaf*>(branch->GetListOfLeaves()->At(0));
+      if (branch->GetListOfLeaves()->GetEntriesFast() != 1) {
+        std::cerr << "Error: branch '" << branch->GetName() << "' of tree '" << input->GetName() << "' has more than one leaf" << std::endl;
+        return false;
+      }
+
+      TLeaf* count = leaf->GetLeafCount();
+      if ((pass == 0) == (count != NULL))
+        continue;
+
+      // GetMaximum() is the largest count stored in the input tree
+      size_t length = leaf->GetLenStatic() * ((count) ? std::max(count->GetMaximum(), 1) : 1);
+      char* buffer = buffers.allocate(length * leaf->GetLenType());
+
+      input->SetBranchAddress(branch->GetName(), buffer);
+      output->Branch((prefix + branch->GetName()).c_str(), buffer, wideLeafList(branch, leaf, prefix).c_str());
+    }
+  }
+
+  return true;
+}
+
+// Merge the trees of directory 'in' named in 'treeNames' into a new 'events' tree in directory 'out'
+bool mergeTrees(TDirectory* in, const std::vector<std::string>& treeNames, TDirectory* out, int basketOptimizationEvents, BranchBuffers& buffers) {
+  out->cd();
+  TTree* output = new TTree("events", "events tree");
+  if (basketOptimizationEvents > 0)
+    output->SetAutoFlush(basketOptimizationEvents);
+
+  std::vector<TTree*> inputs;
+  for (const std::string& treeName: treeNames) {
+    TTree* input = static_cast<TTree*>(in->Get(treeName.c_str()));
+    if (! input)
+      continue;
+
+    if (! inputs.empty() && input->GetEntries() != inputs.front()->GetEntries()) {
+      std::cerr << "Error: tree '" << in->GetName() << "/" << treeName << "' has " << input->GetEntries() << " entries instead of " << inputs.front()->GetEntries() << std::endl;
+      return false;
+    }
+
+    if (! addBranches(input, output, prefixFor(treeName), buffers))
+      return false;
+
+    inputs.push_back(input);
+  }
+
+  if (inputs.empty()) {
+    std::cerr << "Error: no tree to convert in '" << in->GetName() << "'" << std::endl;
+    return false;
+  }
+
+  Long64_t entries = inputs.front()->GetEntries();
+  for (Long64_t i = 0; i < entries; i++) {
+    for (TTree* input: inputs)
+      input->GetEntry(i);
+
+    output->Fill();
+  }
+
+  out->cd();
+  output->Write("", TObject::kOverwrite);
+
+  for (TTree* input: inputs)
+    input->ResetBranchAddresses();
+
+  std::cout << in->GetName() << ": " << inputs.size() << " trees, " << output->GetNbranches() << " branches, " << entries << " entries" << std::endl;
+  return true;
+}
+
+// Copy the content of the gammaJet directory, converting the trees
+bool convert(TDirectory* in, TDirectory* out, bool isCollection, int basketOptimizationEvents) {
+  BranchBuffers buffers;
+  if (! mergeTrees(in, (isCollection) ? COLLECTION_TREES : EVENT_TREES, out, basketOptimizationEvents, buffers))
+    return false;
+
+  std::set<std::string> converted((isCollection) ? COLLECTION_TREES.begin() : EVENT_TREES.begin(), (isCollection) ? COLLECTION_TREES.end() : EVENT_TREES.end());
+
+  // Keys are sorted by decreasing cycle: only keep the first one of each name
+  std::set<std::string> done;
+  TIter next(in->GetListOfKeys());
+  while (TKey* key = static_cast<TKey*>(next())) {
+    std::string name = key->GetName();
+    if (converted.count(name) || ! done.insert(name).second)
+      continue;
+
+    TClass* cl = TClass::GetClass(key->GetClassName());
+    if (cl && cl->InheritsFrom(TDirectory::Class())) {
+      TDirectory* outDirectory = out->mkdir(name.c_str());
+      if (! convert(static_cast<TDirectory*>(key->ReadObj()), outDirectory, true, basketOptimizationEvents))
+        return false;
+    } else if (cl && cl->InheritsFrom(TTree::Class())) {
+      // Trees outside of the per-object layout, like trigger_menus, are copied as is
+      TTree* tree = static_cast<TTree*>(key->ReadObj());
+      out->cd();
+      tree->CloneTree(-1, "fast")->Write("", TObject::kOverwrite);
+    } else {
+      TObject* object = key->ReadObj();
+      out->cd();
+      object->Write(name.c_str(), TObject::kOverwrite);
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv) {
+  try {
+    TCLAP::CmdLine cmd("Convert GammaJetFilter ntuples to the wide tree layout", ' ', "0.1");
+
+    TCLAP::ValueArg<std::string> inputArg("i", "in", "Input file", true, "", "string", cmd);
+    TCLAP::ValueArg<std::string> outputArg("o", "out", "Output file", true, "", "string", cmd);
+
+    std::vector<std::string> algorithms = {"zlib", "lzma", "lz4"};
+    TCLAP::ValuesConstraint<std::string> allowedAlgorithms(algorithms);
+    TCLAP::ValueArg<std::string> compressionAlgorithmArg("", "compression-algorithm", "Compression algorithm of the output file (default: ROOT default)", false, "", &allowedAlgorithms, cmd);
+    TCLAP::ValueArg<int> compressionLevelArg("", "compression-level", "Compression level, between 0 and 9 (default: 4)", false, 4, "int", cmd);
+    TCLAP::ValueArg<int> basketOptimizationEventsArg("", "basket-optimization-events", "Optimize basket sizes after this number of events, 0 to keep ROOT default (default: 1000)", false, 1000, "int", cmd);
+
+    cmd.parse(argc, argv);
+
+    TFile* input = TFile::Open(inputArg.getValue().c_str());
+    if (! input || input->IsZombie()) {
+      std::cerr << "Error: can't open '" << inputArg.getValue() << "'" << std::endl;
+      return 1;
+    }
+
+    TDirectory* gammaJet = static_cast<TDirectory*>(input->Get("gammaJet"));
+    if (! gammaJet) {
+      std::cerr << "Error: '" << inputArg.getValue() << "' doesn't contain any gammaJet directory" << std::endl;
+      return 1;
+    }
+
+    if (gammaJet->Get("events")) {
+      std::cerr << "Error: '" << inputArg.getValue() << "' already uses the wide layout" << std::endl;
+      return 1;
+    }
+
+    TFile* output = TFile::Open(outputArg.getValue().c_str(), "recreate");
+    if (! output || output->IsZombie()) {
+      std::cerr << "Error: can't create '" << outputArg.getValue() << "'" << std::endl;
+      return 1;
+    }
+
+    if (compressionAlgorithmArg.isSet()) {
+      int compressionSettings = OutputTree::compressionSettings(compressionAlgorithmArg.getValue(), compressionLevelArg.getValue());
+      if (compressionSettings < 0) {
+        std::cerr << "Error: invalid compression level " << compressionLevelArg.getValue() << std::endl;
+        return 1;
+      }
+
+      output->SetCompressionSettings(compressionSettings);
+    }
+
+    bool success = convert(gammaJet, output->mkdir("gammaJet"), false, basketOptimizationEventsArg.getValue());
+
+    output->Close();
+    input->Close();
+
+    if (! success) {
+      remove(outputArg.getValue().c_str());
+      return 1;
+    }
+
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -5,8 +5,12 @@
 #include <TTree.h>
 #include <TParameter.h>
 #include <TH2D.h>
+#include <TThread.h>
+#include <TFileMerger.h>
 
+#include <algorithm>
 #include <fstream>
+#include <set>
 #include <sstream>
 
 #include <signal.h>
@@ -37,6 +41,10 @@
 #include "gammaJetFinalizer.h"
 #include "PUReweighter.h"
 #include "JECReader.h"
+#include "JECCorrectionGrid.h"
+#include "IncrementalManifest.h"
+
+#include "JetMETCorrections/GammaJetFilter/interface/OutputTree.h"
 
 #include <boost/regex.hpp>
 
@@ -44,11 +52,36 @@
 #define MAKE_RED "\033[31m"
 #define MAKE_BLUE "\033[34m"
 
-#define ADD_TREES true
 #define PROFILE false
 
 #define DELTAPHI_CUT (2.8)
 
+// Maximal number of events whose selection variables are read and evaluated at once.
+// Blocks also end with the file of the chain, so a block never switches files
+#define SELECTION_BLOCK_SIZE 1024
+// With --tune-cuts, the selection cuts are ordered after this number of blocks
+#define CUT_TUNING_BLOCKS 16
+
+// Binnings, as nBins, xMin, xMax, of the histograms also filled per run period
+#define NVERTEX_BINNING 50, 0., 50.
+#define PT_BINNING 200, 5., 1000.
+#define RESPONSE_BINNING 150, 0., 2.
+
+// Payloads of the external JEC
+#define JEC_PAYLOADS_FILE "jec_payloads.xml"
+// Trigger selections
+#define TRIGGERS_FILE "triggers.xml"
+#define MC_TRIGGERS_FILE "triggers_mc.xml"
+
+// Data and MC pile-up profiles of the PU reweighting
+static std::string puReweightingDirectory() {
+  const char* cmsswBase = getenv("CMSSW_BASE");
+  return TString::Format("%s/src/JetMETCorrections/GammaJetFilter/analysis/PUReweighting", cmsswBase ? cmsswBase : "").Data();
+}
+
+// Maximal relative difference allowed between batch and scalar JEC
+#define BATCH_JEC_TOLERANCE (1e-5)
+
 #define TRIGGER_OK                    0
 #define TRIGGER_NOT_FOUND            -1
 #define TRIGGER_FOUND_BUT_PT_OUT     -2
@@ -63,6 +96,13 @@ GammaJetFinalizer::GammaJetFinalizer():
   mNoPUReweighting = false;
   mIsBatchJob = false;
   mUseExternalJECCorrecion = false;
+  mJECGridTolerance = -1;
+  mWideTrees = false;
+  mTuneCuts = false;
+  mSkimCompressionSettings = -1;
+  mSkimQueueSize = 0;
+  mProcessedEvents = 0;
+  mSplitRunPeriods = false;
 }
 
 GammaJetFinalizer::~GammaJetFinalizer() {
@@ -81,25 +121,210 @@ std::string GammaJetFinalizer::buildPostfix() {
   return postfix;
 }
 
+std::string GammaJetFinalizer::outputFileName() {
+  if (! mOutputFile.empty())
+    return mOutputFile;
+
+  // PhotonJet_<dataset>_<postfix>.root
+  std::string postFix = buildPostfix();
+  return (!mIsBatchJob)
+    ? TString::Format("PhotonJet_%s_%s.root", mDatasetName.c_str(), postFix.c_str()).Data()
+    : TString::Format("PhotonJet_%s_%s_part%02d.root", mDatasetName.c_str(), postFix.c_str(), mCurrentJob).Data();
+}
+
+// Algorithm of the external JEC payloads
+std::string GammaJetFinalizer::jecJetAlgo() {
+  std::string jecJetAlgo = "AK5";
+  if (mJetType == PF)
+    jecJetAlgo += "PF";
+  else/* if (recoType == "calo")*/
+    jecJetAlgo += "Calo";
+  /*else if (recoType == "jpt")
+    jecJetAlgo += "JPT";*/
+
+  if (mJetType == PF && mUseCHS)
+    jecJetAlgo += "chs";
+
+  return jecJetAlgo;
+}
+
+std::string GammaJetFinalizer::configurationFingerprint() {
+  ConfigurationFingerprint fingerprint;
+  fingerprint.add("dataset", mDatasetName);
+  fingerprint.add("jets", buildPostfix());
+  fingerprint.add("chs", mUseCHS);
+  fingerprint.add("mc", mIsMC);
+  fingerprint.add("mc-comp", mDoMCComparison);
+  fingerprint.add("alpha", mAlphaCut);
+  fingerprint.add("uncut-trees", mUncutTrees);
+
+  // The other inputs: they can be updated in place
+  fingerprint.addFile("triggers", (mIsMC) ? MC_TRIGGERS_FILE : TRIGGERS_FILE);
+  fingerprint.add("pu-reweighting", mIsMC && ! mNoPUReweighting);
+  if (mIsMC && ! mNoPUReweighting) {
+    // The profiles used depend on the triggers and run periods of the events: all of them
+    std::vector<std::string> profiles;
+    boost::system::error_code error;
+    for (boost::filesystem::directory_iterator it(puReweightingDirectory(), error), end; ! error && it != end; it.increment(error)) {
+      if (it->path().extension() == ".root")
+        profiles.push_back(it->path().string());
+    }
+    std::sort(profiles.begin(), profiles.end());
+    for (const std::string& profile: profiles)
+      fingerprint.addFile("pu-profile", profile);
+  }
+
+  fingerprint.add("jec", mUseExternalJECCorrecion);
+  if (mUseExternalJECCorrecion) {
+    fingerprint.add("jec-grid-tolerance", mJECGridTolerance);
+
+    fingerprint.addFile("jec-payloads", JEC_PAYLOADS_FILE);
+    std::vector<std::string> payloads;
+    getJECPayloadsFromXML(JEC_PAYLOADS_FILE, jecJetAlgo(), mIsMC, payloads);
+    for (const std::string& payload: payloads)
+      fingerprint.addFile("jec-payload", payload);
+  }
+
+  for (const std::string& branch: mSkimBranches)
+    fingerprint.add("skim-branch", branch);
+
+  fingerprint.add("run-periods", mSplitRunPeriods);
+  if (mSplitRunPeriods) {
+    for (size_t i = 0; i < mRunPeriods.size(); i++) {
+      std::pair<unsigned int, unsigned int> runs = mRunPeriods.getRuns(i);
+      fingerprint.add("run-period " + mRunPeriods.getName(i), TString::Format("%u-%u", runs.first, runs.second).Data());
+    }
+  }
+
+  return fingerprint.hex();
+}
+
 void GammaJetFinalizer::loadFiles(TChain& chain) {
+  TraceSpan span("open files", "io", chain.GetName());
   for (std::vector<std::string>::const_iterator it = mInputFiles.begin(); it != mInputFiles.end(); ++it) {
     chain.Add(it->c_str());
   }
 }
 
-void GammaJetFinalizer::cloneTree(TTree* from, TTree*& to) {
-  to = from->CloneTree(0);
-  from->CopyAddresses(to);
+// Copy the variables used downstream to a skim event, and queue it for writing
+void GammaJetFinalizer::fillSkim(AsyncWriter<SkimEvent>& skimWriter, double eventWeight) {
+  TraceSpan span("fill skim", "io");
+  SkimEvent event = SkimEvent();
+
+  event.run = analysis.run;
+  event.lumi_block = analysis.lumi_block;
+  event.event = analysis.event;
+
+  event.weight = eventWeight;
+  event.generator_weight = (mIsMC) ? analysis.generator_weight : 1.;
+  event.pu_weight = (mIsMC) ? mPUWeight : 1.;
+
+  event.nvertex = analysis.nvertex;
+  event.rho = misc.rho;
+
+  event.photon_pt = photon.pt;
+  event.photon_eta = photon.eta;
+  event.photon_phi = photon.phi;
+
+  event.first_jet_pt = firstJet.pt;
+  event.first_jet_eta = firstJet.eta;
+  event.first_jet_phi = firstJet.phi;
+  event.first_jet_raw_pt = firstRawJet.pt;
+  event.second_jet_pt = secondJet.pt;
+
+  event.alpha = secondJet.pt / photon.pt;
+  event.resp_balancing = firstJet.pt / photon.pt;
+  event.resp_balancing_raw = firstRawJet.pt / photon.pt;
+  event.resp_mpf = 1. + MET.et * photon.pt * cos(reco::deltaPhi(photon.phi, MET.phi)) / (photon.pt * photon.pt);
+  event.resp_mpf_raw = 1. + rawMET.et * photon.pt * cos(reco::deltaPhi(photon.phi, rawMET.phi)) / (photon.pt * photon.pt);
+
+  event.pt_bin = mPtBinning.getPtBin(photon.pt);
+  event.eta_bin = mEtaBinning.getBin(firstJet.eta);
+
+  if (mIsMC) {
+    event.gen_photon_pt = genPhoton.pt;
+    event.first_gen_jet_pt = firstGenJet.pt;
+    event.resp_balancing_gen = firstJet.pt / firstGenJet.pt;
+    event.resp_mpf_gen = 1. + genMET.et * genPhoton.pt * cos(reco::deltaPhi(genPhoton.phi, genMET.phi)) / (genPhoton.pt * genPhoton.pt);
+  }
+
+  skimWriter.push(event);
+}
+
+// Read an entry of a tree, recorded in the trace
+template<typename Tree>
+static void getEntry(Tree& tree, uint64_t entry, const char* name) {
+  TraceSpan span(name, "io");
+  tree.GetEntry(entry);
+}
+
+// Read only some branches of an entry. The branch pointers are updated by the chain when it changes file
+static void readBranches(TTree* tree, Long64_t entry, std::initializer_list<TBranch**> branches) {
+  Long64_t localEntry = tree->LoadTree(entry);
+  for (TBranch** branch: branches)
+    (*branch)->GetEntry(localEntry);
+}
+
+// Entry following the last one of the chain's file containing entry
+static uint64_t treeEnd(TTree* chain, Long64_t entry) {
+  chain->LoadTree(entry);
+  TTree* tree = chain->GetTree();
+  return tree->GetChainOffset() + tree->GetEntries();
+}
+
+// Fill the block with the selection variables of the entries [from, to), without reading the other branches
+void GammaJetFinalizer::readSelectionBlock(uint64_t from, uint64_t to, SelectionBlock& block) {
+  TraceSpan span("read selection block", "io");
+  size_t n = to - from;
+  block.photonIsPresent.resize(n);
+  block.photonHasPixelSeed.resize(n);
+  block.photonPt.resize(n);
+  block.photonEta.resize(n);
+  block.photonPhi.resize(n);
+  block.firstJetIsPresent.resize(n);
+  block.firstJetPhi.resize(n);
+  block.muonsN.resize(n);
+  block.electronsBegin.assign(1, 0);
+  block.electronsEta.clear();
+  block.electronsPhi.clear();
+
+  for (size_t k = 0; k < n; k++) {
+    readBranches(photon.fChain, from + k, {&photon.b_is_present, &photon.b_has_pixel_seed, &photon.b_pt, &photon.b_eta, &photon.b_phi});
+    readBranches(firstJet.fChain, from + k, {&firstJet.b_is_present, &firstJet.b_phi});
+    // LoadTree() reads n, and grows the lepton arrays if needed
+    muons.LoadTree(from + k);
+    electrons.LoadTree(from + k);
+    readBranches(electrons.fChain, from + k, {&electrons.b_eta, &electrons.b_phi});
+
+    block.photonIsPresent[k] = photon.is_present;
+    block.photonHasPixelSeed[k] = photon.has_pixel_seed;
+    block.photonPt[k] = photon.pt;
+    block.photonEta[k] = photon.eta;
+    block.photonPhi[k] = photon.phi;
+    block.firstJetIsPresent[k] = firstJet.is_present;
+    block.firstJetPhi[k] = firstJet.phi;
+    block.muonsN[k] = muons.n;
+
+    block.electronsEta.insert(block.electronsEta.end(), electrons.eta.begin(), electrons.eta.begin() + electrons.n);
+    block.electronsPhi.insert(block.electronsPhi.end(), electrons.phi.begin(), electrons.phi.begin() + electrons.n);
+    block.electronsBegin.push_back(block.electronsEta.size());
+  }
 }
 
 void GammaJetFinalizer::runAnalysis() {
 
   typedef std::chrono::high_resolution_clock clock;
+
+  mProcessedEvents = 0;
+  if (mInputFiles.empty()) {
+    std::cerr << "Error: no input file to finalize" << std::endl;
+    return;
+  }
   
   if (mIsMC) {
-    mMCTriggers = new MCTriggers("triggers_mc.xml");
+    mMCTriggers = new MCTriggers(MC_TRIGGERS_FILE);
   } else {
-    mTriggers = new Triggers("triggers.xml");
+    mTriggers = new Triggers(TRIGGERS_FILE);
   }
 
   // Initialization
@@ -164,62 +389,88 @@ void GammaJetFinalizer::runAnalysis() {
   treeName = TString::Format("gammaJet/%s/misc", postFix.c_str());
   TChain miscChain(treeName);
 
-  loadFiles(analysisChain);
-  loadFiles(photonChain);
-  if (mIsMC)
-    loadFiles(genPhotonChain);
-  loadFiles(muonsChain);
-  loadFiles(electronsChain);
+  // Wide layout: all the event trees share one tree, and all the jet collection trees another one
+  TChain eventsChain("gammaJet/events");
+  treeName = TString::Format("gammaJet/%s/events", postFix.c_str());
+  TChain collectionChain(treeName);
 
-  loadFiles(firstJetChain);
-  loadFiles(firstRawJetChain);
-  if (mIsMC)
-    loadFiles(firstGenJetChain);
+  if (mWideTrees) {
+    loadFiles(eventsChain);
+    loadFiles(collectionChain);
 
-  loadFiles(secondJetChain);
-  if (mIsMC)
-    loadFiles(secondGenJetChain);
-  loadFiles(secondRawJetChain);
+    analysis.Init(&eventsChain);
+    photon.Init(&eventsChain, "photon_");
+    muons.Init(&eventsChain, "muons_");
+    electrons.Init(&eventsChain, "electrons_");
 
-  loadFiles(metChain);
-  if (mIsMC)
-    loadFiles(genMetChain);
-  loadFiles(rawMetChain);
+    firstJet.Init(&collectionChain, "first_jet_");
+    firstRawJet.Init(&collectionChain, "first_jet_raw_");
+    secondJet.Init(&collectionChain, "second_jet_");
+    secondRawJet.Init(&collectionChain, "second_jet_raw_");
 
-  loadFiles(miscChain);
+    MET.Init(&collectionChain, "met_");
+    rawMET.Init(&collectionChain, "met_raw_");
 
-  analysis.Init(&analysisChain);
-  photon.Init(&photonChain);
-  muons.Init(&muonsChain);
-  electrons.Init(&electronsChain);
+    if (mIsMC) {
+      genPhoton.Init(&eventsChain, "photon_gen_");
+      genMET.Init(&collectionChain, "met_gen_");
+      secondGenJet.Init(&collectionChain, "second_jet_gen_");
+      firstGenJet.Init(&collectionChain, "first_jet_gen_");
+    }
 
-  firstJet.Init(&firstJetChain);
-  firstRawJet.Init(&firstRawJetChain);
+    misc.Init(&collectionChain, "misc_");
+  } else {
+    loadFiles(analysisChain);
+    loadFiles(photonChain);
+    if (mIsMC)
+      loadFiles(genPhotonChain);
+    loadFiles(muonsChain);
+    loadFiles(electronsChain);
 
-#if !ADD_TREES
-  firstJet.DisableUnrelatedBranches();
-  firstRawJet.DisableUnrelatedBranches();
-#endif
+    loadFiles(firstJetChain);
+    loadFiles(firstRawJetChain);
+    if (mIsMC)
+      loadFiles(firstGenJetChain);
 
-  secondJet.Init(&secondJetChain);
-  secondRawJet.Init(&secondRawJetChain);
+    loadFiles(secondJetChain);
+    if (mIsMC)
+      loadFiles(secondGenJetChain);
+    loadFiles(secondRawJetChain);
 
-#if !ADD_TREES
-  secondJet.DisableUnrelatedBranches();
-  secondRawJet.DisableUnrelatedBranches();
-#endif
+    loadFiles(metChain);
+    if (mIsMC)
+      loadFiles(genMetChain);
+    loadFiles(rawMetChain);
 
-  MET.Init(&metChain);
-  rawMET.Init(&rawMetChain);
+    loadFiles(miscChain);
 
-  if (mIsMC) {
-    genPhoton.Init(&genPhotonChain);
-    genMET.Init(&genMetChain);
-    secondGenJet.Init(&secondGenJetChain);
-    firstGenJet.Init(&firstGenJetChain);
+    analysis.Init(&analysisChain);
+
+    photon.Init(&photonChain);
+    muons.Init(&muonsChain);
+    electrons.Init(&electronsChain);
+
+    firstJet.Init(&firstJetChain);
+    firstRawJet.Init(&firstRawJetChain);
+    secondJet.Init(&secondJetChain);
+    secondRawJet.Init(&secondRawJetChain);
+
+    MET.Init(&metChain);
+    rawMET.Init(&rawMetChain);
+
+    if (mIsMC) {
+      genPhoton.Init(&genPhotonChain);
+      genMET.Init(&genMetChain);
+      secondGenJet.Init(&secondGenJetChain);
+      firstGenJet.Init(&firstGenJetChain);
+    }
+
+    misc.Init(&miscChain);
   }
 
-  misc.Init(&miscChain);
+  TChain triggerMenusChain("gammaJet/trigger_menus");
+  loadFiles(triggerMenusChain);
+  analysis.LoadTriggerMenus(&triggerMenusChain);
 
   std::cout << "done." << std::endl;
 
@@ -231,85 +482,73 @@ void GammaJetFinalizer::runAnalysis() {
   std::cout << "##########" << std::endl << std::endl;
 
   // Output file
-  // Build output file name
-  // PhotonJet_<dataset>_<postfix>.root
-  std::string outputFile = (!mIsBatchJob)
-    ? TString::Format("PhotonJet_%s_%s.root", mDatasetName.c_str(), postFix.c_str()).Data()
-    : TString::Format("PhotonJet_%s_%s_part%02d.root", mDatasetName.c_str(), postFix.c_str(), mCurrentJob).Data();
+  std::string outputFile = outputFileName();
+  // Destroyed after the output file, and all the objects writing to it: started after the event loop, spans the writing
+  TraceSpan outputSpan("write output", "io", outputFile, false);
   fwlite::TFileService fs(outputFile);
 
-#if ADD_TREES
-  TTree* photonTree = NULL;
-  cloneTree(photon.fChain, photonTree);
-
-  TTree* genPhotonTree = NULL;
-  if (mIsMC)
-    cloneTree(genPhoton.fChain, genPhotonTree);
-
-  TTree* firstJetTree = NULL;
-  cloneTree(firstJet.fChain, firstJetTree);
-
-  TTree* firstGenJetTree = NULL;
-  if (mIsMC)
-    cloneTree(firstGenJet.fChain, firstGenJetTree);
-
-  TTree* firstRawJetTree = NULL;
-  cloneTree(firstRawJet.fChain, firstRawJetTree);
-
-  TTree* secondJetTree = NULL;
-  cloneTree(secondJet.fChain, secondJetTree);
-
-  TTree* secondGenJetTree = NULL;
-  if (mIsMC)
-    cloneTree(secondGenJet.fChain, secondGenJetTree);
-
-  TTree* secondRawJetTree = NULL;
-  cloneTree(secondRawJet.fChain, secondRawJetTree);
-
-  TTree* metTree = NULL;
-  cloneTree(MET.fChain, metTree);
-
-  TTree* rawMetTree = NULL;
-  cloneTree(rawMET.fChain, rawMetTree);
-
-  TTree* genMetTree = NULL;
-  if (mIsMC)
-    cloneTree(genMET.fChain, genMetTree);
-
-  TTree* muonsTree = NULL;
-  cloneTree(muons.fChain, muonsTree);
-
-  TTree* electronsTree = NULL;
-  cloneTree(electrons.fChain, electronsTree);
+  // Flat tree of the selected events, or of the events passing the trigger with --uncut-trees.
+  // With a queue, the skim is filled, and its baskets compressed, by a writer thread. The thread has a file of its own, so
+  // no ROOT object is shared with the event loop, and the skim is copied into the output file once the thread is done.
+  // Without queue, the skim is filled in the event loop, directly in the output file
+  std::unique_ptr<TFile> skimFile;
+  TTree* skimTree = NULL;
+  if (mSkimQueueSize > 0) {
+    TThread::Initialize();
+
+    TDirectory::TContext context(gDirectory);
+    skimFile.reset(TFile::Open((outputFile + ".skim.root").c_str(), "recreate"));
+    if (! skimFile || skimFile->IsZombie()) {
+      std::cerr << "Failed to create " << outputFile << ".skim.root for the skim writer thread" << std::endl;
+      return;
+    }
+    skimTree = new TTree("skim", "Selected events");
+  } else {
+    skimTree = fs.make<TTree>("skim", "Selected events");
+  }
 
-  TTree* analysisTree = NULL;
-  cloneTree(analysis.fChain, analysisTree);
-  analysisTree->SetName("misc");
-
-  TTree *miscTree = NULL;
-  cloneTree(misc.fChain, miscTree);
-  miscTree->SetName("rho");
-#endif
+  SkimWriter skim(skimTree, mSkimBranches, mIsMC, mSkimCompressionSettings);
+  AsyncWriter<SkimEvent> skimWriter(mSkimQueueSize, [&skim](const SkimEvent& event) { skim.Fill(event); });
 
   FactorizedJetCorrector* jetCorrector = NULL;
+  JECBatchCorrector* batchJetCorrector = NULL;
+  JECCorrectionGrid* jetCorrectionGrid = NULL;
+  JECJetBatch jecJets;
+  std::vector<float> jecCorrections;
   //void* jetCorrector = NULL;
   if (mUseExternalJECCorrecion) {
 
-    std::string jecJetAlgo = "AK5";
-    if (mJetType == PF)
-      jecJetAlgo += "PF";
-    else/* if (recoType == "calo")*/
-      jecJetAlgo += "Calo";
-    /*else if (recoType == "jpt")
-      jecJetAlgo += "JPT";*/
+    std::string jecJetAlgo = this->jecJetAlgo();
+    std::cout << "Using '" << jecJetAlgo << "' algorithm for external JEC" << std::endl;
 
-    if (mJetType == PF && mUseCHS)
-      jecJetAlgo += "chs";
+    std::vector<std::string> payloads;
+    if (getJECPayloadsFromXML(JEC_PAYLOADS_FILE, jecJetAlgo, mIsMC, payloads)) {
+      jetCorrector = makeFactorizedJetCorrector(payloads);
+      batchJetCorrector = makeJECBatchCorrector(payloads);
+    }
 
-    std::cout << "Using '" << jecJetAlgo << "' algorithm for external JEC" << std::endl;
+    if (jetCorrector && batchJetCorrector) {
+      double deviation = batchJetCorrector->maxDeviation(*jetCorrector);
+      std::cout << "Batch JEC maximal relative deviation from FactorizedJetCorrector: " << deviation << std::endl;
+
+      if (deviation > BATCH_JEC_TOLERANCE) {
+        std::cout << MAKE_RED << "Batch JEC deviation is too large, using FactorizedJetCorrector" << RESET_COLOR << std::endl;
+        delete batchJetCorrector;
+        batchJetCorrector = NULL;
+      }
+    }
+
+    if (mJECGridTolerance > 0) {
+      std::string reason = "JEC grid needs the batch JEC corrector";
+      if (batchJetCorrector && JECCorrectionGrid::canTabulate(*batchJetCorrector, reason)) {
+        jetCorrectionGrid = new JECCorrectionGrid(*batchJetCorrector);
+        jetCorrectionGrid->setTolerance(mJECGridTolerance);
 
-    const std::string payloadsFile = "jec_payloads.xml";
-    jetCorrector = makeFactorizedJetCorrectorFromXML(payloadsFile, jecJetAlgo, mIsMC);
+        std::cout << "JEC grid: " << jetCorrectionGrid->size() << " points, maximal deviation " << jetCorrectionGrid->maxDeviation() << " (tolerance: " << mJECGridTolerance << "), " << jetCorrectionGrid->exactFraction() * 100 << "% of the cells use the exact corrector" << std::endl;
+      } else {
+        std::cout << MAKE_RED << "Can't use the JEC grid: " << reason << ". Using exact corrections" << RESET_COLOR << std::endl;
+      }
+    }
   }
 
   std::cout << "Processing..." << std::endl;
@@ -320,14 +559,14 @@ void GammaJetFinalizer::runAnalysis() {
   // Init some analysis variables
   TFileDirectory analysisDir = fs.mkdir("analysis");
 
-  TH1F* h_nvertex = analysisDir.make<TH1F>("nvertex", "nvertex", 50, 0., 50.);
-  TH1F* h_nvertex_reweighted = analysisDir.make<TH1F>("nvertex_reweighted", "nvertex_reweighted", 50, 0., 50.);
+  TH1F* h_nvertex = analysisDir.make<TH1F>("nvertex", "nvertex", NVERTEX_BINNING);
+  TH1F* h_nvertex_reweighted = analysisDir.make<TH1F>("nvertex_reweighted", "nvertex_reweighted", NVERTEX_BINNING);
   TH1F* h_ntrue_interactions_reweighted = analysisDir.make<TH1F>("ntrue_interactions_reweighted", "ntrue_interactions_reweighted", 75, 0., 75.);
   TH1F* h_ntrue_interactions = analysisDir.make<TH1F>("ntrue_interactions", "ntrue_interactions", 75, 0., 75.);
 
   TH1F* h_deltaPhi = analysisDir.make<TH1F>("deltaPhi", "deltaPhi", 60, M_PI / 2, M_PI);
   TH1F* h_deltaPhi_2ndJet = analysisDir.make<TH1F>("deltaPhi_2ndjet", "deltaPhi of 2nd jet", 60, M_PI / 2., M_PI);
-  TH1F* h_ptPhoton = analysisDir.make<TH1F>("ptPhoton", "ptPhoton", 200, 5., 1000.);
+  TH1F* h_ptPhoton = analysisDir.make<TH1F>("ptPhoton", "ptPhoton", PT_BINNING);
   TH1F* h_ptFirstJet = analysisDir.make<TH1F>("ptFirstJet", "ptFirstJet", 100, 10., 1000.);
   TH1F* h_ptSecondJet = analysisDir.make<TH1F>("ptSecondJet", "ptSecondJet", 90, 10., 200.);
   TH1F* h_MET = analysisDir.make<TH1F>("MET", "MET", 150, 0., 300.);
@@ -343,8 +582,8 @@ void GammaJetFinalizer::runAnalysis() {
   TH1F* h_photonIsolation = analysisDir.make<TH1F>("photonIsolation", "photonIsolation", 100, 0, 15);
 
   TH1F* h_deltaPhi_passedID = analysisDir.make<TH1F>("deltaPhi_passedID", "deltaPhi", 40, M_PI / 2, M_PI);
-  TH1F* h_ptPhoton_passedID = analysisDir.make<TH1F>("ptPhoton_passedID", "ptPhoton", 200, 5., 1000.);
-  TH1F* h_ptFirstJet_passedID = analysisDir.make<TH1F>("ptFirstJet_passedID", "ptFirstJet", 200, 5., 1000.);
+  TH1F* h_ptPhoton_passedID = analysisDir.make<TH1F>("ptPhoton_passedID", "ptPhoton", PT_BINNING);
+  TH1F* h_ptFirstJet_passedID = analysisDir.make<TH1F>("ptFirstJet_passedID", "ptFirstJet", PT_BINNING);
   TH1F* h_ptSecondJet_passedID = analysisDir.make<TH1F>("ptSecondJet_passedID", "ptSecondJet", 45, 10., 100.);
   TH1F* h_MET_passedID = analysisDir.make<TH1F>("MET_passedID", "MET", 75, 0., 600.);
   TH1F* h_rawMET_passedID = analysisDir.make<TH1F>("rawMET_passedID", "raw MET", 75, 0., 300.);
@@ -430,7 +669,7 @@ void GammaJetFinalizer::runAnalysis() {
   std::vector<std::vector<TH1F*> > ElMult = buildEtaPtVector<TH1F>(ecompositionDir, "ElMult", 20, 0, 20);
   std::vector<std::vector<TH1F*> > PhMult = buildEtaPtVector<TH1F>(ecompositionDir, "PhMult", 20, 0, 20);
 //check Nvtx vs ptphoton
-  std::vector<std::vector<TH1F*> > Nvertices = buildEtaPtVector<TH1F>(ecompositionDir, "Nvertices", 50, 0., 50.);
+  std::vector<std::vector<TH1F*> > Nvertices = buildEtaPtVector<TH1F>(ecompositionDir, "Nvertices", NVERTEX_BINNING);
 
 //
   std::vector<TH1F*> h_ptPhotonBinned_passedID = buildPtVector<TH1F>(analysisDir, "ptPhoton_passedID", 100, -1, -1);
@@ -447,61 +686,61 @@ void GammaJetFinalizer::runAnalysis() {
 
   // Balancing
   TFileDirectory balancingDir = analysisDir.mkdir("balancing");
-  std::vector<std::vector<TH1F*> > responseBalancing = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing", 150, 0., 2.);
-  std::vector<std::vector<TH1F*> > responseBalancingRaw = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_raw", 150, 0., 2.);
+  std::vector<std::vector<TH1F*> > responseBalancing = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing", RESPONSE_BINNING);
+  std::vector<std::vector<TH1F*> > responseBalancingRaw = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_raw", RESPONSE_BINNING);
   std::vector<std::vector<TH1F*> > responseBalancingGen;
   std::vector<std::vector<TH1F*> > responseBalancingRawGen;
   if (mIsMC) {
-    responseBalancingGen = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_gen", 150, 0., 2.);
-    responseBalancingRawGen = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_raw_gen", 150, 0., 2.);
+    responseBalancingGen = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_gen", RESPONSE_BINNING);
+    responseBalancingRawGen = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_raw_gen", RESPONSE_BINNING);
   }
 
-  std::vector<TH1F*> responseBalancingEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing", "eta013", 150, 0., 2.);
-  std::vector<TH1F*> responseBalancingRawEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_raw", "eta013", 150, 0., 2.);
+  std::vector<TH1F*> responseBalancingEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing", "eta013", RESPONSE_BINNING);
+  std::vector<TH1F*> responseBalancingRawEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_raw", "eta013", RESPONSE_BINNING);
   std::vector<TH1F*> responseBalancingGenEta013;
   std::vector<TH1F*> responseBalancingRawGenEta013;
   if (mIsMC) {
-    responseBalancingGenEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_gen", "eta013", 150, 0., 2.);
-    responseBalancingRawGenEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_raw_gen", "eta013", 150, 0., 2.);
+    responseBalancingGenEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_gen", "eta013", RESPONSE_BINNING);
+    responseBalancingRawGenEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_raw_gen", "eta013", RESPONSE_BINNING);
   }
-  std::vector<TH1F*> responseBalancingEta024 = buildPtVector<TH1F>(balancingDir, "resp_balancing", "eta024", 150, 0., 2.);
+  std::vector<TH1F*> responseBalancingEta024 = buildPtVector<TH1F>(balancingDir, "resp_balancing", "eta024", RESPONSE_BINNING);
 
   // MPF
   TFileDirectory mpfDir = analysisDir.mkdir("mpf");
-  std::vector<std::vector<TH1F*> > responseMPF = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf", 150, 0., 2.);
-  std::vector<std::vector<TH1F*> > responseMPFRaw = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf_raw", 150, 0., 2.);
+  std::vector<std::vector<TH1F*> > responseMPF = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf", RESPONSE_BINNING);
+  std::vector<std::vector<TH1F*> > responseMPFRaw = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf_raw", RESPONSE_BINNING);
   std::vector<std::vector<TH1F*> > responseMPFGen;
   if (mIsMC) {
     responseMPFGen = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf_gen", 150, 0., 5.);
   }
 
-  std::vector<TH1F*> responseMPFEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf", "eta013", 150, 0., 2.);
-  std::vector<TH1F*> responseMPFRawEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf_raw", "eta013", 150, 0., 2.);
+  std::vector<TH1F*> responseMPFEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf", "eta013", RESPONSE_BINNING);
+  std::vector<TH1F*> responseMPFRawEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf_raw", "eta013", RESPONSE_BINNING);
   std::vector<TH1F*> responseMPFGenEta013;
   if (mIsMC) {
-    responseMPFGenEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf_gen", "eta013", 150, 0., 2.);
+    responseMPFGenEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf_gen", "eta013", RESPONSE_BINNING);
   }
-  std::vector<TH1F*> responseMPFEta024 = buildPtVector<TH1F>(mpfDir, "resp_mpf", "eta024", 150, 0., 2.);
+  std::vector<TH1F*> responseMPFEta024 = buildPtVector<TH1F>(mpfDir, "resp_mpf", "eta024", RESPONSE_BINNING);
 
   TFileDirectory trueDir = analysisDir.mkdir("trueresp");
   std::vector<std::vector<TH1F*> > responseTrue;
   std::vector<std::vector<TH1F*> > responsePLI;
   if (mIsMC) {
-  responseTrue = buildEtaPtVector<TH1F>(trueDir, "true_resp", 150, 0., 2.);
-  responsePLI = buildEtaPtVector<TH1F>(trueDir, "pli", 150, 0., 2.);
+  responseTrue = buildEtaPtVector<TH1F>(trueDir, "true_resp", RESPONSE_BINNING);
+  responsePLI = buildEtaPtVector<TH1F>(trueDir, "pli", RESPONSE_BINNING);
 }
  
  // vs number of vertices
   TFileDirectory vertexDir = analysisDir.mkdir("vertex");
-  std::vector<std::vector<TH1F*>> vertex_responseBalancing = buildEtaVertexVector<TH1F>(vertexDir, "resp_balancing", 150, 0., 2.);
-  std::vector<std::vector<TH1F*>> vertex_responseBalancingRaw = buildEtaVertexVector<TH1F>(vertexDir, "resp_balancing_raw", 150, 0., 2.);
-  std::vector<TH1F*> vertex_responseBalancingEta013 = buildVertexVector<TH1F>(vertexDir, "resp_balancing", "eta013", 150, 0., 2.);
-  std::vector<TH1F*> vertex_responseBalancingRawEta013 = buildVertexVector<TH1F>(vertexDir, "resp_balancing_raw", "eta013", 150, 0., 2.);
-
-  std::vector<std::vector<TH1F*>> vertex_responseMPF = buildEtaVertexVector<TH1F>(vertexDir, "resp_mpf", 150, 0., 2.);
-  std::vector<std::vector<TH1F*>> vertex_responseMPFRaw = buildEtaVertexVector<TH1F>(vertexDir, "resp_mpf_raw", 150, 0., 2.);
-  std::vector<TH1F*> vertex_responseMPFEta013 = buildVertexVector<TH1F>(vertexDir, "resp_mpf", "eta013", 150, 0., 2.);
-  std::vector<TH1F*> vertex_responseMPFRawEta013 = buildVertexVector<TH1F>(vertexDir, "resp_mpf_raw", "eta013", 150, 0., 2.);
+  std::vector<std::vector<TH1F*>> vertex_responseBalancing = buildEtaVertexVector<TH1F>(vertexDir, "resp_balancing", RESPONSE_BINNING);
+  std::vector<std::vector<TH1F*>> vertex_responseBalancingRaw = buildEtaVertexVector<TH1F>(vertexDir, "resp_balancing_raw", RESPONSE_BINNING);
+  std::vector<TH1F*> vertex_responseBalancingEta013 = buildVertexVector<TH1F>(vertexDir, "resp_balancing", "eta013", RESPONSE_BINNING);
+  std::vector<TH1F*> vertex_responseBalancingRawEta013 = buildVertexVector<TH1F>(vertexDir, "resp_balancing_raw", "eta013", RESPONSE_BINNING);
+
+  std::vector<std::vector<TH1F*>> vertex_responseMPF = buildEtaVertexVector<TH1F>(vertexDir, "resp_mpf", RESPONSE_BINNING);
+  std::vector<std::vector<TH1F*>> vertex_responseMPFRaw = buildEtaVertexVector<TH1F>(vertexDir, "resp_mpf_raw", RESPONSE_BINNING);
+  std::vector<TH1F*> vertex_responseMPFEta013 = buildVertexVector<TH1F>(vertexDir, "resp_mpf", "eta013", RESPONSE_BINNING);
+  std::vector<TH1F*> vertex_responseMPFRawEta013 = buildVertexVector<TH1F>(vertexDir, "resp_mpf_raw", "eta013", RESPONSE_BINNING);
 //
   std::vector<TH1F*> vertex_DeltapT = buildVertexVector<TH1F>(vertexDir, "vertex_DeltapT", "eta013", 100, -50., 50.);
 
@@ -570,29 +809,72 @@ void GammaJetFinalizer::runAnalysis() {
   // Luminosity
   if (! mIsMC) {
     // For data, there's only one file, so open it in order to read the luminosity
+    TraceSpan span("open luminosity file", "io");
     TFile* f = TFile::Open(mInputFiles[0].c_str());
     analysisDir.make<TParameter<double>>("luminosity", static_cast<TParameter<double>*>(f->Get("gammaJet/total_luminosity"))->GetVal());
     f->Close();
     delete f;
   }
 
-  // Store alpha cut
-  analysisDir.make<TParameter<double>>("alpha_cut", mAlphaCut);
+  // Store alpha cut. Merged outputs (hadd, --incremental) all use the same cut: keep it instead of summing
+  analysisDir.make<TParameter<double>>("alpha_cut", mAlphaCut)->SetMergeMode('M');
 
-  uint64_t totalEvents = photonChain.GetEntries();
+  // Run period histograms, filled in the same pass
+  std::vector<RunPeriodHistograms> runPeriodHistograms;
+  if (mSplitRunPeriods) {
+    TFileDirectory runPeriodsDir = fs.mkdir("run_periods");
+    for (size_t j = 0; j < mRunPeriods.size(); j++)
+      runPeriodHistograms.push_back(buildRunPeriodHistograms(runPeriodsDir.mkdir(mRunPeriods.getName(j)), j));
+  }
+
+  uint64_t totalEvents = photon.fChain->GetEntries();
   uint64_t passedEvents = 0;
   uint64_t passedEventsFromTriggers = 0;
   uint64_t rejectedEventsFromTriggers = 0;
   uint64_t rejectedEventsTriggerNotFound = 0;
   uint64_t rejectedEventsPtOut = 0;
 
-  uint64_t passedPhotonJetCut = 0;
-  uint64_t passedDeltaPhiCut = 0;
-  uint64_t passedPixelSeedVetoCut = 0;
-  uint64_t passedMuonsCut = 0;
-  uint64_t passedElectronsCut = 0;
   uint64_t passedAlphaCut = 0;
 
+  // Event selection, evaluated on blocks of events before reading them.
+  // The photon/jet cut is applied before the trigger, the other cuts after it
+  CutFlow<SelectionBlock> preselection;
+  preselection.add("photon/jet", 2, [](const SelectionBlock& block, size_t k) {
+      return block.photonIsPresent[k] && block.firstJetIsPresent[k];
+  });
+
+  CutFlow<SelectionBlock> selection;
+  // The photon is good from previous step
+  // From previous step, we have fabs(deltaPhi(photon, firstJet)) > PI/2
+  selection.add("Δφ", 20, [](const SelectionBlock& block, size_t k) {
+      return fabs(reco::deltaPhi(block.photonPhi[k], block.firstJetPhi[k])) >= DELTAPHI_CUT;
+  });
+
+  selection.add("pixel seed veto", 1, [](const SelectionBlock& block, size_t k) {
+      return ! block.photonHasPixelSeed[k];
+  });
+
+  selection.add("muons", 1, [](const SelectionBlock& block, size_t k) {
+      return block.muonsN[k] == 0;
+  });
+
+  // Electron veto. No electron close to the photon
+  selection.add("electrons", 50, [](const SelectionBlock& block, size_t k) {
+      for (uint32_t j = block.electronsBegin[k]; j < block.electronsBegin[k + 1]; j++) {
+        double deltaR = fabs(reco::deltaR(block.photonEta[k], block.photonPhi[k], block.electronsEta[j], block.electronsPhi[j]));
+        if (deltaR < 0.13)
+          return false;
+      }
+      return true;
+  });
+
+  if (mDoMCComparison) {
+    // Lowest unprescaled trigger for 2012 if at 150 GeV
+    selection.add("photon pT > 200 GeV", 1, [](const SelectionBlock& block, size_t k) {
+        return block.photonPt[k] >= 200.;
+    });
+  }
+
   uint64_t from = 0;
   uint64_t to = totalEvents;
 
@@ -605,6 +887,16 @@ void GammaJetFinalizer::runAnalysis() {
     std::cout << "Batch mode: running from " << from << " (included) to " << to << " (excluded)" << std::endl;
   }
 
+  SelectionBlock selectionBlock;
+  std::vector<uint32_t> selectedEvents;
+  std::vector<uint8_t> preselectionFailedAt;
+  std::vector<uint8_t> selectionFailedAt;
+  uint64_t blockStart = from;
+  uint64_t blockEnd = from;
+  uint64_t blocks = 0;
+  // First event counted in the selection counters, which restart when --tune-cuts changes the order of the cuts
+  uint64_t selectionCountedFrom = from;
+
   clock::time_point start = clock::now();
 
 #if PROFILE
@@ -626,33 +918,98 @@ void GammaJetFinalizer::runAnalysis() {
       break;
     }
 
+    if (i == blockEnd) {
+      // Blocks are always recorded, whatever the sampled events
+      TraceRecorder::instance().clearEvent();
+
+      if (mTuneCuts && blocks == CUT_TUNING_BLOCKS) {
+        std::cout << "Cut flow of the first " << (i - from) << " events:";
+        for (size_t j = 0; j < selection.size(); j++)
+          std::cout << " " << selection.name(j) << " (" << (double) selection.passed(j) / (i - from) * 100 << "%)";
+        std::cout << std::endl;
+
+        if (selection.tune())
+          selectionCountedFrom = i;
+
+        std::cout << "Selection cuts order:";
+        for (size_t j = 0; j < selection.size(); j++)
+          std::cout << " " << selection.name(j) << " (" << selection.cost(j) << " ns, " << selection.rejection(j) * 100 << "% rejected)";
+        std::cout << std::endl;
+      }
+
+      blockStart = i;
+      // All the chains have the same files, so the photon one gives the file boundaries
+      blockEnd = std::min(std::min(to, i + SELECTION_BLOCK_SIZE), treeEnd(photon.fChain, i));
+      readSelectionBlock(blockStart, blockEnd, selectionBlock);
+
+      selectedEvents.resize(selectionBlock.size());
+      for (size_t k = 0; k < selectedEvents.size(); k++)
+        selectedEvents[k] = k;
+      preselectionFailedAt.resize(selectionBlock.size());
+      selectionFailedAt.resize(selectionBlock.size());
+
+      TraceSpan span("evaluate selection", "selection");
+      preselection.evaluate(selectionBlock, selectedEvents, preselectionFailedAt);
+      selection.evaluate(selectionBlock, selectedEvents, selectionFailedAt);
+      blocks++;
+    }
+
+    TraceRecorder::instance().setEvent(i);
+    TraceSpan eventSpan("event", "event");
+
+    size_t k = i - blockStart;
+    if (! preselection.count(preselectionFailedAt[k]))
+      continue;
+
+    // Events failing the selection are only needed for the trigger counters and the uncut trees
+    bool readEvent = (selectionFailedAt[k] == selection.size()) || mUncutTrees;
+
 #if PROFILE
     auto fooA = clock::now();
 #endif
 
-    analysis.GetEntry(i);
-    photon.GetEntry(i);
-    if (mIsMC)
-      genPhoton.GetEntry(i);
-    muons.GetEntry(i);
-    electrons.GetEntry(i);
+    // The lepton arrays of the shared events tree are grown by their readers before the entry is read
+    if (mWideTrees) {
+      muons.LoadTree(i);
+      electrons.LoadTree(i);
+    }
 
-    firstJet.GetEntry(i);
-    firstRawJet.GetEntry(i);
-    if (mIsMC)
-      firstGenJet.GetEntry(i);
+    if (! readEvent) {
+      if (mWideTrees) {
+        getEntry(eventsChain, i, "GetEntry events");
+      } else {
+        getEntry(analysis, i, "GetEntry analysis");
+        getEntry(photon, i, "GetEntry photon");
+      }
+    } else if (mWideTrees) {
+      // Each tree is shared by several readers: read it only once
+      getEntry(eventsChain, i, "GetEntry events");
+      getEntry(collectionChain, i, "GetEntry collection");
+    } else {
+      getEntry(analysis, i, "GetEntry analysis");
+      getEntry(photon, i, "GetEntry photon");
+      if (mIsMC)
+        getEntry(genPhoton, i, "GetEntry genPhoton");
+      getEntry(muons, i, "GetEntry muons");
+      getEntry(electrons, i, "GetEntry electrons");
 
-    secondJet.GetEntry(i);
-    secondRawJet.GetEntry(i);
-    if (mIsMC)
-      secondGenJet.GetEntry(i);
+      getEntry(firstJet, i, "GetEntry firstJet");
+      getEntry(firstRawJet, i, "GetEntry firstRawJet");
+      if (mIsMC)
+        getEntry(firstGenJet, i, "GetEntry firstGenJet");
 
-    MET.GetEntry(i);
-    if (mIsMC)
-      genMET.GetEntry(i);
-    rawMET.GetEntry(i);
+      getEntry(secondJet, i, "GetEntry secondJet");
+      getEntry(secondRawJet, i, "GetEntry secondRawJet");
+      if (mIsMC)
+        getEntry(secondGenJet, i, "GetEntry secondGenJet");
+
+      getEntry(MET, i, "GetEntry MET");
+      if (mIsMC)
+        getEntry(genMET, i, "GetEntry genMET");
+      getEntry(rawMET, i, "GetEntry rawMET");
 
-    misc.GetEntry(i);
+      getEntry(misc, i, "GetEntry misc");
+    }
 
 #if PROFILE
     auto fooB = clock::now();
@@ -665,11 +1022,6 @@ void GammaJetFinalizer::runAnalysis() {
     }
 #endif
 
-    if (! photon.is_present || ! firstJet.is_present)
-      continue;
-
-    passedPhotonJetCut++;
-
     /*
     {
       // DEBUG
@@ -678,7 +1030,21 @@ void GammaJetFinalizer::runAnalysis() {
     }
     */
 
-    if (jetCorrector) {
+    if (readEvent && batchJetCorrector) {
+      TraceSpan span("JEC", "jec");
+      // Correct both raw jets in one go
+      jecJets.clear();
+      jecJets.push_back(firstRawJet.eta, firstRawJet.pt, misc.rho, firstRawJet.jet_area, analysis.nvertex);
+      jecJets.push_back(secondRawJet.eta, secondRawJet.pt, misc.rho, secondRawJet.jet_area, analysis.nvertex);
+      if (jetCorrectionGrid)
+        jetCorrectionGrid->getCorrections(jecJets, jecCorrections);
+      else
+        batchJetCorrector->getCorrections(jecJets, jecCorrections);
+
+      firstJet.pt = firstRawJet.pt * jecCorrections[0];
+      secondJet.pt = secondRawJet.pt * jecCorrections[1];
+    } else if (readEvent && jetCorrector) {
+      TraceSpan span("JEC", "jec");
       // jetCorrector isn't null. Correct raw jet with jetCorrector and rebuild the corrected jet
       jetCorrector->setJetEta(firstRawJet.eta);
       jetCorrector->setJetPt(firstRawJet.pt);
@@ -711,10 +1077,10 @@ void GammaJetFinalizer::runAnalysis() {
         case TRIGGER_NOT_FOUND:
           if (mVerbose) {
             std::cout << MAKE_RED << "[Run #" << analysis.run << ", pT: " << photon.pt << "] Event does not pass required trigger. List of passed triggers: " << RESET_COLOR << std::endl;
-            size_t size = analysis.trigger_names->size();
-            for (size_t i = 0; i < size; i++) {
-              if (analysis.trigger_results->at(i)) {
-                std::cout << "\t" << analysis.trigger_names->at(i) << std::endl;
+            const std::vector<std::string>& triggerNames = analysis.GetTriggerNames();
+            for (size_t i = 0; i < triggerNames.size(); i++) {
+              if (analysis.GetTriggerResult(i)) {
+                std::cout << "\t" << triggerNames[i] << std::endl;
               }
             }
           }
@@ -732,10 +1098,10 @@ void GammaJetFinalizer::runAnalysis() {
           //if (contains250) {
           if (mVerbose) {
             std::cout << MAKE_RED << "[Run #" << analysis.run << ", pT: " << photon.pt << "] Event does pass required trigger, but pT is out of range. List of passed triggers: " << RESET_COLOR << std::endl;
-            size_t size = analysis.trigger_names->size();
-            for (size_t i = 0; i < size; i++) {
-              if (analysis.trigger_results->at(i)) {
-                std::cout << "\t" << analysis.trigger_names->at(i) <<  std::endl;
+            const std::vector<std::string>& triggerNames = analysis.GetTriggerNames();
+            for (size_t i = 0; i < triggerNames.size(); i++) {
+              if (analysis.GetTriggerResult(i)) {
+                std::cout << "\t" << triggerNames[i] <<  std::endl;
               }
             }
           }
@@ -753,10 +1119,8 @@ void GammaJetFinalizer::runAnalysis() {
     
     if (mIsMC) {
 
-     int run_period=0;
-      if (analysis.run>190456 && analysis.run<196531) run_period=1;
-      if (analysis.run>198022 && analysis.run<203742) run_period=2;
-      if (analysis.run>203768 && analysis.run<208686) run_period=3;
+      // 0 outside of the RD periods, then 1 for RDAB, 2 for RDC and 3 for RDD
+      int run_period = mPileupRunPeriods.getPeriod(analysis.run) + 1;
 
       cleanTriggerName(passedTrigger);
 //new RD PU reweighting
@@ -784,78 +1148,30 @@ void GammaJetFinalizer::runAnalysis() {
     if (generatorWeight == 0.)
       generatorWeight = 1.;
     double eventWeight = (mIsMC) ? mPUWeight * analysis.event_weight * generatorWeight : triggerWeight;
-#if ADD_TREES
-    double oldAnalysisWeight = analysis.event_weight;
-    analysis.event_weight = eventWeight;
-#endif
 
 #if PROFILE
     fooA = clock::now();
 #endif
 
-#if ADD_TREES
-    if (mUncutTrees) {
-      photonTree->Fill();
-      if (mIsMC)
-        genPhotonTree->Fill();
-      firstJetTree->Fill();
-      if (mIsMC)
-        firstGenJetTree->Fill();
-      firstRawJetTree->Fill();
-      secondJetTree->Fill();
-      if (mIsMC)
-        secondGenJetTree->Fill();
-      secondRawJetTree->Fill();
-      metTree->Fill();
-      rawMetTree->Fill();
-      if (mIsMC)
-        genMetTree->Fill();
-      electronsTree->Fill();
-      muonsTree->Fill();
-      analysisTree->Fill();
-      miscTree->Fill();
-    }
-#endif
-
-
-    // Event selection
-    // The photon is good from previous step
-    // From previous step, we have fabs(deltaPhi(photon, firstJet)) > PI/2
-    double deltaPhi = fabs(reco::deltaPhi(photon.phi, firstJet.phi));
-
-    bool isBack2Back = (deltaPhi >= DELTAPHI_CUT);
-    if (! isBack2Back) {
-      continue;
-    }
-
-    passedDeltaPhiCut++;
-
-    // Pixel seed veto
-    if (photon.has_pixel_seed)
-      continue;
+    if (mUncutTrees)
+      fillSkim(skimWriter, eventWeight);
 
-    passedPixelSeedVetoCut++;
 
-    // No muons
-    if (muons.n != 0)
+    // Event selection, evaluated with the block
+    if (! selection.count(selectionFailedAt[k]))
       continue;
 
-    passedMuonsCut++;
+    // Until the end of the event
+    TraceSpan fillSpan("fill histograms", "histograms");
 
-    // Electron veto. No electron close to the photon
-    bool keepEvent = true;
-    for (int j = 0; j < electrons.n; j++) {
-      double deltaR = fabs(reco::deltaR(photon.eta, photon.phi, electrons.eta[j], electrons.phi[j]));
-      if (deltaR < 0.13) {
-        keepEvent = false;
-        break;
-      }
+    RunPeriodHistograms* periodHistograms = NULL;
+    if (mSplitRunPeriods) {
+      int period = mRunPeriods.getPeriod(analysis.run);
+      if (period >= 0)
+        periodHistograms = &runPeriodHistograms[period];
     }
 
-    if (! keepEvent)
-      continue;
-
-    passedElectronsCut++;
+    double deltaPhi = fabs(reco::deltaPhi(photon.phi, firstJet.phi));
 
     /*
     if (firstJet.pt < 12)
@@ -865,24 +1181,15 @@ void GammaJetFinalizer::runAnalysis() {
     //bool secondJetOK = !secondJet.is_present || (secondJet.pt < mAlphaCut * photon.pt);
     bool secondJetOK = !secondJet.is_present || (secondJet.pt < 10 || secondJet.pt < mAlphaCut * photon.pt);
 
-    if (mDoMCComparison) {
-      // Lowest unprescaled trigger for 2012 if at 150 GeV
-      if (photon.pt < 200.)
-        continue;
-    }
-
     if (secondJetOK)
       passedAlphaCut++;
 
-#if ADD_TREES
-    h_nvertex->Fill(analysis.nvertex, oldAnalysisWeight);
-    h_ntrue_interactions->Fill(analysis.ntrue_interactions, oldAnalysisWeight);
-#else
     h_nvertex->Fill(analysis.nvertex, analysis.event_weight);
     h_ntrue_interactions->Fill(analysis.ntrue_interactions, analysis.event_weight);
-#endif
 
     h_nvertex_reweighted->Fill(analysis.nvertex, eventWeight);
+    if (periodHistograms)
+      periodHistograms->h_nvertex_reweighted->Fill(analysis.nvertex, eventWeight);
     h_ntrue_interactions_reweighted->Fill(analysis.ntrue_interactions, eventWeight);
 
     double deltaPhi_2ndJet = fabs(reco::deltaPhi(secondJet.phi, photon.phi));
@@ -1071,6 +1378,8 @@ float vparGen=0.;
       do {
         h_deltaPhi_passedID->Fill(deltaPhi, eventWeight);
         h_ptPhoton_passedID->Fill(photon.pt, eventWeight);
+        if (periodHistograms)
+          periodHistograms->h_ptPhoton_passedID->Fill(photon.pt, eventWeight);
         h_ptFirstJet_passedID->Fill(firstJet.pt, eventWeight);
         h_ptSecondJet_passedID->Fill(secondJet.pt, eventWeight);
         h_MET_passedID->Fill(MET.et, eventWeight);
@@ -1130,6 +1439,13 @@ float vparGen=0.;
           responseMPFEta013[ptBin]->Fill(respMPF, eventWeight);
           responseMPFRawEta013[ptBin]->Fill(respMPFRaw, eventWeight);
 
+          if (periodHistograms) {
+            periodHistograms->responseBalancingEta013[ptBin]->Fill(respBalancing, eventWeight);
+            periodHistograms->responseBalancingRawEta013[ptBin]->Fill(respBalancingRaw, eventWeight);
+            periodHistograms->responseMPFEta013[ptBin]->Fill(respMPF, eventWeight);
+            periodHistograms->responseMPFRawEta013[ptBin]->Fill(respMPFRaw, eventWeight);
+          }
+
           if (vertexBin >= 0) {
             vertex_responseBalancingEta013[vertexBin]->Fill(respBalancing, eventWeight);
             vertex_responseBalancingRawEta013[vertexBin]->Fill(respBalancingRaw, eventWeight);
@@ -1241,6 +1557,13 @@ float vparGen=0.;
         responseMPF[etaBin][ptBin]->Fill(respMPF, eventWeight);
         responseMPFRaw[etaBin][ptBin]->Fill(respMPFRaw, eventWeight);
 
+        if (periodHistograms) {
+          periodHistograms->responseBalancing[etaBin][ptBin]->Fill(respBalancing, eventWeight);
+          periodHistograms->responseBalancingRaw[etaBin][ptBin]->Fill(respBalancingRaw, eventWeight);
+          periodHistograms->responseMPF[etaBin][ptBin]->Fill(respMPF, eventWeight);
+          periodHistograms->responseMPFRaw[etaBin][ptBin]->Fill(respMPFRaw, eventWeight);
+        }
+
         if (vertexBin >= 0) {
           vertex_responseBalancing[etaBin][vertexBin]->Fill(respBalancing, eventWeight);
           vertex_responseBalancingRaw[etaBin][vertexBin]->Fill(respBalancingRaw, eventWeight);
@@ -1258,29 +1581,8 @@ float vparGen=0.;
         }
       } while (false);
 
-#if ADD_TREES
-      if (! mUncutTrees) {
-        photonTree->Fill();
-        if (mIsMC)
-          genPhotonTree->Fill();
-        firstJetTree->Fill();
-        if (mIsMC)
-          firstGenJetTree->Fill();
-        firstRawJetTree->Fill();
-        secondJetTree->Fill();
-        if (mIsMC)
-          secondGenJetTree->Fill();
-        secondRawJetTree->Fill();
-        metTree->Fill();
-        rawMetTree->Fill();
-        if (mIsMC)
-          genMetTree->Fill();
-        electronsTree->Fill();
-        muonsTree->Fill();
-        analysisTree->Fill();
-        miscTree->Fill();
-      }
-#endif
+      if (! mUncutTrees)
+        fillSkim(skimWriter, eventWeight);
 
       passedEvents++;
     }
@@ -1298,18 +1600,58 @@ float vparGen=0.;
 
   }
 
+  TraceRecorder::instance().clearEvent();
+  mProcessedEvents = to - from;
+
+  {
+    TraceSpan span("wait for skim writer", "io");
+    skimWriter.close();
+  }
+
+  const AsyncWriter<SkimEvent>::Stats& skimStats = skimWriter.stats();
+  if (skimFile) {
+    // The baskets are copied as they are, without being decompressed
+    TraceSpan span("copy skim", "io");
+    skimTree->Write();
+
+    TDirectory::TContext context(fs.getBareDirectory());
+    TTree* outputSkimTree = skimTree->CloneTree(-1, "fast");
+    outputSkimTree->ResetBranchAddresses();
+
+    std::string skimFileName = skimFile->GetName();
+    skimFile->Close();
+    skimFile.reset();
+    boost::filesystem::remove(skimFileName);
+
+    analysisDir.make<TParameter<long long>>("skim_writer_records", skimStats.records);
+    // Maxima over the jobs, once merged
+    analysisDir.make<TParameter<long long>>("skim_writer_max_queue_depth", skimStats.maxDepth)->SetMergeMode('M');
+    analysisDir.make<TParameter<double>>("skim_writer_mean_queue_depth", skimStats.meanDepth)->SetMergeMode('M');
+    analysisDir.make<TParameter<long long>>("skim_writer_stalls", skimStats.stalls);
+    analysisDir.make<TParameter<double>>("skim_writer_stall_time", skimStats.stallTime);
+  }
+
   std::cout << "Selection efficiency: " << MAKE_RED << (double) passedEvents / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
-  std::cout << "Efficiency for photon/jet cut: " << MAKE_RED << (double) passedPhotonJetCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
+  for (size_t j = 0; j < preselection.size(); j++)
+    std::cout << "Efficiency for " << preselection.name(j) << " cut: " << MAKE_RED << (double) preselection.passed(j) / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
   std::cout << "Selection efficiency for trigger selection: " << MAKE_RED << (double) passedEventsFromTriggers / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
-  std::cout << "Efficiency for Δφ cut: " << MAKE_RED << (double) passedDeltaPhiCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
-  std::cout << "Efficiency for pixel seed veto cut: " << MAKE_RED << (double) passedPixelSeedVetoCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
-  std::cout << "Efficiency for muons cut: " << MAKE_RED << (double) passedMuonsCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
-  std::cout << "Efficiency for electrons cut: " << MAKE_RED << (double) passedElectronsCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
+  if (selectionCountedFrom != from)
+    std::cout << "Cut flow of the " << (to - selectionCountedFrom) << " events after the tuning of the cuts:" << std::endl;
+  for (size_t j = 0; j < selection.size(); j++)
+    std::cout << "Efficiency for " << selection.name(j) << " cut: " << MAKE_RED << (double) selection.passed(j) / (to - selectionCountedFrom) * 100 << "%" << RESET_COLOR << " (" << selection.cost(j) << " ns per event)" << std::endl;
   std::cout << "Efficiency for α cut: " << MAKE_RED << (double) passedAlphaCut / (to - from) * 100 << "%" << RESET_COLOR << std::endl;
 
   std::cout << std::endl;
   std::cout << "Rejected events because trigger was not found: " << MAKE_RED << (double) rejectedEventsTriggerNotFound / (rejectedEventsFromTriggers) * 100 << "%" << RESET_COLOR << std::endl;
   std::cout << "Rejected events because trigger was found but pT was out of range: " << MAKE_RED << (double) rejectedEventsPtOut / (rejectedEventsFromTriggers) * 100 << "%" << RESET_COLOR << std::endl;
+
+  if (mSkimQueueSize > 0) {
+    std::cout << std::endl;
+    std::cout << "Skim writer: " << skimStats.records << " events, queue depth " << skimStats.meanDepth << " on average (max. " << skimStats.maxDepth << " / " << mSkimQueueSize << "), ";
+    std::cout << MAKE_RED << skimStats.stalls << RESET_COLOR << " stalls (" << skimStats.stallTime << " ms)" << std::endl;
+  }
+
+  outputSpan.start();
 }
 
 template<typename T>
@@ -1360,6 +1702,33 @@ std::vector<std::vector<T*> > GammaJetFinalizer::buildEtaPtVector(TFileDirectory
   return etaBinning;
 }
 
+// Same names and layout as the main histograms, in dir
+RunPeriodHistograms GammaJetFinalizer::buildRunPeriodHistograms(TFileDirectory dir, int period) {
+  // Merged outputs keep the run range
+  std::pair<unsigned int, unsigned int> runs = mRunPeriods.getRuns(period);
+  dir.make<TParameter<long long>>("first_run", runs.first)->SetMergeMode('m');
+  dir.make<TParameter<long long>>("last_run", runs.second)->SetMergeMode('M');
+
+  RunPeriodHistograms histograms;
+  TFileDirectory analysisDir = dir.mkdir("analysis");
+  histograms.h_nvertex_reweighted = analysisDir.make<TH1F>("nvertex_reweighted", "nvertex_reweighted", NVERTEX_BINNING);
+  histograms.h_ptPhoton_passedID = analysisDir.make<TH1F>("ptPhoton_passedID", "ptPhoton", PT_BINNING);
+
+  TFileDirectory balancingDir = analysisDir.mkdir("balancing");
+  histograms.responseBalancing = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing", RESPONSE_BINNING);
+  histograms.responseBalancingRaw = buildEtaPtVector<TH1F>(balancingDir, "resp_balancing_raw", RESPONSE_BINNING);
+  histograms.responseBalancingEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing", "eta013", RESPONSE_BINNING);
+  histograms.responseBalancingRawEta013 = buildPtVector<TH1F>(balancingDir, "resp_balancing_raw", "eta013", RESPONSE_BINNING);
+
+  TFileDirectory mpfDir = analysisDir.mkdir("mpf");
+  histograms.responseMPF = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf", RESPONSE_BINNING);
+  histograms.responseMPFRaw = buildEtaPtVector<TH1F>(mpfDir, "resp_mpf_raw", RESPONSE_BINNING);
+  histograms.responseMPFEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf", "eta013", RESPONSE_BINNING);
+  histograms.responseMPFRawEta013 = buildPtVector<TH1F>(mpfDir, "resp_mpf_raw", "eta013", RESPONSE_BINNING);
+
+  return histograms;
+}
+
 template<typename T>
 std::vector<T*> GammaJetFinalizer::buildVertexVector(TFileDirectory dir, const std::string& branchName, const std::string& etaName, int nBins, double xMin, double xMax) {
 
@@ -1470,8 +1839,8 @@ void GammaJetFinalizer::cleanTriggerName(std::string& trigger) {
 
 // // new PU reweighting RD
 void GammaJetFinalizer::computePUWeight(const std::string& passedTrigger, int run_period) {
-  static std::string cmsswBase = getenv("CMSSW_BASE");
-  static std::string puPrefix = TString::Format("%s/src/JetMETCorrections/GammaJetFilter/analysis/PUReweighting", cmsswBase.c_str()).Data();
+  TraceSpan span("PU weight", "weights");
+  static std::string puPrefix = puReweightingDirectory();
 //  static std::string puMC = TString::Format("%s/summer12_computed_mc_%s_pu_truth_75bins.root", puPrefix.c_str(), mDatasetName.c_str()).Data();
   std::string puData = TString::Format("%s/pu_truth_data_photon_2012_true_%s_75bins.root", puPrefix.c_str(), passedTrigger.c_str()).Data();
   std::string puMC = TString::Format("%s/", puPrefix.c_str()).Data();
@@ -1541,6 +1910,7 @@ void GammaJetFinalizer::computePUWeight(const std::string& passedTrigger) {
 
 
 void GammaJetFinalizer::checkInputFiles() {
+  mEmptyInputFiles.clear();
   for (std::vector<std::string>::iterator it = mInputFiles.begin(); it != mInputFiles.end();) {
     TFile* f = TFile::Open(it->c_str());
     if (! f) {
@@ -1549,9 +1919,15 @@ void GammaJetFinalizer::checkInputFiles() {
       continue;
     }
 
-    TTree* analysis = static_cast<TTree*>(f->Get("gammaJet/analysis"));
+    // All the files must use the same layout as the first one
+    TTree* wideTree = static_cast<TTree*>(f->Get("gammaJet/events"));
+    if (it == mInputFiles.begin())
+      mWideTrees = (wideTree != NULL);
+
+    TTree* analysis = (mWideTrees) ? wideTree : static_cast<TTree*>(f->Get("gammaJet/analysis"));
     if (! analysis || analysis->GetEntry(0) == 0) {
       std::cerr << "Error: Trees inside '" << it->c_str() << "' were empty. Removed from input files." << std::endl;
+      mEmptyInputFiles.push_back(*it);
       it = mInputFiles.erase(it);
 
       f->Close();
@@ -1569,6 +1945,8 @@ void GammaJetFinalizer::checkInputFiles() {
 
 int GammaJetFinalizer::checkTrigger(std::string& passedTrigger, float& weight) {
 
+  TraceSpan span("trigger", "trigger");
+
   if (! mIsMC) {
     const PathVector& mandatoryTriggers = mTriggers->getTriggers(analysis.run);
 
@@ -1591,15 +1969,38 @@ int GammaJetFinalizer::checkTrigger(std::string& passedTrigger, float& weight) {
     weight = mandatoryTrigger->second.weight;
 
     // This photon must pass mandatoryTrigger.first
-    size_t size = analysis.trigger_names->size();
-    for (int i = size - 1; i >= 0; i--) {
-      bool passed = analysis.trigger_results->at(i);
-      if (! passed)
-        continue;
+    const std::vector<std::string>& triggerNames = analysis.GetTriggerNames();
+    if (analysis.HasTriggerMenus()) {
+      // Paths matching mandatoryTrigger only depend on the trigger menu, look for them once per menu
+      std::pair<ULong64_t, const PathData*> key(analysis.trigger_menu_id, mandatoryTrigger);
+      std::map<std::pair<ULong64_t, const PathData*>, std::vector<size_t>>::const_iterator it = mTriggerPathIndexes.find(key);
+      if (it == mTriggerPathIndexes.end()) {
+        std::vector<size_t> indexes;
+        for (size_t i = 0; i < triggerNames.size(); i++) {
+          if (boost::regex_match(triggerNames[i], mandatoryTrigger->first))
+            indexes.push_back(i);
+        }
 
-      if (boost::regex_match(analysis.trigger_names->at(i), mandatoryTrigger->first)) {
-        passedTrigger = mandatoryTrigger->first.str();
-        return TRIGGER_OK;
+        it = mTriggerPathIndexes.insert(std::make_pair(key, indexes)).first;
+      }
+
+      for (size_t index: it->second) {
+        if (analysis.GetTriggerResult(index)) {
+          passedTrigger = mandatoryTrigger->first.str();
+          return TRIGGER_OK;
+        }
+      }
+    } else {
+      size_t size = triggerNames.size();
+      for (int i = size - 1; i >= 0; i--) {
+        bool passed = analysis.GetTriggerResult(i);
+        if (! passed)
+          continue;
+
+        if (boost::regex_match(triggerNames[i], mandatoryTrigger->first)) {
+          passedTrigger = mandatoryTrigger->first.str();
+          return TRIGGER_OK;
+        }
       }
     }
   } else {
@@ -1618,6 +2019,7 @@ int GammaJetFinalizer::checkTrigger(std::string& passedTrigger, float& weight) {
     weight = 1;
 
     if (mandatoryTrigger->size() > 1) {
+      mRandomGenerator.SetStream(analysis.run, analysis.lumi_block, analysis.event, PhiloxRandom::MC_TRIGGER);
       double random = mRandomGenerator.Rndm();
 
       double weight_low = 0;
@@ -1681,6 +2083,181 @@ std::vector<std::string> readInputFiles(const std::string& list) {
   return files;
 }
 
+// Finalize the new or changed input files into partial outputs in 'directory', then merge the partial outputs into the
+// output file. A refresh thus only processes the new events. When files were only added, only their partial outputs are
+// merged into the existing output; the output is rebuilt from all the partial outputs when a file changed or was removed
+int runIncremental(const std::string& directory, const std::vector<std::string>& files, const std::function<void(GammaJetFinalizer&)>& configure) {
+  boost::filesystem::create_directories(directory);
+
+  std::string manifestFile = directory + "/manifest.txt";
+  IncrementalManifest manifest;
+  if (! manifest.load(manifestFile)) {
+    std::cerr << "Error: can't parse manifest '" << manifestFile << "'" << std::endl;
+    return 1;
+  }
+
+  GammaJetFinalizer output;
+  configure(output);
+  std::string outputFile = output.outputFileName();
+
+  // With other options, none of the partial outputs can be reused
+  std::string configuration = output.configurationFingerprint();
+  std::vector<IncrementalManifest::Entry> outdated = manifest.configure(configuration);
+  if (! outdated.empty())
+    std::cout << "Configuration changed: all the files are finalized again" << std::endl;
+  for (const IncrementalManifest::Entry& entry: outdated) {
+    if (! entry.partial.empty())
+      boost::filesystem::remove(entry.partial);
+  }
+
+  // The events of a changed, removed or outdated file have to be removed from the output
+  bool rebuild = ! outdated.empty() || ! boost::filesystem::exists(outputFile);
+
+  size_t finalizedFiles = 0;
+  std::set<std::string> finalized;
+  for (const std::string& file: files) {
+    IncrementalManifest::Entry entry;
+    if (! IncrementalManifest::describe(file, entry)) {
+      std::cerr << "Error: can't access '" << file << "'. Its previous partial output, if any, is kept." << std::endl;
+      continue;
+    }
+
+    if (manifest.upToDate(entry))
+      continue;
+
+    std::map<std::string, IncrementalManifest::Entry>::const_iterator previous = manifest.entries().find(file);
+    if (previous != manifest.entries().end() && previous->second.merged && ! previous->second.partial.empty())
+      rebuild = true;
+    finalized.insert(file);
+
+    std::cout << "Finalizing new or changed file " << MAKE_BLUE << file << RESET_COLOR << std::endl;
+    entry.partial = directory + "/" + IncrementalManifest::partialOutputName(file, configuration);
+    boost::filesystem::remove(entry.partial);
+
+    GammaJetFinalizer finalizer;
+    finalizer.setInputFiles(std::vector<std::string>(1, file));
+    if (finalizer.inputFiles().empty()) {
+      if (finalizer.emptyInputFiles().empty()) {
+        std::cerr << "Error: can't open '" << file << "'. It is finalized again on the next run." << std::endl;
+        continue;
+      }
+
+      // Nothing to finalize: recorded without partial output, so it's skipped until it changes
+      entry.partial.clear();
+      manifest.update(entry);
+      if (! manifest.save(manifestFile)) {
+        std::cerr << "Error: can't write manifest '" << manifestFile << "'" << std::endl;
+        return 1;
+      }
+      finalizedFiles++;
+      continue;
+    }
+
+    configure(finalizer);
+    finalizer.setOutputFile(entry.partial);
+    finalizer.runAnalysis();
+
+    if (EXIT) {
+      // Incomplete: finalized again on the next run
+      boost::filesystem::remove(entry.partial);
+      return 1;
+    }
+
+    if (! boost::filesystem::exists(entry.partial)) {
+      std::cerr << "Error: failed to finalize '" << file << "'" << std::endl;
+      return 1;
+    }
+
+    entry.entries = finalizer.processedEvents();
+    manifest.update(entry);
+    if (! manifest.save(manifestFile)) {
+      std::cerr << "Error: can't write manifest '" << manifestFile << "'" << std::endl;
+      return 1;
+    }
+    finalizedFiles++;
+  }
+
+  std::vector<IncrementalManifest::Entry> removed = manifest.retain(files);
+  for (const IncrementalManifest::Entry& entry: removed) {
+    std::cout << "Removing the output of " << entry.file << ", not in the input files anymore" << std::endl;
+    if (! entry.partial.empty())
+      boost::filesystem::remove(entry.partial);
+    if (entry.merged && ! entry.partial.empty())
+      rebuild = true;
+  }
+  if (! manifest.save(manifestFile)) {
+    std::cerr << "Error: can't write manifest '" << manifestFile << "'" << std::endl;
+    return 1;
+  }
+
+  uint64_t totalEvents = 0;
+  for (const auto& it: manifest.entries())
+    totalEvents += it.second.entries;
+
+  std::cout << finalizedFiles << " file(s) finalized, " << manifest.entries().size() - finalizedFiles << " up to date (" << totalEvents << " events in total)" << std::endl;
+
+  // Empty input files have no partial output
+  std::vector<std::string> partials;
+  std::vector<std::string> unmerged;
+  for (const auto& it: manifest.entries()) {
+    const IncrementalManifest::Entry& entry = it.second;
+    if (entry.partial.empty())
+      continue;
+
+    partials.push_back(entry.partial);
+    if (! entry.merged) {
+      unmerged.push_back(entry.partial);
+      // Finalized by an earlier run, but maybe already in the output: not known for manifests without merged column
+      if (finalized.count(entry.file) == 0)
+        rebuild = true;
+    }
+  }
+
+  if (! rebuild && unmerged.empty()) {
+    std::cout << outputFile << " is up to date" << std::endl;
+    return 0;
+  }
+
+  if (partials.empty()) {
+    std::cerr << "Warning: all the input files are empty, no output written" << std::endl;
+    boost::filesystem::remove(outputFile);
+    return 0;
+  }
+
+  // Merged into a temporary file first, so a failed merge keeps the previous output
+  TraceSpan span("merge partial outputs", "io", outputFile);
+  std::string temporary = outputFile + ".merging.root";
+  {
+    TFileMerger merger(kFALSE);
+    merger.OutputFile(temporary.c_str(), kTRUE);
+    if (rebuild) {
+      for (const std::string& partial: partials)
+        merger.AddFile(partial.c_str(), kFALSE);
+    } else {
+      std::cout << "Merging " << unmerged.size() << " new partial output(s) into the existing output" << std::endl;
+      merger.AddFile(outputFile.c_str(), kFALSE);
+      for (const std::string& partial: unmerged)
+        merger.AddFile(partial.c_str(), kFALSE);
+    }
+
+    if (! merger.Merge()) {
+      std::cerr << "Error: failed to merge the partial outputs into '" << outputFile << "'" << std::endl;
+      boost::filesystem::remove(temporary);
+      return 1;
+    }
+  }
+  boost::filesystem::rename(temporary, outputFile);
+
+  manifest.setMerged();
+  if (! manifest.save(manifestFile)) {
+    std::cerr << "Error: can't write manifest '" << manifestFile << "'" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Partial outputs merged into " << MAKE_RED << outputFile << RESET_COLOR << std::endl;
+  return 0;
+}
+
 void handleCtrlC(int s){
   EXIT = true;
 }
@@ -1724,12 +2301,26 @@ int main(int argc, char** argv) {
 
     TCLAP::SwitchArg mcComparisonArg("", "mc-comp", "Cut photon pt to avoid trigger prescale issues", cmd);
     TCLAP::SwitchArg externalJECArg("", "jec", "Use external JEC", cmd);
+    TCLAP::ValueArg<float> jecGridToleranceArg("", "jec-grid-tolerance", "With --jec, use a precomputed correction grid where it differs from the exact correction factor by less than this value (default: disabled)", false, -1, "float", cmd);
 
     TCLAP::ValueArg<float> alphaCutArg("", "alpha", "P_t^{second jet} / p_t^{photon} cut (default: 0.2)", false, 0.2, "float", cmd);
 
     TCLAP::SwitchArg chsArg("", "chs", "Use CHS branches", cmd);
     TCLAP::SwitchArg verboseArg("v", "verbose", "Enable verbose mode", cmd);
-    TCLAP::SwitchArg uncutTreesArg("", "uncut-trees", "Fill trees before second jet cut", cmd);
+    TCLAP::SwitchArg uncutTreesArg("", "uncut-trees", "Fill the skim tree with all the events passing the trigger, before the selection", cmd);
+    TCLAP::ValueArg<std::string> skimBranchesArg("", "skim-branches", "Comma separated list of the branches of the skim tree (default: all)", false, "", "string", cmd);
+
+    std::vector<std::string> compressionAlgorithms = {"zlib", "lzma", "lz4"};
+    TCLAP::ValuesConstraint<std::string> allowedCompressionAlgorithms(compressionAlgorithms);
+    TCLAP::ValueArg<std::string> skimCompressionAlgorithmArg("", "skim-compression-algorithm", "Compression algorithm of the skim tree (default: zlib)", false, "zlib", &allowedCompressionAlgorithms, cmd);
+    TCLAP::ValueArg<int> skimCompressionLevelArg("", "skim-compression-level", "Compression level of the skim tree, between 0 and 9 (default: 1)", false, 1, "int", cmd);
+    TCLAP::ValueArg<int> skimQueueSizeArg("", "skim-queue-size", "Number of events queued for the skim writer thread, which fills the skim in a file of its own. 0 to fill the skim in the event loop (default: 4096)", false, 4096, "int", cmd);
+    TCLAP::ValueArg<std::string> traceArg("", "trace", "Write a Chrome trace-event timeline of the job to this JSON file", false, "", "string", cmd);
+    TCLAP::ValueArg<int> traceSamplingArg("", "trace-sampling", "With --trace, record the spans of one event out of this number (default: 100)", false, 100, "int", cmd);
+    TCLAP::ValueArg<std::string> incrementalArg("", "incremental", "Finalize each input file into a partial output kept in this directory, with a manifest. Only new or changed files, or all of them if the options changed, are finalized again, and the partial outputs are merged into the output file", false, "", "string", cmd);
+    TCLAP::SwitchArg splitRunPeriodsArg("", "split-run-periods", "Also fill the response histograms of each 2012 run period (RDAB, RDC, RDD) in run_periods/<period>", cmd);
+    TCLAP::ValueArg<std::string> runPeriodsArg("", "run-periods", "Like --split-run-periods, with the run periods of this file: one '<name> <first run> <last run>' per line, with unique names and non-overlapping runs", false, "", "string", cmd);
+    TCLAP::SwitchArg tuneCutsArg("", "tune-cuts", "Order the selection cuts by their measured cost and rejection. The cut flow of the events before and after the new order are reported separately", cmd);
 
     cmd.parse(argc, argv);
 
@@ -1745,22 +2336,79 @@ int main(int argc, char** argv) {
       files = readInputFiles(inputListArg.getValue());
     }
 
-    GammaJetFinalizer finalizer;
-    finalizer.setInputFiles(files);
-    finalizer.setDatasetName(datasetArg.getValue());
-    finalizer.setJetAlgo(typeArg.getValue(), algoArg.getValue());
-    finalizer.setMC(mcArg.getValue());
-    finalizer.setMCComparison(mcComparisonArg.getValue());
-    finalizer.setUseExternalJEC(externalJECArg.getValue());
-    finalizer.setAlphaCut(alphaCutArg.getValue());
-    finalizer.setCHS(chsArg.getValue());
-    finalizer.setVerbose(verboseArg.getValue());
-    finalizer.setUncutTrees(uncutTreesArg.getValue());
-    if (totalJobsArg.isSet() && currentJobArg.isSet()) {
-      finalizer.setBatchJob(currentJobArg.getValue(), totalJobsArg.getValue());
+    std::vector<std::string> skimBranches;
+    if (! skimBranchesArg.getValue().empty())
+      boost::split(skimBranches, skimBranchesArg.getValue(), boost::is_any_of(","));
+    std::string unknownBranch = SkimWriter::unknownVariable(skimBranches);
+    if (! unknownBranch.empty()) {
+      std::cerr << "Error: unknown skim branch '" << unknownBranch << "'" << std::endl;
+      return 1;
     }
 
-    finalizer.runAnalysis();
+    int skimCompressionSettings = OutputTree::compressionSettings(skimCompressionAlgorithmArg.getValue(), skimCompressionLevelArg.getValue());
+    if (skimCompressionSettings < 0) {
+      std::cerr << "Error: invalid compression level " << skimCompressionLevelArg.getValue() << std::endl;
+      return 1;
+    }
+
+    RunPeriods runPeriods;
+    std::string runPeriodsError;
+    if (runPeriodsArg.isSet() && ! runPeriods.load(runPeriodsArg.getValue(), runPeriodsError)) {
+      std::cerr << "Error: can't read run periods from '" << runPeriodsArg.getValue() << "': " << runPeriodsError << std::endl;
+      return 1;
+    }
+
+    bool isBatchJob = totalJobsArg.isSet() && currentJobArg.isSet();
+    if (isBatchJob && incrementalArg.isSet()) {
+      std::cerr << "Error: --incremental can't be used with --num-jobs / --job" << std::endl;
+      return 1;
+    }
+
+    // Everything but the input files
+    auto configure = [&](GammaJetFinalizer& finalizer) {
+      finalizer.setDatasetName(datasetArg.getValue());
+      finalizer.setJetAlgo(typeArg.getValue(), algoArg.getValue());
+      finalizer.setMC(mcArg.getValue());
+      finalizer.setMCComparison(mcComparisonArg.getValue());
+      finalizer.setUseExternalJEC(externalJECArg.getValue());
+      finalizer.setJECGridTolerance(jecGridToleranceArg.getValue());
+      finalizer.setAlphaCut(alphaCutArg.getValue());
+      finalizer.setCHS(chsArg.getValue());
+      finalizer.setVerbose(verboseArg.getValue());
+      finalizer.setUncutTrees(uncutTreesArg.getValue());
+      finalizer.setTuneCuts(tuneCutsArg.getValue());
+      finalizer.setSkimBranches(skimBranches);
+      finalizer.setSkimCompressionSettings(skimCompressionSettings);
+      finalizer.setSkimQueueSize(std::max(skimQueueSizeArg.getValue(), 0));
+      if (splitRunPeriodsArg.getValue() || runPeriodsArg.isSet()) {
+        finalizer.setRunPeriods(runPeriods);
+      }
+      if (isBatchJob) {
+        finalizer.setBatchJob(currentJobArg.getValue(), totalJobsArg.getValue());
+      }
+    };
+
+    if (traceArg.isSet())
+      TraceRecorder::instance().enable(traceArg.getValue(), std::max(traceSamplingArg.getValue(), 1));
+
+    int status = 0;
+    if (incrementalArg.isSet()) {
+      status = runIncremental(incrementalArg.getValue(), files, configure);
+    } else {
+      GammaJetFinalizer finalizer;
+      finalizer.setInputFiles(files);
+      configure(finalizer);
+      finalizer.runAnalysis();
+    }
+
+    if (traceArg.isSet()) {
+      if (TraceRecorder::instance().write())
+        std::cout << "Trace written to " << traceArg.getValue() << std::endl;
+      else
+        std::cerr << "Failed to write trace to " << traceArg.getValue() << std::endl;
+    }
+
+    return status;
 
   } catch (TCLAP::ArgException &e) {
     std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <TRandom3.h>
+#include "JetMETCorrections/GammaJetFilter/interface/PhiloxRandom.h"
 
 #include "Tree/AnalysisTree.h"
 #include "Tree/PhotonTree.h"
@@ -18,6 +18,11 @@
 #include "newExtrapBinning.h"
 #include "triggers.h"
 #include "GaussianProfile.h"
+#include "CutFlow.h"
+#include "TraceRecorder.h"
+#include "SkimWriter.h"
+#include "AsyncWriter.h"
+#include "runPeriods.h"
 
 #include <vector>
 #include <memory>
@@ -38,6 +43,7 @@ namespace edm {
 
 class TTree;
 class TChain;
+class TH1F;
 class TFileDirectory;
 
 enum JetAlgo {
@@ -56,6 +62,45 @@ struct ExtrapolationVectors {
 };
 
 
+// Variables of the event selection for a block of consecutive entries, one array per variable
+struct SelectionBlock {
+  std::vector<char> photonIsPresent;
+  std::vector<char> photonHasPixelSeed;
+  std::vector<float> photonPt;
+  std::vector<float> photonEta;
+  std::vector<float> photonPhi;
+
+  std::vector<char> firstJetIsPresent;
+  std::vector<float> firstJetPhi;
+
+  std::vector<int> muonsN;
+
+  // Electrons of the k-th event are [electronsBegin[k], electronsBegin[k + 1]), electronsBegin has size() + 1 elements
+  std::vector<uint32_t> electronsBegin;
+  std::vector<float> electronsEta;
+  std::vector<float> electronsPhi;
+
+  size_t size() const {
+    return photonPt.size();
+  }
+};
+
+// Copy of the main response histograms, filled with the events of one run period only
+struct RunPeriodHistograms {
+  TH1F* h_nvertex_reweighted;
+  TH1F* h_ptPhoton_passedID;
+
+  std::vector<std::vector<TH1F*> > responseBalancing;
+  std::vector<std::vector<TH1F*> > responseBalancingRaw;
+  std::vector<TH1F*> responseBalancingEta013;
+  std::vector<TH1F*> responseBalancingRawEta013;
+
+  std::vector<std::vector<TH1F*> > responseMPF;
+  std::vector<std::vector<TH1F*> > responseMPFRaw;
+  std::vector<TH1F*> responseMPFEta013;
+  std::vector<TH1F*> responseMPFRawEta013;
+};
+
 class PUReweighter;
 
 class GammaJetFinalizer
@@ -69,6 +114,16 @@ class GammaJetFinalizer
       checkInputFiles();
     }
 
+    // Input files which can be finalized, after setInputFiles()
+    const std::vector<std::string>& inputFiles() const {
+      return mInputFiles;
+    }
+
+    // Input files removed by setInputFiles() because their trees are empty
+    const std::vector<std::string>& emptyInputFiles() const {
+      return mEmptyInputFiles;
+    }
+
     void setDatasetName(const std::string& name) {
       mDatasetName = name;
     }
@@ -99,6 +154,10 @@ class GammaJetFinalizer
       mUseExternalJECCorrecion = useExternalJEC;
     }
 
+    void setJECGridTolerance(float tolerance) {
+      mJECGridTolerance = tolerance;
+    }
+
     void setBatchJob(int currentJob, int totalJobs) {
       mIsBatchJob = true;
       mCurrentJob = currentJob;
@@ -121,11 +180,52 @@ class GammaJetFinalizer
       mUncutTrees = uncutTrees;
     }
 
+    void setTuneCuts(bool tuneCuts) {
+      mTuneCuts = tuneCuts;
+    }
+
+    // Branches of the skim tree, all if empty
+    void setSkimBranches(const std::vector<std::string>& branches) {
+      mSkimBranches = branches;
+    }
+
+    // See OutputTree::compressionSettings
+    void setSkimCompressionSettings(int settings) {
+      mSkimCompressionSettings = settings;
+    }
+
+    // Number of skim events queued for the writer thread, which fills the skim in a file of its own. 0 to fill the skim in the event loop
+    void setSkimQueueSize(size_t size) {
+      mSkimQueueSize = size;
+    }
+
+    // Also fill the response histograms of each run period, in run_periods/<period name>
+    void setRunPeriods(const RunPeriods& periods) {
+      mSplitRunPeriods = true;
+      mRunPeriods = periods;
+    }
+
+    // Output file, instead of PhotonJet_<dataset>_<postfix>.root
+    void setOutputFile(const std::string& outputFile) {
+      mOutputFile = outputFile;
+    }
+
+    std::string outputFileName();
+
+    // Hash of the options changing the output, see ConfigurationFingerprint
+    std::string configurationFingerprint();
+
+    // Number of events processed by the last runAnalysis()
+    uint64_t processedEvents() const {
+      return mProcessedEvents;
+    }
+
     void runAnalysis();
 
   private:
     void checkInputFiles();
     void loadFiles(TChain& chain);
+    void readSelectionBlock(uint64_t from, uint64_t to, SelectionBlock& block);
 
     //bool passTrigger(const TRegexp& regexp) const;
     int checkTrigger(std::string& passedTrigger, float& weight);
@@ -151,12 +251,15 @@ class GammaJetFinalizer
     template<typename T>
       std::vector<std::vector<T*> > buildExtrapolationVector(TFileDirectory dir, const std::string& branchName, const std::string& etaName, int nBins, double xMin, double xMax);
 
+    RunPeriodHistograms buildRunPeriodHistograms(TFileDirectory dir, int period);
+
     std::shared_ptr<GaussianProfile> buildNewExtrapolationVector(TFileDirectory dir, const std::string& branchName, const std::string& etaName, int nBins, double xMin, double xMax);
     std::vector<std::shared_ptr<GaussianProfile>> buildNewExtrapolationEtaVector(TFileDirectory dir, const std::string& branchName, int nBins, double xMin, double xMax);
 
-    void cloneTree(TTree* from, TTree*& to);
+    void fillSkim(AsyncWriter<SkimEvent>& skimWriter, double eventWeight);
 
     std::string buildPostfix();
+    std::string jecJetAlgo();
 
     // Datas from step 2
     AnalysisTree analysis;
@@ -184,8 +287,11 @@ class GammaJetFinalizer
     VertexBinning mVertexBinning;
     ExtrapBinning mExtrapBinning;
     NewExtrapBinning mNewExtrapBinning;
+    // Periods of the run dependent PU profiles
+    RunPeriods mPileupRunPeriods;
 
     std::vector<std::string> mInputFiles;
+    std::vector<std::string> mEmptyInputFiles;
     std::string mDatasetName;
     JetType mJetType;
     JetAlgo mJetAlgo;
@@ -195,12 +301,24 @@ class GammaJetFinalizer
     int mTotalJobs;
     int mCurrentJob;
     bool mUseExternalJECCorrecion;
+    float mJECGridTolerance;
 
     float  mAlphaCut;
     bool   mDoMCComparison;
     bool   mUseCHS;
     bool   mVerbose;
     bool   mUncutTrees;
+    // Order the selection cuts by their measured cost and rejection
+    bool   mTuneCuts;
+    // Input files use the wide layout: gammaJet/events, and gammaJet/<collection>/events, with prefixed branches
+    bool   mWideTrees;
+    std::vector<std::string> mSkimBranches;
+    int    mSkimCompressionSettings;
+    size_t mSkimQueueSize;
+    std::string mOutputFile;
+    uint64_t mProcessedEvents;
+    bool   mSplitRunPeriods;
+    RunPeriods mRunPeriods;
 
 //new RD PU rweighting
     std::map<std::pair<std::string,int>, boost::shared_ptr<PUReweighter>> mLumiReweighting;
@@ -225,5 +343,8 @@ class GammaJetFinalizer
     // Triggers on data
     Triggers* mTriggers;
     MCTriggers* mMCTriggers;
-    TRandom3 mRandomGenerator;
+    // Indexes of the paths matching a trigger selection, for each trigger menu
+    std::map<std::pair<ULong64_t, const PathData*>, std::vector<size_t>> mTriggerPathIndexes;
+    // Keyed on the event, so the emulated trigger does not depend on the job splitting
+    PhiloxRandom mRandomGenerator;
 };
@@ -74,7 +74,12 @@ void listTriggers() {
 
   std::cout << "Opening files ..." << std::endl;
 
-  TChain analysisChain("gammaJet/analysis");
+  // In the wide layout, analysis branches are stored without prefix in the events tree
+  TFile* f = TFile::Open(mInputFiles[0].c_str());
+  bool wideTrees = (f && f->Get("gammaJet/events"));
+  delete f;
+
+  TChain analysisChain((wideTrees) ? "gammaJet/events" : "gammaJet/analysis");
 /*  TChain photonChain("gammaJet/photon");
   TChain genPhotonChain("gammaJet/photon_gen");
   TChain muonsChain("gammaJet/muons");
@@ -127,6 +132,14 @@ void listTriggers() {
 */
 
   analysis.Init(&analysisChain);
+
+  TChain triggerMenusChain("gammaJet/trigger_menus");
+  loadFiles(triggerMenusChain);
+  analysis.LoadTriggerMenus(&triggerMenusChain);
+
+  // With trigger menus, count passed paths per menu and only look at names at the end
+  std::map<std::pair<ULong64_t, size_t>, int64_t> passedPaths;
+
 /*  photon.Init(&photonChain);
   genPhoton.Init(&genPhotonChain);
   muons.Init(&muonsChain);
@@ -185,6 +198,18 @@ void listTriggers() {
 
     misc.GetEntry(i);
 */
+    if (analysis.HasTriggerMenus()) {
+      for (int word = 0; word < analysis.trigger_words; word++) {
+        ULong64_t bits = analysis.trigger_bits[word];
+        for (size_t bit = 0; bits != 0; bit++, bits >>= 1) {
+          if (bits & 1)
+            passedPaths[std::make_pair(analysis.trigger_menu_id, word * 64 + bit)]++;
+        }
+      }
+
+      continue;
+    }
+
     size_t size = analysis.trigger_names->size();
     for (int i = size - 1; i >= 0; i--) {
       bool passed = analysis.trigger_results->at(i);
@@ -201,6 +226,14 @@ void listTriggers() {
     }
   }
 
+  for (auto& path: passedPaths) {
+    const std::vector<std::string>& triggerNames = analysis.GetTriggerNames(path.first.first);
+    if (path.first.second >= triggerNames.size())
+      continue;
+
+    mTriggers[removeTriggerVersion(triggerNames[path.first.second])] += path.second;
+  }
+
   std::cout << std::endl << std::endl;
 
   std::cout << "Trigger summary" << std::endl;
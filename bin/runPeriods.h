@@ -0,0 +1,111 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Named run ranges, first and last runs included
+class RunPeriods {
+  public:
+    // 2012 periods of the run dependent PU profiles (RDAB, RDC and RDD)
+    RunPeriods() {
+      add("RDAB", 190457, 196530);
+      add("RDC", 198023, 203741);
+      add("RDD", 203769, 208685);
+    }
+
+    // Replace the periods by the ones of a text file, one per line: <name> <first run> <last run>.
+    // Lines starting with # are ignored. Names must be unique, and ranges must not overlap.
+    // Returns false, with the reason in error, if the file can't be read or is invalid. The periods are then unchanged
+    bool load(const std::string& file, std::string& error) {
+      std::ifstream f(file.c_str());
+      if (! f) {
+        error = "can't open the file";
+        return false;
+      }
+
+      std::vector<Period> periods;
+
+      std::string line;
+      for (size_t lineNumber = 1; std::getline(f, line); lineNumber++) {
+        std::stringstream ss(line);
+        std::string name;
+        if (! (ss >> name) || name[0] == '#')
+          continue;
+
+        std::stringstream location;
+        location << "line " << lineNumber << ": ";
+
+        unsigned int first, last;
+        std::string rest;
+        if (! (ss >> first >> last) || (ss >> rest)) {
+          error = location.str() + "expected '<name> <first run> <last run>'";
+          return false;
+        }
+        if (first > last) {
+          error = location.str() + "first run of '" + name + "' after its last run";
+          return false;
+        }
+
+        for (const Period& period: periods) {
+          if (period.name == name) {
+            error = location.str() + "duplicate period '" + name + "'";
+            return false;
+          }
+          if (first <= period.last && period.first <= last) {
+            error = location.str() + "runs of '" + name + "' overlap those of '" + period.name + "'";
+            return false;
+          }
+        }
+
+        Period period = {name, first, last};
+        periods.push_back(period);
+      }
+
+      if (periods.empty()) {
+        error = "no run period";
+        return false;
+      }
+
+      mPeriods.swap(periods);
+      return true;
+    }
+
+    // Index of the period containing run, -1 if none
+    int getPeriod(unsigned int run) const {
+      for (size_t i = 0; i < mPeriods.size(); i++) {
+        if (run >= mPeriods[i].first && run <= mPeriods[i].last)
+          return i;
+      }
+
+      return -1;
+    }
+
+    size_t size() const {
+      return mPeriods.size();
+    }
+
+    const std::string& getName(int period) const {
+      return mPeriods[period].name;
+    }
+
+    std::pair<unsigned int, unsigned int> getRuns(int period) const {
+      return std::make_pair(mPeriods[period].first, mPeriods[period].last);
+    }
+
+  private:
+    struct Period {
+      std::string name;
+      unsigned int first;
+      unsigned int last;
+    };
+
+    void add(const std::string& name, unsigned int first, unsigned int last) {
+      Period period = {name, first, last};
+      mPeriods.push_back(period);
+    }
+
+    std::vector<Period> mPeriods;
+};
@@ -278,7 +278,17 @@ def createProcess(runOnMC, runCHS, correctMETWithT1, processCaloJets, globalTag)
   # Add our PhotonIsolationProducer to the analysisSequence. This producer compute pf isolations
   # for our photons
   process.photonPFIsolation = cms.EDProducer("PhotonIsolationProducer",
-      src = cms.InputTag("selectedPatPhotons")
+      src = cms.InputTag("selectedPatPhotons"),
+
+      # Footprint isolations, random cone and footprint MET are only computed for photons
+      # able to pass the GammaJetFilter selection. Others get -999 (isolations, random cone)
+      # and no footprint correction
+      preselection = cms.untracked.PSet(
+        enable = cms.untracked.bool(True),
+        maxAbsEta = cms.untracked.double(1.3),
+        maxHadTowOverEm = cms.untracked.double(0.05),
+        maxSigmaIetaIeta = cms.untracked.double(0.011)
+        )
       )
 
   process.analysisSequence *= process.photonPFIsolation
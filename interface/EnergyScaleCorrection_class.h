@@ -13,11 +13,12 @@
 #include<fstream>
 #include<map>
 #include<math.h>
+#include <utility>
+#include <vector>
 #include <TChain.h>
+#include <TRandom.h>
 #include <TRandom3.h>
 #include <string>
-#include <RooRealVar.h>
-#include <RooCBShape.h>
 
 class correctionValue_class{
  public:
@@ -26,12 +27,15 @@ class correctionValue_class{
   float constTerm, constTerm_err;
   float alpha, alpha_err;
   float Emean, Emean_err;
+  // Crystal Ball tail of the smearing (smearingType 1), 0 for the values of SetSmearingCBAlpha / SetSmearingCBPower
+  float cbAlpha, cbPower;
 
   correctionValue_class(void){
     scale=1;  scale_err=0;
     constTerm=0; constTerm_err=0;
     alpha=0; alpha_err=0;
     Emean=0; Emean_err=0;
+    cbAlpha=0; cbPower=0;
   };
     
   friend ostream& operator << (ostream& os, const correctionValue_class a){
@@ -48,7 +52,9 @@ class correctionValue_class{
 };
 
 class correctionCategory_class{
-  // for class definition and ordering
+  // for class definition
+  friend class correctionTable_class;
+
  public:
   unsigned int runmin;
   unsigned int runmax;
@@ -75,8 +81,6 @@ class correctionCategory_class{
 
   correctionCategory_class(TString category_); ///< constructor with name of the category according to ElectronCategory_class
 
-  bool operator<(const correctionCategory_class& b) const;
-
   friend ostream& operator << (ostream& os, const correctionCategory_class a){
     os <<  a.runmin << " " << a.runmax 
        << "\t" << a.etamin << " "<<a.etamax 
@@ -88,7 +92,59 @@ class correctionCategory_class{
 
 
 //typedef std::map < TString, std::pair<double, double> > correction_map_t;
-typedef std::map < correctionCategory_class, correctionValue_class > correction_map_t;
+typedef std::vector < std::pair<correctionCategory_class, correctionValue_class> > correction_map_t;
+
+/// Categories of a .dat file compiled into a dense table
+/**
+ * Each dimension (run, |eta|, R9, Et) is cut at the boundaries of all the
+ * categories, and each cell of the resulting grid holds the index of the
+ * category covering it. Bins are [min, max), run ranges [runmin, runmax].
+ * A lookup is a binary search on each (short) list of edges and one array
+ * access, instead of a std::map traversal.
+ */
+class correctionTable_class{
+ public:
+  /// Fill the table. Reports cells covered by several categories (fatal) and cells covered by none
+  void build(const correction_map_t& categories, const std::string& name);
+
+  /// Index of the category covering this point in the list given to build(), -1 if none
+  int index(unsigned int runNumber, float etaEle, float R9Ele, float EtEle) const;
+
+  /// NULL if no category covers this point
+  const correctionValue_class* find(unsigned int runNumber, float etaEle, float R9Ele, float EtEle) const;
+
+ private:
+  static int bin(const std::vector<double>& edges, double value);
+  size_t cellIndex(int runBin, int etaBin, int r9Bin, int etBin) const;
+
+  std::vector<double> runEdges, etaEdges, r9Edges, etEdges;
+  std::vector<int> cells; ///< category index, -1 if not covered
+  std::vector<correctionValue_class> values;
+};
+
+/// Crystal Ball random numbers by inversion of its cumulative distribution
+/**
+ * Same shape as RooCBShape (gaussian core, power law tail on the left for
+ * alpha > 0, on the right for alpha < 0), truncated to [xmin, xmax] like a
+ * RooFit generation over the range of x. Building a sampler is a few erf
+ * evaluations, and each number costs one uniform draw and one erf_inv or pow.
+ */
+class crystalBallSampler_class{
+ public:
+  crystalBallSampler_class(double mean, double sigma, double alpha, double n, double xmin, double xmax);
+
+  double generate(TRandom& rgen) const;
+  double cdf(double x) const; ///< normalized over [xmin, xmax]
+
+ private:
+  double integral(double t) const; ///< in units of sigma, of the shape with alpha > 0
+  double inverse(double c) const;
+
+  double mean_, sigma_, alpha_, n_;
+  double sign_; ///< -1 for alpha < 0: the shape is mirrored
+  double A_, B_;
+  double cmin_, cmax_;
+};
 
 class EnergyScaleCorrection_class{
 
@@ -110,7 +166,8 @@ class EnergyScaleCorrection_class{
 		     TString etaEleBranchName="etaEle",
 		     TString etaSCEleBranchName="etaSCEle",
 		     TString energySCEleBranchName="energySCEle",
-		     TString nPVBranchName="nPV");
+		     TString nPVBranchName="nPV",
+		     unsigned int nThreads=1); ///< categories of the electrons are looked up in parallel on nThreads threads
 
  private:
   void ReadFromFile(TString filename); ///<   category  "runNumber"   runMin  runMax   deltaP  err_deltaP
@@ -125,19 +182,32 @@ class EnergyScaleCorrection_class{
   int smearingType_;
 
   TRandom3 *rgen_;
-  correction_map_t scales, scales_not_defined;
-  correction_map_t smearings, smearings_not_defined;
+  correction_map_t scales, smearings;
+  correctionTable_class scalesTable, smearingsTable;
+
+  /// Lookup of a category, with a warning for the first ones not found. Returns the default values if not found
+  const correctionValue_class& findCorrection(const correctionTable_class& table, int runNumber, float etaEle, float R9Ele, float EtEle);
+  correctionValue_class notDefined_;
+  unsigned long long nNotDefined_;
+  UInt_t smearingSeed_;
 
   void AddSmearing(TString category_, int runMin_, int runMax_, //double smearing_, double err_smearing_);
 		   double constTerm, double err_constTerm, double alpha, double err_alpha, double Emean, double err_Emean);
   float getSmearingSigma(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle); 
+  static float smearingSigma(const correctionValue_class& corr, float energy, float etaSCEle);
+  float drawSmearing(const correctionValue_class& corr, float smear, TRandom& rgen) const; ///< multiplicative smearing for a width, with the Crystal Ball tail of the category
   void ReadSmearingFromFile(TString filename); ///< File structure: category constTerm alpha;
+  std::vector<TString> smearingNames_; ///< name of each category of smearings
  public:
   inline void SetSmearingType(int value){if(value>=0 && value<=1){smearingType_=value;}else{smearingType_=0;}};
-  inline void SetSmearingCBAlpha(double value){cut.setVal(value);};
-  inline void SetSmearingCBPower(double value){power.setVal(value);};
+  inline void SetSmearingCBAlpha(double value){cbAlpha_=value;};
+  inline void SetSmearingCBPower(double value){cbPower_=value;};
+  bool SetSmearingCBShape(TString category, double alpha, double power); ///< Crystal Ball tail of one smearing category. Returns false if there is no such category
+  void ReadSmearingCBShapeFromFile(TString filename); ///< File structure: category alpha power
+  inline void SetSmearingSeed(UInt_t value){smearingSeed_=value;}; ///< base seed of GetSmearTree, 0 to derive it from the class generator
 
   float getSmearing(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle);
+  float getSmearing(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle, TRandom& rgen); ///< with the caller generator, e.g. one per thread
   float getSmearingRho(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle); ///< public for sigmaE estimate
 
 
@@ -147,26 +217,16 @@ class EnergyScaleCorrection_class{
 		      TString runNumberBranchName="runNumber",
 		      TString R9EleBranchName="R9Ele",
 		      TString etaEleBranchName="etaEle",
-		      TString etaSCEleBranchName="etaSCEle"
-		      );
-
-  //---------- CB parameters
-  RooRealVar 	deltaM;
-  RooRealVar 	sigma;
-  RooRealVar 	cut;
-  RooRealVar 	power;
-  RooRealVar    x;
-  //--------------- BW parameters
-  //RooRealVar  mRes;
-  //RooRealVar  Gamma;
-
-  //  RooRealVar& invMass_ref;
-  //RooBreitWigner bw_pdf;
-  RooCBShape resCB;
-  RooDataSet *data;
-  int index_data;
-  // convolution
-  //RooFFTConvPdf conv_pdf;
+		      TString etaSCEleBranchName="etaSCEle",
+		      unsigned int nThreads=1
+		      ); ///< categories are processed in parallel, each electron with its own random stream: same content for any nThreads with a fixed seed
+
+  //---------- CB parameters (smearingType 1)
+ private:
+  double cbMean_;
+  double cbAlpha_; ///< default of the categories without their own tail
+  double cbPower_;
+  double cbMin_, cbMax_; ///< range of the generated values, in GeV/c^2
 
 };
 
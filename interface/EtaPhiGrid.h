@@ -0,0 +1,95 @@
+#pragma once
+
+// Uniform eta-phi grid of object indexes, to find the objects close to a
+// direction without looping over all of them.
+//
+// Cells are at least 'cellSize' wide, and phi wraps around, so every object
+// within cellSize in both eta and phi of a direction is in the 3x3 cells
+// around it. neighbours() returns the content of these cells: a superset of
+// the objects inside a cone of radius cellSize, that the caller still has to
+// filter with its own distance. neighbourCells() and cell() give access to
+// the same cells without copying their content. Objects beyond +-etaMax go
+// to the first and last eta rows.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class EtaPhiGrid {
+  public:
+    EtaPhiGrid(double cellSize, double etaMax = 5.) {
+      mEtaMax = etaMax;
+      mNEta = std::max(1, (int) std::floor(2 * etaMax / cellSize));
+      mNPhi = std::max(1, (int) std::floor(2 * M_PI / cellSize));
+      mEtaCellSize = 2 * etaMax / mNEta;
+      mPhiCellSize = 2 * M_PI / mNPhi;
+
+      mCells.resize(mNEta * mNPhi);
+    }
+
+    // Empty the cells, keeping their memory for the next event
+    void clear() {
+      for (std::vector<unsigned int>& cell: mCells)
+        cell.clear();
+    }
+
+    void insert(double eta, double phi, unsigned int index) {
+      mCells[etaBin(eta) * mNPhi + phiBin(phi)].push_back(index);
+    }
+
+    // Append to 'indexes' the objects of the cells around (eta, phi), in insertion order within each cell
+    void neighbours(double eta, double phi, std::vector<unsigned int>& indexes) const {
+      std::vector<unsigned int> cells;
+      neighbourCells(eta, phi, cells);
+
+      for (unsigned int c: cells)
+        indexes.insert(indexes.end(), mCells[c].begin(), mCells[c].end());
+    }
+
+    // Append to 'cells' the numbers of the cells around (eta, phi), to read
+    // them in place with cell()
+    void neighbourCells(double eta, double phi, std::vector<unsigned int>& cells) const {
+      int etaCell = etaBin(eta);
+      int phiCell = phiBin(phi);
+
+      // With less than 3 phi cells, the neighbours of a cell are all the cells
+      int phiSpan = std::min(mNPhi, 3);
+      int firstPhiCell = (phiSpan == 3) ? phiCell - 1 + mNPhi : 0;
+
+      for (int i = std::max(etaCell - 1, 0); i <= std::min(etaCell + 1, mNEta - 1); i++) {
+        for (int j = 0; j < phiSpan; j++)
+          cells.push_back(i * mNPhi + (firstPhiCell + j) % mNPhi);
+      }
+    }
+
+    // Object indexes of a cell, in insertion order
+    const std::vector<unsigned int>& cell(unsigned int c) const {
+      return mCells[c];
+    }
+
+    size_t cellCount() const {
+      return mCells.size();
+    }
+
+  private:
+    int etaBin(double eta) const {
+      int bin = (int) std::floor((eta + mEtaMax) / mEtaCellSize);
+      return std::min(std::max(bin, 0), mNEta - 1);
+    }
+
+    int phiBin(double phi) const {
+      double wrapped = std::fmod(phi + M_PI, 2 * M_PI);
+      if (wrapped < 0)
+        wrapped += 2 * M_PI;
+
+      return std::min((int) (wrapped / mPhiCellSize), mNPhi - 1);
+    }
+
+    double mEtaMax;
+    int mNEta;
+    int mNPhi;
+    double mEtaCellSize;
+    double mPhiCellSize;
+
+    std::vector<std::vector<unsigned int>> mCells;
+};
@@ -0,0 +1,1137 @@
+#pragma once
+
+// Structure-of-arrays evaluation of jet energy corrections.
+//
+// JECBatchCorrector reads the same text payloads as JetCorrectorParameters
+// (L1FastJet, L2Relative, L3Absolute, L2L3Residual, ...) and evaluates the
+// full chain for many jets at once. Each level keeps its parameters in flat
+// per-bin arrays; for a block of jets the parameters of the selected eta bins
+// are gathered once, then the formula (compiled to a small stack program) is
+// run instruction by instruction over the whole block.
+//
+// Input clamping, bin lookup and level ordering follow FactorizedJetCorrector,
+// so both paths agree up to floating point rounding. Use maxDeviation() to
+// check a payload set against the scalar corrector before relying on it.
+//
+// Payloads go through JECPayloadCache: each file is parsed at most once per
+// process, and the parsed form is stored in a binary cache file keyed by the
+// path, size and modification time of the text payload, memory-mapped on the
+// next job start without reading the text. JetCorrectorParameters for
+// FactorizedJetCorrector are built from the same parsed levels, see
+// JECPayloadCache::get().
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct JECJetBatch {
+  std::vector<float> eta;
+  std::vector<float> pt;
+  std::vector<float> rho;
+  std::vector<float> area;
+  std::vector<float> npv;
+
+  size_t size() const {
+    return pt.size();
+  }
+
+  void clear() {
+    eta.clear();
+    pt.clear();
+    rho.clear();
+    area.clear();
+    npv.clear();
+  }
+
+  void reserve(size_t n) {
+    eta.reserve(n);
+    pt.reserve(n);
+    rho.reserve(n);
+    area.reserve(n);
+    npv.reserve(n);
+  }
+
+  void push_back(float jetEta, float jetPt, float jetRho, float jetArea, float jetNPV = 0.) {
+    eta.push_back(jetEta);
+    pt.push_back(jetPt);
+    rho.push_back(jetRho);
+    area.push_back(jetArea);
+    npv.push_back(jetNPV);
+  }
+};
+
+// Number of jets evaluated together by each formula instruction
+static const size_t JEC_BATCH_BLOCK_SIZE = 64;
+
+// TFormula-compatible expression compiled to a stack program.
+// Supports + - * / ^, unary minus, [n] parameters, x y z t variables and
+// the log, log10, exp, sqrt, abs, pow, max and min functions (with or
+// without the TMath:: prefix).
+class JECFormula {
+  public:
+    enum OpCode {
+      kConstant,
+      kParameter,
+      kVariable,
+      kAdd,
+      kSub,
+      kMul,
+      kDiv,
+      kPow,
+      kNeg,
+      kLog,
+      kLog10,
+      kExp,
+      kSqrt,
+      kAbs,
+      kMax,
+      kMin
+    };
+
+    struct Instruction {
+      OpCode op;
+      int    index;
+      double value;
+    };
+
+    JECFormula():
+      mStackSize(0), mStackDepth(0), mParameterCount(0), mVariableCount(0), mPosition(0) {}
+
+    explicit JECFormula(const std::string& expression):
+      mStackSize(0), mStackDepth(0), mParameterCount(0), mVariableCount(0), mPosition(0) {
+
+      for (char c: expression) {
+        if (! isspace(c))
+          mExpression += c;
+      }
+
+      parseExpression();
+      if (mPosition != mExpression.size())
+        error("unexpected character");
+    }
+
+    size_t parameterCount() const {
+      return mParameterCount;
+    }
+
+    size_t variableCount() const {
+      return mVariableCount;
+    }
+
+    size_t stackSize() const {
+      return mStackSize;
+    }
+
+    // Evaluate the formula for n <= JEC_BATCH_BLOCK_SIZE lanes.
+    // variables and parameters are laid out as [index * JEC_BATCH_BLOCK_SIZE + lane],
+    // stack must hold at least stackSize() * JEC_BATCH_BLOCK_SIZE values.
+    void evaluate(size_t n, const double* variables, const double* parameters, double* stack, double* result) const {
+      const size_t B = JEC_BATCH_BLOCK_SIZE;
+      // Number of values on the stack. The value on top is stack[(depth - 1) * B + lane]
+      size_t depth = 0;
+
+      for (const Instruction& instruction: mProgram) {
+        switch (instruction.op) {
+          case kConstant: {
+            double* top = stack + (depth++) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = instruction.value;
+            break;
+          }
+
+          case kParameter: {
+            double* top = stack + (depth++) * B;
+            const double* p = parameters + instruction.index * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = p[l];
+            break;
+          }
+
+          case kVariable: {
+            double* top = stack + (depth++) * B;
+            const double* v = variables + instruction.index * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = v[l];
+            break;
+          }
+
+          case kNeg: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = -top[l];
+            break;
+          }
+
+          case kLog: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = std::log(top[l]);
+            break;
+          }
+
+          case kLog10: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = std::log10(top[l]);
+            break;
+          }
+
+          case kExp: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = std::exp(top[l]);
+            break;
+          }
+
+          case kSqrt: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = std::sqrt(top[l]);
+            break;
+          }
+
+          case kAbs: {
+            double* top = stack + (depth - 1) * B;
+            for (size_t l = 0; l < n; l++)
+              top[l] = std::fabs(top[l]);
+            break;
+          }
+
+          default: {
+            double* a = stack + (depth - 2) * B;
+            const double* top = a + B;
+            switch (instruction.op) {
+              case kAdd:
+                for (size_t l = 0; l < n; l++)
+                  a[l] += top[l];
+                break;
+              case kSub:
+                for (size_t l = 0; l < n; l++)
+                  a[l] -= top[l];
+                break;
+              case kMul:
+                for (size_t l = 0; l < n; l++)
+                  a[l] *= top[l];
+                break;
+              case kDiv:
+                for (size_t l = 0; l < n; l++)
+                  a[l] /= top[l];
+                break;
+              case kPow:
+                for (size_t l = 0; l < n; l++)
+                  a[l] = std::pow(a[l], top[l]);
+                break;
+              case kMax:
+                for (size_t l = 0; l < n; l++)
+                  a[l] = (a[l] > top[l]) ? a[l] : top[l];
+                break;
+              case kMin:
+                for (size_t l = 0; l < n; l++)
+                  a[l] = (a[l] < top[l]) ? a[l] : top[l];
+                break;
+              default:
+                break;
+            }
+            depth--;
+            break;
+          }
+        }
+      }
+
+      for (size_t l = 0; l < n; l++)
+        result[l] = stack[l];
+    }
+
+  private:
+    void error(const std::string& what) const {
+      throw std::runtime_error("Invalid JEC formula '" + mExpression + "': " + what);
+    }
+
+    void emit(OpCode op, int index = 0, double value = 0.) {
+      Instruction instruction = {op, index, value};
+      mProgram.push_back(instruction);
+
+      if (op == kConstant || op == kParameter || op == kVariable)
+        mStackDepth++;
+      else if (op >= kAdd && op <= kPow)
+        mStackDepth--;
+      else if (op == kMax || op == kMin)
+        mStackDepth--;
+
+      mStackSize = std::max(mStackSize, mStackDepth);
+    }
+
+    bool accept(char c) {
+      if (mPosition < mExpression.size() && mExpression[mPosition] == c) {
+        mPosition++;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char c) {
+      if (! accept(c))
+        error(std::string("expected '") + c + "'");
+    }
+
+    void parseExpression() {
+      parseTerm();
+      while (true) {
+        if (accept('+')) {
+          parseTerm();
+          emit(kAdd);
+        } else if (accept('-')) {
+          parseTerm();
+          emit(kSub);
+        } else {
+          break;
+        }
+      }
+    }
+
+    void parseTerm() {
+      parseUnary();
+      while (true) {
+        if (accept('*')) {
+          parseUnary();
+          emit(kMul);
+        } else if (accept('/')) {
+          parseUnary();
+          emit(kDiv);
+        } else {
+          break;
+        }
+      }
+    }
+
+    void parseUnary() {
+      if (accept('-')) {
+        parseUnary();
+        emit(kNeg);
+      } else if (accept('+')) {
+        parseUnary();
+      } else {
+        parsePower();
+      }
+    }
+
+    void parsePower() {
+      parsePrimary();
+      if (accept('^')) {
+        parseUnary();
+        emit(kPow);
+      }
+    }
+
+    void parsePrimary() {
+      if (mPosition >= mExpression.size())
+        error("unexpected end of expression");
+
+      char c = mExpression[mPosition];
+
+      if (accept('(')) {
+        parseExpression();
+        expect(')');
+        return;
+      }
+
+      if (accept('[')) {
+        const char* begin = mExpression.c_str() + mPosition;
+        char* end = NULL;
+        long index = strtol(begin, &end, 10);
+        if (end == begin || index < 0)
+          error("invalid parameter index");
+        mPosition += end - begin;
+        expect(']');
+
+        mParameterCount = std::max(mParameterCount, (size_t) index + 1);
+        emit(kParameter, index);
+        return;
+      }
+
+      if (isdigit(c) || c == '.') {
+        const char* begin = mExpression.c_str() + mPosition;
+        char* end = NULL;
+        double value = strtod(begin, &end);
+        mPosition += end - begin;
+        emit(kConstant, 0, value);
+        return;
+      }
+
+      if (! isalpha(c))
+        error(std::string("unexpected character '") + c + "'");
+
+      std::string name;
+      while (mPosition < mExpression.size() && (isalnum(mExpression[mPosition]) || mExpression[mPosition] == '_' || mExpression[mPosition] == ':')) {
+        name += mExpression[mPosition++];
+      }
+
+      if (name.compare(0, 7, "TMath::") == 0)
+        name = name.substr(7);
+
+      if (name.size() == 1 && (name[0] == 'x' || name[0] == 'y' || name[0] == 'z' || name[0] == 't')) {
+        int index = (name[0] == 't') ? 3 : name[0] - 'x';
+        mVariableCount = std::max(mVariableCount, (size_t) index + 1);
+        emit(kVariable, index);
+        return;
+      }
+
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+      OpCode op;
+      size_t arguments = 1;
+      if (name == "log")
+        op = kLog;
+      else if (name == "log10")
+        op = kLog10;
+      else if (name == "exp")
+        op = kExp;
+      else if (name == "sqrt")
+        op = kSqrt;
+      else if (name == "abs" || name == "fabs")
+        op = kAbs;
+      else if (name == "pow" || name == "power") {
+        op = kPow;
+        arguments = 2;
+      } else if (name == "max") {
+        op = kMax;
+        arguments = 2;
+      } else if (name == "min") {
+        op = kMin;
+        arguments = 2;
+      } else {
+        error("unknown function '" + name + "'");
+        return;
+      }
+
+      expect('(');
+      parseExpression();
+      for (size_t i = 1; i < arguments; i++) {
+        expect(',');
+        parseExpression();
+      }
+      expect(')');
+
+      emit(op);
+    }
+
+    std::string mExpression;
+    std::vector<Instruction> mProgram;
+    size_t mStackSize;
+    size_t mStackDepth;
+    size_t mParameterCount;
+    size_t mVariableCount;
+    size_t mPosition;
+};
+
+// One correction level, read from a JetCorrectorParameters text payload
+class JECBatchLevel {
+  public:
+    enum Variable {
+      kJetEta,
+      kJetPt,
+      kJetA,
+      kRho,
+      kNPV
+    };
+
+    explicit JECBatchLevel(const std::string& filename):
+      mSortedBins(true), mParameterCount(0) {
+
+      std::ifstream f(filename.c_str());
+      if (! f.good())
+        throw std::runtime_error("Failed to open JEC payload '" + filename + "'");
+
+      parse(filename, f);
+    }
+
+    // Parse the content of a text payload; filename is only used for error messages
+    JECBatchLevel(const std::string& filename, std::istream& text):
+      mSortedBins(true), mParameterCount(0) {
+
+      parse(filename, text);
+    }
+
+    const std::string& level() const {
+      return mLevel;
+    }
+
+  private:
+    void parse(const std::string& filename, std::istream& f) {
+      std::string line;
+      bool hasDefinition = false;
+      while (std::getline(f, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+          continue;
+
+        if (line[first] == '[')
+          throw std::runtime_error("JEC payload '" + filename + "': sections are not supported");
+
+        if (line[first] == '{') {
+          parseDefinition(filename, line);
+          hasDefinition = true;
+        } else {
+          if (! hasDefinition)
+            throw std::runtime_error("JEC payload '" + filename + "': missing definition line");
+          parseRecord(filename, line);
+        }
+      }
+
+      if (mRecords.empty())
+        throw std::runtime_error("JEC payload '" + filename + "' does not contain any bin");
+
+      buildArrays();
+    }
+
+  public:
+    size_t binCount() const {
+      return mBinMin.size();
+    }
+
+    const std::vector<float>& binMin() const {
+      return mBinMin;
+    }
+
+    const std::vector<float>& binMax() const {
+      return mBinMax;
+    }
+
+    // Variable of the bins
+    Variable binVariable() const {
+      return mBinVariable;
+    }
+
+    // Variables of the formula, in the order of the definition line
+    const std::vector<Variable>& variables() const {
+      return mVariables;
+    }
+
+    bool uses(Variable variable) const {
+      return mBinVariable == variable || std::find(mVariables.begin(), mVariables.end(), variable) != mVariables.end();
+    }
+
+    // Evaluate this level for all jets: scale[i] is the correction of
+    // jet i, pt[i] being its transverse momentum before this level.
+    void evaluate(const JECJetBatch& jets, const std::vector<float>& pt, std::vector<float>& scale) const {
+      const size_t B = JEC_BATCH_BLOCK_SIZE;
+      const size_t nBins = binCount();
+      const size_t nVariables = mVariables.size();
+
+      scale.resize(jets.size());
+
+      const float* sources[5] = {&jets.eta[0], &pt[0], &jets.area[0], &jets.rho[0], &jets.npv[0]};
+
+      std::vector<double> variables(std::max<size_t>(nVariables, 1) * B);
+      std::vector<double> parameters(std::max<size_t>(mParameterCount, 1) * B);
+      std::vector<double> stack(std::max<size_t>(mFormula.stackSize(), 1) * B);
+      double result[JEC_BATCH_BLOCK_SIZE];
+      int bins[JEC_BATCH_BLOCK_SIZE];
+      size_t lanes[JEC_BATCH_BLOCK_SIZE];
+
+      for (size_t begin = 0; begin < jets.size(); begin += B) {
+        size_t end = std::min(begin + B, jets.size());
+
+        // Bin lookup; jets outside of the payload get a correction of 1
+        size_t n = 0;
+        for (size_t i = begin; i < end; i++) {
+          int bin = findBin(sources[mBinVariable][i]);
+          if (bin < 0) {
+            scale[i] = 1.;
+          } else {
+            bins[n] = bin;
+            lanes[n] = i;
+            n++;
+          }
+        }
+
+        if (n == 0)
+          continue;
+
+        // Gather clamped inputs and parameters of the selected bins
+        for (size_t v = 0; v < nVariables; v++) {
+          const float* source = sources[mVariables[v]];
+          const float* min = &mVariableMin[v * nBins];
+          const float* max = &mVariableMax[v * nBins];
+          double* out = &variables[v * B];
+          for (size_t l = 0; l < n; l++) {
+            float x = source[lanes[l]];
+            int bin = bins[l];
+            out[l] = (x < min[bin]) ? min[bin] : (x > max[bin]) ? max[bin] : x;
+          }
+        }
+
+        for (size_t p = 0; p < mParameterCount; p++) {
+          const float* par = &mParameters[p * nBins];
+          double* out = &parameters[p * B];
+          for (size_t l = 0; l < n; l++)
+            out[l] = par[bins[l]];
+        }
+
+        mFormula.evaluate(n, &variables[0], &parameters[0], &stack[0], result);
+
+        for (size_t l = 0; l < n; l++)
+          scale[lanes[l]] = result[l];
+      }
+    }
+
+    // JetCorrectorParameters (or any type with the same Definitions / Record
+    // interface) holding this level, without parsing the text payload again.
+    // Records are sorted like in the JetCorrectorParameters text constructor.
+    template<typename Parameters>
+      Parameters toParameters() const {
+        typedef typename Parameters::Record Record;
+
+        const size_t nBins = binCount();
+        const size_t nVariables = mVariables.size();
+
+        std::vector<Record> records;
+        records.reserve(nBins);
+        for (size_t b = 0; b < nBins; b++) {
+          std::vector<float> values;
+          values.reserve(2 * nVariables + mParameterCount);
+          for (size_t v = 0; v < nVariables; v++) {
+            values.push_back(mVariableMin[v * nBins + b]);
+            values.push_back(mVariableMax[v * nBins + b]);
+          }
+          for (size_t p = 0; p < mParameterCount; p++)
+            values.push_back(mParameters[p * nBins + b]);
+
+          records.push_back(Record(1, std::vector<float>(1, mBinMin[b]), std::vector<float>(1, mBinMax[b]), values));
+        }
+        std::sort(records.begin(), records.end());
+
+        return Parameters(typename Parameters::Definitions(mDefinition), records);
+      }
+
+    // Binary image of the parsed payload, used by JECPayloadCache. key
+    // identifies the text payload it was parsed from.
+    std::string toBinary(uint64_t key) const {
+      BinaryHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, binaryMagic(), sizeof(header.magic));
+      header.key = key;
+      header.binCount = binCount();
+      header.variableCount = mVariables.size();
+      header.parameterCount = mParameterCount;
+      header.binVariable = mBinVariable;
+      header.sortedBins = mSortedBins;
+      header.levelSize = mLevel.size();
+      header.formulaSize = mFormulaString.size();
+      header.definitionSize = mDefinition.size();
+
+      std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (Variable variable: mVariables) {
+        uint32_t v = variable;
+        data.append(reinterpret_cast<const char*>(&v), sizeof(v));
+      }
+      data.append(mLevel);
+      data.append(mFormulaString);
+      data.append(mDefinition);
+
+      const std::vector<float>* arrays[] = {&mBinMin, &mBinMax, &mVariableMin, &mVariableMax, &mParameters};
+      for (const std::vector<float>* array: arrays) {
+        if (! array->empty())
+          data.append(reinterpret_cast<const char*>(&(*array)[0]), array->size() * sizeof(float));
+      }
+
+      return data;
+    }
+
+    // Rebuild a level from toBinary() output. Returns NULL if data is truncated,
+    // or was not produced from a payload with this key.
+    static JECBatchLevel* fromBinary(const char* data, size_t size, uint64_t key) {
+      BinaryHeader header;
+      if (size < sizeof(header))
+        return NULL;
+
+      memcpy(&header, data, sizeof(header));
+      if (memcmp(header.magic, binaryMagic(), sizeof(header.magic)) != 0 || header.key != key)
+        return NULL;
+
+      const size_t nBins = header.binCount;
+      const size_t nVariables = header.variableCount;
+      const size_t nParameters = header.parameterCount;
+      const size_t expected = sizeof(header) + nVariables * sizeof(uint32_t) + header.levelSize + header.formulaSize + header.definitionSize +
+        (2 * nBins + 2 * nVariables * nBins + nParameters * nBins) * sizeof(float);
+      if (size != expected)
+        return NULL;
+
+      std::unique_ptr<JECBatchLevel> level(new JECBatchLevel());
+      const char* cursor = data + sizeof(header);
+
+      level->mBinVariable = static_cast<Variable>(header.binVariable);
+      for (size_t i = 0; i < nVariables; i++) {
+        uint32_t v;
+        memcpy(&v, cursor, sizeof(v));
+        cursor += sizeof(v);
+        level->mVariables.push_back(static_cast<Variable>(v));
+      }
+
+      level->mLevel.assign(cursor, header.levelSize);
+      cursor += header.levelSize;
+      level->mFormulaString.assign(cursor, header.formulaSize);
+      cursor += header.formulaSize;
+      level->mDefinition.assign(cursor, header.definitionSize);
+      cursor += header.definitionSize;
+
+      level->mSortedBins = header.sortedBins;
+      level->mParameterCount = nParameters;
+
+      std::vector<float>* arrays[] = {&level->mBinMin, &level->mBinMax, &level->mVariableMin, &level->mVariableMax, &level->mParameters};
+      const size_t sizes[] = {nBins, nBins, nVariables * nBins, nVariables * nBins, nParameters * nBins};
+      for (size_t i = 0; i < 5; i++) {
+        arrays[i]->resize(sizes[i]);
+        if (sizes[i] > 0)
+          memcpy(&(*arrays[i])[0], cursor, sizes[i] * sizeof(float));
+        cursor += sizes[i] * sizeof(float);
+      }
+
+      level->mFormula = JECFormula(level->mFormulaString);
+
+      return level.release();
+    }
+
+  private:
+    struct BinaryHeader {
+      char     magic[8];
+      uint64_t key;
+      uint32_t binCount;
+      uint32_t variableCount;
+      uint32_t parameterCount;
+      uint32_t binVariable;
+      uint32_t sortedBins;
+      uint32_t levelSize;
+      uint32_t formulaSize;
+      uint32_t definitionSize;
+    };
+
+    static const char* binaryMagic() {
+      return "JECBIN2";
+    }
+
+    JECBatchLevel():
+      mBinVariable(kJetEta), mSortedBins(true), mParameterCount(0) {}
+
+    struct Record {
+      float binMin;
+      float binMax;
+      std::vector<float> values;
+    };
+
+    static Variable variableFromName(const std::string& filename, const std::string& name) {
+      if (name == "JetEta")
+        return kJetEta;
+      else if (name == "JetPt")
+        return kJetPt;
+      else if (name == "JetA")
+        return kJetA;
+      else if (name == "Rho")
+        return kRho;
+      else if (name == "NPV")
+        return kNPV;
+
+      throw std::runtime_error("JEC payload '" + filename + "': unsupported variable '" + name + "'");
+    }
+
+    void parseDefinition(const std::string& filename, std::string line) {
+      std::replace(line.begin(), line.end(), '{', ' ');
+      std::replace(line.begin(), line.end(), '}', ' ');
+      mDefinition = line;
+
+      std::istringstream stream(line);
+      std::vector<std::string> tokens;
+      std::string token;
+      while (stream >> token)
+        tokens.push_back(token);
+
+      size_t nBinVariables = (tokens.size() > 0) ? atoi(tokens[0].c_str()) : 0;
+      if (nBinVariables != 1 || tokens.size() < 4)
+        throw std::runtime_error("JEC payload '" + filename + "': only payloads binned in one variable are supported");
+
+      mBinVariable = variableFromName(filename, tokens[1]);
+
+      size_t nVariables = atoi(tokens[2].c_str());
+      if (tokens.size() < 4 + nVariables)
+        throw std::runtime_error("JEC payload '" + filename + "': malformed definition line");
+
+      for (size_t i = 0; i < nVariables; i++)
+        mVariables.push_back(variableFromName(filename, tokens[3 + i]));
+
+      mFormulaString = tokens[3 + nVariables];
+      mLevel = tokens.back();
+
+      for (size_t i = 4 + nVariables; i < tokens.size(); i++) {
+        if (tokens[i] == "Response")
+          throw std::runtime_error("JEC payload '" + filename + "': response payloads are not supported");
+      }
+
+      mFormula = JECFormula(mFormulaString);
+      if (mFormula.variableCount() > nVariables)
+        throw std::runtime_error("JEC payload '" + filename + "': formula uses more variables than declared");
+    }
+
+    void parseRecord(const std::string& filename, const std::string& line) {
+      std::istringstream stream(line);
+      Record record;
+      size_t nValues = 0;
+      if (! (stream >> record.binMin >> record.binMax >> nValues))
+        throw std::runtime_error("JEC payload '" + filename + "': malformed line '" + line + "'");
+
+      float value;
+      while (stream >> value)
+        record.values.push_back(value);
+
+      if (record.values.size() != nValues || nValues < 2 * mVariables.size())
+        throw std::runtime_error("JEC payload '" + filename + "': malformed line '" + line + "'");
+
+      mRecords.push_back(record);
+    }
+
+    void buildArrays() {
+      const size_t nBins = mRecords.size();
+      const size_t nVariables = mVariables.size();
+
+      mParameterCount = mFormula.parameterCount();
+      for (const Record& record: mRecords)
+        mParameterCount = std::max(mParameterCount, record.values.size() - 2 * nVariables);
+
+      mBinMin.resize(nBins);
+      mBinMax.resize(nBins);
+      mVariableMin.assign(nVariables * nBins, 0.);
+      mVariableMax.assign(nVariables * nBins, 0.);
+      mParameters.assign(mParameterCount * nBins, 0.);
+
+      for (size_t b = 0; b < nBins; b++) {
+        const Record& record = mRecords[b];
+        mBinMin[b] = record.binMin;
+        mBinMax[b] = record.binMax;
+
+        for (size_t v = 0; v < nVariables; v++) {
+          mVariableMin[v * nBins + b] = record.values[2 * v];
+          mVariableMax[v * nBins + b] = record.values[2 * v + 1];
+        }
+
+        for (size_t p = 2 * nVariables; p < record.values.size(); p++)
+          mParameters[(p - 2 * nVariables) * nBins + b] = record.values[p];
+
+        if (b > 0 && (mBinMin[b] < mBinMax[b - 1] || mBinMin[b] < mBinMin[b - 1]))
+          mSortedBins = false;
+      }
+
+      mRecords.clear();
+    }
+
+    // Same semantic as JetCorrectorParameters::binIndex: first bin with min <= x < max
+    int findBin(float x) const {
+      if (mSortedBins) {
+        std::vector<float>::const_iterator it = std::upper_bound(mBinMin.begin(), mBinMin.end(), x);
+        if (it == mBinMin.begin())
+          return -1;
+
+        size_t bin = (it - mBinMin.begin()) - 1;
+        return (x < mBinMax[bin]) ? bin : -1;
+      }
+
+      for (size_t bin = 0; bin < mBinMin.size(); bin++) {
+        if (x >= mBinMin[bin] && x < mBinMax[bin])
+          return bin;
+      }
+
+      return -1;
+    }
+
+    std::string mLevel;
+    // Definition line of the text payload, as given to JetCorrectorParameters::Definitions
+    std::string mDefinition;
+    std::string mFormulaString;
+    JECFormula mFormula;
+
+    Variable mBinVariable;
+    std::vector<Variable> mVariables;
+
+    bool mSortedBins;
+    std::vector<float> mBinMin;
+    std::vector<float> mBinMax;
+
+    // Flat arrays, indexed as [variable or parameter index * binCount() + bin]
+    std::vector<float> mVariableMin;
+    std::vector<float> mVariableMax;
+    size_t mParameterCount;
+    std::vector<float> mParameters;
+
+    std::vector<Record> mRecords;
+};
+
+// Process-wide cache of parsed JEC payloads
+class JECPayloadCache {
+  public:
+    // Parsed payload, read from the binary cache when it's up to date
+    static std::shared_ptr<const JECBatchLevel> getLevel(const std::string& filename) {
+      static std::mutex mutex;
+      static std::map<std::string, std::shared_ptr<const JECBatchLevel>> levels;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      std::map<std::string, std::shared_ptr<const JECBatchLevel>>::const_iterator it = levels.find(filename);
+      if (it != levels.end())
+        return it->second;
+
+      std::shared_ptr<const JECBatchLevel> level = loadLevel(filename);
+      levels[filename] = level;
+
+      return level;
+    }
+
+    // JetCorrectorParameters of a payload, built from the parsed level so that
+    // the text is never parsed again. See JECBatchLevel::toParameters()
+    template<typename T>
+      static const T& get(const std::string& filename) {
+        static std::mutex mutex;
+        static std::map<std::string, std::shared_ptr<T>> payloads;
+
+        std::shared_ptr<const JECBatchLevel> level = getLevel(filename);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<T>& payload = payloads[filename];
+        if (! payload.get())
+          payload.reset(new T(level->toParameters<T>()));
+
+        return *payload;
+      }
+
+    // FNV-1a
+    static uint64_t checksum(const std::string& data) {
+      uint64_t hash = 14695981039346656037ULL;
+      for (unsigned char c: data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+      }
+
+      return hash;
+    }
+
+    // Key of the binary cache of a text payload: its path, size and modification time
+    static uint64_t cacheKey(const std::string& filename, const struct stat& info) {
+      std::ostringstream key;
+      key << filename << '\0' << info.st_size << '\0' << info.st_mtim.tv_sec << '.' << info.st_mtim.tv_nsec;
+
+      return checksum(key.str());
+    }
+
+    // Taken from $JEC_CACHE_DIR, $TMPDIR or /tmp. An empty $JEC_CACHE_DIR disables the binary cache
+    static std::string cacheDirectory() {
+      const char* directory = getenv("JEC_CACHE_DIR");
+      if (! directory)
+        directory = getenv("TMPDIR");
+      if (! directory)
+        directory = "/tmp";
+
+      return directory;
+    }
+
+  private:
+    static std::shared_ptr<const JECBatchLevel> loadLevel(const std::string& filename) {
+      struct stat info;
+      const std::string directory = cacheDirectory();
+      if (directory.empty() || stat(filename.c_str(), &info) != 0)
+        return std::shared_ptr<const JECBatchLevel>(new JECBatchLevel(filename));
+
+      // The cache is looked up before reading the text payload: a hit only costs a stat and a mmap
+      char* path = realpath(filename.c_str(), NULL);
+      const uint64_t key = cacheKey(path ? path : filename, info);
+      free(path);
+
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), ".%016llx.jecbin", (unsigned long long) key);
+      const std::string cacheFile = directory + "/" + filename.substr(filename.find_last_of('/') + 1) + suffix;
+
+      std::shared_ptr<const JECBatchLevel> level;
+
+      int fd = open(cacheFile.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (data != MAP_FAILED) {
+            level.reset(JECBatchLevel::fromBinary(static_cast<const char*>(data), st.st_size, key));
+            munmap(data, st.st_size);
+          }
+        }
+        close(fd);
+      }
+
+      if (level.get())
+        return level;
+
+      level.reset(new JECBatchLevel(filename));
+
+      // Write the cache through a temporary file, so that concurrent jobs never see a partial file.
+      // Failures are not fatal: the payload will simply be parsed again next time
+      std::stringstream tmpFile;
+      tmpFile << cacheFile << "." << getpid();
+
+      std::ofstream out(tmpFile.str().c_str(), std::ios::binary);
+      if (out.good()) {
+        const std::string data = level->toBinary(key);
+        out.write(data.c_str(), data.size());
+        out.close();
+
+        if (! out.good() || rename(tmpFile.str().c_str(), cacheFile.c_str()) != 0)
+          remove(tmpFile.str().c_str());
+      }
+
+      return level;
+    }
+};
+
+class JECBatchCorrector {
+  public:
+    JECBatchCorrector() {}
+
+    // Payloads must be given in the order they are applied, like for FactorizedJetCorrector
+    explicit JECBatchCorrector(const std::vector<std::string>& payloads) {
+      for (const std::string& payload: payloads)
+        addLevel(payload);
+    }
+
+    void addLevel(const std::string& payload) {
+      mLevels.push_back(JECPayloadCache::getLevel(payload));
+    }
+
+    bool empty() const {
+      return mLevels.empty();
+    }
+
+    bool usesVariable(JECBatchLevel::Variable variable) const {
+      for (const std::shared_ptr<const JECBatchLevel>& level: mLevels) {
+        if (level->uses(variable))
+          return true;
+      }
+
+      return false;
+    }
+
+    // True if all levels are binned in variable and none of their formulas depends on it
+    bool binnedIn(JECBatchLevel::Variable variable) const {
+      for (const std::shared_ptr<const JECBatchLevel>& level: mLevels) {
+        if (level->binVariable() != variable)
+          return false;
+        if (std::find(level->variables().begin(), level->variables().end(), variable) != level->variables().end())
+          return false;
+      }
+
+      return ! mLevels.empty();
+    }
+
+    // Sorted union of the bin edges of all levels. The full correction
+    // doesn't depend on the binning variable between two consecutive edges.
+    std::vector<float> binEdges() const {
+      std::vector<float> edges;
+      for (const std::shared_ptr<const JECBatchLevel>& level: mLevels) {
+        edges.insert(edges.end(), level->binMin().begin(), level->binMin().end());
+        edges.insert(edges.end(), level->binMax().begin(), level->binMax().end());
+      }
+
+      std::sort(edges.begin(), edges.end());
+      edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+      return edges;
+    }
+
+    // Full correction factor for each jet of the batch
+    void getCorrections(const JECJetBatch& jets, std::vector<float>& corrections) const {
+      corrections.assign(jets.size(), 1.);
+      if (jets.size() == 0)
+        return;
+
+      std::vector<float> pt(jets.pt);
+      std::vector<float> scale;
+
+      for (const std::shared_ptr<const JECBatchLevel>& level: mLevels) {
+        level->evaluate(jets, pt, scale);
+        for (size_t i = 0; i < jets.size(); i++) {
+          corrections[i] *= scale[i];
+          pt[i] *= scale[i];
+        }
+      }
+    }
+
+    float getCorrection(float eta, float pt, float rho, float area, float npv = 0.) const {
+      JECJetBatch jet;
+      jet.push_back(eta, pt, rho, area, npv);
+
+      std::vector<float> corrections;
+      getCorrections(jet, corrections);
+
+      return corrections[0];
+    }
+
+    // Reference implementation: evaluate the batch one jet at a time with a FactorizedJetCorrector
+    template<typename Corrector>
+      static void getScalarCorrections(Corrector& corrector, const JECJetBatch& jets, std::vector<float>& corrections) {
+        corrections.resize(jets.size());
+        for (size_t i = 0; i < jets.size(); i++) {
+          corrector.setJetEta(jets.eta[i]);
+          corrector.setJetPt(jets.pt[i]);
+          corrector.setRho(jets.rho[i]);
+          corrector.setJetA(jets.area[i]);
+          corrector.setNPV(jets.npv[i]);
+          corrections[i] = corrector.getCorrection();
+        }
+      }
+
+    // Maximal relative difference with the scalar corrector over the validation sample
+    template<typename Corrector>
+      double maxDeviation(Corrector& corrector) const {
+        JECJetBatch jets = validationSample();
+
+        std::vector<float> batch;
+        std::vector<float> scalar;
+        getCorrections(jets, batch);
+        getScalarCorrections(corrector, jets, scalar);
+
+        double deviation = 0.;
+        for (size_t i = 0; i < jets.size(); i++) {
+          double reference = std::max(std::fabs(scalar[i]), 1e-6f);
+          deviation = std::max(deviation, std::fabs(batch[i] - scalar[i]) / reference);
+        }
+
+        return deviation;
+      }
+
+    // Jets spanning the phase space of the Winter14 payloads
+    static JECJetBatch validationSample() {
+      JECJetBatch jets;
+      for (float eta = -5.15; eta < 5.2; eta += 0.13) {
+        for (float logPt = std::log(3.); logPt < std::log(5000.); logPt += 0.35) {
+          for (float rho = 0.; rho <= 45.; rho += 7.5) {
+            for (float area = 0.1; area < 1.; area += 0.3) {
+              jets.push_back(eta, std::exp(logPt), rho, area, 1 + rho);
+            }
+          }
+        }
+      }
+
+      return jets;
+    }
+
+  private:
+    // Levels are shared between correctors using the same payloads
+    std::vector<std::shared_ptr<const JECBatchLevel>> mLevels;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+// Luminosity mask and per lumi section luminosity / pileup lookup for data.
+//
+// Valid lumi sections are stored, for each run, as a sorted list of disjoint
+// [first, last] intervals, searched with a binary search. Luminosity and true
+// pileup are stored in a single vector sorted by (run, lumi section).
+//
+// The CSV file produced by lumiCalc2 can be large (one line per lumi section
+// for a whole year), so its parsed content can be cached in a binary file
+// next to it (<csv>.cache). The cache is rebuilt when the size or the
+// modification time of the CSV file changes.
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class LumiIndex {
+  public:
+    // Good lumi sections, from a JSON file in the usual CMS format
+    void readJSON(const std::string& filename);
+
+    // Recorded luminosity and true pileup, from a 'lumiCalc2.py lumibyls' CSV file
+    void readCSV(const std::string& filename, bool useCache = true);
+
+    bool isValidRun(uint32_t run) const;
+    bool isValid(uint32_t run, uint32_t lumiSection) const;
+
+    // Both return 0 for lumi sections not present in the CSV file
+    double luminosity(uint32_t run, uint32_t lumiSection) const;
+    double truePileup(uint32_t run, uint32_t lumiSection) const;
+
+  private:
+    struct Interval {
+      uint32_t first;
+      uint32_t last;
+    };
+
+    struct LumiSection {
+      uint64_t key;
+      double luminosity;
+      double truePileup;
+    };
+
+    static uint64_t key(uint32_t run, uint32_t lumiSection) {
+      return (static_cast<uint64_t>(run) << 32) | lumiSection;
+    }
+
+    const LumiSection* find(uint32_t run, uint32_t lumiSection) const;
+
+    void parseCSV(const std::string& filename);
+    bool readCache(const std::string& filename, uint64_t size, int64_t mtime);
+    void writeCache(const std::string& filename, uint64_t size, int64_t mtime) const;
+
+    std::unordered_map<uint32_t, std::vector<Interval>> mValidLumiSections;
+    std::vector<LumiSection> mLumiSections;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+// Output tree of GammaJetFilter.
+//
+// In the default layout, an OutputTree is a plain TTree and branches are
+// created or updated exactly like TTree::Branch / TBranch::SetAddress would.
+//
+// In the wide layout, several OutputTrees are views on one shared TTree (one
+// tree for the event, one per jet collection). Each view prefixes its branch
+// names (first_jet_pt, met_raw_pt, ...), and only the view filled last in an
+// event fills the shared tree. Branch addresses usually point to local
+// variables which are gone by then, so each view copies the current values
+// into buffers it owns when it is filled.
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <TBranch.h>
+#include <TTree.h>
+
+class OutputTree {
+  public:
+    // Standalone tree
+    explicit OutputTree(TTree* tree);
+
+    // View on a shared tree. If fillsTree is true, Fill() also fills the shared tree
+    OutputTree(TTree* tree, const std::string& prefix, bool fillsTree);
+
+    TTree* tree() const {
+      return mTree;
+    }
+
+    const std::string& prefix() const {
+      return mPrefix;
+    }
+
+    void updateBranch(void* address, const std::string& name, const std::string& type = "F");
+    void updateBranchArray(void* address, const std::string& name, const std::string& size, const std::string& type = "F");
+
+    // Object branches (std::vector, TLorentzVector, TClonesArray, ...). T must be copy-assignable
+    template<typename T>
+      void updateObjectBranch(T*& address, const std::string& name, int bufsize = 32000, int splitlevel = 99);
+
+    void Fill();
+
+    // Compression settings of a file for an algorithm name ("zlib", "lzma" or
+    // "lz4") and a level. -1 if the algorithm is unknown.
+    static int compressionSettings(const std::string& algorithm, int level) {
+      static const std::map<std::string, int> algorithms = {{"zlib", 1}, {"lzma", 2}, {"lz4", 4}};
+
+      std::map<std::string, int>::const_iterator it = algorithms.find(algorithm);
+      if (it == algorithms.end() || level < 0 || level > 9)
+        return -1;
+
+      return it->second * 100 + level;
+    }
+
+  private:
+    struct Field {
+      const void* source;
+      TBranch* branch;
+
+      // Leaf branches
+      size_t typeSize;
+      std::vector<char> buffer;
+      const Field* count;
+
+      // Object branches
+      std::shared_ptr<void> object;
+      void* objectAddress;
+      void (*copyObject)(void* to, const void* from);
+    };
+
+    Field* findField(const std::string& name);
+    Field& createField(const std::string& name, const void* source);
+
+    static size_t typeSize(const std::string& type);
+
+    template<typename T>
+      static void copyObject(void* to, const void* from) {
+        *static_cast<T*>(to) = *static_cast<const T*>(from);
+      }
+
+    TTree* mTree;
+    std::string mPrefix;
+    bool mFillsTree;
+    bool mShared;
+
+    // Fields are copied in creation order, so that counts are always copied before their arrays
+    std::deque<Field> mFields;
+    std::map<std::string, size_t> mFieldIndexes;
+};
+
+template<typename T>
+void OutputTree::updateObjectBranch(T*& address, const std::string& name, int bufsize/* = 32000*/, int splitlevel/* = 99*/) {
+  if (! mShared) {
+    TBranch* branch = mTree->GetBranch(name.c_str());
+    if (branch == NULL) {
+      branch = mTree->Branch(name.c_str(), &address, bufsize, splitlevel);
+    } else {
+      branch->SetAddress(&address);
+    }
+
+    return;
+  }
+
+  Field* field = findField(name);
+  if (field) {
+    field->source = address;
+    return;
+  }
+
+  Field& newField = createField(name, address);
+
+  // Copy construct the buffer, so that it gets the same setup as the source (class of a TClonesArray, ...)
+  newField.object.reset(new T(*address));
+  newField.objectAddress = newField.object.get();
+  newField.copyObject = &OutputTree::copyObject<T>;
+  newField.branch = mTree->Branch((mPrefix + name).c_str(), reinterpret_cast<T**>(&newField.objectAddress), bufsize, splitlevel);
+}
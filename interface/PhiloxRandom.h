@@ -0,0 +1,100 @@
+#pragma once
+
+// Counter-based random generator (Philox4x32-10, Salmon et al., SC'11).
+//
+// Numbers are not drawn from an evolving state: the i-th number of a stream
+// is a fixed function of (seed, stream, i). A stream is selected with
+// SetStream(run, lumi, event, purpose, object), so the numbers used for an
+// event do not depend on the events processed before it, on job splitting,
+// on the number of threads or on the order of the other draws of the event.
+//
+// The draw index and the stream identifiers form the 128 bits counter, the
+// event number and the seed the 64 bits key.
+
+#include <TRandom.h>
+
+#include <stdint.h>
+
+class PhiloxRandom: public TRandom {
+  public:
+    // What the numbers are used for. Different purposes get independent streams for the same event
+    enum Purpose {
+      MC_TRIGGER = 1,
+      PHOTON_SMEARING = 2
+    };
+
+    PhiloxRandom(uint32_t seed = 0) {
+      mSeed = seed;
+      SetStream(0, 0, 0, 0);
+    }
+
+    // Start the stream of an object of an event, for a purpose
+    void SetStream(uint32_t run, uint32_t lumi, uint64_t event, uint16_t purpose, uint16_t object = 0) {
+      mCounter[0] = 0;
+      mCounter[1] = ((uint32_t) purpose << 16) | object;
+      mCounter[2] = lumi;
+      mCounter[3] = run;
+      mKey[0] = (uint32_t) event;
+      mKey[1] = (uint32_t) (event >> 32) ^ mSeed;
+      mUsed = 4;
+    }
+
+    // Uniform in ]0, 1[, with 32 bits of precision like TRandom3
+    virtual Double_t Rndm(Int_t = 0) {
+      if (mUsed == 4) {
+        philox(mCounter, mKey, mBlock);
+        mCounter[0]++;
+        mUsed = 0;
+      }
+
+      return (mBlock[mUsed++] + 0.5) * (1. / 4294967296.);
+    }
+
+    virtual void RndmArray(Int_t n, Float_t* array) {
+      for (Int_t i = 0; i < n; i++)
+        array[i] = Rndm();
+    }
+
+    virtual void RndmArray(Int_t n, Double_t* array) {
+      for (Int_t i = 0; i < n; i++)
+        array[i] = Rndm();
+    }
+
+    // The seed is mixed in the key. The current stream is restarted
+    virtual void SetSeed(UInt_t seed = 0) {
+      mKey[1] ^= mSeed ^ seed;
+      mSeed = seed;
+      mCounter[0] = 0;
+      mUsed = 4;
+    }
+
+    static void philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+      uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+      uint32_t k[2] = {key[0], key[1]};
+
+      for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t) 0xD2511F53 * c[0];
+        uint64_t p1 = (uint64_t) 0xCD9E8D57 * c[2];
+
+        uint32_t next[4] = {
+          (uint32_t) (p1 >> 32) ^ c[1] ^ k[0],
+          (uint32_t) p1,
+          (uint32_t) (p0 >> 32) ^ c[3] ^ k[1],
+          (uint32_t) p0
+        };
+        c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+      }
+
+      out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = c[3];
+    }
+
+  private:
+    uint32_t mSeed;
+    uint32_t mKey[2];
+    uint32_t mCounter[4];
+    uint32_t mBlock[4];
+    int mUsed;
+};
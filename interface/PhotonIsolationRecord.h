@@ -0,0 +1,43 @@
+#pragma once
+
+// Isolations and footprint MET correction of a photon, produced at PAT level
+// by PhotonIsolationProducer as a single edm::ValueMap<PhotonIsolationRecord>
+// (label photonPFIsolation, empty instance).
+//
+// Footprint quantities of photons failing the producer preselection are set
+// to -999 (isolations, random cone) and their footprint MET is the raw MET.
+
+struct PhotonIsolationRecord {
+  PhotonIsolationRecord():
+    chargedHadronsIsolation(0), neutralHadronsIsolation(0), photonIsolation(0), hasMatchedPromptElectron(false),
+    footprintChargedIsolation(0), footprintChargedIsolationPrimaryVertex(0), footprintNeutralIsolation(0), footprintPhotonIsolation(0),
+    randomConeChargedIsolation(0), randomConeChargedIsolationPrimaryVertex(0), randomConeNeutralIsolation(0), randomConePhotonIsolation(0),
+    randomConeEta(0), randomConePhi(0), randomConeIsOK(false),
+    footprintPx(0), footprintPy(0), footprintMExCorr(0), footprintMEyCorr(0) {}
+
+  // PFIsolationEstimator, 0.3 cone
+  float chargedHadronsIsolation;
+  float neutralHadronsIsolation;
+  float photonIsolation;
+  bool hasMatchedPromptElectron;
+
+  // SuperClusterFootprintRemoval
+  float footprintChargedIsolation;
+  float footprintChargedIsolationPrimaryVertex;
+  float footprintNeutralIsolation;
+  float footprintPhotonIsolation;
+
+  float randomConeChargedIsolation;
+  float randomConeChargedIsolationPrimaryVertex;
+  float randomConeNeutralIsolation;
+  float randomConePhotonIsolation;
+  float randomConeEta;
+  float randomConePhi;
+  bool randomConeIsOK;
+
+  // Sum of the PF candidates removed from the MET, and MET without them
+  float footprintPx;
+  float footprintPy;
+  float footprintMExCorr;
+  float footprintMEyCorr;
+};
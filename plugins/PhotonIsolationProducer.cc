@@ -1,4 +1,5 @@
 // system include files
+#include <algorithm>
 #include <memory>
 #include <iostream>
 #include <string>
@@ -22,8 +23,21 @@
 
 #include "PFIsolation/SuperClusterFootprintRemoval/interface/SuperClusterFootprintRemoval.h"
 
+#include "JetMETCorrections/GammaJetFilter/interface/EtaPhiGrid.h"
+#include "JetMETCorrections/GammaJetFilter/interface/PhotonIsolationRecord.h"
+
 using namespace std;
 
+// PF candidates given to the isolation estimator: its cone is 0.3 around the
+// photon, and directions are recomputed from the vertex, so keep a margin
+static const double ISOLATION_SEARCH_RADIUS = 0.6;
+
+// Distance between seeds for a supercluster to overlap with the photon one
+static const double SUPERCLUSTER_SEARCH_RADIUS = 0.2;
+
+// Footprint isolations and random cone of photons failing the preselection
+static const double FOOTPRINT_SENTINEL = -999.;
+
 class PhotonIsolationProducer : public edm::EDProducer {
   public:
     explicit PhotonIsolationProducer(const edm::ParameterSet&);
@@ -34,44 +48,53 @@ class PhotonIsolationProducer : public edm::EDProducer {
     virtual void produce(edm::Event&, const edm::EventSetup&);
     virtual void endJob() ;
 
+    bool passPreselection(const pat::Photon& photon) const;
+
     // ----------member data --------------------------
     edm::InputTag src_;
 
     // Photon ID
     PFIsolationEstimator mPFIsolator;
+
+    // Footprint isolations, random cone and footprint MET are only computed for
+    // photons passing this preselection. Disabled by default
+    bool mDoPreselection;
+    double mPreselectionMaxAbsEta;
+    double mPreselectionMaxHadTowOverEm;
+    double mPreselectionMaxSigmaIetaIeta;
+
+    // Per event indexes of PF candidates, PF photon superclusters and electron superclusters
+    EtaPhiGrid mPFCandidatesGrid;
+    EtaPhiGrid mPFPhotonSCGrid;
+    EtaPhiGrid mElectronSCGrid;
+
+    std::vector<unsigned int> mNeighbourCells;
+
+    // PFIsolationEstimator only reads a PFCandidateCollection: the PF candidates of a
+    // grid cell are gathered the first time a photon needs them, then shared by all
+    // the photons of the event around this cell
+    std::vector<reco::PFCandidateCollection> mCellPFCandidates;
+    std::vector<bool> mCellPFCandidatesFilled;
 };
 
-PhotonIsolationProducer::PhotonIsolationProducer(const edm::ParameterSet& iConfig)
+PhotonIsolationProducer::PhotonIsolationProducer(const edm::ParameterSet& iConfig):
+  mPFCandidatesGrid(ISOLATION_SEARCH_RADIUS), mPFPhotonSCGrid(SUPERCLUSTER_SEARCH_RADIUS), mElectronSCGrid(SUPERCLUSTER_SEARCH_RADIUS),
+  mCellPFCandidates(mPFCandidatesGrid.cellCount())
 {
   src_= iConfig.getParameter<edm::InputTag>("src");
 
+  const edm::ParameterSet& preselection = iConfig.getUntrackedParameter<edm::ParameterSet>("preselection", edm::ParameterSet());
+  mDoPreselection = preselection.getUntrackedParameter<bool>("enable", false);
+  mPreselectionMaxAbsEta = preselection.getUntrackedParameter<double>("maxAbsEta", 1.3);
+  mPreselectionMaxHadTowOverEm = preselection.getUntrackedParameter<double>("maxHadTowOverEm", 0.05);
+  mPreselectionMaxSigmaIetaIeta = preselection.getUntrackedParameter<double>("maxSigmaIetaIeta", 0.011);
+
   mPFIsolator.initializePhotonIsolation(true);
   mPFIsolator.setConeSize(0.3);
 
-  produces<edm::ValueMap<double>>("chargedHadronsIsolation");
-  produces<edm::ValueMap<double>>("photonIsolation");
-  produces<edm::ValueMap<double>>("neutralHadronsIsolation");
-  produces<edm::ValueMap<bool>>("hasMatchedPromptElectron");
-  //Footprint
-  produces<edm::ValueMap<double>>("footchargediso");
-  produces<edm::ValueMap<double>>("footchargedisoprimvtx");
-  produces<edm::ValueMap<double>>("footneutraliso");
-  produces<edm::ValueMap<double>>("footphotoniso");
-  produces<edm::ValueMap<double>>("footchargedisorcone");
-  produces<edm::ValueMap<double>>("footchargedisoprimvtxrcone");  
-  produces<edm::ValueMap<double>>("footneutralisorcone");
-  produces<edm::ValueMap<double>>("footphotonisorcone");
-  produces<edm::ValueMap<double>>("footetarcone");
-  produces<edm::ValueMap<double>>("footphircone");
-  produces<edm::ValueMap<bool>>("footrconeisOK");
-  //  produces<edm::ValueMap<std::vector<int>>>("footpfcandindexfootprint");
- produces<edm::ValueMap<double>>("footprintPx");
- produces<edm::ValueMap<double>>("footprintPy");
- produces<edm::ValueMap<double>>("footprintMExCorr");
- produces<edm::ValueMap<double>>("footprintMEyCorr");
-//
- produces<double>("footprintMExraw");
- produces<double>("footprintMEyraw");
+  produces<edm::ValueMap<PhotonIsolationRecord>>();
+  produces<double>("footprintMExraw");
+  produces<double>("footprintMEyraw");
 }
 
 
@@ -83,75 +106,8 @@ PhotonIsolationProducer::~PhotonIsolationProducer()
 // ------------ method called to produce the data  ------------
 void PhotonIsolationProducer::produce(edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
-  std::auto_ptr<edm::ValueMap<double>> chIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler chFiller(*chIsoMap);
-
-  std::auto_ptr<edm::ValueMap<double>> phIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler phFiller(*phIsoMap);
-
-  std::auto_ptr<edm::ValueMap<double>> nhIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler nhFiller(*nhIsoMap);
-
-  std::auto_ptr<edm::ValueMap<bool>> promptConvMap(new edm::ValueMap<bool>());
-  edm::ValueMap<bool>::Filler promptConvFiller(*promptConvMap);
-
-  //foot
-
-  std::auto_ptr<edm::ValueMap<double>> footChIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footchIsoFiller(*footChIsoMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footChIsoPVMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footchIsoPVFiller(*footChIsoPVMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footNIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footnIsoFiller(*footNIsoMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footPhIsoMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footphIsoFiller(*footPhIsoMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footChIsoRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footchIsoRconeFiller(*footChIsoRconeMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footChIsoPVRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footchIsoPVRconeFiller(*footChIsoPVRconeMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footNIsoRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footnIsoRconeFiller(*footNIsoRconeMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footPhIsoRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footphIsoRconeFiller(*footPhIsoRconeMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footEtaRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footEtaRconeFiller(*footEtaRconeMap);
-
-  std::auto_ptr<edm::ValueMap<double>> footPhiRconeMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler footPhiRconeFiller(*footPhiRconeMap);
-
-  std::auto_ptr<edm::ValueMap<bool>> footRconeOKMap(new edm::ValueMap<bool>());
-  edm::ValueMap<bool>::Filler footRconeOKFiller(*footRconeOKMap);
-
-  std::auto_ptr<edm::ValueMap<double>> FootPxMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler FootPxFiller(*FootPxMap);
-
-  std::auto_ptr<edm::ValueMap<double>> FootPyMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler FootPyFiller(*FootPyMap);
-
-  std::auto_ptr<edm::ValueMap<double>> FootprintMExMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler FootprintMExFiller(*FootprintMExMap);
-
-  std::auto_ptr<edm::ValueMap<double>> FootprintMEyMap(new edm::ValueMap<double>());
-  edm::ValueMap<double>::Filler FootprintMEyFiller(*FootprintMEyMap);
-
   std::auto_ptr<double> MExraw(new double(0.));
   std::auto_ptr<double> MEyraw(new double(0.));
-/*
-std::auto_ptr<float> px(new float(0.));
-std::auto_ptr<float> py(new float(0.));
-std::auto_ptr<float> FootprintMEx(new float(0.));
-std::auto_ptr<float> FootprintMEy(new float(0.));
-*/
-  /*  std::auto_ptr<edm::ValueMap<std::vector<int>>> footPFcandIdxFPrintMap(new edm::ValueMap<std::vector<int>>());
-      edm::ValueMap<std::vector<int>>::Filler footPFcIdxFPFiller(*footPFcandIdxFPrintMap);*/
 
   edm::Handle<pat::PhotonCollection> photonsHandle;
   iEvent.getByLabel(src_, photonsHandle);
@@ -189,268 +145,219 @@ std::auto_ptr<float> FootprintMEy(new float(0.));
   if (vertexCollection->empty())
     return;
 
-  std::vector<double> chIsoValues;
-  std::vector<double> phIsoValues;
-  std::vector<double> nhIsoValues;
-  std::vector<bool>   promptConvValues;
-  chIsoValues.reserve(photonsHandle->size());
-  phIsoValues.reserve(photonsHandle->size());
-  nhIsoValues.reserve(photonsHandle->size());
-  promptConvValues.reserve(photonsHandle->size());
-
-  //foot
-  std::vector<double> footChIsovalues;
-  std::vector<double> footChIsoPVValues;
-  std::vector<double> footNIsoValues;
-  std::vector<double> footPhIsoValues;
-  std::vector<double> footChIsoRconeValues;
-  std::vector<double> footChIsoPVRconeValues;
-  std::vector<double> footNIsoRconeValues;
-  std::vector<double> footPhIsoRconeValues;
-  std::vector<double> footEtaRconeValues;
-  std::vector<double> footPhiRconeValues;
-  std::vector<bool> footRconeOKValues;
-  std::vector<double> footPxValues;
-  std::vector<double> footPyValues;
-  std::vector<double> footFootprintMExValues;
-  std::vector<double> footFootprintMEyValues;
-
-  //  std::vector<std::vector<int>>  footPFcandIdxFPrint;
-  footChIsovalues.reserve(photonsHandle->size());
-  footChIsoPVValues.reserve(photonsHandle->size());
-  footNIsoValues.reserve(photonsHandle->size());
-  footPhIsoValues.reserve(photonsHandle->size());
-  footChIsoRconeValues.reserve(photonsHandle->size());
-  footChIsoPVRconeValues.reserve(photonsHandle->size());
-  footNIsoRconeValues.reserve(photonsHandle->size());
-  footPhIsoRconeValues.reserve(photonsHandle->size());
-  footEtaRconeValues.reserve(photonsHandle->size());
-  footPhiRconeValues.reserve(photonsHandle->size());
-  footRconeOKValues.reserve(photonsHandle->size());
-  footPxValues.reserve(photonsHandle->size());
-  footPyValues.reserve(photonsHandle->size());
-  footFootprintMExValues.reserve(photonsHandle->size());
-  footFootprintMEyValues.reserve(photonsHandle->size());
-
- //  footPFcandIdxFPrint.reserve(photonsHandle->size());
-
-  SuperClusterFootprintRemoval remover(iEvent,iSetup);
-  PFIsolation_struct PFIso_struct;
-
-  double px;
-  double py;
-  double FootprintMEx;
-  double FootprintMEy;
-
-/*
-  edm::EventID eventId = iEvent.id();
-  int event = eventId.event();
-  int run = eventId.run();
-  int lumiBlock = eventId.luminosityBlock();
-*/
-
-  pat::PhotonCollection::const_iterator it = photonsHandle->begin();
-  for (; it != photonsHandle->end(); ++it) {
+  std::vector<PhotonIsolationRecord> records;
+  records.reserve(photonsHandle->size());
 
-  *MExraw=0.;
-  *MEyraw=0.;
-  px=0.;
-  py=0.;
-  FootprintMEx=0.;
-  FootprintMEy=0.;
- //
-   pat::Photon photon = *it;
-    reco::SuperClusterRef scref = photon.superCluster();
+  // Only created if a photon passes the preselection
+  std::unique_ptr<SuperClusterFootprintRemoval> remover;
+  PFIsolation_struct PFIso_struct;
 
-    promptConvValues.push_back(ConversionTools::hasMatchedPromptElectron(photon.superCluster(), hElectrons, hConversions, beamspot.position()));
-
-    mPFIsolator.fGetIsolation(&photon, &pfCandidates, vertexRef, vertexCollection);
-
-    chIsoValues.push_back(mPFIsolator.getIsolationCharged());
-    phIsoValues.push_back(mPFIsolator.getIsolationPhoton());
-    nhIsoValues.push_back(mPFIsolator.getIsolationNeutral());
-
-   PFIso_struct = remover.PFIsolation(scref,edm::Ptr<Vertex>(vertexCollection,0));
-
-   footChIsovalues.push_back(PFIso_struct.chargediso);
-   footChIsoPVValues.push_back(PFIso_struct.chargediso_primvtx);
-   footNIsoValues.push_back(PFIso_struct.neutraliso);
-   footPhIsoValues.push_back(PFIso_struct.photoniso);
-   footChIsoRconeValues.push_back(PFIso_struct.chargediso_rcone);
-   footChIsoPVRconeValues.push_back(PFIso_struct.chargediso_primvtx_rcone);
-   footNIsoRconeValues.push_back(PFIso_struct.neutraliso_rcone);
-   footPhIsoRconeValues.push_back(PFIso_struct.photoniso_rcone);
-   footEtaRconeValues.push_back(PFIso_struct.eta_rcone);
-   footPhiRconeValues.push_back(PFIso_struct.phi_rcone);
-   footRconeOKValues.push_back(PFIso_struct.rcone_isOK);
-// initialize alternative calculation of raw met
-
-//calculate pfcandidates to remove from met calculation
-//already stored in the footprint
-std::set<int> PFCandsToRemove;
-for (unsigned int i=0; i<PFIso_struct.pfcandindex_footprint.size(); i++) PFCandsToRemove.insert(PFIso_struct.pfcandindex_footprint.at(i)); 
-//look if there is an overlapping photon in the pfCands list
-reco::SuperCluster* phsc = (reco::SuperCluster*)(photon.superCluster()).get();
-reco::SuperCluster* pfCsc=0;
-reco::SuperCluster* elsc=0;
-edm::Ptr<reco::CaloCluster> pfCcc;
-edm::Ptr<reco::CaloCluster> phcc = phsc->seed();
-for(unsigned int i=0; i<pfCandidates.size(); ++i ) {
-   if ((pfCandidates)[i].particleId()==reco::PFCandidate::gamma){
-   if ((pfCandidates)[i].mva_nothing_gamma()>0.){
-   if(((pfCandidates)[i].superClusterRef()).isNonnull()) {
-     pfCsc = (reco::SuperCluster*)((pfCandidates)[i].superClusterRef()).get();
-     pfCcc = pfCsc->seed();
-//       if(sqrt(pow((pfCcc->eta()-phcc->eta()),2)+pow((pfCcc->phi()-phcc->phi()),2))<0.001 && fabs(pfCsc->rawEnergy()-phsc->rawEnergy())<0.001) {
-       if( fabs(pfCsc->rawEnergy())/cosh(pfCcc->eta())>20. && sqrt(pow((pfCcc->eta()-phcc->eta()),2)+pow((pfCcc->phi()-phcc->phi()),2))<0.2 && fabs((pfCsc->rawEnergy()-phsc->rawEnergy())/phsc->rawEnergy())<0.5) {
-        PFCandsToRemove.insert(i);
-       }
-      }//sc nonnull
+  // Per event indexes, built once and queried for each photon. Superclusters
+  // are indexed by the position of their seed, and only if they pass the Et
+  // cut of the footprint overlap removal, which doesn't depend on the photon
+  mPFCandidatesGrid.clear();
+  mPFPhotonSCGrid.clear();
+  mElectronSCGrid.clear();
+  mCellPFCandidatesFilled.assign(mCellPFCandidates.size(), false);
+  std::vector<unsigned int> pfElectrons;
+
+  // Raw MET is the same for all photons
+  for (unsigned int i = 0; i < pfCandidates.size(); ++i) {
+    const reco::PFCandidate& pfCandidate = pfCandidates[i];
+
+    *MExraw += -1. * pfCandidate.px();
+    *MEyraw += -1. * pfCandidate.py();
+
+    mPFCandidatesGrid.insert(pfCandidate.eta(), pfCandidate.phi(), i);
+
+    if (pfCandidate.particleId() == reco::PFCandidate::gamma && pfCandidate.mva_nothing_gamma() > 0. && pfCandidate.superClusterRef().isNonnull()) {
+      const reco::SuperCluster& pfCsc = *pfCandidate.superClusterRef();
+      const reco::CaloCluster& pfCcc = *pfCsc.seed();
+      if (fabs(pfCsc.rawEnergy()) / cosh(pfCcc.eta()) > 20.)
+        mPFPhotonSCGrid.insert(pfCcc.eta(), pfCcc.phi(), i);
     }
-   }
-  }
 
-//look if there is an overlapping electron
-bool foundEgSC = false;
-edm::Ptr<GsfElectron> elPtrSl;
-reco::GsfElectron  selected_electron;
-reco::GsfElectronCollection::const_iterator elit = hElectrons->begin();
- for (; elit != hElectrons->end(); ++elit) {
-   reco::GsfElectron electron = *elit;
-  if(electron.superCluster().isNonnull()) {
-     elsc = (reco::SuperCluster*)(electron.superCluster()).get();
-     edm::Ptr<reco::CaloCluster>  elcc = elsc->seed();
-//    if(sqrt(pow((elcc->eta()-phcc->eta()),2)+pow((elcc->phi()-phcc->phi()),2))<0.001 && (elsc->rawEnergy()-phsc->rawEnergy())<0.001){
-    if( fabs(elsc->rawEnergy())/cosh(elcc->eta())>20. && sqrt(pow((elcc->eta()-phcc->eta()),2)+pow((elcc->phi()-phcc->phi()),2))<0.2 && fabs((elsc->rawEnergy()-phsc->rawEnergy())/phsc->rawEnergy())<0.50){
-     selected_electron=electron;
-     foundEgSC=true;
-     break;
-     }
-    }//sc nonnull
-    }
-//now look for it in the pfcands list
-if (foundEgSC){
- double MVACut_ = -1.;
- for(unsigned int i=0; i< pfCandidates.size(); ++i ) {
-  if ((pfCandidates)[i].particleId()==reco::PFCandidate::e && (pfCandidates)[i].gsfTrackRef().isNull()==false && (pfCandidates)[i].mva_e_pi()>MVACut_){ 
-   if((pfCandidates)[i].gsfTrackRef()==selected_electron.gsfTrack()) {
-  PFCandsToRemove.insert(i);
-   }
+    double MVACut_ = -1.;
+    if (pfCandidate.particleId() == reco::PFCandidate::e && pfCandidate.gsfTrackRef().isNonnull() && pfCandidate.mva_e_pi() > MVACut_)
+      pfElectrons.push_back(i);
   }
- }
-}
-
-//re-loop over all pfcandidates
-for(unsigned int i=0; i<pfCandidates.size(); ++i ) {
-//fill alternative calculation of raw met
-*MExraw += -1.*(pfCandidates)[i].px();
-*MEyraw += -1.*(pfCandidates)[i].py();
-bool UseThisPfC=true;
-for(unsigned int v: PFCandsToRemove) {
-if(i==v) UseThisPfC=false;
-}
-if(UseThisPfC) {
-//calculatio of FootPrintMET
-FootprintMEx += -1.*(pfCandidates)[i].px();
-FootprintMEy += -1.*(pfCandidates)[i].py();
-}
-}
-
-//now loop over candidates to remove and sum up their px and py
-for(int v: PFCandsToRemove) {
-px+=(pfCandidates)[v].px();
-py+=(pfCandidates)[v].py();
-}
-//fill alternative met calc variables
-  footPxValues.push_back(px);
-  footPyValues.push_back(py);
-  footFootprintMExValues.push_back(FootprintMEx);
-  footFootprintMEyValues.push_back(FootprintMEy);
-}
-
-
-  chFiller.insert(photonsHandle, chIsoValues.begin(), chIsoValues.end());
-  chFiller.fill();
-  
-  phFiller.insert(photonsHandle, phIsoValues.begin(), phIsoValues.end());
-  phFiller.fill();
-  
-  nhFiller.insert(photonsHandle, nhIsoValues.begin(), nhIsoValues.end());
-  nhFiller.fill();
-  
-  promptConvFiller.insert(photonsHandle, promptConvValues.begin(), promptConvValues.end());
-  promptConvFiller.fill();
-
-  footchIsoFiller.insert(photonsHandle, footChIsovalues.begin(), footChIsovalues.end());
-  footchIsoFiller.fill();
-
-  footchIsoPVFiller.insert(photonsHandle, footChIsovalues.begin(), footChIsovalues.end());
-  footchIsoPVFiller.fill();
-
-  footnIsoFiller.insert(photonsHandle, footNIsoValues.begin(), footNIsoValues.end());
-  footnIsoFiller.fill();
 
-  footphIsoFiller.insert(photonsHandle, footPhIsoValues.begin(), footPhIsoValues.end());
-  footphIsoFiller.fill();
+  for (unsigned int i = 0; i < hElectrons->size(); ++i) {
+    const reco::GsfElectron& electron = (*hElectrons)[i];
+    if (electron.superCluster().isNull())
+      continue;
 
-  footchIsoRconeFiller.insert(photonsHandle, footChIsoRconeValues.begin(), footChIsoRconeValues.end());
-  footchIsoRconeFiller.fill();
+    const reco::SuperCluster& elsc = *electron.superCluster();
+    const reco::CaloCluster& elcc = *elsc.seed();
+    if (fabs(elsc.rawEnergy()) / cosh(elcc.eta()) > 20.)
+      mElectronSCGrid.insert(elcc.eta(), elcc.phi(), i);
+  }
 
-  footchIsoPVRconeFiller.insert(photonsHandle, footChIsoPVRconeValues.begin(), footChIsoPVRconeValues.end());
-  footchIsoPVRconeFiller.fill();
+  std::vector<bool> removePFCandidate(pfCandidates.size(), false);
+  std::vector<unsigned int> PFCandsToRemove;
 
-  footnIsoRconeFiller.insert(photonsHandle, footNIsoRconeValues.begin(), footNIsoRconeValues.end());
-  footnIsoRconeFiller.fill();
+  pat::PhotonCollection::const_iterator it = photonsHandle->begin();
+  for (; it != photonsHandle->end(); ++it) {
+    const pat::Photon& photon = *it;
+    reco::SuperClusterRef scref = photon.superCluster();
 
-  footphIsoRconeFiller.insert(photonsHandle, footPhIsoRconeValues.begin(), footPhIsoRconeValues.end());
-  footphIsoRconeFiller.fill();
+    PhotonIsolationRecord record;
+    record.hasMatchedPromptElectron = (ConversionTools::hasMatchedPromptElectron(photon.superCluster(), hElectrons, hConversions, beamspot.position()));
+
+    // Only the PF candidates of the cells around the photon can enter its isolation cone.
+    // Isolations are sums over the candidates, so each cell is given to the estimator in turn
+    record.chargedHadronsIsolation = 0.;
+    record.photonIsolation = 0.;
+    record.neutralHadronsIsolation = 0.;
+
+    mNeighbourCells.clear();
+    mPFCandidatesGrid.neighbourCells(photon.eta(), photon.phi(), mNeighbourCells);
+    for (unsigned int c: mNeighbourCells) {
+      reco::PFCandidateCollection& cellPFCandidates = mCellPFCandidates[c];
+      if (! mCellPFCandidatesFilled[c]) {
+        cellPFCandidates.clear();
+        for (unsigned int i: mPFCandidatesGrid.cell(c))
+          cellPFCandidates.push_back(pfCandidates[i]);
+        mCellPFCandidatesFilled[c] = true;
+      }
+
+      if (cellPFCandidates.empty())
+        continue;
+
+      mPFIsolator.fGetIsolation(&photon, &cellPFCandidates, vertexRef, vertexCollection);
+
+      record.chargedHadronsIsolation += mPFIsolator.getIsolationCharged();
+      record.photonIsolation += mPFIsolator.getIsolationPhoton();
+      record.neutralHadronsIsolation += mPFIsolator.getIsolationNeutral();
+    }
 
-  footEtaRconeFiller.insert(photonsHandle, footEtaRconeValues.begin(), footEtaRconeValues.end());
-  footEtaRconeFiller.fill();
+    if (! passPreselection(photon)) {
+      record.footprintChargedIsolation = FOOTPRINT_SENTINEL;
+      record.footprintChargedIsolationPrimaryVertex = FOOTPRINT_SENTINEL;
+      record.footprintNeutralIsolation = FOOTPRINT_SENTINEL;
+      record.footprintPhotonIsolation = FOOTPRINT_SENTINEL;
+      record.randomConeChargedIsolation = FOOTPRINT_SENTINEL;
+      record.randomConeChargedIsolationPrimaryVertex = FOOTPRINT_SENTINEL;
+      record.randomConeNeutralIsolation = FOOTPRINT_SENTINEL;
+      record.randomConePhotonIsolation = FOOTPRINT_SENTINEL;
+      record.randomConeEta = FOOTPRINT_SENTINEL;
+      record.randomConePhi = FOOTPRINT_SENTINEL;
+      record.randomConeIsOK = false;
+
+      // Nothing removed: footprint MET is the raw MET
+      record.footprintMExCorr = *MExraw;
+      record.footprintMEyCorr = *MEyraw;
+
+      records.push_back(record);
+      continue;
+    }
 
-  footPhiRconeFiller.insert(photonsHandle, footPhiRconeValues.begin(), footPhiRconeValues.end());
-  footPhiRconeFiller.fill();
+    if (! remover.get())
+      remover.reset(new SuperClusterFootprintRemoval(iEvent,iSetup));
+
+    PFIso_struct = remover->PFIsolation(scref,edm::Ptr<Vertex>(vertexCollection,0));
+
+    record.footprintChargedIsolation = PFIso_struct.chargediso;
+    record.footprintChargedIsolationPrimaryVertex = PFIso_struct.chargediso_primvtx;
+    record.footprintNeutralIsolation = PFIso_struct.neutraliso;
+    record.footprintPhotonIsolation = PFIso_struct.photoniso;
+    record.randomConeChargedIsolation = PFIso_struct.chargediso_rcone;
+    record.randomConeChargedIsolationPrimaryVertex = PFIso_struct.chargediso_primvtx_rcone;
+    record.randomConeNeutralIsolation = PFIso_struct.neutraliso_rcone;
+    record.randomConePhotonIsolation = PFIso_struct.photoniso_rcone;
+    record.randomConeEta = PFIso_struct.eta_rcone;
+    record.randomConePhi = PFIso_struct.phi_rcone;
+    record.randomConeIsOK = PFIso_struct.rcone_isOK;
+
+    // PF candidates to remove from the MET: the ones already in the footprint...
+    PFCandsToRemove.clear();
+    for (unsigned int i = 0; i < PFIso_struct.pfcandindex_footprint.size(); i++) {
+      unsigned int index = PFIso_struct.pfcandindex_footprint[i];
+      if (! removePFCandidate[index]) {
+        removePFCandidate[index] = true;
+        PFCandsToRemove.push_back(index);
+      }
+    }
 
-  footRconeOKFiller.insert(photonsHandle, footRconeOKValues.begin(), footRconeOKValues.end());
-  footRconeOKFiller.fill();
+    const reco::SuperCluster& phsc = *photon.superCluster();
+    const reco::CaloCluster& phcc = *phsc.seed();
+
+    // ... PF photons overlapping with the photon supercluster...
+    mNeighbourCells.clear();
+    mPFPhotonSCGrid.neighbourCells(phcc.eta(), phcc.phi(), mNeighbourCells);
+    for (unsigned int c: mNeighbourCells) {
+      for (unsigned int i: mPFPhotonSCGrid.cell(c)) {
+        const reco::SuperCluster& pfCsc = *pfCandidates[i].superClusterRef();
+        const reco::CaloCluster& pfCcc = *pfCsc.seed();
+        if (sqrt(pow((pfCcc.eta()-phcc.eta()),2)+pow((pfCcc.phi()-phcc.phi()),2))<0.2 && fabs((pfCsc.rawEnergy()-phsc.rawEnergy())/phsc.rawEnergy())<0.5 && ! removePFCandidate[i]) {
+          removePFCandidate[i] = true;
+          PFCandsToRemove.push_back(i);
+        }
+      }
+    }
 
+    // ... and the PF electrons of the first electron overlapping with it
+    int selected_electron = -1;
+    mNeighbourCells.clear();
+    mElectronSCGrid.neighbourCells(phcc.eta(), phcc.phi(), mNeighbourCells);
+    for (unsigned int c: mNeighbourCells) {
+      for (unsigned int i: mElectronSCGrid.cell(c)) {
+        const reco::GsfElectron& electron = (*hElectrons)[i];
+        const reco::SuperCluster& elsc = *electron.superCluster();
+        const reco::CaloCluster& elcc = *elsc.seed();
+        if (sqrt(pow((elcc.eta()-phcc.eta()),2)+pow((elcc.phi()-phcc.phi()),2))<0.2 && fabs((elsc.rawEnergy()-phsc.rawEnergy())/phsc.rawEnergy())<0.50) {
+          if (selected_electron < 0 || (int) i < selected_electron)
+            selected_electron = i;
+        }
+      }
+    }
 
-  FootPxFiller.insert(photonsHandle, footPxValues.begin(), footPxValues.end());
-  FootPxFiller.fill();
+    if (selected_electron >= 0) {
+      const reco::GsfTrackRef& electronTrack = (*hElectrons)[selected_electron].gsfTrack();
+      for (unsigned int i: pfElectrons) {
+        if (pfCandidates[i].gsfTrackRef() == electronTrack && ! removePFCandidate[i]) {
+          removePFCandidate[i] = true;
+          PFCandsToRemove.push_back(i);
+        }
+      }
+    }
 
-  FootPyFiller.insert(photonsHandle, footPyValues.begin(), footPyValues.end());
-  FootPyFiller.fill();
+    // Footprint MET is the raw MET without the removed candidates
+    double px = 0.;
+    double py = 0.;
+    std::sort(PFCandsToRemove.begin(), PFCandsToRemove.end());
+    for (unsigned int i: PFCandsToRemove) {
+      px += pfCandidates[i].px();
+      py += pfCandidates[i].py();
+      removePFCandidate[i] = false;
+    }
 
-  FootprintMExFiller.insert(photonsHandle, footFootprintMExValues.begin(), footFootprintMExValues.end());
-  FootprintMExFiller.fill();
+    record.footprintPx = px;
+    record.footprintPy = py;
+    record.footprintMExCorr = *MExraw + px;
+    record.footprintMEyCorr = *MEyraw + py;
 
-  FootprintMEyFiller.insert(photonsHandle, footFootprintMEyValues.begin(), footFootprintMEyValues.end());
-  FootprintMEyFiller.fill();
+    records.push_back(record);
+  }
 
+  std::auto_ptr<edm::ValueMap<PhotonIsolationRecord>> recordMap(new edm::ValueMap<PhotonIsolationRecord>());
+  edm::ValueMap<PhotonIsolationRecord>::Filler recordFiller(*recordMap);
+  recordFiller.insert(photonsHandle, records.begin(), records.end());
+  recordFiller.fill();
 
- 
-  iEvent.put(chIsoMap, "chargedHadronsIsolation");
-  iEvent.put(phIsoMap, "photonIsolation");
-  iEvent.put(nhIsoMap, "neutralHadronsIsolation");
-  iEvent.put(promptConvMap, "hasMatchedPromptElectron");
-
-  iEvent.put(footChIsoMap, "footchargediso");
-  iEvent.put(footChIsoPVMap, "footchargedisoprimvtx");
-  iEvent.put(footNIsoMap, "footneutraliso");
-  iEvent.put(footPhIsoMap, "footphotoniso");
-  iEvent.put(footChIsoRconeMap, "footchargedisorcone");
-  iEvent.put(footChIsoPVRconeMap, "footchargedisoprimvtxrcone");
-  iEvent.put(footNIsoRconeMap, "footneutralisorcone");
-  iEvent.put(footPhIsoRconeMap, "footphotonisorcone");
-  iEvent.put(footEtaRconeMap, "footetarcone");
-  iEvent.put(footPhiRconeMap, "footphircone");
-  iEvent.put(footRconeOKMap, "footrconeisOK");
-  iEvent.put(FootPxMap, "footprintPx");
-  iEvent.put(FootPyMap, "footprintPy");
+  iEvent.put(recordMap);
   iEvent.put(MExraw, "footprintMExraw");
   iEvent.put(MEyraw, "footprintMEyraw");
-  iEvent.put(FootprintMExMap, "footprintMExCorr");
-  iEvent.put(FootprintMEyMap, "footprintMEyCorr");
+}
+
+// Loose version of the photon ID applied by GammaJetFilter: photons failing it can't be selected
+bool PhotonIsolationProducer::passPreselection(const pat::Photon& photon) const {
+  if (! mDoPreselection)
+    return true;
+
+  return fabs(photon.eta()) <= mPreselectionMaxAbsEta &&
+    photon.hadTowOverEm() < mPreselectionMaxHadTowOverEm &&
+    photon.sigmaIetaIeta() < mPreselectionMaxSigmaIetaIeta;
 }
 
 // ------------ method called once each job just before starting event loop  ------------
@@ -1,8 +1,10 @@
 #include "../interface/EnergyScaleCorrection_class.h"
-#include <RooDataSet.h>
-#include <RooArgSet.h>
+#include "../interface/PhiloxRandom.h"
 
-#define NGENMAX 10000
+#include <boost/math/special_functions/erf.hpp>
+
+#include <atomic>
+#include <future>
 
 // for exit(0)
 #include <stdlib.h>
@@ -10,20 +12,59 @@
 #include <iomanip>
 //for istreamstring
 #include <sstream>
+#include <algorithm>
 
 //#define DEBUG
 
+namespace {
+  // Run fn(group) for all groups on up to nThreads threads. Groups are
+  // independent from each other, so the result doesn't depend on nThreads
+  template<typename F>
+  void forEachGroup(size_t nGroups, unsigned int nThreads, F fn){
+    std::atomic<size_t> next(0);
+    auto work = [&](){
+      for(size_t group = next++; group < nGroups; group = next++) fn(group);
+    };
+
+    std::vector<std::future<void> > workers;
+    for(size_t i = 1; i < std::min<size_t>(std::max(nThreads, 1U), nGroups); i++)
+      workers.push_back(std::async(std::launch::async, work));
+    work();
+    for(size_t i = 0; i < workers.size(); i++) workers[i].get();
+  }
+
+  // Electrons (2*entry+electron) grouped by category, in entry order in each group.
+  // Group 0 holds the electrons without category, group i+1 the ones of category i
+  std::vector<std::vector<size_t> > groupByCategory(const std::vector<int>& categories, size_t nCategories){
+    std::vector<std::vector<size_t> > groups(nCategories+1);
+    for(size_t i = 0; i < categories.size(); i++) groups[categories[i]+1].push_back(i);
+    return groups;
+  }
+
+  // Category in table of each electron (2*entry+electron), looked up in blocks of electrons on up to nThreads threads
+  std::vector<int> findCategories(const correctionTable_class& table, const std::vector<Int_t>& runNumber,
+				  const std::vector<Float_t>& etaEle, const std::vector<Float_t>& R9Ele,
+				  const std::vector<Float_t>& EtEle, unsigned int nThreads){
+    const size_t blockSize = 4096;
+    std::vector<int> categories(etaEle.size());
+    forEachGroup((categories.size()+blockSize-1)/blockSize, nThreads, [&](size_t block){
+	size_t end = std::min(categories.size(), (block+1)*blockSize);
+	for(size_t i = block*blockSize; i < end; i++)
+	  categories[i] = table.index(runNumber[i/2], etaEle[i], R9Ele[i], EtEle[i]);
+      });
+    return categories;
+  }
+}
+
 EnergyScaleCorrection_class::EnergyScaleCorrection_class(TString correctionFileName, 
 							 TString smearingFileName):
   noCorrections(true), noSmearings(true), 
   smearingType_(0),
   rgen_(NULL),
-  deltaM("\\Delta m",   "Bias",   0, -35, 10, "GeV/c^{2}"),
-  sigma(  "\\sigma_{CB}","Width", 2.14, 0.,  10.0, "GeV/c^{2}"),
-  cut(    "\\alpha",     "Cut",   1.424, 0.01, 5.0),
-  power(  "\\gamma",     "Power", 1.86, 0.5, 100.0),
-  x("x","",0,-50,100,"GeV/c^{2}"),
-  resCB("resCB", "A  Crystal Ball Lineshape", x, deltaM, sigma, cut, power)
+  nNotDefined_(0),
+  smearingSeed_(0),
+  cbMean_(0), cbAlpha_(1.424), cbPower_(1.86),
+  cbMin_(-50), cbMax_(100)
 {
   if(smearingFileName.Sizeof()>1) noSmearings=false;
   else noSmearings=true;
@@ -38,6 +79,7 @@ EnergyScaleCorrection_class::EnergyScaleCorrection_class(TString correctionFileN
       noCorrections=true;
       exit(1);
     }
+    scalesTable.build(scales, "scale correction");
   }
   
   if(!noSmearings){
@@ -47,6 +89,7 @@ EnergyScaleCorrection_class::EnergyScaleCorrection_class(TString correctionFileN
       noCorrections=true;
       exit(1);
     }
+    smearingsTable.build(smearings, "smearing");
   }
   rgen_=new TRandom3(0); // inizializzo il generatore con seed impostato sull'ora
 
@@ -54,36 +97,36 @@ EnergyScaleCorrection_class::EnergyScaleCorrection_class(TString correctionFileN
 }
 
 EnergyScaleCorrection_class::~EnergyScaleCorrection_class(void){
+  if(nNotDefined_>0) std::cerr << "[WARNING] " << nNotDefined_ << " lookups without any category" << std::endl;
   return;
 }
 
+const correctionValue_class& EnergyScaleCorrection_class::findCorrection(const correctionTable_class& table, int runNumber, float etaEle, float R9Ele, float EtEle){
+  const correctionValue_class *corr = table.find(runNumber, etaEle, R9Ele, EtEle);
+  if(corr!=NULL) return *corr;
+
+  // only the first ones are reported, the total is given at the end
+  if(nNotDefined_++ < 10){
+    std::cerr << "[WARNING] Category not found: " << std::endl;
+    std::cerr << correctionCategory_class(runNumber, etaEle, R9Ele, EtEle) << std::endl;
+  }
+  return notDefined_;
+}
+
 
 
   
 float EnergyScaleCorrection_class::getScaleOffset(int runNumber, bool isEBEle, double R9Ele, double etaSCEle, double EtEle){
   if(noCorrections) return 1;
   
-  correctionCategory_class category(runNumber, etaSCEle, R9Ele, EtEle);
-  correction_map_t::const_iterator corr_itr = scales.find(category);
-  if(corr_itr==scales.end()){ // if not in the standard classes, add it in the list of not defined classes
-    if(scales_not_defined.count(category)==0){
-      correctionValue_class corr;
-      scales_not_defined[category]=corr;
-    }
-    corr_itr = scales_not_defined.find(category);
-    std::cout << "[ERROR] Category not found: " << std::endl;
-    std::cout << category << std::endl;
-    //     exit(1);
-  }
+  const correctionValue_class& corr = findCorrection(scalesTable, runNumber, etaSCEle, R9Ele, EtEle);
 
 #ifdef DEBUG
-  std::cout << "[DEBUG] Checking correction for category: " << category << std::endl;
-  std::cout << "[DEBUG] Correction is: " << corr_itr->second
-	    << std::endl 
-    	    << "        given for category " <<  corr_itr->first << std::endl;;
+  std::cout << "[DEBUG] Checking correction for category: " << correctionCategory_class(runNumber, etaSCEle, R9Ele, EtEle) << std::endl;
+  std::cout << "[DEBUG] Correction is: " << corr << std::endl;
 #endif
 
-  return corr_itr->second.scale;
+  return corr.scale;
 
 }
 
@@ -93,17 +136,11 @@ void EnergyScaleCorrection_class::Add(TString category_, int runMin_, int runMax
   cat.runmin=runMin_;
   cat.runmax=runMax_;
 
-  if(scales.count(cat)!=0){
-    std::cerr << "[ERROR] Category already defined!" << std::endl;
-    std::cerr << "        Adding category:  " << cat << std::endl;
-    std::cerr << "        Defined category: " << scales[cat] << std::endl;
-    exit(1);
-  }
-
+  // overlapping categories are reported when building the table
   correctionValue_class corr;
   corr.scale=deltaP_;
   corr.scale_err=err_deltaP_;
-  scales[cat]=corr;
+  scales.push_back(std::make_pair(cat, corr));
 
   std::cout << "[INFO:scale correction] " << cat << corr << std::endl;
   return;
@@ -153,9 +190,10 @@ TTree *EnergyScaleCorrection_class::GetCorrTree(TChain *tree, bool fastLoop,
 						TString etaEleBranchName,
 						TString etaSCEleBranchName,
 						TString energySCEleBranchName,
-						TString nPVBranchName
+						TString nPVBranchName,
+						unsigned int nThreads
 						){
-  float nPVmean = 0;
+//   float nPVmean = 0;
 //   if(correctionType.Contains("nPV"))
 //     nPVmean = GetMean_nPV(tree, fastLoop,nPVBranchName);
 
@@ -188,6 +226,7 @@ TTree *EnergyScaleCorrection_class::GetCorrTree(TChain *tree, bool fastLoop,
   tree->SetBranchAddress(energySCEleBranchName,energySCEle_);
   tree->SetBranchAddress(R9EleBranchName, R9Ele_);
   Long64_t nentries = tree->GetEntries();
+  Long64_t step = std::max(nentries/100, 1LL);
 
 
 
@@ -195,18 +234,41 @@ TTree *EnergyScaleCorrection_class::GetCorrTree(TChain *tree, bool fastLoop,
 	    << "\t" << "with " << nentries << " entries" << std::endl;
   std::cerr << "[00%]";
 
-  // loop over tree 
+  // read the tree (serially, ROOT I/O isn't thread safe), then find the category of each electron (2*entry+electron)
+  std::vector<Int_t> runNumber(nentries);
+  std::vector<Float_t> etaEle(2*nentries), R9Ele(2*nentries), EtEle(2*nentries);
   for(Long64_t ientry = 0; ientry<nentries; ientry++){
     tree->GetEntry(ientry);
-    scaleEle_[0] = ScaleCorrection(runNumber_, fabs(etaSCEle_[0]) < 1.4442, 
-				   R9Ele_[0],etaEle_[0], energySCEle_[0]/cosh(etaSCEle_[0]), nPV_, nPVmean);
-    scaleEle_[1] = ScaleCorrection(runNumber_, fabs(etaSCEle_[1]) < 1.4442, 
-				   R9Ele_[1],etaEle_[1], energySCEle_[1]/cosh(etaSCEle_[1]), nPV_, nPVmean);
+    runNumber[ientry] = runNumber_;
+    for(int i = 0; i < 2; i++){
+      etaEle[2*ientry+i] = etaEle_[i];
+      R9Ele[2*ientry+i] = R9Ele_[i];
+      EtEle[2*ientry+i] = energySCEle_[i]/cosh(etaSCEle_[i]);
+    }
+    if(ientry%step==0) std::cerr << "\b\b\b\b" << std::setw(2) << ientry/step << "%]";
+  }
+  std::cerr << std::endl;
+
+  std::vector<int> categories = findCategories(scalesTable, runNumber, etaEle, R9Ele, EtEle, nThreads);
+  size_t nWithoutCategory = std::count(categories.begin(), categories.end(), -1);
+  if(!noCorrections && nWithoutCategory > 0){
+    nNotDefined_ += nWithoutCategory;
+    std::cerr << "[WARNING] " << nWithoutCategory << " electrons without scale category" << std::endl;
+  }
+
+  // same value as ScaleCorrection, without its warnings
+  std::vector<Float_t> scaleEle(2*nentries, 1);
+  if(!noCorrections){
+    for(size_t i = 0; i < scaleEle.size(); i++)
+      scaleEle[i] = (categories[i]<0) ? notDefined_.scale : scales[categories[i]].second.scale;
+  }
+
+  for(Long64_t ientry = 0; ientry<nentries; ientry++){
+    scaleEle_[0] = scaleEle[2*ientry];
+    scaleEle_[1] = scaleEle[2*ientry+1];
     newTree->Fill();
-    if(ientry%(nentries/100)==0) std::cerr << "\b\b\b\b" << std::setw(2) << ientry/(nentries/100) << "%]";
   }
 
-  
   if(fastLoop) tree->SetBranchStatus("*",1);
   tree->ResetBranchAddresses();
   tree->GetEntry(0);
@@ -225,13 +287,6 @@ void EnergyScaleCorrection_class::AddSmearing(TString category_, int runMin_, in
   cat.runmin= (runMin_ < 0) ? 0 : runMin_;
   cat.runmax=runMax_;
 
-  if(scales.count(cat)!=0){
-    std::cerr << "[ERROR] Category already defined!" << std::endl;
-    std::cerr << "        Adding category:  " << cat << std::endl;
-    std::cerr << "        Defined category: " << scales[cat] << std::endl;
-    exit(1);
-  }
-
   correctionValue_class corr;
   corr.constTerm    = constTerm;
   corr.constTerm_err= err_constTerm;
@@ -239,7 +294,8 @@ void EnergyScaleCorrection_class::AddSmearing(TString category_, int runMin_, in
   corr.alpha_err    = err_alpha;
   corr.Emean        = Emean; 
   corr.Emean_err    = err_Emean;
-  smearings[cat]=corr;
+  smearings.push_back(std::make_pair(cat, corr));
+  smearingNames_.push_back(category_);
 
   std::cout << "[INFO:smearings] " << cat << corr << std::endl;
 #ifdef DEBUG
@@ -350,48 +406,75 @@ void EnergyScaleCorrection_class::ReadSmearingFromFile(TString filename){
 
 
 
-float EnergyScaleCorrection_class::getSmearingSigma(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle){
-  
-  correctionCategory_class category(runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
-  correction_map_t::const_iterator corr_itr = smearings.find(category);
-  if(corr_itr==smearings.end()){ // if not in the standard classes, add it in the list of not defined classes
-    if(smearings_not_defined.count(category)==0){
-      correctionValue_class corr;
-      smearings_not_defined[category]=corr;
+bool EnergyScaleCorrection_class::SetSmearingCBShape(TString category, double alpha, double power){
+  bool found=false;
+  for(size_t i = 0; i < smearings.size(); i++){
+    if(smearingNames_[i]!=category) continue;
+    smearings[i].second.cbAlpha = alpha;
+    smearings[i].second.cbPower = power;
+    found=true;
+  }
+
+  // the table holds a copy of the values
+  if(found) smearingsTable.build(smearings, "smearing");
+  return found;
+}
+
+/**
+ *  File structure, one line per category of the smearing file:
+EBlowEtaBad8TeV    1.424 1.86
+ */
+void EnergyScaleCorrection_class::ReadSmearingCBShapeFromFile(TString filename){
+  std::cout << "[STATUS] Reading Crystal Ball tails from file: " << filename << std::endl;
+  ifstream f_in(filename);
+  if(!f_in.good()){
+    std::cerr << "[ERROR] file " << filename << " not readable" << std::endl;
+    exit(1);
+  }
+
+  std::string line;
+  while(std::getline(f_in, line)){
+    std::istringstream s_in(line);
+    std::string category;
+    double alpha, power;
+    if(!(s_in >> category) || category[0]=='#') continue;
+    if(!(s_in >> alpha >> power) || alpha==0 || power<=0){
+      std::cerr << "[ERROR] malformed line in " << filename << ": " << line << std::endl;
+      exit(1);
     }
-    corr_itr = smearings_not_defined.find(category);
-    std::cerr << "[WARNING] Category not found: " << std::endl;
-    std::cerr << category << std::endl;
-    //     exit(1);
+    if(!SetSmearingCBShape(category, alpha, power)){
+      std::cerr << "[ERROR] no smearing category " << category << " for its Crystal Ball tail in " << filename << std::endl;
+      exit(1);
+    }
+    std::cout << "[INFO:smearings] " << category << " Crystal Ball alpha=" << alpha << " power=" << power << std::endl;
   }
+}
+
+float EnergyScaleCorrection_class::getSmearingSigma(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle){
+  
+  const correctionValue_class& corr = findCorrection(smearingsTable, runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
 
 #ifdef DEBUG
-  std::cout << "[DEBUG] Checking correction for category: " << category << std::endl;
-  std::cout << "[DEBUG] Correction is: " << corr_itr->second
-	    << std::endl 
-    	    << "        given for category " <<  corr_itr->first;
+  std::cout << "[DEBUG] Checking correction for category: " << correctionCategory_class(runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle)) << std::endl;
+  std::cout << "[DEBUG] Correction is: " << corr << std::endl;
 #endif
 
-  double constTerm=corr_itr->second.constTerm;
-  double alpha=corr_itr->second.alpha;
-  return sqrt(constTerm*constTerm + alpha*alpha/(energy/cosh(etaSCEle)));
+  return smearingSigma(corr, energy, etaSCEle);
+}
 
+float EnergyScaleCorrection_class::smearingSigma(const correctionValue_class& corr, float energy, float etaSCEle){
+  double constTerm=corr.constTerm;
+  double alpha=corr.alpha;
+  return sqrt(constTerm*constTerm + alpha*alpha/(energy/cosh(etaSCEle)));
 }
 
 float EnergyScaleCorrection_class::getSmearingRho(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle){
   
-  correctionCategory_class category(runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
-  correction_map_t::const_iterator corr_itr = smearings.find(category);
-  if(corr_itr==smearings.end()){ // if not in the standard classes, add it in the list of not defined classes
-    if(smearings_not_defined.count(category)==0){
-      correctionValue_class corr;
-      smearings_not_defined[category]=corr;
-    }
-    corr_itr = smearings_not_defined.find(category);
-  }
+  const correctionValue_class* corr = smearingsTable.find(runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
+  if(corr==NULL) corr=&notDefined_;
 
-  double constTerm=corr_itr->second.constTerm;
-  double alpha = (corr_itr->second.Emean==0) ? 0 : corr_itr->second.alpha/corr_itr->second.Emean;
+  double constTerm=corr->constTerm;
+  double alpha = (corr->Emean==0) ? 0 : corr->alpha/corr->Emean;
   
   //std::cout << (*corr_itr).second << std::endl;
   return sqrt(constTerm*constTerm + alpha*alpha); ///< return rho
@@ -399,10 +482,18 @@ float EnergyScaleCorrection_class::getSmearingRho(int runNumber, float energy, b
 }
 
 float EnergyScaleCorrection_class::getSmearing(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle){
+  return getSmearing(runNumber, energy, isEBEle, R9Ele, etaSCEle, *rgen_);
+}
+
+float EnergyScaleCorrection_class::getSmearing(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle, TRandom& rgen){
   
   if(noSmearings) return 1;
-  float smear =getSmearingSigma(runNumber, energy, isEBEle, R9Ele, etaSCEle); 
-  
+
+  const correctionValue_class& corr = findCorrection(smearingsTable, runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
+  return drawSmearing(corr, smearingSigma(corr, energy, etaSCEle), rgen);
+}
+
+float EnergyScaleCorrection_class::drawSmearing(const correctionValue_class& corr, float smear, TRandom& rgen) const{
   if(smear==0) return 0;
   if( smear!=smear) return 0;
 //     correctionCategory_class category(runNumber, etaSCEle, R9Ele, energy/cosh(etaSCEle));
@@ -412,21 +503,13 @@ float EnergyScaleCorrection_class::getSmearing(int runNumber, float energy, bool
 //     exit(1);
 //   }
   if(smearingType_==1){
-    if(sigma.getVal()!=smear){
-      sigma.setVal(smear);
-      index_data=NGENMAX; //force to produce new random values
-    }
-    
-    if(index_data>=NGENMAX-1){
-      if(data!=NULL) delete data;
-      data=resCB.generate(x,NGENMAX);
-      index_data=-1;
-    }
-    index_data++;
-    return 1+data->get(index_data)->getRealValue("x");
-
+    // the width depends on the category and on the energy: one sampler per call, it's cheap
+    double cbAlpha = (corr.cbAlpha!=0) ? corr.cbAlpha : cbAlpha_;
+    double cbPower = (corr.cbPower!=0) ? corr.cbPower : cbPower_;
+    crystalBallSampler_class sampler(cbMean_, smear, cbAlpha, cbPower, cbMin_, cbMax_);
+    return 1+sampler.generate(rgen);
 
-  }else return rgen_->Gaus(1,getSmearingSigma(runNumber, energy, isEBEle, R9Ele, etaSCEle));
+  }else return rgen.Gaus(1,smear);
   
 }
 
@@ -437,8 +520,8 @@ TTree *EnergyScaleCorrection_class::GetSmearTree(TChain *tree,
 						 TString runNumberBranchName,
 						 TString R9EleBranchName,
 						 TString etaEleBranchName,
-						 TString etaSCEleBranchName
-						 
+						 TString etaSCEleBranchName,
+						 unsigned int nThreads
 						 ){
   Int_t runNumber_;
   Float_t energyEle_[2];
@@ -472,27 +555,61 @@ TTree *EnergyScaleCorrection_class::GetSmearTree(TChain *tree,
   tree->SetBranchAddress(etaSCEleBranchName,etaSCEle_);
   tree->SetBranchAddress(R9EleBranchName, R9Ele_);
   
-  // loop over tree 
+  // read the tree (serially, ROOT I/O isn't thread safe), then find the category of each electron (2*entry+electron)
   std::cerr << "Adding smearEle branch \t";
   std::cerr << "[00%]";
 
   Long64_t nentries = tree->GetEntries();
-  for(Long64_t ientry = 0; ientry<tree->GetEntriesFast(); ientry++){
+  Long64_t step = std::max(nentries/100, 1LL);
+  std::vector<Float_t> energyEle(2*nentries), etaEle(2*nentries), R9Ele(2*nentries), EtEle(2*nentries);
+  std::vector<Int_t> runNumber(nentries);
+  for(Long64_t ientry = 0; ientry<nentries; ientry++){
     tree->GetEntry(ientry);
-    smearSigmaEle_[0] = getSmearingSigma(runNumber_, energyEle_[0], fabs(etaSCEle_[0]) < 1.4442, 
-					 R9Ele_[0],etaEle_[0]);
-    smearSigmaEle_[1] = getSmearingSigma(runNumber_, energyEle_[1], fabs(etaSCEle_[1]) < 1.4442, 
-					 R9Ele_[1],etaEle_[1]);
-    smearEle_[0] = getSmearing(runNumber_, energyEle_[0], fabs(etaSCEle_[0]) < 1.4442, 
-			       R9Ele_[0],etaEle_[0]);
-    smearEle_[1] = getSmearing(runNumber_, energyEle_[1], fabs(etaSCEle_[1]) < 1.4442, 
-			       R9Ele_[1],etaEle_[1]);
-    
-    newTree->Fill();
-    if(ientry%(nentries/100)==0) std::cerr << "\b\b\b\b" << std::setw(2) << ientry/(nentries/100) << "%]";
-
+    runNumber[ientry] = runNumber_;
+    for(int i = 0; i < 2; i++){
+      energyEle[2*ientry+i] = energyEle_[i];
+      etaEle[2*ientry+i] = etaEle_[i];
+      R9Ele[2*ientry+i] = R9Ele_[i];
+      EtEle[2*ientry+i] = energyEle_[i]/cosh(etaEle_[i]);
+    }
+    if(ientry%step==0) std::cerr << "\b\b\b\b" << std::setw(2) << ientry/step << "%]";
   }
   std::cerr << std::endl;
+
+  std::vector<int> categories = findCategories(smearingsTable, runNumber, etaEle, R9Ele, EtEle, nThreads);
+  std::vector<std::vector<size_t> > groups = groupByCategory(categories, smearings.size());
+  if(!noSmearings && !groups[0].empty()){
+    nNotDefined_ += groups[0].size();
+    std::cerr << "[WARNING] " << groups[0].size() << " electrons without smearing category" << std::endl;
+  }
+
+  // each electron draws from its own stream, keyed on the base seed, the run, the entry and the electron:
+  // the smearings don't depend on the grouping, the thread count or the categories of the other electrons
+  UInt_t baseSeed = (smearingSeed_!=0) ? smearingSeed_ : (UInt_t) (rgen_->Rndm() * 4294967295.);
+  std::vector<Float_t> smearEle(2*nentries), smearSigmaEle(2*nentries);
+  forEachGroup(groups.size(), nThreads, [&](size_t group){
+      const correctionValue_class& corr = (group==0) ? notDefined_ : smearings[group-1].second;
+      PhiloxRandom rgen(baseSeed);
+      for(size_t j = 0; j < groups[group].size(); j++){
+	size_t i = groups[group][j];
+	float sigma = smearingSigma(corr, energyEle[i], etaEle[i]);
+	smearSigmaEle[i] = sigma;
+	if(noSmearings){
+	  smearEle[i] = 1;
+	  continue;
+	}
+	rgen.SetStream(runNumber[i/2], 0, i/2, PhiloxRandom::PHOTON_SMEARING, i%2);
+	smearEle[i] = drawSmearing(corr, sigma, rgen);
+      }
+    });
+
+  for(Long64_t ientry = 0; ientry<nentries; ientry++){
+    smearSigmaEle_[0] = smearSigmaEle[2*ientry];
+    smearSigmaEle_[1] = smearSigmaEle[2*ientry+1];
+    smearEle_[0] = smearEle[2*ientry];
+    smearEle_[1] = smearEle[2*ientry+1];
+    newTree->Fill();
+  }
   
   if(fastLoop) tree->SetBranchStatus("*",1);
   tree->ResetBranchAddresses();
@@ -545,22 +662,6 @@ float EnergyScaleCorrection_class::GetMean_nPV(TChain *tree, bool fastLoop,
 }
 
 
-bool correctionCategory_class::operator<(const correctionCategory_class& b) const{
-    if(runmin < b.runmin && runmax < b.runmax) return true;  
-    if(runmax > b.runmax && runmin > b.runmin) return false; 
-       
-    if(etamin < b.etamin && etamax<b.etamax) return true; 
-    if(etamax > b.etamax && etamin>b.etamin) return false;
-       
-    if(r9min  < b.r9min && r9max < b.r9max) return true; 
-    if(r9max  > b.r9max && r9min > b.r9min) return  false;
-       
-    if(etmin  < b.etmin && etmax < b.etmax) return true;  
-    if(etmax  > b.etmax && etmin > b.etmin) return  false;
-    return false;
-
-  };    
-
 correctionCategory_class::correctionCategory_class(TString category_){
     std::string category(category_.Data());
 #ifdef DEBUG
@@ -615,3 +716,137 @@ correctionCategory_class::correctionCategory_class(TString category_){
     else if(category.find("bad")!=std::string::npos || category.find("Bad")!=std::string::npos){ r9min=-1; r9max=0.94;};
     
 };
+
+
+//============================== Crystal Ball sampler
+crystalBallSampler_class::crystalBallSampler_class(double mean, double sigma, double alpha, double n, double xmin, double xmax):
+  mean_(mean), sigma_(sigma), alpha_(fabs(alpha)), n_(n), sign_((alpha<0) ? -1 : 1){
+  A_ = pow(n_/alpha_, n_) * exp(-0.5*alpha_*alpha_);
+  B_ = n_/alpha_ - alpha_;
+
+  // for alpha < 0, t = -(x-mean)/sigma: the bounds are swapped
+  double tmin = sign_*(((sign_>0) ? xmin : xmax) - mean_)/sigma_;
+  double tmax = sign_*(((sign_>0) ? xmax : xmin) - mean_)/sigma_;
+  cmin_ = integral(tmin);
+  cmax_ = integral(tmax);
+}
+
+// Integrals are counted from t=-alpha, where the tail joins the core: the
+// tail integral from -inf diverges for n <= 1, and only differences are used
+double crystalBallSampler_class::integral(double t) const{
+  if(t >= -alpha_) return sqrt(M_PI/2)*(erf(t/sqrt(2.)) - erf(-alpha_/sqrt(2.)));
+
+  if(n_==1) return -A_*(log(B_-t) - log(B_+alpha_));
+  return A_/(1-n_)*(pow(B_+alpha_, 1-n_) - pow(B_-t, 1-n_));
+}
+
+double crystalBallSampler_class::inverse(double c) const{
+  if(c < 0){
+    if(n_==1) return B_ - (B_+alpha_)*exp(-c/A_);
+    return B_ - pow(pow(B_+alpha_, 1-n_) - c*(1-n_)/A_, 1/(1-n_));
+  }
+
+  double e = c/sqrt(M_PI/2) + erf(-alpha_/sqrt(2.));
+  e = std::min(e, 1-1e-16);
+  return sqrt(2.)*boost::math::erf_inv(e);
+}
+
+double crystalBallSampler_class::generate(TRandom& rgen) const{
+  double t = inverse(cmin_ + rgen.Rndm()*(cmax_-cmin_));
+  return mean_ + sign_*sigma_*t;
+}
+
+double crystalBallSampler_class::cdf(double x) const{
+  double t = sign_*(x-mean_)/sigma_;
+  double c = (integral(t)-cmin_)/(cmax_-cmin_);
+  // the mirrored shape accumulates from the right
+  c = std::max(0., std::min(c, 1.));
+  return (sign_>0) ? c : 1-c;
+}
+
+//============================== category table
+int correctionTable_class::bin(const std::vector<double>& edges, double value){
+  // edges[i] <= value < edges[i+1]
+  std::vector<double>::const_iterator it = std::upper_bound(edges.begin(), edges.end(), value);
+  if(it==edges.begin() || it==edges.end()) return -1;
+  return (it - edges.begin()) - 1;
+}
+
+size_t correctionTable_class::cellIndex(int runBin, int etaBin, int r9Bin, int etBin) const{
+  return ((runBin * (etaEdges.size()-1) + etaBin) * (r9Edges.size()-1) + r9Bin) * (etEdges.size()-1) + etBin;
+}
+
+int correctionTable_class::index(unsigned int runNumber, float etaEle, float R9Ele, float EtEle) const{
+  if(cells.empty()) return -1;
+
+  int runBin = bin(runEdges, runNumber);
+  int etaBin = bin(etaEdges, fabs(etaEle));
+  int r9Bin = bin(r9Edges, R9Ele);
+  int etBin = bin(etEdges, EtEle);
+  if(runBin<0 || etaBin<0 || r9Bin<0 || etBin<0) return -1;
+
+  return cells[cellIndex(runBin, etaBin, r9Bin, etBin)];
+}
+
+const correctionValue_class* correctionTable_class::find(unsigned int runNumber, float etaEle, float R9Ele, float EtEle) const{
+  int i = index(runNumber, etaEle, R9Ele, EtEle);
+  return (i<0) ? NULL : &values[i];
+}
+
+void correctionTable_class::build(const correction_map_t& categories, const std::string& name){
+  runEdges.clear(); etaEdges.clear(); r9Edges.clear(); etEdges.clear();
+  values.clear();
+
+  for(correction_map_t::const_iterator itr = categories.begin(); itr != categories.end(); itr++){
+    const correctionCategory_class& cat = itr->first;
+    runEdges.push_back(cat.runmin); runEdges.push_back((double) cat.runmax + 1);
+    etaEdges.push_back(cat.etamin); etaEdges.push_back(cat.etamax);
+    r9Edges.push_back(cat.r9min); r9Edges.push_back(cat.r9max);
+    etEdges.push_back(cat.etmin); etEdges.push_back(cat.etmax);
+    values.push_back(itr->second);
+  }
+
+  std::vector<double>* allEdges[] = {&runEdges, &etaEdges, &r9Edges, &etEdges};
+  for(int i = 0; i < 4; i++){
+    std::vector<double>& edges = *allEdges[i];
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  }
+
+  cells.assign((runEdges.size()-1) * (etaEdges.size()-1) * (r9Edges.size()-1) * (etEdges.size()-1), -1);
+
+  // each category fills the cells between its boundaries
+  bool overlap = false;
+  for(size_t c = 0; c < categories.size(); c++){
+    const correctionCategory_class& cat = categories[c].first;
+    int runFirst = bin(runEdges, cat.runmin), runLast = bin(runEdges, cat.runmax);
+    int etaFirst = bin(etaEdges, cat.etamin), etaLast = std::lower_bound(etaEdges.begin(), etaEdges.end(), cat.etamax) - etaEdges.begin() - 1;
+    int r9First = bin(r9Edges, cat.r9min), r9Last = std::lower_bound(r9Edges.begin(), r9Edges.end(), cat.r9max) - r9Edges.begin() - 1;
+    int etFirst = bin(etEdges, cat.etmin), etLast = std::lower_bound(etEdges.begin(), etEdges.end(), cat.etmax) - etEdges.begin() - 1;
+
+    for(int run = runFirst; run <= runLast; run++)
+      for(int eta = etaFirst; eta <= etaLast; eta++)
+	for(int r9 = r9First; r9 <= r9Last; r9++)
+	  for(int et = etFirst; et <= etLast; et++){
+	    int& cell = cells[cellIndex(run, eta, r9, et)];
+	    if(cell>=0 && !overlap){
+	      std::cerr << "[ERROR] Overlapping " << name << " categories:" << std::endl;
+	      std::cerr << "        " << categories[cell].first << std::endl;
+	      std::cerr << "        " << cat << std::endl;
+	      overlap = true;
+	    }
+	    cell = c;
+	  }
+  }
+
+  if(overlap) exit(1);
+
+  // holes between the categories: points falling there get the default values
+  size_t missing = std::count(cells.begin(), cells.end(), -1);
+  if(missing>0){
+    std::cout << "[WARNING] " << missing << " of " << cells.size() << " " << name << " bins (run, |eta|, R9, Et) not covered by any category" << std::endl;
+  }
+#ifdef DEBUG
+  std::cout << "[DEBUG] " << name << " table: " << runEdges.size()-1 << " x " << etaEdges.size()-1 << " x " << r9Edges.size()-1 << " x " << etEdges.size()-1 << " bins" << std::endl;
+#endif
+}
@@ -18,12 +18,18 @@ Implementation:
 
 
 // system include files
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <fstream>
+#include <future>
 #include <map>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <mutex>
 #include <string>
 #include "Math/GenVector/LorentzVector.h"
 
@@ -44,6 +50,7 @@ Implementation:
 #include "FWCore/Framework/interface/LuminosityBlock.h"
 #include "FWCore/Framework/interface/MakerMacros.h"
 #include "FWCore/Framework/interface/Run.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
 #include "FWCore/Utilities/interface/Exception.h"
 #include "FWCore/ServiceRegistry/interface/Service.h"
@@ -76,16 +83,22 @@ Implementation:
 #include "SimDataFormats/GeneratorProducts/interface/GenEventInfoProduct.h"
 
 #include "JetMETCorrections/Objects/interface/JetCorrector.h"
-#include "JetMETCorrections/GammaJetFilter/interface/json/json.h"
 
 #include "CondFormats/JetMETObjects/interface/JetCorrectorParameters.h"
 #include "CondFormats/JetMETObjects/interface/FactorizedJetCorrector.h"
 
 #include "JetMETCorrections/GammaJetFilter/interface/EnergyScaleCorrection_class.h"
-
+#include "JetMETCorrections/GammaJetFilter/interface/JECBatchCorrector.h"
+#include "JetMETCorrections/GammaJetFilter/interface/LumiIndex.h"
+#include "JetMETCorrections/GammaJetFilter/interface/OutputTree.h"
+#include "JetMETCorrections/GammaJetFilter/interface/PhiloxRandom.h"
+#include "JetMETCorrections/GammaJetFilter/interface/PhotonIsolationRecord.h"
+
+#include <TH1D.h>
+#include <TH1F.h>
+#include <TH2F.h>
 #include <TParameter.h>
 #include <TTree.h>
-#include <TClonesArray.h>
 #include <TLorentzVector.h>
 
 #include <boost/regex.hpp>
@@ -104,6 +117,215 @@ struct JetInfos {
   edm::InputTag inputTag;
 };
 
+// Content of the electrons and muons trees, written as [n] arrays.
+// Arrays keep at least one element, so that branch addresses are never NULL
+struct LeptonBranches {
+  int n;
+  std::vector<int>   id;
+  std::vector<float> isolation;
+  std::vector<float> delta_beta_isolation;
+  std::vector<float> pt;
+  std::vector<float> px;
+  std::vector<float> py;
+  std::vector<float> pz;
+  std::vector<float> eta;
+  std::vector<float> phi;
+  std::vector<int>   charge;
+
+  LeptonBranches(): n(0) {
+    resize(0);
+  }
+
+  void resize(size_t size) {
+    n = size;
+    size = std::max<size_t>(size, 1);
+
+    id.resize(size);
+    isolation.resize(size);
+    delta_beta_isolation.resize(size);
+    pt.resize(size);
+    px.resize(size);
+    py.resize(size);
+    pz.resize(size);
+    eta.resize(size);
+    phi.resize(size);
+    charge.resize(size);
+  }
+};
+
+// Neutrinos from B / C partons decays, written in the gen tree of the first jet
+struct NeutrinoBranches {
+  std::vector<float> px;
+  std::vector<float> py;
+  std::vector<float> pz;
+  std::vector<float> e;
+  std::vector<int>   pdg_id;
+
+  void clear() {
+    px.clear();
+    py.clear();
+    pz.clear();
+    e.clear();
+    pdg_id.clear();
+  }
+};
+
+// Histograms filled by filter()
+struct FilterHistograms {
+  TH1F* firstJetPhotonDeltaPhi;
+  TH1F* firstJetPhotonDeltaR;
+  TH1F* firstJetPhotonDeltaPt;
+  TH2F* firstJetPhotonDeltaPhiDeltaR;
+
+  TH1F* selectedFirstJetIndex;
+  TH1F* selectedSecondJetIndex;
+
+  TH1F* secondJetPhotonDeltaPhi;
+  TH1F* secondJetPhotonDeltaR;
+  TH1F* secondJetPhotonDeltaPt;
+
+  TH1F* selectedFirstJetPhotonDeltaPhi;
+  TH1F* selectedFirstJetPhotonDeltaR;
+
+  TH1F* selectedSecondJetPhotonDeltaPhi;
+  TH1F* selectedSecondJetPhotonDeltaR;
+
+  // Cut flow of filter(): time spent in each stage (seconds, summed over all events) and events rejected by each stage
+  TH1D* stageTime;
+  TH1D* stageRejectedEvents;
+
+  std::vector<TH1*> all() const {
+    return {firstJetPhotonDeltaPhi, firstJetPhotonDeltaR, firstJetPhotonDeltaPt, firstJetPhotonDeltaPhiDeltaR,
+      selectedFirstJetIndex, selectedSecondJetIndex,
+      secondJetPhotonDeltaPhi, secondJetPhotonDeltaR, secondJetPhotonDeltaPt,
+      selectedFirstJetPhotonDeltaPhi, selectedFirstJetPhotonDeltaR,
+      selectedSecondJetPhotonDeltaPhi, selectedSecondJetPhotonDeltaR,
+      stageTime, stageRejectedEvents};
+  }
+
+  // Empty copies, attached to no directory. They must be deleted with deleteAll()
+  FilterHistograms emptyCopy() const {
+    FilterHistograms copy;
+    copy.firstJetPhotonDeltaPhi = detachedCopy(firstJetPhotonDeltaPhi);
+    copy.firstJetPhotonDeltaR = detachedCopy(firstJetPhotonDeltaR);
+    copy.firstJetPhotonDeltaPt = detachedCopy(firstJetPhotonDeltaPt);
+    copy.firstJetPhotonDeltaPhiDeltaR = detachedCopy(firstJetPhotonDeltaPhiDeltaR);
+    copy.selectedFirstJetIndex = detachedCopy(selectedFirstJetIndex);
+    copy.selectedSecondJetIndex = detachedCopy(selectedSecondJetIndex);
+    copy.secondJetPhotonDeltaPhi = detachedCopy(secondJetPhotonDeltaPhi);
+    copy.secondJetPhotonDeltaR = detachedCopy(secondJetPhotonDeltaR);
+    copy.secondJetPhotonDeltaPt = detachedCopy(secondJetPhotonDeltaPt);
+    copy.selectedFirstJetPhotonDeltaPhi = detachedCopy(selectedFirstJetPhotonDeltaPhi);
+    copy.selectedFirstJetPhotonDeltaR = detachedCopy(selectedFirstJetPhotonDeltaR);
+    copy.selectedSecondJetPhotonDeltaPhi = detachedCopy(selectedSecondJetPhotonDeltaPhi);
+    copy.selectedSecondJetPhotonDeltaR = detachedCopy(selectedSecondJetPhotonDeltaR);
+    copy.stageTime = detachedCopy(stageTime);
+    copy.stageRejectedEvents = detachedCopy(stageRejectedEvents);
+
+    return copy;
+  }
+
+  void add(const FilterHistograms& other) {
+    std::vector<TH1*> histograms = all();
+    std::vector<TH1*> otherHistograms = other.all();
+    for (size_t i = 0; i < histograms.size(); i++)
+      histograms[i]->Add(otherHistograms[i]);
+  }
+
+  void deleteAll() {
+    for (TH1* histogram: all())
+      delete histogram;
+  }
+
+  template<typename T>
+    static T* detachedCopy(const T* histogram) {
+      T* copy = static_cast<T*>(histogram->Clone());
+      copy->SetDirectory(NULL);
+      copy->Reset();
+
+      return copy;
+    }
+};
+
+// Products used by several helpers. Each one is read at most once per event,
+// the first time it's needed, so rejected events don't pay for them
+class EventProducts {
+  public:
+    explicit EventProducts(const edm::Event& event):
+      mEvent(event) {}
+
+    // kt6PFJets, for JEC and misc trees
+    const edm::Handle<double>& pfRho() const { return get(mPFRho, "kt6PFJets", "rho"); }
+    // kt6PFJets from RECO, for photon ID
+    const edm::Handle<double>& pfRhoRECO() const { return get(mPFRhoRECO, "kt6PFJets", "rho", "RECO"); }
+    // kt6CaloJets, for misc trees
+    const edm::Handle<double>& caloRho() const { return get(mCaloRho, "kt6CaloJets", "rho"); }
+
+    // Produced at PAT level by the PhotonPFIsolation producer. PAT tuples made
+    // before the record existed have one ValueMap per quantity: only the ones
+    // used here are read back, other fields are left to 0
+    PhotonIsolationRecord photonIsolation(const pat::PhotonRef& photonRef) const {
+      if (get(mPhotonIsolationRecords, "photonPFIsolation", "", "PAT").isValid())
+        return (*mPhotonIsolationRecords)[photonRef];
+
+      PhotonIsolationRecord record;
+      record.hasMatchedPromptElectron = (*get(mHasMatchedPromptElectron, "photonPFIsolation", "hasMatchedPromptElectron", "PAT"))[photonRef];
+      record.chargedHadronsIsolation = (*get(mChargedHadronsIsolation, "photonPFIsolation", "chargedHadronsIsolation", "PAT"))[photonRef];
+      record.neutralHadronsIsolation = (*get(mNeutralHadronsIsolation, "photonPFIsolation", "neutralHadronsIsolation", "PAT"))[photonRef];
+      record.photonIsolation = (*get(mPhotonIsolation, "photonPFIsolation", "photonIsolation", "PAT"))[photonRef];
+
+      // Only stored when the footprint correction was enabled
+      if (get(mFootprintMExCorr, "photonPFIsolation", "footprintMExCorr", "PAT").isValid() && get(mFootprintMEyCorr, "photonPFIsolation", "footprintMEyCorr", "PAT").isValid()) {
+        record.footprintMExCorr = (*mFootprintMExCorr)[photonRef];
+        record.footprintMEyCorr = (*mFootprintMEyCorr)[photonRef];
+      }
+
+      return record;
+    }
+
+    const edm::Handle<edm::ValueMap<float>>& regressionEnergy() const { return get(mRegressionEnergy, "eleNewEnergiesProducer", "energySCEleJoshPhoSemiParamV5ecorr", "PAT"); }
+
+  private:
+    template<typename T>
+      const edm::Handle<T>& get(edm::Handle<T>& handle, const char* label, const char* instance, const char* process = "") const {
+        if (! handle.isValid() && ! handle.failedToGet())
+          mEvent.getByLabel(edm::InputTag(label, instance, process), handle);
+
+        return handle;
+      }
+
+    const edm::Event& mEvent;
+
+    mutable edm::Handle<double> mPFRho;
+    mutable edm::Handle<double> mPFRhoRECO;
+    mutable edm::Handle<double> mCaloRho;
+    mutable edm::Handle<edm::ValueMap<PhotonIsolationRecord>> mPhotonIsolationRecords;
+    mutable edm::Handle<edm::ValueMap<bool>> mHasMatchedPromptElectron;
+    mutable edm::Handle<edm::ValueMap<double>> mChargedHadronsIsolation;
+    mutable edm::Handle<edm::ValueMap<double>> mNeutralHadronsIsolation;
+    mutable edm::Handle<edm::ValueMap<double>> mPhotonIsolation;
+    mutable edm::Handle<edm::ValueMap<double>> mFootprintMExCorr;
+    mutable edm::Handle<edm::ValueMap<double>> mFootprintMEyCorr;
+    mutable edm::Handle<edm::ValueMap<float>> mRegressionEnergy;
+};
+
+// Steps of filter() able to reject an event, in the order they're run.
+// The jets and output steps never reject events, they're only timed
+enum FilterStage {
+  LUMI_MASK_STAGE,
+  PT_HAT_STAGE,
+  PHOTON_STAGE,
+  VERTEX_STAGE,
+  JETS_STAGE,
+  OUTPUT_STAGE,
+  STAGE_COUNT
+};
+
+typedef std::chrono::steady_clock StageClock;
+
+// Up to 64 * MAX_TRIGGER_WORDS photon paths per menu. Must match bin/Tree/AnalysisTree.h
+#define MAX_TRIGGER_WORDS 8
+
 #define FOREACH(x) for (std::vector<std::string>::const_iterator it = x.begin(); it != x.end(); ++it)
 
 class GammaJetFilter : public edm::EDFilter {
@@ -124,34 +346,118 @@ class GammaJetFilter : public edm::EDFilter {
     virtual bool endLuminosityBlock(edm::LuminosityBlock&, edm::EventSetup const&);
 
     void correctPhoton(pat::Photon& photon, edm::Event& iEvent, int isData, int nPV);
+    // Per-event state. A context is used by one event at a time, and owns everything filter() modifies
+    // while processing it: JEC correctors (their setters mutate them), output buffers and histograms.
+    // Everything else is either read-only once the module is constructed, atomic, or guarded by a mutex.
+    // CMSSW 5_3 processes events one at a time, with one stream context. The state of the jet collections
+    // is in separate contexts, one per collection, so that the collections of an event can be processed
+    // concurrently without access to the state of the event
+    struct StreamContext {
+      StreamContext(const GammaJetFilter& filter);
+      ~StreamContext();
+
+      // Lumi section of the last event, with its true pileup
+      edm::LuminosityBlockID lumiBlock;
+      bool isValidLumiBlock;
+      double truePU;
+
+      LeptonBranches electrons;
+      LeptonBranches muons;
+
+      // Added to the output histograms in endJob()
+      FilterHistograms histograms;
+    };
+
+    std::unique_ptr<StreamContext> mStreamContext;
+
+    // State of one jet collection
+    struct JetCollectionContext {
+      JetCollectionContext(const GammaJetFilter& filter);
+      ~JetCollectionContext();
+
+      // FactorizedJetCorrector instances of this context, built from the parameters of the module
+      std::unique_ptr<FactorizedJetCorrector> jetCorrector;
+      std::unique_ptr<FactorizedJetCorrector> jetCorrectorForTypeI;
+      std::unique_ptr<FactorizedJetCorrector> jetCorrectorForTypeIL1;
+      std::vector<float> typeICorrections;
+      std::vector<float> typeIL1Corrections;
+
+      boost::shared_ptr<JetIDSelectionFunctor> caloJetID;
+      pat::strbitset caloJetIDRet;
+
+      NeutrinoBranches neutrinos;
+
+      // Added to the output histograms in endJob()
+      FilterHistograms histograms;
+    };
+
+    std::vector<std::unique_ptr<JetCollectionContext>> mJetCollectionContexts;
+
+    // Inputs and results of one jet collection for the current event
+    struct JetCollectionTask {
+      std::string name;
+      JetInfos infos;
+      JetCollectionContext* context;
+
+      edm::Handle<pat::JetCollection> jetsHandle;
+      edm::Handle<edm::ValueMap<float>> qgTagMLP;
+      edm::Handle<edm::ValueMap<float>> qgTagLikelihood;
+      edm::Handle<pat::METCollection> rawMets;
+
+      pat::JetCollection jets;
+      pat::JetCollection selectedJets;
+      pat::METCollection mets;
+      double rho;
+    };
+
+    // Jet collections are processed by up to this number of threads, including the one running filter()
+    unsigned int mJetCollectionThreads;
+
+    void fetchJetCollection(JetCollectionTask& task, edm::Event& iEvent, const edm::EventSetup& iSetup, const EventProducts& products);
+    void processJetCollection(JetCollectionTask& task, const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef);
+    void jetCollectionToTrees(JetCollectionTask& task);
+
+    void prepareJetsForJEC(pat::JetCollection& jets);
+    void correctJets(JetCollectionContext& context, pat::JetCollection& jets, const EventProducts& products);
     void correctJets(pat::JetCollection& jets, edm::Event& iEvent, const edm::EventSetup& iSetup);
     void extractRawJets(pat::JetCollection& jets);
-    void processJets(pat::Photon* photon, pat::JetCollection& jets, const JetAlgorithm algo, edm::Handle<edm::ValueMap<float>>& qgTagMLP, edm::Handle<edm::ValueMap<float>>& qgTagLikelihood, const edm::Handle<pat::JetCollection>& handleForRef, std::vector<TTree*>& trees);
+    void processJets(JetCollectionContext& context, pat::Photon* photon, pat::JetCollection& jets, const JetAlgorithm algo, edm::Handle<edm::ValueMap<float>>& qgTagMLP, edm::Handle<edm::ValueMap<float>>& qgTagLikelihood, const edm::Handle<pat::JetCollection>& handleForRef, pat::JetCollection& selectedJets);
 
-    void correctMETWithTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets, edm::Event& event);
-   void correctMETWithRegressionAndTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  edm::Event& event, pat::Photon& photon, const pat::PhotonRef& photonRef);
-   void correctMETWithFootprintAndTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  edm::Event& event, pat::Photon& photon, const pat::PhotonRef& photonRef);
+    void correctMETWithTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets, const EventProducts& products);
+   void correctMETWithRegressionAndTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef);
+   void correctMETWithFootprintAndTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef);
 //(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets, edm::Event& event,const pat::PhotonRef& photonRef, float regressionCorr);
 
     bool isValidPhotonEB(const pat::Photon& photon, const double rho, const EcalRecHitCollection* recHits, const CaloTopology& topology);
-    bool isValidPhotonEB2012(const pat::PhotonRef& photonRef, edm::Event& event);
-    bool isValidJet(const pat::Jet& jet);
+    bool isValidPhotonEB2012(const pat::PhotonRef& photonRef, const EventProducts& products);
+    bool isValidJet(JetCollectionContext& context, const pat::Jet& jet);
 
-    void readJSONFile();
-    void readCSVFile();
     void updateLuminosity(const edm::LuminosityBlock& lumiBlock);
 
+    // Photon paths of a HLT menu: their indexes in TriggerResults, and the id of the menu in the trigger_menus tree
+    struct TriggerMenu {
+      uint64_t id;
+      std::vector<unsigned int> indexes;
+    };
+
+    const TriggerMenu& getTriggerMenu(const edm::TriggerNames& triggerNames);
+
+    std::map<edm::ParameterSetID, TriggerMenu> mTriggerMenus;
+    std::set<uint64_t> mWrittenTriggerMenus;
+
+    // Guards the output trees and the trigger menus. In the wide layout, all the views of a shared tree
+    // must be filled by the same event, so an event holds it from the first view to the last one
+    std::mutex mOutputMutex;
+    // EnergyScaleCorrection_class counts the lookups without category
+    std::mutex mRegressionMutex;
+
     // ----------member data ---------------------------
     bool mIsMC;
     bool mFilterData;
     std::string mJSONFile;
     std::string mCSVFile;
-    boost::shared_ptr<Json::Value> mValidRuns;
-    boost::shared_ptr<Json::Value> mCurrentRunValidLumis;
-    std::map<std::pair<unsigned int, unsigned int>, double> mLumiByLS;
-    std::map<std::pair<unsigned int, unsigned int>, double> mTruePUByLS;
-    bool mIsValidLumiBlock;
-    double mCurrentTruePU;
+    bool mCacheLumiFiles;
+    LumiIndex mLumiIndex;
 
     // Photon ID
     PFIsolationEstimator mPFIsolator;
@@ -177,28 +483,38 @@ class GammaJetFilter : public edm::EDFilter {
     edm::InputTag mJetsAK5CaloIT;
     edm::InputTag mJetsAK7CaloIT;
 
-    boost::shared_ptr<JetIDSelectionFunctor> mCaloJetID;
-    pat::strbitset mCaloJetIDRet;
-
     double mPtHatMin;
     double mPtHatMax;
 
     // Trees
     void createTrees(const std::string& rootName, TFileService& fs);
+    OutputTree* makeOutputTree(TFileDirectory& dir, const std::string& name, const std::string& title, TTree* sharedTree = NULL, const std::string& prefix = "", bool fillsSharedTree = false);
+    TTree* makeTree(TFileDirectory& dir, const std::string& name, const std::string& title);
+
+    // Wide layout: one tree for the event and one per jet collection, instead of one tree per object
+    bool mWideTrees;
+    // Basket sizes are optimized after this number of events. 0 to keep ROOT default
+    unsigned int mBasketOptimizationEvents;
+    std::vector<std::unique_ptr<OutputTree>> mOutputTrees;
+
     TTree* mGenParticlesTree;
-    TTree* mPhotonTree;
-    TTree* mPhotonGenTree;
-    TTree* mAnalysisTree;
-    TTree* mElectronsTree;
-    TTree* mMuonsTree;
+    OutputTree* mPhotonTree;
+    OutputTree* mPhotonGenTree;
+    OutputTree* mAnalysisTree;
+    OutputTree* mTriggerMenusTree;
+    OutputTree* mElectronsTree;
+    OutputTree* mMuonsTree;
     TParameter<double>*    mTotalLuminosity;
     float                  mEventsWeight;
     TParameter<long long>* mProcessedEvents;
     TParameter<long long>* mSelectedEvents;
+    // Copied to the TParameters above in endJob()
+    std::atomic<long long> mProcessedEventsCount;
+    std::atomic<long long> mSelectedEventsCount;
 
-    std::map<std::string, std::vector<TTree*> > mJetTrees;
-    std::map<std::string, std::vector<TTree*> > mMETTrees;
-    std::map<std::string, TTree*>               mMiscTrees;
+    std::map<std::string, std::vector<OutputTree*> > mJetTrees;
+    std::map<std::string, std::vector<OutputTree*> > mMETTrees;
+    std::map<std::string, OutputTree*>               mMiscTrees;
     std::map<std::string, TTree*> mMETNFTrees;
 
     // TParameters for storing current config (JEC, correctorLabel, Treshold, etc...
@@ -208,58 +524,51 @@ class GammaJetFilter : public edm::EDFilter {
     TParameter<bool>*             mFirstJetPtCutParameter;
     TParameter<double>*           mFirstJetThresholdParameter;
 
-    // DEBUG
-    TH1F* mFirstJetPhotonDeltaPhi;
-    TH1F* mFirstJetPhotonDeltaR;
-    TH1F* mFirstJetPhotonDeltaPt;
-    TH2F* mFirstJetPhotonDeltaPhiDeltaR;
+    FilterHistograms mHistograms;
 
-    TH1F* mSelectedFirstJetIndex;
-    TH1F* mSelectedSecondJetIndex;
-
-    TH1F* mSecondJetPhotonDeltaPhi;
-    TH1F* mSecondJetPhotonDeltaR;
-    TH1F* mSecondJetPhotonDeltaPt;
-
-    TH1F* mSelectedFirstJetPhotonDeltaPhi;
-    TH1F* mSelectedFirstJetPhotonDeltaR;
-
-    TH1F* mSelectedSecondJetPhotonDeltaPhi;
-    TH1F* mSelectedSecondJetPhotonDeltaR;
-
-    // For B / C jets neutrinos
-    TClonesArray* mNeutrinos;
-    TClonesArray* mNeutrinosPDG;
+    StageClock::time_point endStage(StreamContext& context, FilterStage stage, StageClock::time_point start);
+    bool rejectEvent(StreamContext& context, FilterStage stage, StageClock::time_point start);
 
     // Cache for MC particles
     bool mDumpAllMCParticles;
     std::unordered_map<const reco::Candidate*, int> mParticlesIndexes;
 
-    void particleToTree(const reco::Candidate* particle, TTree* t, std::vector<boost::shared_ptr<void> >& addresses);
+    // Neutrinos of the B / C partons of the current event. Partons are usually matched by jets of several
+    // collections, so their decay trees are only searched once. Only used with mOutputMutex held
+    std::unordered_map<const reco::Candidate*, std::vector<const reco::Candidate*>> mPartonNeutrinos;
+
+    void particleToTree(const reco::Candidate* particle, OutputTree* t, std::vector<boost::shared_ptr<void> >& addresses);
     
-    void updateBranch(TTree* tree, void* address, const std::string& name, const std::string& type = "F");
+    void updateBranch(OutputTree* tree, void* address, const std::string& name, const std::string& type = "F");
     template<typename U>
-      void updateBranch(TTree* tree, std::vector<U>*& address, const std::string& name);
+      void updateBranch(OutputTree* tree, std::vector<U>*& address, const std::string& name);
+    template<typename T>
+      void updateObjectBranch(OutputTree* tree, T*& address, const std::string& name, int bufsize = 32000, int splitlevel = 99);
 
-    void updateBranchArray(TTree* tree, void* address, const std::string& name, const std::string& size, const std::string& type = "F");
+    void updateBranchArray(OutputTree* tree, void* address, const std::string& name, const std::string& size, const std::string& type = "F");
 
-    void photonToTree(const pat::PhotonRef& photonRef, pat::Photon& photon, const edm::Event& event);
-    void metsToTree(const pat::MET& met, const pat::MET& rawMet, const std::vector<TTree*>& trees);
-    void metToTree(const pat::MET* met, TTree* tree, TTree* genTree);
-    void jetsToTree(const pat::Jet* firstJet, const pat::Jet* secondJet, const std::vector<TTree*>& trees);
-    void jetToTree(const pat::Jet* jet, bool findNeutrinos, TTree* tree, TTree* genTree);
-    void electronsToTree(const edm::Handle<pat::ElectronCollection>& electrons, const reco::Vertex& pv);
-    void muonsToTree(const edm::Handle<pat::MuonCollection>& muons, const reco::Vertex& pv);
+    void photonToTree(const pat::PhotonRef& photonRef, pat::Photon& photon, const EventProducts& products);
+    void metsToTree(const pat::MET& met, const pat::MET& rawMet, const std::vector<OutputTree*>& trees);
+    void metToTree(const pat::MET* met, OutputTree* tree, OutputTree* genTree);
+    void jetsToTree(JetCollectionContext& context, const pat::Jet* firstJet, const pat::Jet* secondJet, const std::vector<OutputTree*>& trees);
+    void jetToTree(JetCollectionContext& context, const pat::Jet* jet, bool findNeutrinos, OutputTree* tree, OutputTree* genTree);
+    void electronsToTree(StreamContext& context, const edm::Handle<pat::ElectronCollection>& electrons, const reco::Vertex& pv);
+    void muonsToTree(StreamContext& context, const edm::Handle<pat::MuonCollection>& muons, const reco::Vertex& pv);
 
     int getMotherIndex(const edm::Handle<reco::GenParticleCollection>& genParticles, const reco::Candidate* mother);
     void genParticlesToTree(const edm::Handle<reco::GenParticleCollection>& genParticles);
-  //FactorizedJetCorrector
-  FactorizedJetCorrector *jetCorrector;
-  FactorizedJetCorrector *jetCorrectorForTypeI;
-  FactorizedJetCorrector *jetCorrectorForTypeIL1;
+  //FactorizedJetCorrector parameters. Each JetCollectionContext builds its own correctors from them
   std::vector<JetCorrectorParameters> vPar;
   std::vector<JetCorrectorParameters> vParTypeI;
   std::vector<JetCorrectorParameters> vParTypeIL1;
+  // Batch versions of the correctors above, used when they agree with FactorizedJetCorrector
+  bool mUseBatchJEC;
+  JECBatchCorrector mBatchJetCorrector;
+  JECBatchCorrector mBatchJetCorrectorForTypeI;
+  JECBatchCorrector mBatchJetCorrectorForTypeIL1;
+
+  void getJetCorrections(const JECBatchCorrector& batchCorrector, FactorizedJetCorrector* corrector, const JECJetBatch& jets, std::vector<float>& corrections);
+  void computeTypeICorrections(JetCollectionContext& context, const pat::JetCollection& jets, const EventProducts& products);
 //define (once for all) corrector for regression
   EnergyScaleCorrection_class *RegressionCorrector;
 };
@@ -276,7 +585,7 @@ class GammaJetFilter : public edm::EDFilter {
 // constructors and destructor
 //
 GammaJetFilter::GammaJetFilter(const edm::ParameterSet& iConfig):
-  mIsMC(false), mIsValidLumiBlock(false)
+  mIsMC(false), mProcessedEventsCount(0), mSelectedEventsCount(0)
 {
 
   mIsMC = iConfig.getUntrackedParameter<bool>("isMC", "false");
@@ -292,83 +601,85 @@ if (mIsMC) {
   if (! mIsMC) {
     mJSONFile = iConfig.getParameter<std::string>("json");
     mCSVFile = iConfig.getParameter<std::string>("csv");
+    mCacheLumiFiles = iConfig.getUntrackedParameter<bool>("cacheLumiFiles", true);
     mFilterData = iConfig.getUntrackedParameter<bool>("filterData", true);
     // Create the JetCorrectorParameter objects, the order does not matter.
     // YYYY is the first part of the txt files: usually the global tag from which they are retrieved
     //CHS
-    JetCorrectorParameters *ResJetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_DATA_L2L3Residual_AK5PFchs.txt").fullPath());
-    JetCorrectorParameters *L3JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PFchs.txt").fullPath());
-    JetCorrectorParameters *L2JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PFchs.txt").fullPath());
-//    JetCorrectorParameters *L1JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L1FastJet_AK5PFchs.txt").fullPath());
-    JetCorrectorParameters *L1JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_DATA_L1FastJet_AK5PFchs.txt").fullPath());
+    const std::string ResJetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_DATA_L2L3Residual_AK5PFchs.txt").fullPath();
+    const std::string L3JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PFchs.txt").fullPath();
+    const std::string L2JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PFchs.txt").fullPath();
+//    const std::string L1JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L1FastJet_AK5PFchs.txt").fullPath();
+    const std::string L1JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_DATA_L1FastJet_AK5PFchs.txt").fullPath();
 //Winter14_V1_DATA_L1FastJet_AK5PFchs.txt
     //txt file to use for L1 only for typeI
-    JetCorrectorParameters *L1JetParForTypeI = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_DATA_L1FastJetPU_AK5PFchs_pt.txt").fullPath()); 
+    const std::string L1JetPayloadForTypeI = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_DATA_L1FastJetPU_AK5PFchs_pt.txt").fullPath();
 /*
 //NO CHS
-    JetCorrectorParameters *ResJetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L2L3Residual_AK5PF.txt").fullPath());
-    JetCorrectorParameters *L3JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PF.txt").fullPath());
-    JetCorrectorParameters *L2JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PF.txt").fullPath());
-    JetCorrectorParameters *L1JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L1FastJet_AK5PF.txt").fullPath());
+    const std::string ResJetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L2L3Residual_AK5PF.txt").fullPath();
+    const std::string L3JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PF.txt").fullPath();
+    const std::string L2JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PF.txt").fullPath();
+    const std::string L1JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_DATA_L1FastJet_AK5PF.txt").fullPath();
     //txt file to use for L1 only for typeI
-    JetCorrectorParameters *L1JetParForTypeI = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_DATA_L1FastJetPU_AK5PF_pt.txt").fullPath());
+    const std::string L1JetPayloadForTypeI = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_DATA_L1FastJetPU_AK5PF_pt.txt").fullPath();
 */
+    const JetCorrectorParameters& ResJetPar = JECPayloadCache::get<JetCorrectorParameters>(ResJetPayload);
+    const JetCorrectorParameters& L3JetPar = JECPayloadCache::get<JetCorrectorParameters>(L3JetPayload);
+    const JetCorrectorParameters& L2JetPar = JECPayloadCache::get<JetCorrectorParameters>(L2JetPayload);
+    const JetCorrectorParameters& L1JetPar = JECPayloadCache::get<JetCorrectorParameters>(L1JetPayload);
+    const JetCorrectorParameters& L1JetParForTypeI = JECPayloadCache::get<JetCorrectorParameters>(L1JetPayloadForTypeI);
     //
     //
     // Load the JetCorrectorParameter objects into a vector, IMPORTANT: THE ORDER MATTERS HERE !!!!
-    vPar.push_back(*L1JetPar);
-    vPar.push_back(*L2JetPar);
-    vPar.push_back(*L3JetPar);
-    vPar.push_back(*ResJetPar); //comment if you dont want residuals
-    jetCorrector = new FactorizedJetCorrector(vPar);
+    vPar.push_back(L1JetPar);
+    vPar.push_back(L2JetPar);
+    vPar.push_back(L3JetPar);
+    vPar.push_back(ResJetPar); //comment if you dont want residuals
+    mBatchJetCorrector = JECBatchCorrector({L1JetPayload, L2JetPayload, L3JetPayload, ResJetPayload});
     //FAKE vPar for typeI fix
-    vParTypeI.push_back(*L1JetPar);
-    vParTypeI.push_back(*L2JetPar);
-    vParTypeI.push_back(*L3JetPar);
-    vParTypeI.push_back(*ResJetPar); //comment if you dont want residuals
-    jetCorrectorForTypeI = new FactorizedJetCorrector(vParTypeI);
+    vParTypeI.push_back(L1JetPar);
+    vParTypeI.push_back(L2JetPar);
+    vParTypeI.push_back(L3JetPar);
+    vParTypeI.push_back(ResJetPar); //comment if you dont want residuals
+    mBatchJetCorrectorForTypeI = JECBatchCorrector({L1JetPayload, L2JetPayload, L3JetPayload, ResJetPayload});
     //FAKE vPar for typeI fix only L1
-    vParTypeIL1.push_back(*L1JetParForTypeI);
-    jetCorrectorForTypeIL1 = new FactorizedJetCorrector(vParTypeIL1);
-    //
-    delete ResJetPar;
-    delete L3JetPar;
-    delete L2JetPar;
-    delete L1JetPar;
-    delete L1JetParForTypeI;
+    vParTypeIL1.push_back(L1JetParForTypeI);
+    mBatchJetCorrectorForTypeIL1 = JECBatchCorrector({L1JetPayloadForTypeI});
   } else {
     // Create the JetCorrectorParameter objects, the order does not matter.
     // YYYY is the first part of the txt files: usually the global tag from which they are retrieved
 
 //CHS
-    JetCorrectorParameters *L3JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PFchs.txt").fullPath());
-    JetCorrectorParameters *L2JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PFchs.txt").fullPath());
-    JetCorrectorParameters *L1JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_MC_L1FastJet_AK5PFchs.txt").fullPath());
+    const std::string L3JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PFchs.txt").fullPath();
+    const std::string L2JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PFchs.txt").fullPath();
+    const std::string L1JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V6_MC_L1FastJet_AK5PFchs.txt").fullPath();
     //txt file to use for L1 only for typeI
-    JetCorrectorParameters *L1JetParForTypeI = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_MC_L1FastJetPU_AK5PFchs_pt.txt").fullPath());
+    const std::string L1JetPayloadForTypeI = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_MC_L1FastJetPU_AK5PFchs_pt.txt").fullPath();
 /*
 //NO CHS
-    JetCorrectorParameters *L3JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PF.txt").fullPath());
-    JetCorrectorParameters *L2JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PF.txt").fullPath());
-    JetCorrectorParameters *L1JetPar = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L1FastJet_AK5PF.txt").fullPath());
+    const std::string L3JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L3Absolute_AK5PF.txt").fullPath();
+    const std::string L2JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L2Relative_AK5PF.txt").fullPath();
+    const std::string L1JetPayload = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V5_MC_L1FastJet_AK5PF.txt").fullPath();
     //txt file to use for L1 only for typeI
-    JetCorrectorParameters *L1JetParForTypeI = new JetCorrectorParameters(edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_MC_L1FastJetPU_AK5PF_pt.txt").fullPath());
+    const std::string L1JetPayloadForTypeI = edm::FileInPath("JetMETCorrections/GammaJetFilter/data/Winter14_V0_MC_L1FastJetPU_AK5PF_pt.txt").fullPath();
 */
+    const JetCorrectorParameters& L3JetPar = JECPayloadCache::get<JetCorrectorParameters>(L3JetPayload);
+    const JetCorrectorParameters& L2JetPar = JECPayloadCache::get<JetCorrectorParameters>(L2JetPayload);
+    const JetCorrectorParameters& L1JetPar = JECPayloadCache::get<JetCorrectorParameters>(L1JetPayload);
+    const JetCorrectorParameters& L1JetParForTypeI = JECPayloadCache::get<JetCorrectorParameters>(L1JetPayloadForTypeI);
     //
     // Load the JetCorrectorParameter objects into a vector, IMPORTANT: THE ORDER MATTERS HERE !!!!
 //When i thought it was L1(V0)L2L3 - L1(V0)
-//    vParTypeI.push_back(*L1JetParForTypeI);
-    vParTypeI.push_back(*L1JetPar);
-    vParTypeI.push_back(*L2JetPar);
-    vParTypeI.push_back(*L3JetPar);
-    jetCorrectorForTypeI = new FactorizedJetCorrector(vParTypeI);
+//    vParTypeI.push_back(L1JetParForTypeI);
+    vParTypeI.push_back(L1JetPar);
+    vParTypeI.push_back(L2JetPar);
+    vParTypeI.push_back(L3JetPar);
+    mBatchJetCorrectorForTypeI = JECBatchCorrector({L1JetPayload, L2JetPayload, L3JetPayload});
     //FAKE vPar for typeI fix only L1
-    vParTypeIL1.push_back(*L1JetParForTypeI);
-    jetCorrectorForTypeIL1 = new FactorizedJetCorrector(vParTypeIL1);
+    vParTypeIL1.push_back(L1JetParForTypeI);
+    mBatchJetCorrectorForTypeIL1 = JECBatchCorrector({L1JetPayloadForTypeI});
     //
-    delete L3JetPar;
-    delete L2JetPar;
-    delete L1JetParForTypeI;
+    // Jets are corrected using the EventSetup corrector on MC, vPar stays empty
 }
 
   mPhotonsIT = iConfig.getUntrackedParameter<edm::InputTag>("photons", edm::InputTag("selectedPatPhotons"));
@@ -402,21 +713,41 @@ if (mIsMC) {
 
   if (! mIsMC && mFilterData) {
     // Load JSON file of good runs
-    readJSONFile();
-    readCSVFile();
+    mLumiIndex.readJSON(mJSONFile);
+    mLumiIndex.readCSV(mCSVFile, mCacheLumiFiles);
   }
 
+  mWideTrees = iConfig.getUntrackedParameter<bool>("wideTrees", false);
+  mBasketOptimizationEvents = iConfig.getUntrackedParameter<unsigned int>("basketOptimizationEvents", 0);
+
   edm::Service<TFileService> fs;
-  mPhotonTree = fs->make<TTree>("photon", "photon tree");
+
+  // Compression applies to the whole TFileService file, and must be set before any branch is created
+  std::string compressionAlgorithm = iConfig.getUntrackedParameter<std::string>("compressionAlgorithm", "");
+  if (! compressionAlgorithm.empty()) {
+    int compressionLevel = iConfig.getUntrackedParameter<int>("compressionLevel", 4);
+    int compressionSettings = OutputTree::compressionSettings(compressionAlgorithm, compressionLevel);
+    if (compressionSettings < 0) {
+      throw cms::Exception("Configuration") << "Invalid compression: algorithm '" << compressionAlgorithm << "', level " << compressionLevel << ". Supported algorithms are zlib, lzma and lz4, with a level between 0 and 9" << std::endl;
+    }
+
+    fs->file().SetCompressionSettings(compressionSettings);
+  }
+
+  // In the wide layout, muons are written last and fill the event tree
+  TTree* eventTree = (mWideTrees) ? makeTree(*fs, "events", "events tree") : NULL;
+
+  mPhotonTree = makeOutputTree(*fs, "photon", "photon tree", eventTree, "photon_");
   
   if (mIsMC)
-    mPhotonGenTree = fs->make<TTree>("photon_gen", "photon gen tree");
+    mPhotonGenTree = makeOutputTree(*fs, "photon_gen", "photon gen tree", eventTree, "photon_gen_");
   else
     mPhotonGenTree = nullptr;
 
-  mAnalysisTree = fs->make<TTree>("analysis", "analysis tree");
-  mMuonsTree = fs->make<TTree>("muons", "muons tree");
-  mElectronsTree = fs->make<TTree>("electrons", "electrons tree");
+  mAnalysisTree = makeOutputTree(*fs, "analysis", "analysis tree", eventTree);
+  mTriggerMenusTree = makeOutputTree(*fs, "trigger_menus", "trigger menus tree");
+  mMuonsTree = makeOutputTree(*fs, "muons", "muons tree", eventTree, "muons_", true);
+  mElectronsTree = makeOutputTree(*fs, "electrons", "electrons tree", eventTree, "electrons_");
 
   mTotalLuminosity = fs->make<TParameter<double> >("total_luminosity", 0.);
 
@@ -484,32 +815,57 @@ if (mIsMC) {
     mFirstJetThresholdParameter = fs->make<TParameter<double> >("cut_on_first_jet_treshold", mFirstJetThreshold);
   }
 
-  mFirstJetPhotonDeltaPhi = fs->make<TH1F>("firstJetPhotonDeltaPhi", "firstJetPhotonDeltaPhi", 50, 0., M_PI);
-  mFirstJetPhotonDeltaR = fs->make<TH1F>("firstJetPhotonDeltaR", "firstJetPhotonDeltaR", 80, 0, 10);
-  mFirstJetPhotonDeltaPt = fs->make<TH1F>("firstJetPhotonDeltaPt", "firstJetPhotonDeltaPt", 100, 0, 50);
-  mFirstJetPhotonDeltaPhiDeltaR = fs->make<TH2F>("firstJetPhotonDeltaPhiDeltaR", "firstJetPhotonDeltaPhiDeltaR", 50, 0, M_PI, 80, 0, 10);
+  mHistograms.firstJetPhotonDeltaPhi = fs->make<TH1F>("firstJetPhotonDeltaPhi", "firstJetPhotonDeltaPhi", 50, 0., M_PI);
+  mHistograms.firstJetPhotonDeltaR = fs->make<TH1F>("firstJetPhotonDeltaR", "firstJetPhotonDeltaR", 80, 0, 10);
+  mHistograms.firstJetPhotonDeltaPt = fs->make<TH1F>("firstJetPhotonDeltaPt", "firstJetPhotonDeltaPt", 100, 0, 50);
+  mHistograms.firstJetPhotonDeltaPhiDeltaR = fs->make<TH2F>("firstJetPhotonDeltaPhiDeltaR", "firstJetPhotonDeltaPhiDeltaR", 50, 0, M_PI, 80, 0, 10);
 
-  mSelectedFirstJetIndex = fs->make<TH1F>("selectedFirstJetIndex", "selectedFirstJetIndex", 20, 0, 20);
-  mSelectedSecondJetIndex = fs->make<TH1F>("selectedSecondJetIndex", "selectedSecondJetIndex", 20, 0, 20);
+  mHistograms.selectedFirstJetIndex = fs->make<TH1F>("selectedFirstJetIndex", "selectedFirstJetIndex", 20, 0, 20);
+  mHistograms.selectedSecondJetIndex = fs->make<TH1F>("selectedSecondJetIndex", "selectedSecondJetIndex", 20, 0, 20);
 
-  mSecondJetPhotonDeltaPhi = fs->make<TH1F>("secondJetPhotonDeltaPhi", "secondJetPhotonDeltaPhi", 50, 0., M_PI);
-  mSecondJetPhotonDeltaR = fs->make<TH1F>("secondJetPhotonDeltaR", "secondJetPhotonDeltaR", 80, 0, 10);
-  mSecondJetPhotonDeltaPt = fs->make<TH1F>("secondJetPhotonDeltaPt", "secondJetPhotonDeltaPt", 100, 0, 50);
+  mHistograms.secondJetPhotonDeltaPhi = fs->make<TH1F>("secondJetPhotonDeltaPhi", "secondJetPhotonDeltaPhi", 50, 0., M_PI);
+  mHistograms.secondJetPhotonDeltaR = fs->make<TH1F>("secondJetPhotonDeltaR", "secondJetPhotonDeltaR", 80, 0, 10);
+  mHistograms.secondJetPhotonDeltaPt = fs->make<TH1F>("secondJetPhotonDeltaPt", "secondJetPhotonDeltaPt", 100, 0, 50);
 
-  mSelectedFirstJetPhotonDeltaPhi = fs->make<TH1F>("selectedFirstJetPhotonDeltaPhi", "selectedFirstJetPhotonDeltaPhi", 50, 0., M_PI);
-  mSelectedFirstJetPhotonDeltaR = fs->make<TH1F>("selectedFirstJetPhotonDeltaR", "selectedFirstJetPhotonDeltaR", 80, 0, 10);
+  mHistograms.selectedFirstJetPhotonDeltaPhi = fs->make<TH1F>("selectedFirstJetPhotonDeltaPhi", "selectedFirstJetPhotonDeltaPhi", 50, 0., M_PI);
+  mHistograms.selectedFirstJetPhotonDeltaR = fs->make<TH1F>("selectedFirstJetPhotonDeltaR", "selectedFirstJetPhotonDeltaR", 80, 0, 10);
 
-  mSelectedSecondJetPhotonDeltaPhi = fs->make<TH1F>("selectedSecondJetPhotonDeltaPhi", "selectedSecondJetPhotonDeltaPhi", 50, 0., M_PI);
-  mSelectedSecondJetPhotonDeltaR = fs->make<TH1F>("selectedSecondJetPhotonDeltaR", "selectedSecondJetPhotonDeltaR", 80, 0, 10);
+  mHistograms.selectedSecondJetPhotonDeltaPhi = fs->make<TH1F>("selectedSecondJetPhotonDeltaPhi", "selectedSecondJetPhotonDeltaPhi", 50, 0., M_PI);
+  mHistograms.selectedSecondJetPhotonDeltaR = fs->make<TH1F>("selectedSecondJetPhotonDeltaR", "selectedSecondJetPhotonDeltaR", 80, 0, 10);
+
+  // Cut flow of filter()
+  mHistograms.stageTime = fs->make<TH1D>("filterStageTime", "filterStageTime", STAGE_COUNT, 0, STAGE_COUNT);
+  mHistograms.stageRejectedEvents = fs->make<TH1D>("filterStageRejectedEvents", "filterStageRejectedEvents", STAGE_COUNT, 0, STAGE_COUNT);
+
+  const char* stageNames[STAGE_COUNT] = {"lumi_mask", "pt_hat", "photon", "vertex", "jets", "output"};
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    mHistograms.stageTime->GetXaxis()->SetBinLabel(i + 1, stageNames[i]);
+    mHistograms.stageRejectedEvents->GetXaxis()->SetBinLabel(i + 1, stageNames[i]);
+  }
 
   mPFIsolator.initializePhotonIsolation(true);
   mPFIsolator.setConeSize(0.3);
 
-  mNeutrinos = NULL;
-  mNeutrinosPDG = NULL;
-  if (mIsMC) {
-    mNeutrinos = new TClonesArray("TLorentzVector", 3);
-    mNeutrinosPDG = new TClonesArray("TParameter<int>", 3);
+  mJetCollectionThreads = std::max(1U, iConfig.getUntrackedParameter<unsigned int>("jetCollectionThreads", 1));
+
+  mStreamContext.reset(new StreamContext(*this));
+  for (size_t i = 0; i < std::max<size_t>(mJetCollections.size(), 1); i++)
+    mJetCollectionContexts.push_back(std::unique_ptr<JetCollectionContext>(new JetCollectionContext(*this)));
+
+  // Check that the batch correctors reproduce FactorizedJetCorrector before using them
+  mUseBatchJEC = iConfig.getUntrackedParameter<bool>("useBatchJEC", true);
+  if (mUseBatchJEC) {
+    double tolerance = iConfig.getUntrackedParameter<double>("batchJECTolerance", 1e-5);
+
+    const JetCollectionContext& context = *mJetCollectionContexts.front();
+    double deviation = std::max(mBatchJetCorrectorForTypeI.maxDeviation(*context.jetCorrectorForTypeI), mBatchJetCorrectorForTypeIL1.maxDeviation(*context.jetCorrectorForTypeIL1));
+    if (context.jetCorrector)
+      deviation = std::max(deviation, mBatchJetCorrector.maxDeviation(*context.jetCorrector));
+
+    if (deviation > tolerance) {
+      edm::LogWarning("GammaJetFilter") << "Batch JEC differs from FactorizedJetCorrector by up to " << deviation << " (tolerance: " << tolerance << "). Falling back to FactorizedJetCorrector.";
+      mUseBatchJEC = false;
+    }
   }
 }
 
@@ -520,68 +876,100 @@ GammaJetFilter::~GammaJetFilter()
   // do anything here that needs to be done at desctruction time
   // (e.g. close files, deallocate resources etc.)
 
-  delete mNeutrinos;
-  delete mNeutrinosPDG;
+}
+
+GammaJetFilter::StreamContext::StreamContext(const GammaJetFilter& filter):
+  isValidLumiBlock(false), truePU(0)
+{
+  histograms = filter.mHistograms.emptyCopy();
+}
+
+GammaJetFilter::StreamContext::~StreamContext() {
+  histograms.deleteAll();
+}
+
+GammaJetFilter::JetCollectionContext::JetCollectionContext(const GammaJetFilter& filter) {
+  if (! filter.vPar.empty())
+    jetCorrector.reset(new FactorizedJetCorrector(filter.vPar));
+  jetCorrectorForTypeI.reset(new FactorizedJetCorrector(filter.vParTypeI));
+  jetCorrectorForTypeIL1.reset(new FactorizedJetCorrector(filter.vParTypeIL1));
+
+  histograms = filter.mHistograms.emptyCopy();
+}
+
+GammaJetFilter::JetCollectionContext::~JetCollectionContext() {
+  histograms.deleteAll();
 }
 
 void GammaJetFilter::createTrees(const std::string& rootName, TFileService& fs) {
 
   TFileDirectory dir = fs.mkdir(rootName);
-  std::vector<TTree*>& trees = mJetTrees[rootName];
 
-  trees.push_back(dir.make<TTree>("first_jet", "first jet tree"));
-  trees.push_back(dir.make<TTree>("second_jet", "second jet tree"));
+  // In the wide layout, misc is written last and fills the collection tree
+  TTree* collectionTree = (mWideTrees) ? makeTree(dir, "events", rootName + " events tree") : NULL;
+
+  std::vector<OutputTree*>& trees = mJetTrees[rootName];
+
+  trees.push_back(makeOutputTree(dir, "first_jet", "first jet tree", collectionTree, "first_jet_"));
+  trees.push_back(makeOutputTree(dir, "second_jet", "second jet tree", collectionTree, "second_jet_"));
 
-  trees.push_back(dir.make<TTree>("first_jet_raw", "first raw jet tree"));
-  trees.push_back(dir.make<TTree>("second_jet_raw", "second raw jet tree"));
+  trees.push_back(makeOutputTree(dir, "first_jet_raw", "first raw jet tree", collectionTree, "first_jet_raw_"));
+  trees.push_back(makeOutputTree(dir, "second_jet_raw", "second raw jet tree", collectionTree, "second_jet_raw_"));
 
   if (mIsMC) {
-    trees.push_back(dir.make<TTree>("first_jet_gen", "first gen jet tree"));
-    trees.push_back(dir.make<TTree>("second_jet_gen", "second gen jet tree"));
+    trees.push_back(makeOutputTree(dir, "first_jet_gen", "first gen jet tree", collectionTree, "first_jet_gen_"));
+    trees.push_back(makeOutputTree(dir, "second_jet_gen", "second gen jet tree", collectionTree, "second_jet_gen_"));
   } else {
     trees.push_back(nullptr);
     trees.push_back(nullptr);
   }
 
   // MET
-  std::vector<TTree*>& met = mMETTrees[rootName];
-  met.push_back(dir.make<TTree>("met", "met tree"));
-  met.push_back(dir.make<TTree>("met_raw", "met raw tree"));
+  std::vector<OutputTree*>& met = mMETTrees[rootName];
+  met.push_back(makeOutputTree(dir, "met", "met tree", collectionTree, "met_"));
+  met.push_back(makeOutputTree(dir, "met_raw", "met raw tree", collectionTree, "met_raw_"));
 
   if (mIsMC)
-    met.push_back(dir.make<TTree>("met_gen", "met gen tree"));
+    met.push_back(makeOutputTree(dir, "met_gen", "met gen tree", collectionTree, "met_gen_"));
   else
     met.push_back(nullptr);
 
   // Misc
-  mMiscTrees[rootName] = dir.make<TTree>("misc", "misc tree");
+  mMiscTrees[rootName] = makeOutputTree(dir, "misc", "misc tree", collectionTree, "misc_", true);
 }
 
-void GammaJetFilter::updateBranch(TTree* tree, void* address, const std::string& name, const std::string& type/* = "F"*/) {
-  TBranch* branch = tree->GetBranch(name.c_str());
-  if (branch == NULL) {
-    branch = tree->Branch(name.c_str(), address, std::string(name + "/" + type).c_str()); 
-  } else {
-    branch->SetAddress(address);
-  }
+// If sharedTree is NULL, a standalone tree is created. Otherwise, the returned tree is a view on sharedTree
+OutputTree* GammaJetFilter::makeOutputTree(TFileDirectory& dir, const std::string& name, const std::string& title, TTree* sharedTree/* = NULL*/, const std::string& prefix/* = ""*/, bool fillsSharedTree/* = false*/) {
+  OutputTree* tree = (sharedTree) ? new OutputTree(sharedTree, prefix, fillsSharedTree) : new OutputTree(makeTree(dir, name, title));
+  mOutputTrees.push_back(std::unique_ptr<OutputTree>(tree));
+
+  return tree;
 }
 
-template<typename U> void GammaJetFilter::updateBranch(TTree* tree, std::vector<U>*& address, const std::string& name) {
-  TBranch* branch = tree->GetBranch(name.c_str());
-  if (branch == NULL) {
-    branch = tree->Branch(name.c_str(), &address); 
-  } else {
-    branch->SetAddress(&address);
-  }
+TTree* GammaJetFilter::makeTree(TFileDirectory& dir, const std::string& name, const std::string& title) {
+  TTree* tree = dir.make<TTree>(name.c_str(), title.c_str());
+
+  // Baskets are resized by ROOT when the tree is flushed for the first time
+  if (mBasketOptimizationEvents > 0)
+    tree->SetAutoFlush(mBasketOptimizationEvents);
+
+  return tree;
 }
 
-void GammaJetFilter::updateBranchArray(TTree* tree, void* address, const std::string& name, const std::string& size, const std::string& type/* = "F"*/) {
-  TBranch* branch = tree->GetBranch(name.c_str());
-  if (branch == NULL) {
-    branch = tree->Branch(name.c_str(), address, std::string(name + "[" + size + "]/" +type).c_str()); 
-  } else {
-    branch->SetAddress(address);
-  }
+void GammaJetFilter::updateBranch(OutputTree* tree, void* address, const std::string& name, const std::string& type/* = "F"*/) {
+  tree->updateBranch(address, name, type);
+}
+
+template<typename U> void GammaJetFilter::updateBranch(OutputTree* tree, std::vector<U>*& address, const std::string& name) {
+  tree->updateObjectBranch(address, name);
+}
+
+template<typename T> void GammaJetFilter::updateObjectBranch(OutputTree* tree, T*& address, const std::string& name, int bufsize/* = 32000*/, int splitlevel/* = 99*/) {
+  tree->updateObjectBranch(address, name, bufsize, splitlevel);
+}
+
+void GammaJetFilter::updateBranchArray(OutputTree* tree, void* address, const std::string& name, const std::string& size, const std::string& type/* = "F"*/) {
+  tree->updateBranchArray(address, name, size, type);
 }
 
 //
@@ -593,21 +981,25 @@ bool GammaJetFilter::filter(edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
   using namespace edm;
 
-  mProcessedEvents->SetVal(mProcessedEvents->GetVal() + 1);
+  StreamContext& context = *mStreamContext;
 
-  if (! mIsMC && mFilterData && ! mIsValidLumiBlock) {
-    return false;
-  }
+  mProcessedEventsCount++;
 
-  // Vertex
-  edm::Handle<reco::VertexCollection> vertices;
-  iEvent.getByLabel("goodOfflinePrimaryVertices", vertices);
+  // Cheapest decisive cuts first. Products are only read once an event passed the cuts not needing them
+  StageClock::time_point stageStart = StageClock::now();
 
-  // Keep events with at least one vertex
-  if (!vertices.isValid() || vertices->size() == 0 || vertices->front().isFake())
-    return false;
+  if (! mIsMC && mFilterData) {
+    edm::LuminosityBlockID lumiBlockId(iEvent.id().run(), iEvent.id().luminosityBlock());
+    if (lumiBlockId != context.lumiBlock) {
+      context.lumiBlock = lumiBlockId;
+      context.isValidLumiBlock = mLumiIndex.isValid(lumiBlockId.run(), lumiBlockId.luminosityBlock());
+      context.truePU = (context.isValidLumiBlock) ? mLumiIndex.truePileup(lumiBlockId.run(), lumiBlockId.luminosityBlock()) : 0;
+    }
 
-  const reco::Vertex& primaryVertex = vertices->at(0);
+    if (! context.isValidLumiBlock)
+      return rejectEvent(context, LUMI_MASK_STAGE, stageStart);
+  }
+  stageStart = endStage(context, LUMI_MASK_STAGE, stageStart);
 
   double generatorWeight = 1.;
 
@@ -619,10 +1011,10 @@ bool GammaJetFilter::filter(edm::Event& iEvent, const edm::EventSetup& iSetup)
       double genPt = eventInfos->binningValues()[0];
 
       if (mPtHatMin >= 0. && genPt < mPtHatMin)
-        return false;
+        return rejectEvent(context, PT_HAT_STAGE, stageStart);
 
       if (mPtHatMax >= 0. && genPt > mPtHatMax)
-        return false;
+        return rejectEvent(context, PT_HAT_STAGE, stageStart);
     }
 
     generatorWeight = eventInfos->weight();
@@ -630,51 +1022,54 @@ bool GammaJetFilter::filter(edm::Event& iEvent, const edm::EventSetup& iSetup)
       generatorWeight = 1.;
     }
   }
+  stageStart = endStage(context, PT_HAT_STAGE, stageStart);
 
-  edm::Handle<double> pFlowRho;
-  iEvent.getByLabel(edm::InputTag("kt6PFJets", "rho"), pFlowRho); // For photon ID
-
-  // Necesseray collection for calculate sigmaIPhiIPhi
-  // 2011 Photon ID
-  edm::ESHandle<CaloTopology> topology;
-  iSetup.get<CaloTopologyRecord>().get(topology);
+  EventProducts products(iEvent);
 
   edm::Handle<pat::PhotonCollection> photons; //handle for pat::photonref
   iEvent.getByLabel(mPhotonsIT, photons);
-  pat::PhotonCollection photons_nonconst = *photons; //handle for pat::photon
-  pat::PhotonCollection::iterator it = photons_nonconst.begin();
-  std::vector<pat::Photon> photonsVec;
-  pat::Photon pho_tmp;
 
+  // Photon ID cuts are ordered by cost, isolations are only read for photons passing the shower shape cuts
   uint32_t index = 0;
   uint32_t goodPhoIndex = -1;
-  for (; it != photons_nonconst.end(); ++it, index++) { 
-     pho_tmp=*it;
+  size_t goodPhotons = 0;
+  for (pat::PhotonCollection::const_iterator it = photons->begin(); it != photons->end(); ++it, index++) {
     if (fabs(it->eta()) <= 1.3) {
     pat::PhotonRef PhotonReftmp(photons, index);
-      if (isValidPhotonEB2012(PhotonReftmp, iEvent)) {
-       photonsVec.push_back(*it);
+      if (isValidPhotonEB2012(PhotonReftmp, products)) {
+       goodPhotons++;
        goodPhoIndex=index;
        }
      }
    }
 
   // Only one good photon per event
-  if (photonsVec.size() != 1)    return false;
-  pat::Photon photon = photonsVec[0];
+  if (goodPhotons != 1)
+    return rejectEvent(context, PHOTON_STAGE, stageStart);
+  pat::Photon photon = photons->at(goodPhoIndex);
   pat::PhotonRef GoodphotonRef(photons, goodPhoIndex);
+  stageStart = endStage(context, PHOTON_STAGE, stageStart);
+
+  // Vertex. After the photon: one good photon rejects far more events, and the photon ID doesn't need the vertices
+  edm::Handle<reco::VertexCollection> vertices;
+  iEvent.getByLabel("goodOfflinePrimaryVertices", vertices);
+
+  // Keep events with at least one vertex
+  if (!vertices.isValid() || vertices->size() == 0 || vertices->front().isFake())
+    return rejectEvent(context, VERTEX_STAGE, stageStart);
+
+  const reco::Vertex& primaryVertex = vertices->at(0);
+  stageStart = endStage(context, VERTEX_STAGE, stageStart);
 
 //for technical reasons i need a photonref and a photon. 
 //Since there is only one photon in these events, we are sur that the 
-//goodPhoIndex is referring to the same photon as photonsVec[0];
+//goodPhoIndex is referring to the same photon as photon;
 //
 float regressionCorr=1.;
 if (mCorrPhotonWRegression) {
 //calculate the regression energy using photonRef and getting the reco object
-  edm::Handle<edm::ValueMap<float>> regressionEnergyHandle;
-  iEvent.getByLabel(edm::InputTag("eleNewEnergiesProducer", "energySCEleJoshPhoSemiParamV5ecorr", "PAT"),regressionEnergyHandle);
   edm::Ptr<reco::Candidate> GoodrecoObject = GoodphotonRef->originalObjectRef();
-  float GoodregressionEnergy = (*regressionEnergyHandle)[GoodrecoObject] ;
+  float GoodregressionEnergy = (*products.regressionEnergy())[GoodrecoObject] ;
 //correct this january 15
 //  regressionCorr = GoodregressionEnergy/(GoodphotonRef->energy());
 //rescale the photon to the regression energy (rescale the whole p4 by the ratio of regression energy over uncorrected energy)
@@ -688,73 +1083,49 @@ if(mIsMC) processingdata=0;
  
 
 
-  // Process jets
-  edm::Handle<pat::JetCollection> jetsHandle;
-
-  FOREACH(mJetCollections) {
-
-    JetInfos infos = mJetCollectionsData[*it];
-
-    iEvent.getByLabel(infos.inputTag, jetsHandle);
-    pat::JetCollection jets = *jetsHandle;
-    if (mDoJEC) {
-      correctJets(jets, iEvent, iSetup);
-    } else {
-      extractRawJets(jets);
-    }
-
-    edm::Handle<edm::ValueMap<float>>  qgTagHandleMLP;
-    edm::Handle<edm::ValueMap<float>>  qgTagHandleLikelihood;
-    iEvent.getByLabel("QGTagger" + *it,"qgMLP", qgTagHandleMLP);
-    iEvent.getByLabel("QGTagger" + *it,"qgLikelihood", qgTagHandleLikelihood);
-
-
-    processJets(&photon, jets, infos.algo, qgTagHandleMLP, qgTagHandleLikelihood, jetsHandle, mJetTrees[*it]);
+  // Process jets. Collections are independent: the event is only read while fetching them, then they're
+  // processed concurrently, each with its own context, and finally written in order
+  std::vector<JetCollectionTask> tasks(mJetCollections.size());
+  for (size_t i = 0; i < mJetCollections.size(); i++) {
+    JetCollectionTask& task = tasks[i];
+    task.name = mJetCollections[i];
+    task.infos = mJetCollectionsData[task.name];
+    task.context = mJetCollectionContexts[i].get();
 
-    // MET
-    edm::Handle<pat::METCollection> metsHandle;
-    iEvent.getByLabel(std::string("patMETs" + ((*it == "AK5Calo") ? "" : *it)), metsHandle);
+    fetchJetCollection(task, iEvent, iSetup, products);
+  }
 
-    edm::Handle<pat::METCollection> rawMets;
-    iEvent.getByLabel(std::string("patPFMet" + ((*it == "AK5Calo") ? "" : *it)), rawMets);
+  // Products read lazily by the tasks. They must be in the cache before the tasks start
+  products.pfRho();
+  if (mDoFootprint)
+    products.photonIsolation(GoodphotonRef);
 
-    pat::METCollection mets = *metsHandle;
-    pat::MET& met = mets[0];
-    const pat::MET& rawMet = rawMets->at(0);
+  std::atomic<size_t> nextTask(0);
+  auto processTasks = [&]() {
+    for (size_t i = nextTask++; i < tasks.size(); i = nextTask++)
+      processJetCollection(tasks[i], products, photon, GoodphotonRef);
+  };
 
-    if (mDoJEC || mRedoTypeI) {
-     if (mDoFootprint) {
-     correctMETWithFootprintAndTypeI(rawMet, met, jets, iEvent, photon, GoodphotonRef);
-     } else {
-      if (mCorrPhotonWRegression) {
-       correctMETWithRegressionAndTypeI(rawMet, met, jets, iEvent, photon, GoodphotonRef);
-      } else {
-      correctMETWithTypeI(rawMet, met, jets, iEvent);
-     }
-     }
-    }
+  std::vector<std::future<void>> workers;
+  for (size_t i = 1; i < std::min<size_t>(mJetCollectionThreads, tasks.size()); i++)
+    workers.push_back(std::async(std::launch::async, processTasks));
 
-    if (rawMets.isValid())
-      metsToTree(met, rawMet, mMETTrees[*it]);
-    else {
-      pat::MET emptyRawMet = pat::MET();
-      metsToTree(met, emptyRawMet, mMETTrees[*it]);
-    }
-    //
+  processTasks();
 
-    // Rho
-    edm::Handle<double> rhos;
-    if (it->find("Calo") != std::string::npos)
-      iEvent.getByLabel(edm::InputTag("kt6CaloJets", "rho"), rhos);
-    else
-      iEvent.getByLabel(edm::InputTag("kt6PFJets", "rho"), rhos);
+  // Rethrows the exceptions of the workers
+  for (std::future<void>& worker: workers)
+    worker.get();
 
-    double rho = *rhos;
-    updateBranch(mMiscTrees[*it], &rho, "rho", "D");
+  {
+    std::lock_guard<std::mutex> lock(mOutputMutex);
 
-    mMiscTrees[*it]->Fill();
+    mPartonNeutrinos.clear();
+    for (JetCollectionTask& task: tasks)
+      jetCollectionToTrees(task);
   }
 
+  stageStart = endStage(context, JETS_STAGE, stageStart);
+
   // Number of vertices for pu reweighting
   edm::Handle<std::vector<PileupSummaryInfo> > puInfos;
   iEvent.getByLabel(edm::InputTag("addPileupInfo"), puInfos);
@@ -784,9 +1155,11 @@ if(mIsMC) processingdata=0;
       throw cms::Exception("PUReweighting") << "No in-time beam crossing found!" << std::endl;
     }
   } else {
-    nTrueInteractions = mCurrentTruePU;
+    nTrueInteractions = context.truePU;
   }
 
+  std::lock_guard<std::mutex> lock(mOutputMutex);
+
   updateBranch(mAnalysisTree, &run, "run", "i");
   updateBranch(mAnalysisTree, &lumiBlock, "lumi_block", "i");
   updateBranch(mAnalysisTree, &event, "event", "i");
@@ -796,86 +1169,221 @@ if(mIsMC) processingdata=0;
   updateBranch(mAnalysisTree, &mEventsWeight, "event_weight"); // Only valid for binned samples
   updateBranch(mAnalysisTree, &generatorWeight, "generator_weight", "D"); // Only valid for flat samples
 
-  // Triggers
+  // Triggers. Events only store the id of their trigger menu and one bit per path of this menu,
+  // the path names are stored once per menu in the trigger_menus tree
   edm::Handle<edm::TriggerResults> triggerResults;
   iEvent.getByLabel(edm::InputTag("TriggerResults", "", "HLT"), triggerResults);
 
-  std::vector<std::string>* trigNames = new std::vector<std::string>();
-  std::vector<bool>* trigResults = new std::vector<bool>();
+  ULong64_t triggerMenuId = 0;
+  int triggerWords = 0;
+  ULong64_t triggerBits[MAX_TRIGGER_WORDS] = {0};
 
   if (triggerResults.isValid()) {
-    static std::vector<boost::regex> validTriggers = { boost::regex("HLT_.*Photon.*", boost::regex_constants::icase) };
-    const edm::TriggerNames& triggerNames = iEvent.triggerNames(*triggerResults);
-
-    size_t size = triggerResults->size();
-
-    for (size_t i = 0; i < size; i++) {
-      std::string triggerName = triggerNames.triggerName(i);
-      bool isValid = false;
-      for (boost::regex& validTrigger: validTriggers) {
-        if (boost::regex_match(triggerName, validTrigger)) {
-          isValid = true;
-          break;
-        }
-      }
+    const TriggerMenu& menu = getTriggerMenu(iEvent.triggerNames(*triggerResults));
 
-      if (!isValid)
-        continue;
-
-      unsigned int index = triggerNames.triggerIndex(triggerName);
-      bool passed = triggerResults->accept(index);
-
-      trigResults->push_back(passed);
-      trigNames->push_back(triggerName);
+    triggerMenuId = menu.id;
+    triggerWords = (menu.indexes.size() + 63) / 64;
+    for (size_t i = 0; i < menu.indexes.size(); i++) {
+      if (triggerResults->accept(menu.indexes[i]))
+        triggerBits[i / 64] |= (1ULL << (i % 64));
     }
   }
 
   // Create branches, even if they're empty
-  updateBranch(mAnalysisTree, trigNames, "trigger_names");
-  updateBranch(mAnalysisTree, trigResults, "trigger_results");
+  updateBranch(mAnalysisTree, &triggerMenuId, "trigger_menu_id", "l");
+  updateBranch(mAnalysisTree, &triggerWords, "trigger_words", "I");
+  updateBranchArray(mAnalysisTree, triggerBits, "trigger_bits", "trigger_words", "l");
 
   mAnalysisTree->Fill();
 
-  delete trigNames;
-  delete trigResults;
-
-  photonToTree(GoodphotonRef, photon, iEvent);
+  photonToTree(GoodphotonRef, photon, products);
 
   // Electrons
   edm::Handle<pat::ElectronCollection> electrons;
   iEvent.getByLabel("selectedPatElectronsPFlowAK5chs", electrons);
-  electronsToTree(electrons, primaryVertex);
+  electronsToTree(context, electrons, primaryVertex);
 
   // Muons
   edm::Handle<pat::MuonCollection> muons;
   iEvent.getByLabel("selectedPatMuonsPFlowAK5chs", muons);
-  muonsToTree(muons, primaryVertex);
+  muonsToTree(context, muons, primaryVertex);
+
+  endStage(context, OUTPUT_STAGE, stageStart);
 
-  mSelectedEvents->SetVal(mSelectedEvents->GetVal() + 1);
+  mSelectedEventsCount++;
   return true;
 }
 
+// Everything reading the event: handles, and the EventSetup corrector on MC
+void GammaJetFilter::fetchJetCollection(JetCollectionTask& task, edm::Event& iEvent, const edm::EventSetup& iSetup, const EventProducts& products) {
+  iEvent.getByLabel(task.infos.inputTag, task.jetsHandle);
+  task.jets = *task.jetsHandle;
+
+  iEvent.getByLabel("QGTagger" + task.name,"qgMLP", task.qgTagMLP);
+  iEvent.getByLabel("QGTagger" + task.name,"qgLikelihood", task.qgTagLikelihood);
+
+  edm::Handle<pat::METCollection> metsHandle;
+  iEvent.getByLabel(std::string("patMETs" + ((task.name == "AK5Calo") ? "" : task.name)), metsHandle);
+  task.mets = *metsHandle;
+
+  iEvent.getByLabel(std::string("patPFMet" + ((task.name == "AK5Calo") ? "" : task.name)), task.rawMets);
+
+  task.rho = (task.name.find("Calo") != std::string::npos) ? *products.caloRho() : *products.pfRho();
+
+  if (mIsMC) {
+    // Gen jets are references into the event: resolve them now
+    for (const pat::Jet& jet: task.jets)
+      jet.genJet();
+
+    if (mDoJEC)
+      correctJets(task.jets, iEvent, iSetup);
+  }
+}
+
+// JEC on data, jet selection and TypeI MET. Only uses the context of the task
+void GammaJetFilter::processJetCollection(JetCollectionTask& task, const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef) {
+  JetCollectionContext& context = *task.context;
+  pat::JetCollection& jets = task.jets;
+
+  if (mDoJEC) {
+    if (! mIsMC)
+      correctJets(context, jets, products);
+  } else {
+    extractRawJets(jets);
+  }
+
+  processJets(context, &photon, jets, task.infos.algo, task.qgTagMLP, task.qgTagLikelihood, task.jetsHandle, task.selectedJets);
+
+  // MET
+  pat::MET& met = task.mets[0];
+  const pat::MET& rawMet = task.rawMets->at(0);
+
+  if (mDoJEC || mRedoTypeI) {
+   if (mDoFootprint) {
+   correctMETWithFootprintAndTypeI(context, rawMet, met, jets, products, photon, photonRef);
+   } else {
+    if (mCorrPhotonWRegression) {
+     correctMETWithRegressionAndTypeI(context, rawMet, met, jets, products, photon, photonRef);
+    } else {
+    correctMETWithTypeI(context, rawMet, met, jets, products);
+   }
+   }
+  }
+}
+
+// Must be called with mOutputMutex held
+void GammaJetFilter::jetCollectionToTrees(JetCollectionTask& task) {
+  const pat::Jet* firstJet = (task.selectedJets.size() > 0) ? &task.selectedJets[0] : NULL;
+  const pat::Jet* secondJet = (task.selectedJets.size() > 1) ? &task.selectedJets[1] : NULL;
+  jetsToTree(*task.context, firstJet, secondJet, mJetTrees[task.name]);
+
+  const pat::MET& met = task.mets[0];
+  if (task.rawMets.isValid())
+    metsToTree(met, task.rawMets->at(0), mMETTrees[task.name]);
+  else {
+    pat::MET emptyRawMet = pat::MET();
+    metsToTree(met, emptyRawMet, mMETTrees[task.name]);
+  }
+
+  updateBranch(mMiscTrees[task.name], &task.rho, "rho", "D");
+
+  mMiscTrees[task.name]->Fill();
+}
+
+StageClock::time_point GammaJetFilter::endStage(StreamContext& context, FilterStage stage, StageClock::time_point start) {
+  StageClock::time_point now = StageClock::now();
+  context.histograms.stageTime->Fill(stage, std::chrono::duration<double>(now - start).count());
+
+  return now;
+}
+
+bool GammaJetFilter::rejectEvent(StreamContext& context, FilterStage stage, StageClock::time_point start) {
+  endStage(context, stage, start);
+  context.histograms.stageRejectedEvents->Fill(stage);
+
+  return false;
+}
+
+// Photon paths of a HLT menu. Selecting them needs regular expressions, so it's only done once per menu.
+// Must be called with mOutputMutex held
+const GammaJetFilter::TriggerMenu& GammaJetFilter::getTriggerMenu(const edm::TriggerNames& triggerNames) {
+  std::map<edm::ParameterSetID, TriggerMenu>::const_iterator it = mTriggerMenus.find(triggerNames.parameterSetID());
+  if (it != mTriggerMenus.end())
+    return it->second;
+
+  static const std::vector<boost::regex> validTriggers = { boost::regex("HLT_.*Photon.*", boost::regex_constants::icase) };
+
+  TriggerMenu menu;
+  std::vector<std::string>* names = new std::vector<std::string>();
+
+  // FNV-1a hash of the path names
+  menu.id = 14695981039346656037ULL;
+
+  size_t size = triggerNames.size();
+  for (size_t i = 0; i < size; i++) {
+    const std::string& triggerName = triggerNames.triggerName(i);
+    bool isValid = false;
+    for (const boost::regex& validTrigger: validTriggers) {
+      if (boost::regex_match(triggerName, validTrigger)) {
+        isValid = true;
+        break;
+      }
+    }
+
+    if (!isValid)
+      continue;
+
+    menu.indexes.push_back(i);
+    names->push_back(triggerName);
+
+    for (unsigned char c: triggerName + '\n') {
+      menu.id ^= c;
+      menu.id *= 1099511628211ULL;
+    }
+  }
+
+  if (menu.indexes.size() > MAX_TRIGGER_WORDS * 64) {
+    delete names;
+    throw cms::Exception("TriggerMenu") << "Too many photon paths in HLT menu: " << menu.indexes.size() << std::endl;
+  }
+
+  // Different process histories can share the same menu
+  if (mWrittenTriggerMenus.insert(menu.id).second) {
+    ULong64_t menuId = menu.id;
+    updateBranch(mTriggerMenusTree, &menuId, "menu_id", "l");
+    updateBranch(mTriggerMenusTree, names, "trigger_names");
+
+    mTriggerMenusTree->Fill();
+  }
+
+  delete names;
+
+  return mTriggerMenus[triggerNames.parameterSetID()] = menu;
+}
+
 void GammaJetFilter::correctPhoton(pat::Photon& photon, edm::Event& iEvent, int isData, int nPV) {
   edm::EventID eventId = iEvent.id();
 
+std::lock_guard<std::mutex> lock(mRegressionMutex);
+
 if(isData==1) {
 float scalecorr = RegressionCorrector->ScaleCorrection(eventId.run(),true,photon.r9(),photon.eta(),photon.pt(),nPV,15.); //nPVmean is not actually used in the function, so it is set to a dummy value
 //ScaleCorrection(int runNumber, bool isEBEle, double R9Ele, double etaSCEle, double EtEle, int nPV, float nPVmean=0);
 photon.setP4(photon.p4()*scalecorr);
 } else {
       reco::SuperClusterRef superCluster = photon.superCluster();
-float smearcorr = RegressionCorrector->getSmearing(eventId.run(),photon.energy(),true,photon.r9(),superCluster->eta());
+// Draw from a stream of this event, not from the corrector generator: the smearing doesn't depend on the job splitting
+PhiloxRandom random;
+random.SetStream(eventId.run(), eventId.luminosityBlock(), eventId.event(), PhiloxRandom::PHOTON_SMEARING);
+float smearcorr = RegressionCorrector->getSmearing(eventId.run(),photon.energy(),true,photon.r9(),superCluster->eta(),random);
 //getSmearing(int runNumber, float energy, bool isEBEle, float R9Ele, float etaSCEle);
  photon.setP4(photon.p4()*smearcorr);
 }
 }
 
 
-void GammaJetFilter::correctJets(pat::JetCollection& jets, edm::Event& iEvent, const edm::EventSetup& iSetup) {
-  // Get Jet corrector
-  const JetCorrector* corrector = JetCorrector::getJetCorrector(mCorrectorLabel, iSetup);
-
-  // Correct jets
+// Embed raw and L1 jets, and undo the JEC if needed
+void GammaJetFilter::prepareJetsForJEC(pat::JetCollection& jets) {
   for (pat::JetCollection::iterator it = jets.begin(); it != jets.end(); ++it)  {
     pat::Jet& jet = *it;
 
@@ -889,28 +1397,69 @@ void GammaJetFilter::correctJets(pat::JetCollection& jets, edm::Event& iEvent, c
       double toRaw = jet.jecFactor("Uncorrected");
       jet.setP4(jet.p4() * toRaw); // It's now a raw jet
     }
-
-   double corrections =1.;
-    if(mIsMC)    {
-	    corrections = corrector->correction(jet, iEvent, iSetup);
-    } else {
-	    edm::Handle<double> rho_;
-	    iEvent.getByLabel(edm::InputTag("kt6PFJets", "rho"), rho_);
-	    jetCorrector->setJetEta(jet.eta());
-	    jetCorrector->setJetPt(jet.pt());
-	    jetCorrector->setJetA(jet.jetArea());
-	    jetCorrector->setRho(*rho_);
-	    corrections = jetCorrector->getCorrection();
-    }
-    jet.scaleEnergy(corrections);
   }
+}
+
+// Data: jets are corrected with the JEC payloads of the module. Doesn't read the event
+void GammaJetFilter::correctJets(JetCollectionContext& context, pat::JetCollection& jets, const EventProducts& products) {
+  prepareJetsForJEC(jets);
+
+  JECJetBatch jecJets;
+  jecJets.reserve(jets.size());
+  for (pat::JetCollection::const_iterator it = jets.begin(); it != jets.end(); ++it)
+    jecJets.push_back(it->eta(), it->pt(), *products.pfRho(), it->jetArea());
+
+  // Correct jets
+  std::vector<float> jecCorrections;
+  getJetCorrections(mBatchJetCorrector, context.jetCorrector.get(), jecJets, jecCorrections);
+
+  for (size_t i = 0; i < jets.size(); i++)
+    jets[i].scaleEnergy(jecCorrections[i]);
 
   // Sort collection by pt
   std::sort(jets.begin(), jets.end(), mSorter);
 }
 
+// MC: jets are corrected using the EventSetup corrector
+void GammaJetFilter::correctJets(pat::JetCollection& jets, edm::Event& iEvent, const edm::EventSetup& iSetup) {
+  // Get Jet corrector
+  const JetCorrector* corrector = JetCorrector::getJetCorrector(mCorrectorLabel, iSetup);
+
+  prepareJetsForJEC(jets);
+
+  for (pat::JetCollection::iterator it = jets.begin(); it != jets.end(); ++it)
+    it->scaleEnergy(corrector->correction(*it, iEvent, iSetup));
+
+  // Sort collection by pt
+  std::sort(jets.begin(), jets.end(), mSorter);
+}
+
+void GammaJetFilter::getJetCorrections(const JECBatchCorrector& batchCorrector, FactorizedJetCorrector* corrector, const JECJetBatch& jets, std::vector<float>& corrections) {
+  if (mUseBatchJEC)
+    batchCorrector.getCorrections(jets, corrections);
+  else
+    JECBatchCorrector::getScalarCorrections(*corrector, jets, corrections);
+}
+
+// Fill the typeICorrections and typeIL1Corrections of the context with the ad-hoc L1L2L3(Res) and L1 corrections of each raw jet
+void GammaJetFilter::computeTypeICorrections(JetCollectionContext& context, const pat::JetCollection& jets, const EventProducts& products) {
+  const double rho = *products.pfRho();
+
+  JECJetBatch rawJets;
+  rawJets.reserve(jets.size());
+  for (pat::JetCollection::const_iterator it = jets.begin(); it != jets.end(); ++it) {
+    const pat::Jet* rawJet = it->userData<pat::Jet>("rawJet");
+    rawJets.push_back(rawJet->eta(), rawJet->pt(), rho, rawJet->jetArea());
+  }
+
+  getJetCorrections(mBatchJetCorrectorForTypeIL1, context.jetCorrectorForTypeIL1.get(), rawJets, context.typeIL1Corrections);
+  getJetCorrections(mBatchJetCorrectorForTypeI, context.jetCorrectorForTypeI.get(), rawJets, context.typeICorrections);
+}
+
+
+void GammaJetFilter::correctMETWithTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets, const EventProducts& products) {
+  computeTypeICorrections(context, jets, products);
 
-void GammaJetFilter::correctMETWithTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets, edm::Event& event) {
   double deltaPx = 0., deltaPy = 0.;
   // See https://indico.cern.ch/getFile.py/access?contribId=1&resId=0&materialId=slides&confId=174324 slide 4
   // and http://cmssw.cvs.cern.ch/cgi-bin/cmssw.cgi/CMSSW/JetMETCorrections/Type1MET/interface/PFJetMETcorrInputProducerT.h?revision=1.8&view=markup
@@ -926,26 +1475,12 @@ void GammaJetFilter::correctMETWithTypeI(const pat::MET& rawMet, pat::MET& met,
 */
 
 //with typeI fix
-    double corrsForTypeI =1.;
-    double corrsForTypeIL1=1.;
-    edm::Handle<double> rho_;
-    event.getByLabel(edm::InputTag("kt6PFJets", "rho"), rho_);
-
-    jetCorrectorForTypeIL1->setJetEta(rawJet->eta());
-    jetCorrectorForTypeIL1->setJetPt(rawJet->pt());
-    jetCorrectorForTypeIL1->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeIL1->setRho(*rho_);
-    corrsForTypeIL1 = jetCorrectorForTypeIL1->getCorrection();
+    double corrsForTypeI = context.typeICorrections[it - jets.begin()];
+    double corrsForTypeIL1 = context.typeIL1Corrections[it - jets.begin()];
 
     pat::Jet jetL1 = *rawJet;
     jetL1.scaleEnergy(corrsForTypeIL1);
 
-    jetCorrectorForTypeI->setJetEta(rawJet->eta());
-    jetCorrectorForTypeI->setJetPt(rawJet->pt());
-    jetCorrectorForTypeI->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeI->setRho(*rho_);
-    corrsForTypeI = jetCorrectorForTypeI->getCorrection();
-
     pat::Jet jet = *rawJet;
     jet.scaleEnergy(corrsForTypeI);
 
@@ -972,25 +1507,13 @@ void GammaJetFilter::correctMETWithTypeI(const pat::MET& rawMet, pat::MET& met,
   met.setP4(reco::Candidate::LorentzVector(correctedMetPx, correctedMetPy, 0., correctedMetPt));
 }
 
-void GammaJetFilter::correctMETWithFootprintAndTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  edm::Event& event, pat::Photon& photon, const pat::PhotonRef& photonRef) {
+void GammaJetFilter::correctMETWithFootprintAndTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef) {
 //retrieve the footprint corrections to MET vector
-edm::Handle<edm::ValueMap<double>> footpxHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintPx", "PAT"), footpxHandle);
-edm::Handle<edm::ValueMap<double>> footpyHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintPy", "PAT"), footpyHandle);
-
-edm::Handle<double> footprintMExrawHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMExraw", "PAT"), footprintMExrawHandle);
-edm::Handle<double> footprintMEyrawHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMEyraw", "PAT"), footprintMEyrawHandle);
+const PhotonIsolationRecord isolation = products.photonIsolation(photonRef);
+double footprintMExCorr = isolation.footprintMExCorr;
+double footprintMEyCorr = isolation.footprintMEyCorr;
 
-edm::Handle<edm::ValueMap<double>> footprintMExCorrHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMExCorr", "PAT"), footprintMExCorrHandle);
-edm::Handle<edm::ValueMap<double>> footprintMEyCorrHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMEyCorr", "PAT"), footprintMEyCorrHandle);
-
-double footprintMExCorr = (*footprintMExCorrHandle)[photonRef];
-double footprintMEyCorr = (*footprintMEyCorrHandle)[photonRef];
+  computeTypeICorrections(context, jets, products);
 
   double deltaPx = 0., deltaPy = 0.;
 
@@ -1003,25 +1526,11 @@ double footprintMEyCorr = (*footprintMEyCorrHandle)[photonRef];
      const pat::Jet* rawJet = it->userData<pat::Jet>("rawJet");
 //apply the ad hoc corrections
 //calculate the corrections
-    double corrsForTypeI =1.;
-    double corrsForTypeIL1=1.;
-    edm::Handle<double> rho_;
-    event.getByLabel(edm::InputTag("kt6PFJets", "rho"), rho_);
+    double corrsForTypeI = context.typeICorrections[it - jets.begin()];
+    double corrsForTypeIL1 = context.typeIL1Corrections[it - jets.begin()];
 //
-    jetCorrectorForTypeIL1->setJetEta(rawJet->eta());
-    jetCorrectorForTypeIL1->setJetPt(rawJet->pt());
-    jetCorrectorForTypeIL1->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeIL1->setRho(*rho_);
-    corrsForTypeIL1 = jetCorrectorForTypeIL1->getCorrection();
-
     pat::Jet jetL1 = *rawJet;
     jetL1.scaleEnergy(corrsForTypeIL1);
-//
-    jetCorrectorForTypeI->setJetEta(rawJet->eta()); 
-    jetCorrectorForTypeI->setJetPt(rawJet->pt());
-    jetCorrectorForTypeI->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeI->setRho(*rho_);
-    corrsForTypeI = jetCorrectorForTypeI->getCorrection();
 
     pat::Jet jet = *rawJet;
     jet.scaleEnergy(corrsForTypeI);
@@ -1057,10 +1566,11 @@ cout<< "" << endl;
 
 
 
-void GammaJetFilter::correctMETWithRegressionAndTypeI(const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  edm::Event& event, pat::Photon& photon, const pat::PhotonRef& photonRef) {
+void GammaJetFilter::correctMETWithRegressionAndTypeI(JetCollectionContext& context, const pat::MET& rawMet, pat::MET& met, const pat::JetCollection& jets,  const EventProducts& products, pat::Photon& photon, const pat::PhotonRef& photonRef) {
 //photonRef is the one before regression
 //photon is the one after
 
+  computeTypeICorrections(context, jets, products);
 
  double deltaPx = 0., deltaPy = 0.;
   for (pat::JetCollection::const_iterator it = jets.begin(); it != jets.end(); ++it) {
@@ -1069,26 +1579,12 @@ void GammaJetFilter::correctMETWithRegressionAndTypeI(const pat::MET& rawMet, pa
     if (jet.pt() > 10) {
 
       const pat::Jet* rawJet = jet.userData<pat::Jet>("rawJet");
-    double corrsForTypeI =1.;
-    double corrsForTypeIL1=1.;
-    edm::Handle<double> rho_;
-    event.getByLabel(edm::InputTag("kt6PFJets", "rho"), rho_);
-
-    jetCorrectorForTypeIL1->setJetEta(rawJet->eta());
-    jetCorrectorForTypeIL1->setJetPt(rawJet->pt());
-    jetCorrectorForTypeIL1->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeIL1->setRho(*rho_);
-    corrsForTypeIL1 = jetCorrectorForTypeIL1->getCorrection();
+    double corrsForTypeI = context.typeICorrections[it - jets.begin()];
+    double corrsForTypeIL1 = context.typeIL1Corrections[it - jets.begin()];
 
     pat::Jet jetL1 = *rawJet;
     jetL1.scaleEnergy(corrsForTypeIL1);
 
-    jetCorrectorForTypeI->setJetEta(rawJet->eta());
-    jetCorrectorForTypeI->setJetPt(rawJet->pt());
-    jetCorrectorForTypeI->setJetA(rawJet->jetArea());
-    jetCorrectorForTypeI->setRho(*rho_);
-    corrsForTypeI = jetCorrectorForTypeI->getCorrection();
-
     pat::Jet jet = *rawJet;
     jet.scaleEnergy(corrsForTypeI);
 
@@ -1124,30 +1620,31 @@ void GammaJetFilter::extractRawJets(pat::JetCollection& jets) {
 
 }
 
-void GammaJetFilter::processJets(pat::Photon* photon, pat::JetCollection& jets, const JetAlgorithm algo, edm::Handle<edm::ValueMap<float>>& qgTagMLP, edm::Handle<edm::ValueMap<float>>& qgTagLikelihood, const edm::Handle<pat::JetCollection>& handleForRef, std::vector<TTree*>& trees) {
+// Select the first and second jets of the event, if any, in selectedJets
+void GammaJetFilter::processJets(JetCollectionContext& context, pat::Photon* photon, pat::JetCollection& jets, const JetAlgorithm algo, edm::Handle<edm::ValueMap<float>>& qgTagMLP, edm::Handle<edm::ValueMap<float>>& qgTagLikelihood, const edm::Handle<pat::JetCollection>& handleForRef, pat::JetCollection& selectedJets) {
 
-  pat::JetCollection selectedJets;
+  FilterHistograms& histograms = context.histograms;
 
   pat::JetCollection::iterator it = jets.begin();
   uint32_t index = 0;
   uint32_t goodJetIndex = -1;
   for (; it != jets.end(); ++it, index++) {
 
-    if (! isValidJet(*it))
+    if (! isValidJet(context, *it))
       continue;
 
     goodJetIndex++;
 
     if (goodJetIndex == 0) {
-      mFirstJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *it)));
-      mFirstJetPhotonDeltaR->Fill(reco::deltaR(*photon, *it));
-      mFirstJetPhotonDeltaPt->Fill(fabs(photon->pt() - it->pt()));
+      histograms.firstJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *it)));
+      histograms.firstJetPhotonDeltaR->Fill(reco::deltaR(*photon, *it));
+      histograms.firstJetPhotonDeltaPt->Fill(fabs(photon->pt() - it->pt()));
 
-      mFirstJetPhotonDeltaPhiDeltaR->Fill(fabs(reco::deltaPhi(*photon, *it)), reco::deltaR(*photon, *it));
+      histograms.firstJetPhotonDeltaPhiDeltaR->Fill(fabs(reco::deltaPhi(*photon, *it)), reco::deltaR(*photon, *it));
     } else if (goodJetIndex == 1) {
-      mSecondJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *it)));
-      mSecondJetPhotonDeltaR->Fill(reco::deltaR(*photon, *it));
-      mSecondJetPhotonDeltaPt->Fill(fabs(photon->pt() - it->pt()));
+      histograms.secondJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *it)));
+      histograms.secondJetPhotonDeltaR->Fill(reco::deltaR(*photon, *it));
+      histograms.secondJetPhotonDeltaPt->Fill(fabs(photon->pt() - it->pt()));
     }
 
     // Extract Quark Gluon tagger value
@@ -1181,7 +1678,7 @@ void GammaJetFilter::processJets(pat::Photon* photon, pat::JetCollection& jets,
       if (mFirstJetPtCut && (it->pt() < photon->pt() * mFirstJetThreshold))
         break;
 
-      mSelectedFirstJetIndex->Fill(goodJetIndex);
+      histograms.selectedFirstJetIndex->Fill(goodJetIndex);
       selectedJets.push_back(*it);
 
     } else {
@@ -1190,7 +1687,7 @@ void GammaJetFilter::processJets(pat::Photon* photon, pat::JetCollection& jets,
       const double deltaR = reco::deltaR(*photon, *it);
 
       if (deltaR > deltaR_threshold) {
-        mSelectedSecondJetIndex->Fill(goodJetIndex);
+        histograms.selectedSecondJetIndex->Fill(goodJetIndex);
         selectedJets.push_back(*it);
       } else {
         continue;
@@ -1201,25 +1698,20 @@ void GammaJetFilter::processJets(pat::Photon* photon, pat::JetCollection& jets,
 
   }
 
-  const pat::Jet* firstJet = NULL;
-  const pat::Jet* secondJet = NULL;
-
   if (selectedJets.size() > 0) {
 
-    firstJet = &selectedJets[0];
-    mSelectedFirstJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *firstJet)));
-    mSelectedFirstJetPhotonDeltaR->Fill(reco::deltaR(*photon, *firstJet));
+    const pat::Jet* firstJet = &selectedJets[0];
+    histograms.selectedFirstJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *firstJet)));
+    histograms.selectedFirstJetPhotonDeltaR->Fill(reco::deltaR(*photon, *firstJet));
 
     if (selectedJets.size() > 1) {
-      secondJet = &selectedJets[1];
+      const pat::Jet* secondJet = &selectedJets[1];
 
-      mSelectedSecondJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *secondJet)));
-      mSelectedSecondJetPhotonDeltaR->Fill(reco::deltaR(*photon, *secondJet));
+      histograms.selectedSecondJetPhotonDeltaPhi->Fill(fabs(reco::deltaPhi(*photon, *secondJet)));
+      histograms.selectedSecondJetPhotonDeltaR->Fill(reco::deltaR(*photon, *secondJet));
     }
   }
 
-  jetsToTree(firstJet, secondJet, trees);
-
   return;
 }
 
@@ -1230,6 +1722,12 @@ void GammaJetFilter::beginJob()
 
 // ------------ method called once each job just after ending the event loop  ------------
 void GammaJetFilter::endJob() {
+  mHistograms.add(mStreamContext->histograms);
+  for (const std::unique_ptr<JetCollectionContext>& context: mJetCollectionContexts)
+    mHistograms.add(context->histograms);
+
+  mProcessedEvents->SetVal(mProcessedEventsCount);
+  mSelectedEvents->SetVal(mSelectedEventsCount);
 }
 
 // ------------ method called when starting to processes a run  ------------
@@ -1237,13 +1735,8 @@ bool GammaJetFilter::beginRun(edm::Run& run, edm::EventSetup const&)
 {
   if (! mIsMC && mFilterData) {
     // Check if this run is valid
-    std::stringstream stream;
-    stream << run.run();
-
-    if (! mValidRuns->isMember(stream.str()))
+    if (! mLumiIndex.isValidRun(run.run()))
       return false; // Drop run
-
-    mCurrentRunValidLumis.reset(new Json::Value((*mValidRuns)[stream.str()]));
   }
 
   return true;
@@ -1260,27 +1753,8 @@ bool GammaJetFilter::beginLuminosityBlock(edm::LuminosityBlock& lumiBlock, edm::
 {
   if (! mIsMC && mFilterData) {
 
-    mIsValidLumiBlock = false;
-
-    if (! mCurrentRunValidLumis.get())
-      return false;
-
-    // Check if this lumi block is valid
-    assert(mCurrentRunValidLumis->isArray());
-    for (Json::ArrayIndex i = 0; i < mCurrentRunValidLumis->size(); i++) {
-      Json::Value lumiRange = (*mCurrentRunValidLumis)[i];
-
-      assert(lumiRange.size() == 2);
-      edm::LuminosityBlockNumber_t lumi = lumiBlock.luminosityBlock();
-      if (lumi >= lumiRange[0].asUInt64() && lumi <= lumiRange[1].asUInt64()) {
-        mIsValidLumiBlock = true;
-
-        mCurrentTruePU = mTruePUByLS[std::make_pair(lumiBlock.id().run(), lumiBlock.id().luminosityBlock())];
-        return true;
-      }
-    }
-
-    return false;
+    // Check if this lumi block is valid. Events check it again, see filter()
+    return mLumiIndex.isValid(lumiBlock.id().run(), lumiBlock.luminosityBlock());
   }
 
   return true;
@@ -1289,7 +1763,7 @@ bool GammaJetFilter::beginLuminosityBlock(edm::LuminosityBlock& lumiBlock, edm::
 // ------------ method called when ending the processing of a luminosity block  ------------
 bool GammaJetFilter::endLuminosityBlock(edm::LuminosityBlock& lumiBlock, edm::EventSetup const&)
 {
-  if (! mIsMC && mFilterData && mIsValidLumiBlock) {
+  if (! mIsMC && mFilterData && mLumiIndex.isValid(lumiBlock.id().run(), lumiBlock.luminosityBlock())) {
     updateLuminosity(lumiBlock);
   }
   return true;
@@ -1304,7 +1778,7 @@ void GammaJetFilter::fillDescriptions(edm::ConfigurationDescriptions& descriptio
   descriptions.addDefault(desc);
 }
 
-bool GammaJetFilter::isValidJet(const pat::Jet& jet) {
+bool GammaJetFilter::isValidJet(JetCollectionContext& context, const pat::Jet& jet) {
   // First, check if this pat::Jet has a gen jet
   if (mIsMC && !jet.genJet()) {
     return false;
@@ -1330,13 +1804,13 @@ bool GammaJetFilter::isValidJet(const pat::Jet& jet) {
 
   } else if (jet.isCaloJet() || jet.isJPTJet()) {
 
-    if (! mCaloJetID.get()) {
-      mCaloJetID.reset(new JetIDSelectionFunctor(JetIDSelectionFunctor::PURE09, JetIDSelectionFunctor::LOOSE));
-      mCaloJetIDRet = mCaloJetID->getBitTemplate();
+    if (! context.caloJetID.get()) {
+      context.caloJetID.reset(new JetIDSelectionFunctor(JetIDSelectionFunctor::PURE09, JetIDSelectionFunctor::LOOSE));
+      context.caloJetIDRet = context.caloJetID->getBitTemplate();
     }
 
-    mCaloJetIDRet.set(false);
-    return (*mCaloJetID)(jet, mCaloJetIDRet);
+    context.caloJetIDRet.set(false);
+    return (*context.caloJetID)(jet, context.caloJetIDRet);
 
   } else {
     throw cms::Exception("UnsupportedJetType")
@@ -1417,7 +1891,7 @@ double getCorrectedPFIsolation(double isolation, double rho, float eta, Isolatio
 }
 
 // See https://twiki.cern.ch/twiki/bin/viewauth/CMS/CutBasedPhotonID2012
-bool GammaJetFilter::isValidPhotonEB2012(const pat::PhotonRef& photonRef, edm::Event& event) {
+bool GammaJetFilter::isValidPhotonEB2012(const pat::PhotonRef& photonRef, const EventProducts& products) {
   if (mIsMC && !photonRef->genPhoton())
     return false;
 
@@ -1429,28 +1903,16 @@ bool GammaJetFilter::isValidPhotonEB2012(const pat::PhotonRef& photonRef, edm::E
   if (! isValid)
     return false;
 
-  edm::Handle<double> rhos;
-  event.getByLabel(edm::InputTag("kt6PFJets", "rho", "RECO"), rhos);
-  double rho = *rhos;
-
   // Isolations are produced at PAT level by the PḧotonPFIsolation producer
-  edm::Handle<edm::ValueMap<bool>> hasMatchedPromptElectronHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "hasMatchedPromptElectron", "PAT"), hasMatchedPromptElectronHandle);
-
-  isValid &= ! (*hasMatchedPromptElectronHandle)[photonRef];
+  const PhotonIsolationRecord isolation = products.photonIsolation(photonRef);
+  isValid &= ! isolation.hasMatchedPromptElectron;
 
   if (! isValid)
     return false;
 
-  // Now, isolations
-  edm::Handle<edm::ValueMap<double>> chargedHadronsIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "chargedHadronsIsolation", "PAT"), chargedHadronsIsolationHandle);
+  double rho = *products.pfRhoRECO();
 
-  edm::Handle<edm::ValueMap<double>> neutralHadronsIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "neutralHadronsIsolation", "PAT"), neutralHadronsIsolationHandle);
-
-  edm::Handle<edm::ValueMap<double>> photonIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "photonIsolation", "PAT"), photonIsolationHandle);
+  // Now, isolations
   /*
   edm::Handle<edm::ValueMap<double>> chargedHadronsIsolationHandle;
   event.getByLabel(edm::InputTag("photonPFIsolation", "footchargediso", "PAT"), chargedHadronsIsolationHandle);
@@ -1462,9 +1924,9 @@ bool GammaJetFilter::isValidPhotonEB2012(const pat::PhotonRef& photonRef, edm::E
   event.getByLabel(edm::InputTag("photonPFIsolation", "footphotoniso", "PAT"), photonIsolationHandle);
 */
 
-  isValid &= getCorrectedPFIsolation((*chargedHadronsIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::CHARGED_HADRONS) < 0.7;
-  isValid &= getCorrectedPFIsolation((*neutralHadronsIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::NEUTRAL_HADRONS) < (0.4 + 0.04 * photonRef->pt());
-  isValid &= getCorrectedPFIsolation((*photonIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::PHOTONS) < (0.5 + 0.005 * photonRef->pt());
+  isValid &= getCorrectedPFIsolation(isolation.chargedHadronsIsolation, rho, photonRef->eta(), IsolationType::CHARGED_HADRONS) < 0.7;
+  isValid &= getCorrectedPFIsolation(isolation.neutralHadronsIsolation, rho, photonRef->eta(), IsolationType::NEUTRAL_HADRONS) < (0.4 + 0.04 * photonRef->pt());
+  isValid &= getCorrectedPFIsolation(isolation.photonIsolation, rho, photonRef->eta(), IsolationType::PHOTONS) < (0.5 + 0.005 * photonRef->pt());
 
   return isValid;
 }
@@ -1508,62 +1970,13 @@ bool GammaJetFilter::isValidPhotonEB(const pat::Photon& photon, const double rho
   return isValid;
 }
 
-void GammaJetFilter::readJSONFile() {
-  Json::Value root;
-  Json::Reader reader;
-  std::ifstream file(mJSONFile.c_str());
-  if (! reader.parse(file, root)) {
-    throw cms::Exception("ReadError")
-      << "Failed to parse luminosity JSON file '" << mJSONFile << "'" << std::endl;
-  }
-
-  mValidRuns.reset(new Json::Value(root));
-}
-
-void GammaJetFilter::readCSVFile() {
-  FILE* iff = fopen(mCSVFile.c_str(), "r");
-
-  if(iff == 0) {
-    throw cms::Exception("ReadError")
-      << "Failed to parse luminosity CSV file '" << mCSVFile << "'" << std::endl;
-  }
-
-  int run = 0, fill = 0;
-  int lumiSection_left = 0, lumiSection_right = 0;
-  double lumiRecorded = 0.;
-  double true_pu = 0;
-
-
-  /* lumiCalc2 format :
-   * Run:Fill,LS,UTCTime,Beam Status,E(GeV),Delivered(/ub),Recorded(/ub),avgPU
-   * use 'lumiCalc2.py -i lumiSummary.json -o output.csv -b stable lumibyls' to generate file
-   */
-
-  // Skip header line
-  char buffer[1024];
-  fgets(buffer, 1024, iff);
-
-  while (fscanf(iff, "%d:%d,%d:%d,%*[^,],%*[^,],%*f,%*f,%lf,%lf", &run, &fill, &lumiSection_left, &lumiSection_right, &lumiRecorded, &true_pu) > 0 ) {
-
-    if (lumiSection_right == 0)
-      continue;
-
-    mLumiByLS[std::pair<unsigned int, unsigned int>(run, lumiSection_right)] = lumiRecorded; //in mb^(-1)
-    mTruePUByLS[std::pair<unsigned int, unsigned int>(run, lumiSection_right)] = true_pu; //in mb^(-1)
-  }
-
-  fclose(iff);
-
-  assert(mLumiByLS.size() > 0);
-}
-
 void GammaJetFilter::updateLuminosity(const edm::LuminosityBlock& lumiBlock) {
-  double eventLumi = mLumiByLS[std::pair<unsigned int, unsigned int>(lumiBlock.id().run(), lumiBlock.id().luminosityBlock())];
+  double eventLumi = mLumiIndex.luminosity(lumiBlock.id().run(), lumiBlock.id().luminosityBlock());
   double newLumi = mTotalLuminosity->GetVal() + eventLumi;
   mTotalLuminosity->SetVal(newLumi);
 }
 
-void GammaJetFilter::particleToTree(const reco::Candidate* particle, TTree* t, std::vector<boost::shared_ptr<void> >& addresses) {
+void GammaJetFilter::particleToTree(const reco::Candidate* particle, OutputTree* t, std::vector<boost::shared_ptr<void> >& addresses) {
   addresses.clear();
 
   addresses.push_back(boost::shared_ptr<void>(new int((particle) ? 1 : 0)));
@@ -1588,7 +2001,7 @@ void GammaJetFilter::particleToTree(const reco::Candidate* particle, TTree* t, s
 }
 
 
-void GammaJetFilter::photonToTree(const pat::PhotonRef& photonRef, pat::Photon& photon, const edm::Event& event) {
+void GammaJetFilter::photonToTree(const pat::PhotonRef& photonRef, pat::Photon& photon, const EventProducts& products) {
   std::vector<boost::shared_ptr<void> > addresses;
 //redefine the common variables instead of using particleTotree, because the photonhas been 
 //corrected for regression etc.
@@ -1621,53 +2034,33 @@ void GammaJetFilter::photonToTree(const pat::PhotonRef& photonRef, pat::Photon&
   float sigmaIetaIeta = photonRef->sigmaIetaIeta();
   updateBranch(mPhotonTree, &sigmaIetaIeta, "sigmaIetaIeta");
 
-  edm::Handle<double> rhos;
-  event.getByLabel(edm::InputTag("kt6PFJets", "rho", "RECO"), rhos);
-  float rho = *rhos;
+  float rho = *products.pfRhoRECO();
   updateBranch(mPhotonTree, &rho, "rho");
 
   // Isolations are produced at PAT level by the PḧotonPFIsolation producer
-  edm::Handle<edm::ValueMap<bool>> hasMatchedPromptElectronHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "hasMatchedPromptElectron", "PAT"), hasMatchedPromptElectronHandle);
-
-  bool hasMatchedPromptElectron = (*hasMatchedPromptElectronHandle)[photonRef];
+  const PhotonIsolationRecord isolation = products.photonIsolation(photonRef);
+  bool hasMatchedPromptElectron = isolation.hasMatchedPromptElectron;
   updateBranch(mPhotonTree, &hasMatchedPromptElectron, "hasMatchedPromptElectron", "O");
 
- // Now, isolations
-  edm::Handle<edm::ValueMap<double>> chargedHadronsIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "chargedHadronsIsolation", "PAT"), chargedHadronsIsolationHandle);
-
-  edm::Handle<edm::ValueMap<double>> neutralHadronsIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "neutralHadronsIsolation", "PAT"), neutralHadronsIsolationHandle);
-
-  edm::Handle<edm::ValueMap<double>> photonIsolationHandle;
-  event.getByLabel(edm::InputTag("photonPFIsolation", "photonIsolation", "PAT"), photonIsolationHandle);
-
 //regression energy
-  edm::Handle<edm::ValueMap<float>> regressionEnergyHandle;
-  event.getByLabel(edm::InputTag("eleNewEnergiesProducer", "energySCEleJoshPhoSemiParamV5ecorr", "PAT"),regressionEnergyHandle);
   edm::Ptr<reco::Candidate> recoObject = photonRef->originalObjectRef();
- float regressionEnergy = (*regressionEnergyHandle)[recoObject] ;
+ float regressionEnergy = (*products.regressionEnergy())[recoObject] ;
  updateBranch(mPhotonTree, &regressionEnergy, "regressionEnergy");
  float originalEnergy = photonRef->energy();
  updateBranch(mPhotonTree, &originalEnergy, "originalEnergy");
 
 
 //retrieve px and py of pfcandidates to exclude from met calculation
-edm::Handle<edm::ValueMap<double>> footprintMExCorrHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMExCorr", "PAT"), footprintMExCorrHandle);
-edm::Handle<edm::ValueMap<double>> footprintMEyCorrHandle;
-event.getByLabel(edm::InputTag("photonPFIsolation", "footprintMEyCorr", "PAT"), footprintMEyCorrHandle);
 //MEx/yCorr are the quantities to compare to rawMex/y
-float footprintMExCorr = (*footprintMExCorrHandle)[photonRef]- photonRef->px();
-float footprintMEyCorr = (*footprintMEyCorrHandle)[photonRef]- photonRef->py();
+float footprintMExCorr = isolation.footprintMExCorr - photonRef->px();
+float footprintMEyCorr = isolation.footprintMEyCorr - photonRef->py();
 
   updateBranch(mPhotonTree, &footprintMExCorr, "footprintMExCorr");
   updateBranch(mPhotonTree, &footprintMEyCorr, "footprintMEyCorr");
 
- float chargedHadronsIsolation = getCorrectedPFIsolation((*chargedHadronsIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::CHARGED_HADRONS);
-  float neutralHadronsIsolation = getCorrectedPFIsolation((*neutralHadronsIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::NEUTRAL_HADRONS);
-  float photonIsolation = getCorrectedPFIsolation((*photonIsolationHandle)[photonRef], rho, photonRef->eta(), IsolationType::PHOTONS); 
+ float chargedHadronsIsolation = getCorrectedPFIsolation(isolation.chargedHadronsIsolation, rho, photonRef->eta(), IsolationType::CHARGED_HADRONS);
+  float neutralHadronsIsolation = getCorrectedPFIsolation(isolation.neutralHadronsIsolation, rho, photonRef->eta(), IsolationType::NEUTRAL_HADRONS);
+  float photonIsolation = getCorrectedPFIsolation(isolation.photonIsolation, rho, photonRef->eta(), IsolationType::PHOTONS);
 
   updateBranch(mPhotonTree, &chargedHadronsIsolation, "chargedHadronsIsolation");
   updateBranch(mPhotonTree, &neutralHadronsIsolation, "neutralHadronsIsolation");
@@ -1682,52 +2075,59 @@ float footprintMEyCorr = (*footprintMEyCorrHandle)[photonRef]- photonRef->py();
   }
 }
 
-void GammaJetFilter::jetsToTree(const pat::Jet* firstJet, const pat::Jet* secondJet, const std::vector<TTree*>& trees) {
-  jetToTree(firstJet, mIsMC, trees[0], trees[4]);
-  jetToTree(secondJet, false, trees[1], trees[5]);
+void GammaJetFilter::jetsToTree(JetCollectionContext& context, const pat::Jet* firstJet, const pat::Jet* secondJet, const std::vector<OutputTree*>& trees) {
+  jetToTree(context, firstJet, mIsMC, trees[0], trees[4]);
+  jetToTree(context, secondJet, false, trees[1], trees[5]);
 
   // Raw jets
   const pat::Jet* rawJet = (firstJet) ? firstJet->userData<pat::Jet>("rawJet") : NULL;
-  jetToTree(rawJet, false, trees[2], NULL);
+  jetToTree(context, rawJet, false, trees[2], NULL);
 
   rawJet = (secondJet) ? secondJet->userData<pat::Jet>("rawJet") : NULL;
-  jetToTree(rawJet, false, trees[3], NULL);
+  jetToTree(context, rawJet, false, trees[3], NULL);
 }
 
+// Neutrinos in the decay tree of parent. Each particle is visited once, even when several mothers share it.
+// The decay of a neutrino is not followed, and copies of a neutrino (same pdg id and momentum) are only kept once
 void findNeutrinos(const reco::Candidate* parent, std::vector<const reco::Candidate*>& neutrinos) {
+  std::unordered_set<const reco::Candidate*> visited;
+  std::vector<const reco::Candidate*> stack(1, parent);
+
+  while (! stack.empty()) {
+    const reco::Candidate* candidate = stack.back();
+    stack.pop_back();
 
-  int pdg_id = abs(parent->pdgId());
-  if (pdg_id == 12 || pdg_id == 14 || pdg_id == 16) {
-    if (std::find_if(neutrinos.begin(), neutrinos.end(), [parent] (const reco::Candidate* candidate) -> bool {
-          static double EPSILON = 0.0001;
-          bool same = (candidate->pdgId() == parent->pdgId());
-          same &= (fabs(candidate->px() - candidate->px()) < EPSILON);
-          same &= (fabs(candidate->py() - candidate->py()) < EPSILON);
-          same &= (fabs(candidate->pz() - candidate->pz()) < EPSILON);
+    if (! visited.insert(candidate).second)
+      continue;
 
-          return same;
+    int pdg_id = abs(candidate->pdgId());
+    if (pdg_id == 12 || pdg_id == 14 || pdg_id == 16) {
+      // Only a few neutrinos per parton
+      if (std::find_if(neutrinos.begin(), neutrinos.end(), [candidate] (const reco::Candidate* neutrino) -> bool {
+            const double EPSILON = 0.0001;
+            bool same = (neutrino->pdgId() == candidate->pdgId());
+            same &= (fabs(neutrino->px() - candidate->px()) < EPSILON);
+            same &= (fabs(neutrino->py() - candidate->py()) < EPSILON);
+            same &= (fabs(neutrino->pz() - candidate->pz()) < EPSILON);
 
-      }) == neutrinos.end()) {
-      neutrinos.push_back(parent);
+            return same;
+
+        }) == neutrinos.end()) {
+        neutrinos.push_back(candidate);
+      }
+      continue;
     }
-    return;
-  }
 
-  for (unsigned int i = 0; i < parent->numberOfDaughters(); i++) {
-    const reco::Candidate* d = parent->daughter(i);
-    findNeutrinos(d, neutrinos);
+    // In reverse order, so that daughters are visited in order
+    for (int i = candidate->numberOfDaughters() - 1; i >= 0; i--)
+      stack.push_back(candidate->daughter(i));
   }
 }
 
-void GammaJetFilter::jetToTree(const pat::Jet* jet, bool _findNeutrinos, TTree* tree, TTree* genTree) {
+void GammaJetFilter::jetToTree(JetCollectionContext& context, const pat::Jet* jet, bool _findNeutrinos, OutputTree* tree, OutputTree* genTree) {
   std::vector<boost::shared_ptr<void> > addresses;
   particleToTree(jet, tree, addresses);
 
-  if (mIsMC) {
-    mNeutrinos->Clear("C");
-    mNeutrinosPDG->Clear("C");
-  }
-
   if (jet) {
     float area = jet->jetArea();
     updateBranch(tree, &area, "jet_area");
@@ -1793,42 +2193,41 @@ int jetCHMult = jet->chargedHadronMultiplicity();
   if (genTree) {
     particleToTree((jet) ? jet->genJet() : NULL, genTree, addresses);
 
-    if (_findNeutrinos) {
-      static bool init = false;
-      if (! init) {
-        genTree->Branch("neutrinos", &mNeutrinos, 32000, 0);
-        genTree->Branch("neutrinos_pdg_id", &mNeutrinosPDG, 32000, 0);
-        init = true;
-      }
-    }
-
-    if (jet && _findNeutrinos) {
-      const reco::Candidate* parton = (jet) ? jet->genParton() : NULL;
-
-      if (parton) {
-        if (abs(parton->pdgId()) == 5 || abs(parton->pdgId()) == 4) {
+    NeutrinoBranches& neutrinos = context.neutrinos;
+    neutrinos.clear();
 
-          std::vector<const reco::Candidate*> neutrinos;
-          findNeutrinos(parton, neutrinos);
-
-          if (neutrinos.size() > 0) {
-            // Build TCloneArray of TLorentzVector
-            unsigned int index = 0;
-            for (const reco::Candidate* neutrino: neutrinos) {
-              TLorentzVector* p4 = (TLorentzVector*) mNeutrinos->ConstructedAt(index);
-              p4->SetPxPyPzE(neutrino->px(), neutrino->py(), neutrino->pz(), neutrino->energy());
+    const reco::Candidate* parton = (jet) ? jet->genParton() : NULL;
 
-              TParameter<int>* pdg_id = (TParameter<int>*) mNeutrinosPDG->ConstructedAt(index++);
-              pdg_id->SetVal(neutrino->pdgId());
-            }
-          }
-        }
+    if (parton && _findNeutrinos && (abs(parton->pdgId()) == 5 || abs(parton->pdgId()) == 4)) {
+      std::unordered_map<const reco::Candidate*, std::vector<const reco::Candidate*>>::iterator it = mPartonNeutrinos.find(parton);
+      if (it == mPartonNeutrinos.end()) {
+        it = mPartonNeutrinos.insert(std::make_pair(parton, std::vector<const reco::Candidate*>())).first;
+        findNeutrinos(parton, it->second);
+      }
 
+      for (const reco::Candidate* neutrino: it->second) {
+        neutrinos.px.push_back(neutrino->px());
+        neutrinos.py.push_back(neutrino->py());
+        neutrinos.pz.push_back(neutrino->pz());
+        neutrinos.e.push_back(neutrino->energy());
+        neutrinos.pdg_id.push_back(neutrino->pdgId());
       }
     }
 
+    std::vector<float>* neutrinosPx = &neutrinos.px;
+    std::vector<float>* neutrinosPy = &neutrinos.py;
+    std::vector<float>* neutrinosPz = &neutrinos.pz;
+    std::vector<float>* neutrinosE = &neutrinos.e;
+    std::vector<int>* neutrinosPdgId = &neutrinos.pdg_id;
+    if (_findNeutrinos) {
+      updateBranch(genTree, neutrinosPx, "neutrinos_px");
+      updateBranch(genTree, neutrinosPy, "neutrinos_py");
+      updateBranch(genTree, neutrinosPz, "neutrinos_pz");
+      updateBranch(genTree, neutrinosE, "neutrinos_e");
+      updateBranch(genTree, neutrinosPdgId, "neutrinos_pdg_id");
+    }
+
     // Add parton id and pt
-    const reco::Candidate* parton = (jet) ? jet->genParton() : NULL;
     int pdgId = (parton) ? parton->pdgId() : 0;
     updateBranch(genTree, &pdgId, "parton_pdg_id", "I");
 
@@ -1837,13 +2236,7 @@ int jetCHMult = jet->chargedHadronMultiplicity();
       parton_p4.SetPxPyPzE(parton->px(), parton->py(), parton->pz(), parton->energy());
     }
     TLorentzVector* p_parton_p4 = &parton_p4;
-
-    TBranch* branch = genTree->GetBranch("parton_p4");
-    if (branch == NULL) {
-      branch = genTree->Branch("parton_p4", &p_parton_p4);
-    } else {
-      branch->SetAddress(&p_parton_p4);
-    }
+    updateObjectBranch(genTree, p_parton_p4, "parton_p4");
 
     int flavour = (jet) ? jet->partonFlavour() : 0;
     updateBranch(genTree, &flavour, "parton_flavour", "I");
@@ -1852,12 +2245,12 @@ int jetCHMult = jet->chargedHadronMultiplicity();
   }
 }
 
-void GammaJetFilter::metsToTree(const pat::MET& met, const pat::MET& rawMet, const std::vector<TTree*>& trees) {
+void GammaJetFilter::metsToTree(const pat::MET& met, const pat::MET& rawMet, const std::vector<OutputTree*>& trees) {
   metToTree(&met, trees[0], trees[2]);
   metToTree(&rawMet, trees[1], NULL);
 }
 
-void GammaJetFilter::metToTree(const pat::MET* met, TTree* tree, TTree* genTree) {
+void GammaJetFilter::metToTree(const pat::MET* met, OutputTree* tree, OutputTree* genTree) {
   std::vector<boost::shared_ptr<void> > addresses;
   particleToTree(met, tree, addresses);
 
@@ -1869,26 +2262,15 @@ void GammaJetFilter::metToTree(const pat::MET* met, TTree* tree, TTree* genTree)
   }
 }
 
-void GammaJetFilter::electronsToTree(const edm::Handle<pat::ElectronCollection>& electrons, const reco::Vertex& pv) {
+void GammaJetFilter::electronsToTree(StreamContext& context, const edm::Handle<pat::ElectronCollection>& electrons, const reco::Vertex& pv) {
 
-  int n = electrons->size();
-  static int   id[30];
-  static float isolation[30];
-  static float pt[30];
-  static float px[30];
-  static float py[30];
-  static float pz[30];
-  static float eta[30];
-  static float phi[30];
-  static int   charge[30];
+  LeptonBranches& b = context.electrons;
+  b.resize(electrons->size());
 
   int i = 0;
   for (pat::ElectronCollection::const_iterator it = electrons->begin(); it != electrons->end(); ++it, i++) {
     const pat::Electron& electron = *it;
 
-    if (i >= 30)
-      break;
-
     // See https://twiki.cern.ch/twiki/bin/view/CMS/TopLeptonPlusJetsRefSel_el
     bool elecID = fabs(pv.z() - it->vertex().z()) < 1.;
     elecID     &= it->et() > 30.;
@@ -1898,52 +2280,40 @@ void GammaJetFilter::electronsToTree(const edm::Handle<pat::ElectronCollection>&
 
     float iso     = (it->dr03TkSumPt() + it->dr03EcalRecHitSumEt() + it->dr03HcalTowerSumEt()) / it->et();
 
-    id[i]         = elecID;
-    isolation[i]  = iso;
-    pt[i]         = electron.pt();
-    px[i]         = electron.px();
-    py[i]         = electron.py();
-    pz[i]         = electron.pz();
-    eta[i]        = electron.eta();
-    phi[i]        = electron.phi();
-    charge[i]     = electron.charge();
+    b.id[i]         = elecID;
+    b.isolation[i]  = iso;
+    b.pt[i]         = electron.pt();
+    b.px[i]         = electron.px();
+    b.py[i]         = electron.py();
+    b.pz[i]         = electron.pz();
+    b.eta[i]        = electron.eta();
+    b.phi[i]        = electron.phi();
+    b.charge[i]     = electron.charge();
   }
 
-  updateBranch(mElectronsTree, &n, "n", "I");
-  updateBranchArray(mElectronsTree, id, "id", "n", "I");
-  updateBranchArray(mElectronsTree, isolation, "isolation", "n");
-  updateBranchArray(mElectronsTree, pt, "pt", "n");
-  updateBranchArray(mElectronsTree, px, "px", "n");
-  updateBranchArray(mElectronsTree, py, "py", "n");
-  updateBranchArray(mElectronsTree, pz, "pz", "n");
-  updateBranchArray(mElectronsTree, eta, "eta", "n");
-  updateBranchArray(mElectronsTree, phi, "phi", "n");
-  updateBranchArray(mElectronsTree, charge, "charge", "n", "I");
+  updateBranch(mElectronsTree, &b.n, "n", "I");
+  updateBranchArray(mElectronsTree, &b.id[0], "id", "n", "I");
+  updateBranchArray(mElectronsTree, &b.isolation[0], "isolation", "n");
+  updateBranchArray(mElectronsTree, &b.pt[0], "pt", "n");
+  updateBranchArray(mElectronsTree, &b.px[0], "px", "n");
+  updateBranchArray(mElectronsTree, &b.py[0], "py", "n");
+  updateBranchArray(mElectronsTree, &b.pz[0], "pz", "n");
+  updateBranchArray(mElectronsTree, &b.eta[0], "eta", "n");
+  updateBranchArray(mElectronsTree, &b.phi[0], "phi", "n");
+  updateBranchArray(mElectronsTree, &b.charge[0], "charge", "n", "I");
 
   mElectronsTree->Fill();
 }
 
-void GammaJetFilter::muonsToTree(const edm::Handle<pat::MuonCollection>& muons, const reco::Vertex& pv) {
+void GammaJetFilter::muonsToTree(StreamContext& context, const edm::Handle<pat::MuonCollection>& muons, const reco::Vertex& pv) {
 
-  int n = muons->size();
-  static int   id[30];
-  static float isolation[30];
-  static float delta_beta_isolation[30];
-  static float pt[30];
-  static float px[30];
-  static float py[30];
-  static float pz[30];
-  static float eta[30];
-  static float phi[30];
-  static int   charge[30];
+  LeptonBranches& b = context.muons;
+  b.resize(muons->size());
 
   int i = 0;
   for (pat::MuonCollection::const_iterator it = muons->begin(); it != muons->end(); ++it, i++) {
     const pat::Muon& muon = *it;
 
-    if (i >= 30)
-      break;
-
     // See https://twiki.cern.ch/twiki/bin/view/CMS/TopLeptonPlusJetsRefSel_mu
     bool muonID = it->isGlobalMuon();
     //FIXME: reco::Tracks need to be keept in PF2PAT.
@@ -1963,29 +2333,29 @@ void GammaJetFilter::muonsToTree(const edm::Handle<pat::MuonCollection>& muons,
     float relIso = (it->chargedHadronIso() + it->neutralHadronIso() + it->photonIso()) / it->pt();
     float deltaBetaRelIso = (it->chargedHadronIso() + std::max((it->neutralHadronIso() + it->photonIso()) - 0.5 * it->puChargedHadronIso(), 0.0)) / it->pt();
 
-    id[i]          = muonID;
-    isolation[i]   = relIso;
-    delta_beta_isolation[i] = deltaBetaRelIso;
-    pt[i]          = muon.pt();
-    px[i]          = muon.px();
-    py[i]          = muon.py();
-    pz[i]          = muon.pz();
-    eta[i]         = muon.eta();
-    phi[i]         = muon.phi();
-    charge[i]      = muon.charge();
+    b.id[i]          = muonID;
+    b.isolation[i]   = relIso;
+    b.delta_beta_isolation[i] = deltaBetaRelIso;
+    b.pt[i]          = muon.pt();
+    b.px[i]          = muon.px();
+    b.py[i]          = muon.py();
+    b.pz[i]          = muon.pz();
+    b.eta[i]         = muon.eta();
+    b.phi[i]         = muon.phi();
+    b.charge[i]      = muon.charge();
   }
 
-  updateBranch(mMuonsTree, &n, "n", "I");
-  updateBranchArray(mMuonsTree, id, "id", "n", "I");
-  updateBranchArray(mMuonsTree, isolation, "relative_isolation", "n");
-  updateBranchArray(mMuonsTree, delta_beta_isolation, "delta_beta_relative_isolation", "n");
-  updateBranchArray(mMuonsTree, pt, "pt", "n");
-  updateBranchArray(mMuonsTree, px, "px", "n");
-  updateBranchArray(mMuonsTree, py, "py", "n");
-  updateBranchArray(mMuonsTree, pz, "pz", "n");
-  updateBranchArray(mMuonsTree, eta, "eta", "n");
-  updateBranchArray(mMuonsTree, phi, "phi", "n");
-  updateBranchArray(mMuonsTree, charge, "charge", "n", "I");
+  updateBranch(mMuonsTree, &b.n, "n", "I");
+  updateBranchArray(mMuonsTree, &b.id[0], "id", "n", "I");
+  updateBranchArray(mMuonsTree, &b.isolation[0], "relative_isolation", "n");
+  updateBranchArray(mMuonsTree, &b.delta_beta_isolation[0], "delta_beta_relative_isolation", "n");
+  updateBranchArray(mMuonsTree, &b.pt[0], "pt", "n");
+  updateBranchArray(mMuonsTree, &b.px[0], "px", "n");
+  updateBranchArray(mMuonsTree, &b.py[0], "py", "n");
+  updateBranchArray(mMuonsTree, &b.pz[0], "pz", "n");
+  updateBranchArray(mMuonsTree, &b.eta[0], "eta", "n");
+  updateBranchArray(mMuonsTree, &b.phi[0], "phi", "n");
+  updateBranchArray(mMuonsTree, &b.charge[0], "charge", "n", "I");
 
   mMuonsTree->Fill();
 }
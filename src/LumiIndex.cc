@@ -0,0 +1,280 @@
+#include "JetMETCorrections/GammaJetFilter/interface/LumiIndex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FWCore/Utilities/interface/Exception.h"
+#include "JetMETCorrections/GammaJetFilter/interface/json/json.h"
+
+namespace {
+  const char CACHE_MAGIC[8] = {'L', 'U', 'M', 'I', 'I', 'D', 'X', '1'};
+
+  struct CacheHeader {
+    char     magic[8];
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint64_t count;
+  };
+
+  // Move p after the next occurrence of c on the current line. Returns false at end of line
+  bool skipPast(const char*& p, const char* end, char c) {
+    while (p < end && *p != c && *p != '\n')
+      p++;
+
+    if (p >= end || *p != c)
+      return false;
+
+    p++;
+    return true;
+  }
+
+  // strtoul and strtod skip leading whitespace, which must not include the end of the line
+  bool atEndOfField(const char* p) {
+    return *p == '\0' || *p == '\n' || *p == '\r' || *p == ',';
+  }
+
+  bool parseUnsigned(const char*& p, unsigned long& value) {
+    if (atEndOfField(p))
+      return false;
+
+    char* next;
+    value = strtoul(p, &next, 10);
+    if (next == p)
+      return false;
+
+    p = next;
+    return true;
+  }
+
+  bool parseDouble(const char*& p, double& value) {
+    if (atEndOfField(p))
+      return false;
+
+    char* next;
+    value = strtod(p, &next);
+    if (next == p)
+      return false;
+
+    p = next;
+    return true;
+  }
+}
+
+void LumiIndex::readJSON(const std::string& filename) {
+  Json::Value root;
+  Json::Reader reader;
+  std::ifstream file(filename.c_str());
+  if (! reader.parse(file, root) || ! root.isObject()) {
+    throw cms::Exception("ReadError")
+      << "Failed to parse luminosity JSON file '" << filename << "'" << std::endl;
+  }
+
+  mValidLumiSections.clear();
+
+  const Json::Value::Members runs = root.getMemberNames();
+  for (const std::string& run: runs) {
+    const Json::Value& ranges = root[run];
+    if (! ranges.isArray()) {
+      throw cms::Exception("ReadError")
+        << "Invalid lumi section ranges for run " << run << " in '" << filename << "'" << std::endl;
+    }
+
+    std::vector<Interval>& intervals = mValidLumiSections[strtoul(run.c_str(), NULL, 10)];
+    for (Json::ArrayIndex i = 0; i < ranges.size(); i++) {
+      const Json::Value& range = ranges[i];
+      if (! range.isArray() || range.size() != 2) {
+        throw cms::Exception("ReadError")
+          << "Invalid lumi section range for run " << run << " in '" << filename << "'" << std::endl;
+      }
+
+      Interval interval = {range[0u].asUInt(), range[1u].asUInt()};
+      intervals.push_back(interval);
+    }
+
+    // Sort and merge overlapping ranges, so that a binary search on the first lumi section is enough
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) { return a.first < b.first; });
+
+    std::vector<Interval> merged;
+    for (const Interval& interval: intervals) {
+      if (! merged.empty() && interval.first <= merged.back().last + 1)
+        merged.back().last = std::max(merged.back().last, interval.last);
+      else
+        merged.push_back(interval);
+    }
+    intervals.swap(merged);
+  }
+}
+
+void LumiIndex::readCSV(const std::string& filename, bool useCache/* = true*/) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    throw cms::Exception("ReadError")
+      << "Failed to parse luminosity CSV file '" << filename << "'" << std::endl;
+  }
+
+  if (useCache && readCache(filename, st.st_size, st.st_mtime))
+    return;
+
+  parseCSV(filename);
+
+  if (useCache)
+    writeCache(filename, st.st_size, st.st_mtime);
+}
+
+bool LumiIndex::isValidRun(uint32_t run) const {
+  return mValidLumiSections.count(run) > 0;
+}
+
+bool LumiIndex::isValid(uint32_t run, uint32_t lumiSection) const {
+  std::unordered_map<uint32_t, std::vector<Interval>>::const_iterator it = mValidLumiSections.find(run);
+  if (it == mValidLumiSections.end())
+    return false;
+
+  const std::vector<Interval>& intervals = it->second;
+  std::vector<Interval>::const_iterator interval = std::upper_bound(intervals.begin(), intervals.end(), lumiSection,
+      [](uint32_t ls, const Interval& i) { return ls < i.first; });
+
+  if (interval == intervals.begin())
+    return false;
+
+  --interval;
+  return lumiSection <= interval->last;
+}
+
+double LumiIndex::luminosity(uint32_t run, uint32_t lumiSection) const {
+  const LumiSection* ls = find(run, lumiSection);
+  return (ls) ? ls->luminosity : 0.;
+}
+
+double LumiIndex::truePileup(uint32_t run, uint32_t lumiSection) const {
+  const LumiSection* ls = find(run, lumiSection);
+  return (ls) ? ls->truePileup : 0.;
+}
+
+const LumiIndex::LumiSection* LumiIndex::find(uint32_t run, uint32_t lumiSection) const {
+  const uint64_t k = key(run, lumiSection);
+  std::vector<LumiSection>::const_iterator it = std::lower_bound(mLumiSections.begin(), mLumiSections.end(), k,
+      [](const LumiSection& ls, uint64_t k) { return ls.key < k; });
+
+  if (it == mLumiSections.end() || it->key != k)
+    return NULL;
+
+  return &*it;
+}
+
+/* lumiCalc2 format :
+ * Run:Fill,LS,UTCTime,Beam Status,E(GeV),Delivered(/ub),Recorded(/ub),avgPU
+ * use 'lumiCalc2.py -i lumiSummary.json -o output.csv -b stable lumibyls' to generate file
+ *
+ * LS is written as 'ls:ls', the second one being used. Lines not following this format are ignored.
+ */
+void LumiIndex::parseCSV(const std::string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (! file.good()) {
+    throw cms::Exception("ReadError")
+      << "Failed to parse luminosity CSV file '" << filename << "'" << std::endl;
+  }
+
+  const std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  mLumiSections.clear();
+  mLumiSections.reserve(std::count(content.begin(), content.end(), '\n'));
+
+  const char* p = content.c_str();
+  const char* end = p + content.size();
+
+  // Skip header line
+  skipPast(p, end, '\n');
+
+  while (p < end) {
+    const char* line = p;
+    unsigned long run, fill, lsLeft, lsRight;
+    double delivered, recorded, truePileup, energy;
+
+    bool valid =
+      parseUnsigned(p, run) && *p++ == ':' && parseUnsigned(p, fill) && *p++ == ',' &&
+      parseUnsigned(p, lsLeft) && *p++ == ':' && parseUnsigned(p, lsRight) && *p++ == ',' &&
+      skipPast(p, end, ',') && skipPast(p, end, ',') &&
+      parseDouble(p, energy) && *p++ == ',' && parseDouble(p, delivered) && *p++ == ',' &&
+      parseDouble(p, recorded) && *p++ == ',' && parseDouble(p, truePileup);
+
+    if (valid && lsRight != 0) {
+      LumiSection ls = {key(run, lsRight), recorded /* in mb^(-1) */, truePileup};
+      mLumiSections.push_back(ls);
+    }
+
+    p = line;
+    if (! skipPast(p, end, '\n'))
+      break;
+  }
+
+  // Keep the last entry for duplicated lumi sections, as the previous implementation did
+  std::stable_sort(mLumiSections.begin(), mLumiSections.end(), [](const LumiSection& a, const LumiSection& b) { return a.key < b.key; });
+
+  std::vector<LumiSection> unique;
+  unique.reserve(mLumiSections.size());
+  for (const LumiSection& ls: mLumiSections) {
+    if (! unique.empty() && unique.back().key == ls.key)
+      unique.back() = ls;
+    else
+      unique.push_back(ls);
+  }
+  mLumiSections.swap(unique);
+
+  if (mLumiSections.empty()) {
+    throw cms::Exception("ReadError")
+      << "No lumi section found in luminosity CSV file '" << filename << "'" << std::endl;
+  }
+}
+
+bool LumiIndex::readCache(const std::string& filename, uint64_t size, int64_t mtime) {
+  std::ifstream cache((filename + ".cache").c_str(), std::ios::binary);
+  if (! cache.good())
+    return false;
+
+  CacheHeader header;
+  if (! cache.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    return false;
+
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.sourceSize != size || header.sourceMtime != mtime || header.count == 0)
+    return false;
+
+  std::vector<LumiSection> lumiSections(header.count);
+  if (! cache.read(reinterpret_cast<char*>(&lumiSections[0]), header.count * sizeof(LumiSection)))
+    return false;
+
+  mLumiSections.swap(lumiSections);
+  return true;
+}
+
+// Failures are silently ignored: the CSV file will be parsed again next time
+void LumiIndex::writeCache(const std::string& filename, uint64_t size, int64_t mtime) const {
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.sourceSize = size;
+  header.sourceMtime = mtime;
+  header.count = mLumiSections.size();
+
+  // Write through a temporary file, so that concurrent jobs never read a partial cache
+  std::stringstream tmpFile;
+  tmpFile << filename << ".cache." << getpid();
+
+  std::ofstream cache(tmpFile.str().c_str(), std::ios::binary);
+  if (! cache.good())
+    return;
+
+  cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  cache.write(reinterpret_cast<const char*>(&mLumiSections[0]), mLumiSections.size() * sizeof(LumiSection));
+  cache.close();
+
+  if (! cache.good() || rename(tmpFile.str().c_str(), (filename + ".cache").c_str()) != 0)
+    remove(tmpFile.str().c_str());
+}
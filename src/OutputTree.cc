@@ -0,0 +1,131 @@
+#include "JetMETCorrections/GammaJetFilter/interface/OutputTree.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "FWCore/Utilities/interface/Exception.h"
+
+OutputTree::OutputTree(TTree* tree):
+  mTree(tree), mFillsTree(true), mShared(false) {
+}
+
+OutputTree::OutputTree(TTree* tree, const std::string& prefix, bool fillsTree):
+  mTree(tree), mPrefix(prefix), mFillsTree(fillsTree), mShared(true) {
+}
+
+void OutputTree::updateBranch(void* address, const std::string& name, const std::string& type/* = "F"*/) {
+  if (! mShared) {
+    TBranch* branch = mTree->GetBranch(name.c_str());
+    if (branch == NULL) {
+      branch = mTree->Branch(name.c_str(), address, std::string(name + "/" + type).c_str());
+    } else {
+      branch->SetAddress(address);
+    }
+
+    return;
+  }
+
+  Field* field = findField(name);
+  if (field) {
+    field->source = address;
+    return;
+  }
+
+  Field& newField = createField(name, address);
+  newField.typeSize = typeSize(type);
+  newField.buffer.resize(newField.typeSize);
+  newField.branch = mTree->Branch((mPrefix + name).c_str(), &newField.buffer[0], std::string(mPrefix + name + "/" + type).c_str());
+}
+
+void OutputTree::updateBranchArray(void* address, const std::string& name, const std::string& size, const std::string& type/* = "F"*/) {
+  if (! mShared) {
+    TBranch* branch = mTree->GetBranch(name.c_str());
+    if (branch == NULL) {
+      branch = mTree->Branch(name.c_str(), address, std::string(name + "[" + size + "]/" + type).c_str());
+    } else {
+      branch->SetAddress(address);
+    }
+
+    return;
+  }
+
+  Field* field = findField(name);
+  if (field) {
+    field->source = address;
+    return;
+  }
+
+  const Field* count = findField(size);
+  if (! count || count->typeSize != sizeof(Int_t)) {
+    throw cms::Exception("OutputTree")
+      << "Array branch '" << mPrefix << name << "' needs an integer branch '" << mPrefix << size << "' created before it" << std::endl;
+  }
+
+  Field& newField = createField(name, address);
+  newField.typeSize = typeSize(type);
+  newField.count = count;
+  newField.buffer.resize(newField.typeSize);
+  newField.branch = mTree->Branch((mPrefix + name).c_str(), &newField.buffer[0], std::string(mPrefix + name + "[" + mPrefix + size + "]/" + type).c_str());
+}
+
+void OutputTree::Fill() {
+  if (! mShared) {
+    mTree->Fill();
+    return;
+  }
+
+  for (Field& field: mFields) {
+    if (field.copyObject) {
+      field.copyObject(field.objectAddress, field.source);
+    } else if (field.count) {
+      Int_t n = std::max(*reinterpret_cast<const Int_t*>(&field.count->buffer[0]), 0);
+      field.buffer.resize(std::max<size_t>(n * field.typeSize, field.typeSize));
+      memcpy(&field.buffer[0], field.source, n * field.typeSize);
+
+      // The buffer may have moved
+      field.branch->SetAddress(&field.buffer[0]);
+    } else {
+      memcpy(&field.buffer[0], field.source, field.typeSize);
+    }
+  }
+
+  if (mFillsTree)
+    mTree->Fill();
+}
+
+OutputTree::Field* OutputTree::findField(const std::string& name) {
+  std::map<std::string, size_t>::const_iterator it = mFieldIndexes.find(name);
+  return (it == mFieldIndexes.end()) ? NULL : &mFields[it->second];
+}
+
+OutputTree::Field& OutputTree::createField(const std::string& name, const void* source) {
+  Field field;
+  field.source = source;
+  field.branch = NULL;
+  field.typeSize = 0;
+  field.count = NULL;
+  field.objectAddress = NULL;
+  field.copyObject = NULL;
+
+  mFieldIndexes[name] = mFields.size();
+  mFields.push_back(field);
+
+  return mFields.back();
+}
+
+size_t OutputTree::typeSize(const std::string& type) {
+  if (type.size() == 1) {
+    switch (type[0]) {
+      case 'B': case 'b': case 'O':
+        return 1;
+      case 'S': case 's':
+        return 2;
+      case 'I': case 'i': case 'F':
+        return 4;
+      case 'L': case 'l': case 'D':
+        return 8;
+    }
+  }
+
+  throw cms::Exception("OutputTree") << "Unsupported branch type '" << type << "'" << std::endl;
+}
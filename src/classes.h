@@ -0,0 +1,15 @@
+#include "DataFormats/Common/interface/ValueMap.h"
+#include "DataFormats/Common/interface/Wrapper.h"
+
+#include "JetMETCorrections/GammaJetFilter/interface/PhotonIsolationRecord.h"
+
+#include <vector>
+
+namespace {
+  struct dictionary {
+    PhotonIsolationRecord record;
+    std::vector<PhotonIsolationRecord> records;
+    edm::ValueMap<PhotonIsolationRecord> recordMap;
+    edm::Wrapper<edm::ValueMap<PhotonIsolationRecord> > recordMapWrapper;
+  };
+}
@@ -0,0 +1,125 @@
+// Statistical equivalence of crystalBallSampler_class with RooCBShape::generate,
+// and per category Crystal Ball tails of the smearings.
+
+// The energy scale corrections are part of the plugin library, which can't be linked
+#include "JetMETCorrections/GammaJetFilter/src/EnergyScaleCorrection_class.cc"
+
+#include <RooCBShape.h>
+#include <RooDataSet.h>
+#include <RooRandom.h>
+#include <RooRealVar.h>
+#include <TMath.h>
+#include <TRandom3.h>
+
+#include "testHelpers.h"
+
+#include <algorithm>
+#include <vector>
+
+// Both tests must accept the hypothesis that the samples come from the same distribution
+static const double MIN_PROBABILITY = 1e-3;
+static const int SAMPLE_SIZE = 20000;
+static const int CHI2_BINS = 50;
+
+struct Category {
+  const char* name;
+  double sigma;
+  double alpha;
+  double n;
+  double xmin;
+  double xmax;
+};
+
+void testSampler(const Category& category) {
+  RooRealVar x("x", "x", category.xmin, category.xmax);
+  RooRealVar mean("mean", "mean", 0.);
+  RooRealVar sigma("sigma", "sigma", category.sigma);
+  RooRealVar alpha("alpha", "alpha", category.alpha);
+  RooRealVar n("n", "n", category.n);
+  RooCBShape shape("shape", "shape", x, mean, sigma, alpha, n);
+
+  RooRandom::randomGenerator()->SetSeed(1);
+  RooDataSet* data = shape.generate(x, SAMPLE_SIZE);
+  std::vector<double> reference(data->numEntries());
+  for (int i = 0; i < data->numEntries(); i++)
+    reference[i] = data->get(i)->getRealValue("x");
+  delete data;
+
+  crystalBallSampler_class sampler(0., category.sigma, category.alpha, category.n, category.xmin, category.xmax);
+  TRandom3 random(2);
+  std::vector<double> sample(SAMPLE_SIZE);
+  for (double& value: sample)
+    value = sampler.generate(random);
+
+  std::sort(reference.begin(), reference.end());
+  std::sort(sample.begin(), sample.end());
+
+  double ks = TMath::KolmogorovTest(reference.size(), &reference[0], sample.size(), &sample[0], "");
+
+  // Chi2 on bins of equal reference content
+  std::vector<double> edges;
+  for (int b = 1; b < CHI2_BINS; b++)
+    edges.push_back(reference[b * reference.size() / CHI2_BINS]);
+
+  std::vector<double> referenceCounts(CHI2_BINS), sampleCounts(CHI2_BINS);
+  for (double value: reference)
+    referenceCounts[std::upper_bound(edges.begin(), edges.end(), value) - edges.begin()]++;
+  for (double value: sample)
+    sampleCounts[std::upper_bound(edges.begin(), edges.end(), value) - edges.begin()]++;
+
+  double chi2 = 0.;
+  for (int b = 0; b < CHI2_BINS; b++) {
+    double r = referenceCounts[b], s = sampleCounts[b];
+    if (r + s > 0)
+      chi2 += (r - s) * (r - s) / (r + s);
+  }
+  double chi2Probability = TMath::Prob(chi2, CHI2_BINS - 1);
+
+  std::cout << category.name << ": KS probability " << ks << ", chi2 probability " << chi2Probability << std::endl;
+  CHECK(ks > MIN_PROBABILITY);
+  CHECK(chi2Probability > MIN_PROBABILITY);
+
+  // Generated values stay in the range
+  CHECK(sample.front() >= category.xmin);
+  CHECK(sample.back() <= category.xmax);
+}
+
+void testCategoryShapes() {
+  const std::string smearingFile = dataDirectory() + "/step8-stochasticSmearing-invMass_SC_regrCorrSemiParV5_pho-loose-Et_20-trigger-noPF-HggRunEtaR9Et.dat";
+
+  EnergyScaleCorrection_class withTail("", smearingFile);
+  EnergyScaleCorrection_class withoutTail("", smearingFile);
+  withTail.SetSmearingType(1);
+  withoutTail.SetSmearingType(1);
+
+  CHECK(withTail.SetSmearingCBShape("EBlowEtaBad8TeV", 0.5, 5.));
+  CHECK(! withTail.SetSmearingCBShape("NoSuchCategory", 0.5, 5.));
+
+  // Same random numbers: only the category with its own tail gives different smearings
+  bool differs = false;
+  for (int i = 0; i < 100; i++) {
+    TRandom3 first(i + 1), second(i + 1);
+    differs |= withTail.getSmearing(200000, 100., true, 0.5, 0.5, first) != withoutTail.getSmearing(200000, 100., true, 0.5, 0.5, second);
+
+    TRandom3 third(i + 1), fourth(i + 1);
+    CHECK(withTail.getSmearing(200000, 100., true, 0.5, 1.2, third) == withoutTail.getSmearing(200000, 100., true, 0.5, 1.2, fourth));
+  }
+  CHECK(differs);
+}
+
+int main() {
+  // Widths of the smearing categories, with the default tail, other tails and a tail on the right
+  const Category categories[] = {
+    {"EB default tail", 0.0077, 1.424, 1.86, -0.2, 0.2},
+    {"EB long tail", 0.0126, 0.8, 1.2, -0.5, 0.2},
+    {"EE steep tail", 0.0198, 2.5, 10., -0.3, 0.3},
+    {"right tail", 0.0163, -1.424, 1.86, -0.2, 0.4}
+  };
+
+  for (const Category& category: categories)
+    testSampler(category);
+
+  testCategoryShapes();
+
+  return testResult("testCrystalBallSampler");
+}
@@ -0,0 +1,157 @@
+// Check the selection of CutFlow: the first failed cut of each event, the
+// cut-flow counters, and the order and counters of the cuts after tune().
+
+#include "JetMETCorrections/GammaJetFilter/bin/CutFlow.h"
+
+#include "testHelpers.h"
+
+#include <vector>
+
+struct Block {
+  std::vector<int> values;
+
+  size_t size() const {
+    return values.size();
+  }
+};
+
+static Block makeBlock(size_t n) {
+  Block block;
+  for (size_t k = 0; k < n; k++)
+    block.values.push_back(k);
+
+  return block;
+}
+
+static std::vector<uint32_t> allEvents(const Block& block) {
+  std::vector<uint32_t> selected(block.size());
+  for (size_t k = 0; k < selected.size(); k++)
+    selected[k] = k;
+
+  return selected;
+}
+
+void testEvaluate() {
+  CutFlow<Block> cuts;
+  cuts.add("even", 1., [](const Block& block, size_t k) { return block.values[k] % 2 == 0; });
+  cuts.add("small", 1., [](const Block& block, size_t k) { return block.values[k] < 6; });
+  CHECK(cuts.size() == 2);
+  CHECK(cuts.name(0) == "even");
+  CHECK(cuts.name(1) == "small");
+
+  // Not evaluated yet: the estimations
+  CHECK_CLOSE(cuts.cost(0), 1., 0.);
+  CHECK_CLOSE(cuts.rejection(0), 1., 0.);
+
+  Block block = makeBlock(10);
+  std::vector<uint32_t> selected = allEvents(block);
+  std::vector<uint8_t> failedAt(block.size(), 42);
+  cuts.evaluate(block, selected, failedAt);
+
+  CHECK((selected == std::vector<uint32_t>{0, 2, 4}));
+  const uint8_t expected[] = {2, 0, 2, 0, 2, 0, 1, 0, 1, 0};
+  for (size_t k = 0; k < block.size(); k++)
+    CHECK(failedAt[k] == expected[k]);
+
+  // "small" only sees the 5 even events, and rejects 2 of them
+  CHECK_CLOSE(cuts.rejection(0), 0.5, 1e-12);
+  CHECK_CLOSE(cuts.rejection(1), 0.4, 1e-12);
+  CHECK(cuts.cost(0) >= 0.);
+
+  // Only the events in 'selected' are evaluated
+  selected = {1, 6, 8};
+  failedAt.assign(block.size(), 42);
+  cuts.evaluate(block, selected, failedAt);
+  CHECK(selected.empty());
+  CHECK(failedAt[1] == 0);
+  CHECK(failedAt[6] == 1);
+  CHECK(failedAt[8] == 1);
+  CHECK(failedAt[0] == 42);
+
+  // No event left: the following cuts are not evaluated
+  CutFlow<Block> none;
+  int calls = 0;
+  none.add("nothing", 1., [](const Block&, size_t) { return false; });
+  none.add("counted", 1., [&calls](const Block&, size_t) { calls++; return true; });
+  selected = allEvents(block);
+  none.evaluate(block, selected, failedAt);
+  CHECK(calls == 0);
+  CHECK_CLOSE(none.rejection(1), 1., 0.);
+}
+
+void testCount() {
+  CutFlow<Block> cuts;
+  cuts.add("a", 1., [](const Block&, size_t) { return true; });
+  cuts.add("b", 1., [](const Block&, size_t) { return true; });
+  cuts.add("c", 1., [](const Block&, size_t) { return true; });
+
+  CHECK(! cuts.count(0));
+  CHECK(! cuts.count(1));
+  CHECK(! cuts.count(2));
+  CHECK(cuts.count(3));
+  CHECK(cuts.count(3));
+
+  CHECK(cuts.passed(0) == 4);
+  CHECK(cuts.passed(1) == 3);
+  CHECK(cuts.passed(2) == 2);
+}
+
+void testTune() {
+  CutFlow<Block> cuts;
+  cuts.add("everything", 1., [](const Block&, size_t) { return true; });
+  cuts.add("expensive", 100., [](const Block& block, size_t k) { return block.values[k] % 2 == 0; });
+  cuts.add("cheap", 10., [](const Block& block, size_t k) { return block.values[k] % 2 == 0; });
+
+  // Never evaluated: ordered by estimated cost
+  CHECK(cuts.tune());
+  CHECK(cuts.name(0) == "everything");
+  CHECK(cuts.name(1) == "cheap");
+  CHECK(cuts.name(2) == "expensive");
+
+  Block block = makeBlock(100);
+  std::vector<uint32_t> selected = allEvents(block);
+  std::vector<uint8_t> failedAt(block.size());
+  cuts.evaluate(block, selected, failedAt);
+  for (size_t k = 0; k < block.size(); k++)
+    cuts.count(failedAt[k]);
+  CHECK(cuts.passed(0) == 100);
+  CHECK(cuts.passed(1) == 50);
+  CHECK(cuts.passed(2) == 50);
+
+  // "everything" and "expensive", which only sees even events, reject nothing: they go last, in their current order.
+  // The counters of the old order are reset
+  CHECK(cuts.tune());
+  CHECK(cuts.name(0) == "cheap");
+  CHECK(cuts.name(1) == "everything");
+  CHECK(cuts.name(2) == "expensive");
+  CHECK(cuts.passed(0) == 0);
+  CHECK(cuts.passed(1) == 0);
+  CHECK(cuts.passed(2) == 0);
+
+  // The selection itself doesn't depend on the order
+  selected = allEvents(block);
+  cuts.evaluate(block, selected, failedAt);
+  CHECK(selected.size() == 50);
+  for (size_t k = 0; k < block.size(); k++)
+    CHECK(failedAt[k] == ((k % 2 == 0) ? 3 : 0));
+
+  for (size_t k = 0; k < block.size(); k++)
+    cuts.count(failedAt[k]);
+  CHECK(cuts.passed(0) == 50);
+  CHECK(cuts.passed(1) == 50);
+  CHECK(cuts.passed(2) == 50);
+
+  // Same order: the counters go on
+  CHECK(! cuts.tune());
+  CHECK(cuts.name(0) == "cheap");
+  CHECK(cuts.passed(0) == 50);
+  CHECK(cuts.passed(2) == 50);
+}
+
+int main() {
+  testEvaluate();
+  testCount();
+  testTune();
+
+  return testResult("testCutFlow");
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Minimal checks for the standalone tests of this package. Each test
+// program returns the number of failed checks, so scram runtests reports
+// any failure.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static int gFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (! (condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; \
+      gFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_CLOSE(a, b, tolerance) \
+  do { \
+    double _a = (a), _b = (b); \
+    if (! (std::fabs(_a - _b) <= (tolerance))) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #a << " = " << _a << ", " << #b << " = " << _b << " (tolerance: " << (tolerance) << ")" << std::endl; \
+      gFailures++; \
+    } \
+  } while (0)
+
+// Directory of the payloads shipped with the package
+inline std::string dataDirectory() {
+  const char* base = getenv("CMSSW_BASE");
+  return std::string(base ? base : ".") + "/src/JetMETCorrections/GammaJetFilter/data";
+}
+
+inline int testResult(const std::string& name) {
+  if (gFailures == 0)
+    std::cout << name << ": all checks passed" << std::endl;
+  else
+    std::cerr << name << ": " << gFailures << " check(s) failed" << std::endl;
+
+  return gFailures;
+}
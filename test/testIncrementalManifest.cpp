@@ -0,0 +1,187 @@
+// Check that the partial outputs of an incremental finalization are only
+// reused with the configuration they were finalized with.
+
+#include "JetMETCorrections/GammaJetFilter/bin/IncrementalManifest.h"
+
+#include "testHelpers.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+// Same options as GammaJetFinalizer::configurationFingerprint() without --jec
+static std::string fingerprint(float alpha, bool isMC) {
+  ConfigurationFingerprint fingerprint;
+  fingerprint.add("dataset", "PhotonJet_2012");
+  fingerprint.add("jets", "PFlowAK5chs");
+  fingerprint.add("chs", true);
+  fingerprint.add("mc", isMC);
+  fingerprint.add("mc-comp", false);
+  fingerprint.add("alpha", alpha);
+  fingerprint.add("uncut-trees", false);
+  fingerprint.add("jec", false);
+  fingerprint.add("run-periods", false);
+
+  return fingerprint.hex();
+}
+
+void testFingerprint() {
+  CHECK(fingerprint(0.2, false) == fingerprint(0.2, false));
+  CHECK(fingerprint(0.2, false).size() == 16);
+  CHECK(fingerprint(0.2, false) != fingerprint(0.3, false));
+  CHECK(fingerprint(0.2, false) != fingerprint(0.2000001, false));
+  CHECK(fingerprint(0.2, false) != fingerprint(0.2, true));
+
+  // Names are part of the fingerprint
+  ConfigurationFingerprint a, b;
+  a.add("mc", true);
+  b.add("mc-comp", true);
+  CHECK(a.hex() != b.hex());
+}
+
+// Editing an input of the finalizer, e.g. triggers.xml, changes the fingerprint
+void testFileFingerprint(const std::string& directory) {
+  const std::string triggers = directory + "/triggers.xml";
+  auto fingerprint = [&triggers]() {
+    ConfigurationFingerprint fingerprint;
+    fingerprint.addFile("triggers", triggers);
+    return fingerprint.hex();
+  };
+
+  const std::string missing = fingerprint();
+  std::ofstream(triggers.c_str()) << "<triggers />";
+  const std::string original = fingerprint();
+  CHECK(original != missing);
+  CHECK(original == fingerprint());
+
+  std::ofstream(triggers.c_str()) << "<triggers></triggers>";
+  CHECK(fingerprint() != original);
+
+  unlink(triggers.c_str());
+  CHECK(fingerprint() == missing);
+}
+
+void testPartialOutputName() {
+  const std::string configuration = fingerprint(0.2, false);
+  std::string name = IncrementalManifest::partialOutputName("/store/user/PhotonJet_1.root", configuration);
+  CHECK(name.compare(0, 12, "PhotonJet_1_") == 0);
+  CHECK(name.find(configuration) != std::string::npos);
+
+  CHECK(name != IncrementalManifest::partialOutputName("/store/other/PhotonJet_1.root", configuration));
+  CHECK(name != IncrementalManifest::partialOutputName("/store/user/PhotonJet_1.root", fingerprint(0.3, false)));
+}
+
+void testConfigurationChange(const std::string& directory) {
+  const std::string manifestFile = directory + "/manifest.txt";
+  const std::string input = directory + "/PhotonJet_1.root";
+  std::ofstream(input.c_str()) << "events";
+
+  const std::string alpha02 = fingerprint(0.2, false);
+  const std::string alpha03 = fingerprint(0.3, false);
+
+  // First run, with --alpha 0.2
+  IncrementalManifest manifest;
+  CHECK(manifest.load(manifestFile));
+  CHECK(manifest.configuration().empty());
+  CHECK(manifest.configure(alpha02).empty());
+
+  IncrementalManifest::Entry entry;
+  CHECK(IncrementalManifest::describe(input, entry));
+  CHECK(! manifest.upToDate(entry));
+  entry.partial = directory + "/" + IncrementalManifest::partialOutputName(input, alpha02);
+  entry.entries = 10;
+  std::ofstream(entry.partial.c_str()) << "histograms";
+  manifest.update(entry);
+  CHECK(manifest.save(manifestFile));
+
+  // Same options: the partial output is reused
+  IncrementalManifest same;
+  CHECK(same.load(manifestFile));
+  CHECK(same.configuration() == alpha02);
+  CHECK(same.configure(alpha02).empty());
+  CHECK(same.upToDate(entry));
+
+  // Not merged yet, then merged into the output
+  CHECK(same.entries().size() == 1 && ! same.entries().begin()->second.merged);
+  same.setMerged();
+  CHECK(same.save(manifestFile));
+  CHECK(same.load(manifestFile));
+  CHECK(same.entries().size() == 1 && same.entries().begin()->second.merged);
+
+  // --alpha 0.3: the partial output is outdated
+  IncrementalManifest changed;
+  CHECK(changed.load(manifestFile));
+  std::vector<IncrementalManifest::Entry> outdated = changed.configure(alpha03);
+  CHECK(outdated.size() == 1 && outdated[0].partial == entry.partial);
+  CHECK(changed.entries().empty());
+  CHECK(! changed.upToDate(entry));
+  CHECK(changed.save(manifestFile));
+
+  CHECK(changed.load(manifestFile));
+  CHECK(changed.configuration() == alpha03);
+  CHECK(changed.entries().empty());
+
+  // A manifest written before the fingerprints has no configuration: everything is finalized again
+  std::ofstream(manifestFile.c_str()) << input << "\t" << entry.size << "\t" << entry.modificationTime << "\t10\t" << entry.partial << std::endl;
+  IncrementalManifest legacy;
+  CHECK(legacy.load(manifestFile));
+  CHECK(legacy.entries().size() == 1);
+  CHECK(legacy.entries().size() == 1 && ! legacy.entries().begin()->second.merged);
+  CHECK(legacy.configure(alpha02).size() == 1);
+  CHECK(! legacy.upToDate(entry));
+
+  unlink(entry.partial.c_str());
+  unlink(input.c_str());
+  unlink(manifestFile.c_str());
+}
+
+void testEmptyFile(const std::string& directory) {
+  const std::string manifestFile = directory + "/manifest.txt";
+  const std::string input = directory + "/PhotonJet_empty.root";
+  std::ofstream(input.c_str()) << "no events";
+
+  // An empty input file is recorded without partial output
+  IncrementalManifest manifest;
+  CHECK(manifest.load(manifestFile));
+  manifest.configure(fingerprint(0.2, false));
+  IncrementalManifest::Entry entry;
+  CHECK(IncrementalManifest::describe(input, entry));
+  entry.partial.clear();
+  manifest.update(entry);
+  CHECK(manifest.save(manifestFile));
+
+  // and is up to date until it changes
+  IncrementalManifest loaded;
+  CHECK(loaded.load(manifestFile));
+  CHECK(loaded.configure(fingerprint(0.2, false)).empty());
+  CHECK(loaded.entries().size() == 1);
+  CHECK(loaded.entries().size() == 1 && loaded.entries().begin()->second.partial.empty());
+  CHECK(loaded.entries().size() == 1 && loaded.entries().begin()->second.entries == 0);
+  CHECK(loaded.upToDate(entry));
+
+  entry.size++;
+  CHECK(! loaded.upToDate(entry));
+
+  unlink(input.c_str());
+  unlink(manifestFile.c_str());
+}
+
+int main() {
+  char directory[] = "/tmp/testIncrementalManifest.XXXXXX";
+  if (! mkdtemp(directory)) {
+    std::cerr << "Can't create a temporary directory" << std::endl;
+    return 1;
+  }
+
+  testFingerprint();
+  testFileFingerprint(directory);
+  testPartialOutputName();
+  testConfigurationChange(directory);
+  testEmptyFile(directory);
+
+  rmdir(directory);
+
+  return testResult("testIncrementalManifest");
+}
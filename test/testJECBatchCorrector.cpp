@@ -0,0 +1,116 @@
+// Compare JECBatchCorrector, and FactorizedJetCorrector built from the
+// payload cache, with FactorizedJetCorrector on the Winter14 payloads of
+// data/, for the MC and the data correction chains.
+
+#include "CondFormats/JetMETObjects/interface/FactorizedJetCorrector.h"
+#include "CondFormats/JetMETObjects/interface/JetCorrectorParameters.h"
+
+#include "JetMETCorrections/GammaJetFilter/interface/JECBatchCorrector.h"
+
+#include "testHelpers.h"
+
+#include <vector>
+
+// Same tolerance as the filter and the finalizer before using the batch path
+static const double TOLERANCE = 1e-5;
+
+void testFormula() {
+  const size_t B = JEC_BATCH_BLOCK_SIZE;
+
+  // Deep enough to use every stack slot, with unary and binary operators on the first one
+  JECFormula formula("max(0.0001,pow(x,2))*(-[0]+log10(abs(x+[1]*(y-[2]/(1+exp(-x))))))");
+  CHECK(formula.parameterCount() == 3);
+  CHECK(formula.variableCount() == 2);
+
+  std::vector<double> variables(formula.variableCount() * B);
+  std::vector<double> parameters(formula.parameterCount() * B);
+  std::vector<double> stack(formula.stackSize() * B);
+  std::vector<double> result(B);
+
+  const size_t n = 5;
+  for (size_t l = 0; l < n; l++) {
+    variables[l] = 0.5 + l;
+    variables[B + l] = 2. * l - 3.;
+    parameters[l] = 0.1 * l;
+    parameters[B + l] = 1.5;
+    parameters[2 * B + l] = -0.25 * l;
+  }
+
+  formula.evaluate(n, &variables[0], &parameters[0], &stack[0], &result[0]);
+
+  for (size_t l = 0; l < n; l++) {
+    double x = variables[l], y = variables[B + l];
+    double p0 = parameters[l], p1 = parameters[B + l], p2 = parameters[2 * B + l];
+    double expected = std::max(0.0001, std::pow(x, 2)) * (-p0 + std::log10(std::fabs(x + p1 * (y - p2 / (1 + std::exp(-x))))));
+    CHECK_CLOSE(result[l], expected, 1e-12 * std::fabs(expected));
+  }
+}
+
+void testChain(const std::vector<std::string>& payloads) {
+  std::vector<JetCorrectorParameters> parameters;
+  for (const std::string& payload: payloads)
+    parameters.push_back(JetCorrectorParameters(payload));
+
+  FactorizedJetCorrector scalar(parameters);
+  JECBatchCorrector batch(payloads);
+  CHECK(batch.binnedIn(JECBatchLevel::kJetEta));
+  CHECK(! batch.binnedIn(JECBatchLevel::kJetPt));
+
+  double deviation = batch.maxDeviation(scalar);
+  std::cout << "Maximal relative deviation for " << payloads.back() << ": " << deviation << std::endl;
+  CHECK(deviation < TOLERANCE);
+
+  // JetCorrectorParameters built from the parsed levels must give the same corrections as the text payloads
+  std::vector<JetCorrectorParameters> cachedParameters;
+  for (const std::string& payload: payloads)
+    cachedParameters.push_back(JECPayloadCache::get<JetCorrectorParameters>(payload));
+
+  FactorizedJetCorrector cached(cachedParameters);
+  JECJetBatch sample = JECBatchCorrector::validationSample();
+  std::vector<float> fromText, fromCache;
+  JECBatchCorrector::getScalarCorrections(scalar, sample, fromText);
+  JECBatchCorrector::getScalarCorrections(cached, sample, fromCache);
+  CHECK(fromText == fromCache);
+
+  // Single jet interface, and a batch which isn't a multiple of the block size
+  JECJetBatch jets;
+  for (size_t i = 0; i < JEC_BATCH_BLOCK_SIZE + 3; i++)
+    jets.push_back(-4.7 + 0.14 * i, 15. + 20. * i, 3. + 0.3 * i, 0.5 + 0.001 * i, 10);
+
+  std::vector<float> corrections;
+  batch.getCorrections(jets, corrections);
+  CHECK(corrections.size() == jets.size());
+
+  for (size_t i = 0; i < jets.size(); i++) {
+    scalar.setJetEta(jets.eta[i]);
+    scalar.setJetPt(jets.pt[i]);
+    scalar.setRho(jets.rho[i]);
+    scalar.setJetA(jets.area[i]);
+    scalar.setNPV(jets.npv[i]);
+    float reference = scalar.getCorrection();
+
+    CHECK_CLOSE(corrections[i], reference, TOLERANCE * reference);
+    CHECK_CLOSE(batch.getCorrection(jets.eta[i], jets.pt[i], jets.rho[i], jets.area[i], jets.npv[i]), reference, TOLERANCE * reference);
+  }
+}
+
+int main() {
+  testFormula();
+
+  std::string data = dataDirectory();
+
+  std::vector<std::string> mc;
+  mc.push_back(data + "/Winter14_V1_MC_L1FastJet_AK5PFchs.txt");
+  mc.push_back(data + "/Winter14_V1_MC_L2Relative_AK5PFchs.txt");
+  mc.push_back(data + "/Winter14_V1_MC_L3Absolute_AK5PFchs.txt");
+  testChain(mc);
+
+  std::vector<std::string> dataChain;
+  dataChain.push_back(data + "/Winter14_V1_DATA_L1FastJet_AK5PFchs.txt");
+  dataChain.push_back(data + "/Winter14_V1_MC_L2Relative_AK5PFchs.txt");
+  dataChain.push_back(data + "/Winter14_V1_MC_L3Absolute_AK5PFchs.txt");
+  dataChain.push_back(data + "/Winter14_V3_DATA_L2L3Residual_AK5PFchs.txt");
+  testChain(dataChain);
+
+  return testResult("testJECBatchCorrector");
+}
@@ -0,0 +1,63 @@
+// Compare the corrections of JECCorrectionGrid with the exact ones of
+// JECBatchCorrector, on random jets, for the Winter14 MC payloads of data/.
+
+#include "JetMETCorrections/GammaJetFilter/bin/JECCorrectionGrid.h"
+
+#include "testHelpers.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+void testGrid(const std::vector<std::string>& payloads) {
+  JECBatchCorrector corrector(payloads);
+
+  std::string reason;
+  CHECK(JECCorrectionGrid::canTabulate(corrector, reason));
+
+  JECCorrectionGrid grid(corrector);
+  const double tolerance = 1e-3;
+  grid.setTolerance(tolerance);
+  CHECK(grid.maxDeviation() <= tolerance);
+  CHECK(grid.exactFraction() > 0. && grid.exactFraction() < 1.);
+  std::cout << "JEC grid: maximal deviation " << grid.maxDeviation() << ", " << grid.exactFraction() * 100 << "% of the cells exact" << std::endl;
+
+  // Random jets in the grid. The deviation of a cell is sampled, so it can be exceeded somewhat between the sampled
+  // points, but not by the whole error of the cell: checking only the cell centres missed errors more than 10 times larger
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> uniform(0., 1.);
+  JECJetBatch jets;
+  for (size_t n = 0; n < 200000; n++)
+    jets.push_back(-4.7 + 9.4 * uniform(generator), 10. * std::pow(100., uniform(generator)), 50. * uniform(generator), 2. * uniform(generator));
+
+  // And outside of the grid, corrected exactly
+  jets.push_back(0.5, 8000., 10., 0.5);
+  jets.push_back(0.5, 50., 60., 0.5);
+  jets.push_back(0.5, 50., 10., 3.);
+
+  std::vector<float> interpolated, exact;
+  grid.getCorrections(jets, interpolated);
+  corrector.getCorrections(jets, exact);
+  CHECK(interpolated.size() == jets.size());
+
+  double deviation = 0.;
+  for (size_t n = 0; n < jets.size(); n++)
+    deviation = std::max(deviation, (double) std::fabs(interpolated[n] - exact[n]));
+  std::cout << "JEC grid: maximal deviation on random jets " << deviation << std::endl;
+  CHECK(deviation < 2 * tolerance);
+
+  for (size_t n = jets.size() - 3; n < jets.size(); n++)
+    CHECK(interpolated[n] == exact[n]);
+}
+
+int main() {
+  std::string data = dataDirectory();
+
+  std::vector<std::string> mc;
+  mc.push_back(data + "/Winter14_V1_MC_L1FastJet_AK5PFchs.txt");
+  mc.push_back(data + "/Winter14_V1_MC_L2Relative_AK5PFchs.txt");
+  mc.push_back(data + "/Winter14_V1_MC_L3Absolute_AK5PFchs.txt");
+  testGrid(mc);
+
+  return testResult("testJECCorrectionGrid");
+}
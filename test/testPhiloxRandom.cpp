@@ -0,0 +1,102 @@
+// Check PhiloxRandom against the known answers of the Random123 reference
+// implementation of Philox4x32-10, and the independence and
+// reproducibility of its streams.
+
+#include "JetMETCorrections/GammaJetFilter/interface/PhiloxRandom.h"
+
+#include "testHelpers.h"
+
+#include <vector>
+
+// 'n' numbers of the stream of an event
+static std::vector<Double_t> draw(uint32_t seed, uint32_t run, uint32_t lumi, uint64_t event, uint16_t purpose, uint16_t object = 0, size_t n = 10) {
+  PhiloxRandom random(seed);
+  random.SetStream(run, lumi, event, purpose, object);
+
+  std::vector<Double_t> numbers(n);
+  for (size_t i = 0; i < n; i++)
+    numbers[i] = random.Rndm();
+
+  return numbers;
+}
+
+static void checkKnownAnswer(const uint32_t counter[4], const uint32_t key[2], const uint32_t expected[4]) {
+  uint32_t out[4];
+  PhiloxRandom::philox(counter, key, out);
+  for (int i = 0; i < 4; i++) {
+    if (out[i] != expected[i])
+      std::cerr << std::hex << "Word " << i << ": 0x" << out[i] << " instead of 0x" << expected[i] << std::dec << std::endl;
+    CHECK(out[i] == expected[i]);
+  }
+}
+
+void testKnownAnswers() {
+  const uint32_t zeroCounter[4] = {0, 0, 0, 0};
+  const uint32_t zeroKey[2] = {0, 0};
+  const uint32_t zeroExpected[4] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+  checkKnownAnswer(zeroCounter, zeroKey, zeroExpected);
+
+  const uint32_t onesCounter[4] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+  const uint32_t onesKey[2] = {0xffffffff, 0xffffffff};
+  const uint32_t onesExpected[4] = {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd};
+  checkKnownAnswer(onesCounter, onesKey, onesExpected);
+
+  // Digits of pi
+  const uint32_t piCounter[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+  const uint32_t piKey[2] = {0xa4093822, 0x299f31d0};
+  const uint32_t piExpected[4] = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+  checkKnownAnswer(piCounter, piKey, piExpected);
+
+  // Rndm() returns the words of the block, in order
+  PhiloxRandom random;
+  random.SetStream(0, 0, 0, 0);
+  for (int i = 0; i < 4; i++)
+    CHECK(random.Rndm() == (zeroExpected[i] + 0.5) / 4294967296.);
+}
+
+void testIndependentStreams() {
+  const std::vector<Double_t> reference = draw(1, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING);
+
+  CHECK(draw(2, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING) != reference);
+  CHECK(draw(1, 200001, 10, 1234, PhiloxRandom::PHOTON_SMEARING) != reference);
+  CHECK(draw(1, 200000, 11, 1234, PhiloxRandom::PHOTON_SMEARING) != reference);
+  CHECK(draw(1, 200000, 10, 1235, PhiloxRandom::PHOTON_SMEARING) != reference);
+  CHECK(draw(1, 200000, 10, 1234 + (1ULL << 32), PhiloxRandom::PHOTON_SMEARING) != reference);
+  CHECK(draw(1, 200000, 10, 1234, PhiloxRandom::MC_TRIGGER) != reference);
+  CHECK(draw(1, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING, 1) != reference);
+
+  // Numbers stay in ]0, 1[ and are not repeated inside a stream
+  const std::vector<Double_t> numbers = draw(1, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING, 0, 1000);
+  for (size_t i = 0; i < numbers.size(); i++) {
+    CHECK(numbers[i] > 0. && numbers[i] < 1.);
+    if (i > 0)
+      CHECK(numbers[i] != numbers[i - 1]);
+  }
+}
+
+void testReproducibleStreams() {
+  const std::vector<Double_t> reference = draw(1, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING, 0, 100);
+  CHECK(draw(1, 200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING, 0, 100) == reference);
+
+  // Independently of the numbers drawn before SetStream()
+  PhiloxRandom random(1);
+  random.SetStream(1, 2, 3, PhiloxRandom::MC_TRIGGER);
+  for (int i = 0; i < 7; i++)
+    random.Rndm();
+  random.SetStream(200000, 10, 1234, PhiloxRandom::PHOTON_SMEARING);
+  std::vector<Double_t> numbers(reference.size());
+  random.RndmArray(numbers.size(), &numbers[0]);
+  CHECK(numbers == reference);
+
+  // SetSeed() restarts the stream with the new seed
+  random.SetSeed(1);
+  CHECK(random.Rndm() == reference[0]);
+}
+
+int main() {
+  testKnownAnswers();
+  testIndependentStreams();
+  testReproducibleStreams();
+
+  return testResult("testPhiloxRandom");
+}
@@ -0,0 +1,84 @@
+// Check the run periods read by --run-periods, and the rejection of invalid
+// files.
+
+#include "JetMETCorrections/GammaJetFilter/bin/runPeriods.h"
+
+#include "testHelpers.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+static std::string gFile;
+
+// Load 'content' into periods, which start with the 2012 ones
+static bool load(const std::string& content, RunPeriods& periods, std::string& error) {
+  std::ofstream(gFile.c_str()) << content;
+  return periods.load(gFile, error);
+}
+
+void testValid() {
+  RunPeriods periods;
+  std::string error;
+  CHECK(load("# name first last\nA 100 199\n\nB 200 299\nC 400 400\n", periods, error));
+  CHECK(error.empty());
+  CHECK(periods.size() == 3);
+  CHECK(periods.getName(1) == "B");
+  CHECK(periods.getRuns(2) == std::make_pair(400u, 400u));
+
+  CHECK(periods.getPeriod(99) == -1);
+  CHECK(periods.getPeriod(100) == 0);
+  CHECK(periods.getPeriod(199) == 0);
+  CHECK(periods.getPeriod(200) == 1);
+  CHECK(periods.getPeriod(300) == -1);
+  CHECK(periods.getPeriod(400) == 2);
+}
+
+// The file is rejected with an error mentioning 'expected', and the periods are unchanged
+static void checkInvalid(const std::string& content, const std::string& expected) {
+  RunPeriods periods;
+  std::string error;
+  CHECK(! load(content, periods, error));
+  if (error.find(expected) == std::string::npos)
+    std::cerr << "Unexpected error for '" << content << "': " << error << std::endl;
+  CHECK(error.find(expected) != std::string::npos);
+
+  CHECK(periods.size() == 3);
+  CHECK(periods.getName(0) == "RDAB");
+}
+
+void testInvalid() {
+  checkInvalid("", "no run period");
+  checkInvalid("A 100\n", "line 1: expected");
+  checkInvalid("A 100 200 300\n", "line 1: expected");
+  checkInvalid("A 200 100\n", "line 1: first run of 'A' after its last run");
+  checkInvalid("A 100 199\nA 200 299\n", "line 2: duplicate period 'A'");
+  checkInvalid("A 100 199\nB 150 250\n", "line 2: runs of 'B' overlap those of 'A'");
+  checkInvalid("A 100 199\n# comment\nB 50 100\n", "line 3: runs of 'B' overlap those of 'A'");
+  checkInvalid("A 100 199\nB 0 1000\n", "overlap");
+
+  RunPeriods periods;
+  std::string error;
+  CHECK(! periods.load("/nonexistent/run_periods.txt", error));
+  CHECK(! error.empty());
+}
+
+int main() {
+  char file[] = "/tmp/testRunPeriods.XXXXXX";
+  int fd = mkstemp(file);
+  if (fd < 0) {
+    std::cerr << "Can't create a temporary file" << std::endl;
+    return 1;
+  }
+  close(fd);
+  gFile = file;
+
+  testValid();
+  testInvalid();
+
+  unlink(file);
+
+  return testResult("testRunPeriods");
+}